@@ -9,17 +9,20 @@
 #include "colormod.h"
 #include "color_helpers.h"
 #include "common.h"
+#include "disk_cache.h"
 #include "dynamic_filters.h"
 #include "file.h"
 #include "filter.h"
 #include "font.h"
 #include "grad.h"
 #include "image.h"
+#include "pipeline.h"
 #include "rgbadraw.h"
 #include "rotate.h"
 #include "scale.h"
 #include "script.h"
 #include "span.h"
+#include "threads.h"
 #include "updates.h"
 #ifdef BUILD_X11
 #include "x11_color.h"
@@ -442,6 +445,10 @@ imlib_get_ximage_cache_count_max(void)
  * Whenever you set the max count Imlib2 will flush as many old XImages
  * from the cache as possible until the current cached XImage count is
  * less than or equal to the cache max count.
+ * Shared memory XImages are written to the drawable without waiting for the
+ * X server to finish, and are only reused once it has. With a max count of
+ * 2 or more, rendering the next image can overlap with the server still
+ * copying the previous one.
  */
 EAPI void
 imlib_set_ximage_cache_count_max(int count)
@@ -482,6 +489,50 @@ imlib_set_ximage_cache_size_max(int bytes)
 {
    __imlib_SetXImageCacheSizeMax(ctx->display, bytes);
 }
+
+/**
+ * @return The current number of cached pixmaps.
+ *
+ * Counts all pixmaps rendered through the cache (see
+ * imlib_render_pixmaps_for_whole_image()), in use or not.
+ */
+EAPI int
+imlib_get_pixmap_cache_count_used(void)
+{
+   return __imlib_PixmapCacheCount();
+}
+
+/**
+ * @return The current pixmap cache memory usage.
+ *
+ * The estimated X server memory, in bytes, held by cached pixmaps that are
+ * no longer in use (freed with imlib_free_pixmap_and_mask()) and kept for
+ * reuse. This counts against the cache size set with imlib_set_cache_size(),
+ * the least recently used pixmaps are dropped first when it is exceeded.
+ */
+EAPI int
+imlib_get_pixmap_cache_size_used(void)
+{
+   return __imlib_PixmapCacheSize();
+}
+
+/**
+ * @return The number of pixmap cache lookups that found a pixmap.
+ */
+EAPI int
+imlib_get_pixmap_cache_hits(void)
+{
+   return __imlib_PixmapCacheHits();
+}
+
+/**
+ * @return The number of pixmap cache lookups that had to render a pixmap.
+ */
+EAPI int
+imlib_get_pixmap_cache_misses(void)
+{
+   return __imlib_PixmapCacheMisses();
+}
 #endif
 
 /**
@@ -543,11 +594,13 @@ imlib_context_get_mask_alpha_threshold(void)
  * having "smooth" edges to lines and shapes and this means when
  * images are scaled they will keep their smooth appearance. Passing
  * in 1 turns this on and 0 turns it off.
+ * Turning it on selects the IMLIB_SCALE_AREA scale filter, turning it off
+ * selects IMLIB_SCALE_SAMPLE.
  */
 EAPI void
 imlib_context_set_anti_alias(char anti_alias)
 {
-   ctx->anti_alias = anti_alias;
+   ctx->anti_alias = anti_alias ? IMLIB_SCALE_AREA : IMLIB_SCALE_SAMPLE;
 }
 
 /**
@@ -559,7 +612,39 @@ imlib_context_set_anti_alias(char anti_alias)
 EAPI char
 imlib_context_get_anti_alias(void)
 {
-   return ctx->anti_alias;
+   return ctx->anti_alias != IMLIB_SCALE_SAMPLE;
+}
+
+/**
+ * @param filter The scale filter.
+ *
+ * Selects how images are scaled when blending and rendering them.
+ * IMLIB_SCALE_SAMPLE and IMLIB_SCALE_AREA are the same as turning
+ * anti-aliasing off and on. IMLIB_SCALE_BICUBIC and IMLIB_SCALE_LANCZOS
+ * are separable filters giving sharper results, especially when scaling
+ * up, at a higher cost. Any filter other than IMLIB_SCALE_SAMPLE also
+ * turns on anti-aliasing for everything else (lines, rotation etc.).
+ * Images with borders are scaled with IMLIB_SCALE_AREA instead of the
+ * separable filters.
+ */
+EAPI void
+imlib_context_set_scale_filter(Imlib_Scale_Filter filter)
+{
+   if (filter < IMLIB_SCALE_SAMPLE || filter > IMLIB_SCALE_LANCZOS)
+      filter = IMLIB_SCALE_AREA;
+   ctx->anti_alias = filter;
+}
+
+/**
+ * @return The current scale filter.
+ *
+ * Returns the scale filter set with imlib_context_set_scale_filter() or
+ * imlib_context_set_anti_alias().
+ */
+EAPI                Imlib_Scale_Filter
+imlib_context_get_scale_filter(void)
+{
+   return (Imlib_Scale_Filter) ctx->anti_alias;
 }
 
 /**
@@ -1106,6 +1191,76 @@ imlib_set_cache_size(int bytes)
    __imlib_SetCacheSize(bytes);
 }
 
+/**
+ * @param path Disk cache directory, NULL to disable.
+ *
+ * Enables the persistent cache of decoded images in the directory
+ * @p path (created if needed). Images loaded from files are then looked
+ * up there before running any loader, and stored there after decoding.
+ * Entries are keyed by the file path and validated against the file
+ * modification time and size. The directory may be shared between
+ * processes. The disk cache is disabled by default.
+ */
+EAPI void
+imlib_set_disk_cache_path(const char *path)
+{
+   __imlib_DiskCacheSetPath(path);
+}
+
+/**
+ * @return The disk cache directory, NULL if disabled.
+ */
+EAPI const char    *
+imlib_get_disk_cache_path(void)
+{
+   return __imlib_DiskCacheGetPath();
+}
+
+/**
+ * @param bytes Disk cache max size.
+ *
+ * Sets the maximum size of the disk cache in bytes. When storing an image
+ * makes the cache grow beyond this the least recently used entries are
+ * removed. The default is 64MB.
+ */
+EAPI void
+imlib_set_disk_cache_size(int bytes)
+{
+   __imlib_DiskCacheSetSize(bytes);
+}
+
+/**
+ * @return The disk cache max size.
+ */
+EAPI int
+imlib_get_disk_cache_size(void)
+{
+   return __imlib_DiskCacheGetSize();
+}
+
+/**
+ * @param count Maximum number of threads, 0 for the default.
+ *
+ * Sets the maximum number of threads Imlib2 may use for operations that
+ * can be split up, like executing large draw lists. 1 disables threading.
+ * The default is the number of online CPUs, or the value of the
+ * IMLIB2_THREADS environment variable if set.
+ */
+EAPI void
+imlib_set_thread_count(int count)
+{
+   __imlib_SetThreadCount(count);
+}
+
+/**
+ * @return The maximum number of threads used.
+ */
+EAPI int
+imlib_get_thread_count(void)
+{
+   return __imlib_GetThreadCount();
+}
+
 /**
  * @return The current number of colors.
  *
@@ -1358,6 +1513,39 @@ imlib_load_image_frame(const char *file, int frame)
    return (Imlib_Image) im;
 }
 
+/**
+ * @param file Image file.
+ * @param w Requested width.
+ * @param h Requested height.
+ * @return An image handle.
+ *
+ * Loads the image at or near the requested size.
+ * Formats holding several sizes (ICO) pick the smallest one covering
+ * @p w x @p h, or the largest one if none does.
+ * Scalable formats (SVG) are rendered at the largest size fitting in
+ * @p w x @p h that keeps the aspect ratio (0 leaves that dimension
+ * unconstrained).
+ * Other formats are loaded at their own size, so the result must be
+ * checked (and scaled) as needed.
+ * On success an image handle is returned, otherwise NULL is returned.
+ * The image is loaded immediately.
+ */
+EAPI                Imlib_Image
+imlib_load_image_at_size(const char *file, int w, int h)
+{
+   ImlibImage         *im;
+   ImlibLoadArgs       ila = { ILA0(ctx, 1, 0),.load_w = w,.load_h = h };
+
+   CHECK_PARAM_POINTER_RETURN("file", file, NULL);
+
+   if (w < 0 || h < 0)
+      return NULL;
+
+   im = __imlib_LoadImage(file, &ila);
+
+   return (Imlib_Image) im;
+}
+
 EAPI void
 imlib_image_get_frame_info(Imlib_Frame_Info * info)
 {
@@ -1469,6 +1657,8 @@ imlib_image_get_filename(void)
  * lower 8 bits are the blue channel - so a pixel's bits are ARGB (from
  * most to least significant, 8 bits per channel). You must put the
  * data back at some point.
+ * An image with premultiplied alpha is converted back to straight alpha
+ * first, see imlib_image_set_premultiplied_alpha().
  */
 EAPI DATA32        *
 imlib_image_get_data(void)
@@ -1479,6 +1669,7 @@ imlib_image_get_data(void)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return NULL;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    return im->data;
 }
@@ -1717,9 +1908,96 @@ imlib_image_set_has_alpha(char has_alpha)
 
    CHECK_PARAM_POINTER("image", ctx->image);
    CAST_IMAGE(im, ctx->image);
+   if (!has_alpha)
+      __imlib_SetAlphaPremul(im, 0);
    UPDATE_FLAG(im->flags, F_HAS_ALPHA, has_alpha);
 }
 
+/**
+ * @param use_mipmaps Mipmap flag.
+ *
+ * Enables (1) or disables (0) the mipmap pyramid for the current image.
+ * When enabled, anti-aliased downscales (rendering and blending) start
+ * from the smallest successively halved copy of the image that is still
+ * at least as large as the output, so zooming out of a large image costs
+ * in proportion to the output size. The halved copies are built when first
+ * needed, are counted against the image cache size and are discarded when
+ * the image is modified.
+ * The result is close to, but not exactly, that of a downscale from the
+ * full size image. Channels typically differ by less than 2 on average,
+ * and by up to 32 at sharp edges.
+ */
+EAPI void
+imlib_image_set_use_mipmaps(char use_mipmaps)
+{
+   ImlibImage         *im;
+
+   CHECK_PARAM_POINTER("image", ctx->image);
+   CAST_IMAGE(im, ctx->image);
+   UPDATE_FLAG(im->flags, F_USE_MIPMAP, use_mipmaps);
+   if (!use_mipmaps)
+      __imlib_MipmapFree(im);
+}
+
+/**
+ * @return Current mipmap flag.
+ *
+ * Returns 1 if the mipmap pyramid is enabled for the current image,
+ * 0 otherwise.
+ */
+EAPI char
+imlib_image_get_use_mipmaps(void)
+{
+   ImlibImage         *im;
+
+   CHECK_PARAM_POINTER_RETURN("image", ctx->image, 0);
+   CAST_IMAGE(im, ctx->image);
+   return IMAGE_USE_MIPMAP(im) ? 1 : 0;
+}
+
+/**
+ * @param premultiplied Premultiplied alpha flag.
+ *
+ * Stores the pixels of the current image with the colors premultiplied by
+ * alpha (1) or with straight alpha (0), converting the image data.
+ * Blending a premultiplied image onto another premultiplied image (or onto
+ * an image without alpha) with the copy operation takes a much cheaper path,
+ * which speeds up compositing of many layers. Scaling, rotating, cropping
+ * and rendering keep the premultiplied representation, everything else
+ * sees straight alpha: the pixel queries and saving convert as needed, and
+ * operations that modify the pixels in other ways (drawing, filters, color
+ * modifiers, imlib_image_get_data(), ...) switch the image back to straight
+ * alpha first. imlib_image_get_data_for_reading_only() returns the data as
+ * stored. Has no effect on images without alpha.
+ */
+EAPI void
+imlib_image_set_premultiplied_alpha(char premultiplied)
+{
+   ImlibImage         *im;
+
+   CHECK_PARAM_POINTER("image", ctx->image);
+   CAST_IMAGE(im, ctx->image);
+   if (__imlib_LoadImageData(im))
+      return;
+   __imlib_SetAlphaPremul(im, premultiplied);
+}
+
+/**
+ * @return Current premultiplied alpha flag.
+ *
+ * Returns 1 if the current image is stored with premultiplied alpha,
+ * 0 otherwise.
+ */
+EAPI char
+imlib_image_get_premultiplied_alpha(void)
+{
+   ImlibImage         *im;
+
+   CHECK_PARAM_POINTER_RETURN("image", ctx->image, 0);
+   CAST_IMAGE(im, ctx->image);
+   return IMAGE_ALPHA_PREMUL(im) ? 1 : 0;
+}
+
 #ifdef BUILD_X11
 /**
  * @param pixmap_return The returned pixmap.
@@ -2289,6 +2567,7 @@ imlib_copy_drawable_to_image(Pixmap mask, int x, int y, int width, int height,
 
    if ((width <= 0) || (height <= 0))
       return 0;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    return __imlib_GrabDrawableToRGBA(im->data, destination_x, destination_y,
                                      im->w, im->h, ctx->display,
@@ -2296,6 +2575,91 @@ imlib_copy_drawable_to_image(Pixmap mask, int x, int y, int width, int height,
                                      ctx->colormap, ctx->depth, x, y, width,
                                      height, &domask, need_to_grab_x);
 }
+
+/**
+ * @param x The top left x coordinate of the rectangle.
+ * @param y The top left y coordinate of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @return A new capture session, otherwise NULL.
+ *
+ * Starts a capture session on the (@p x, @p y, @p width, @p height)
+ * rectangle of the current drawable, for grabbing the same area over and
+ * over (screen recording, remote desktops).
+ * The drawable is inspected and the shared memory segment and color tables
+ * are set up once here, instead of on every grab as with
+ * imlib_create_image_from_drawable(). The rectangle is clipped to the
+ * drawable, and to the screen for windows. Shape masks are not used.
+ * The session image is filled by imlib_capture_update().
+ *
+ **/
+EAPI                Imlib_Capture
+imlib_capture_new(int x, int y, int width, int height)
+{
+   CHECK_PARAM_POINTER_RETURN("display", ctx->display, NULL);
+   return (Imlib_Capture) __imlib_CaptureNew(ctx->display, ctx->drawable,
+                                             ctx->visual, ctx->colormap,
+                                             x, y, width, height);
+}
+
+/**
+ * @param capture A capture session.
+ *
+ * Frees the capture session @p capture and its image.
+ *
+ **/
+EAPI void
+imlib_capture_free(Imlib_Capture capture)
+{
+   CHECK_PARAM_POINTER("capture", capture);
+   __imlib_CaptureFree((ImlibCapture *) capture);
+}
+
+/**
+ * @param capture A capture session.
+ * @return The session image.
+ *
+ * Returns the image holding the captured area of @p capture. It is owned
+ * by the session and stays the same for its whole life - do not free it.
+ * It may be read, blended or rendered like any other image between
+ * updates.
+ *
+ **/
+EAPI                Imlib_Image
+imlib_capture_get_image(Imlib_Capture capture)
+{
+   CHECK_PARAM_POINTER_RETURN("capture", capture, NULL);
+   return (Imlib_Image) __imlib_CaptureImage((ImlibCapture *) capture);
+}
+
+/**
+ * @param capture A capture session.
+ * @param need_to_grab_x Grab flag.
+ * @return The updated rectangles, NULL if none.
+ *
+ * Brings the session image of @p capture up to date with the drawable and
+ * returns the list of rectangles that were refetched, in image
+ * coordinates. The list must be freed with imlib_updates_free().
+ * When the X server supports the DAMAGE extension only the areas
+ * changed since the previous update are fetched and converted, so an
+ * update of an idle screen is cheap and returns NULL. Otherwise, and on
+ * the first update, the whole area is fetched.
+ * If the grab fails (e.g. the window was unmapped) NULL is returned and
+ * the next update fetches everything again. If @p need_to_grab_x is 1 the
+ * server is grabbed while fetching.
+ * With DAMAGE the session's DamageNotify events arrive on the application's
+ * display connection like any other event. Applications reading all events
+ * will see them in between updates (they may be taken as a hint that an
+ * update is due, or ignored); the ones still queued are dropped here.
+ *
+ **/
+EAPI                Imlib_Updates
+imlib_capture_update(Imlib_Capture capture, char need_to_grab_x)
+{
+   CHECK_PARAM_POINTER_RETURN("capture", capture, NULL);
+   return (Imlib_Updates) __imlib_CaptureUpdate((ImlibCapture *) capture,
+                                                need_to_grab_x);
+}
 #endif
 
 /**
@@ -2303,6 +2667,8 @@ imlib_copy_drawable_to_image(Pixmap mask, int x, int y, int width, int height,
  *
  * Creates an exact duplicate of the current image and returns a valid
  * image handle on success, or NULL on failure.
+ * The pixel data is shared with the original until either image is
+ * modified, so cloning an image only to read from it is cheap.
  *
  **/
 EAPI                Imlib_Image
@@ -2321,13 +2687,17 @@ imlib_clone_image(void)
    im = __imlib_CreateImage(im_old->w, im_old->h, NULL);
    if (!(im))
       return NULL;
-   im->data = malloc(im->w * im->h * sizeof(DATA32));
-   if (!(im->data))
+   /* Share the pixel data until one of the images is modified */
+   if (__imlib_ShareData(im, im_old, 0))
      {
-        __imlib_FreeImage(im);
-        return NULL;
+        im->data = malloc(im->w * im->h * sizeof(DATA32));
+        if (!(im->data))
+          {
+             __imlib_FreeImage(im);
+             return NULL;
+          }
+        memcpy(im->data, im_old->data, im->w * im->h * sizeof(DATA32));
      }
-   memcpy(im->data, im_old->data, im->w * im->h * sizeof(DATA32));
    im->flags = im_old->flags;
    SET_FLAG(im->flags, F_UNCACHEABLE);
    im->moddate = im_old->moddate;
@@ -2364,6 +2734,16 @@ imlib_create_cropped_image(int x, int y, int width, int height)
    if (__imlib_LoadImageData(im_old))
       return NULL;
    im = __imlib_CreateImage(abs(width), abs(height), NULL);
+   /* A band of whole rows is contiguous in the source and (without alpha
+    * conversion or clipping) identical to it, so share it copy-on-write */
+   if (IMAGE_HAS_ALPHA(im_old) && x == 0 && width == im_old->w &&
+       y >= 0 && height > 0 && y + height <= im_old->h &&
+       ctx->cliprect.w == 0 && !__imlib_ShareData(im, im_old, y * im_old->w))
+     {
+        SET_FLAG(im->flags, F_HAS_ALPHA);
+        UPDATE_FLAG(im->flags, F_ALPHA_PREMUL, IMAGE_ALPHA_PREMUL(im_old));
+        return (Imlib_Image) im;
+     }
    im->data = malloc(abs(width * height) * sizeof(DATA32));
    if (!(im->data))
      {
@@ -2373,6 +2753,7 @@ imlib_create_cropped_image(int x, int y, int width, int height)
    if (IMAGE_HAS_ALPHA(im_old))
      {
         SET_FLAG(im->flags, F_HAS_ALPHA);
+        UPDATE_FLAG(im->flags, F_ALPHA_PREMUL, IMAGE_ALPHA_PREMUL(im_old));
         __imlib_BlendImageToImage(im_old, im, 0, 0, 1, x, y, abs(width),
                                   abs(height), 0, 0, width, height, NULL,
                                   (ImlibOp) IMLIB_OP_COPY,
@@ -2429,6 +2810,7 @@ imlib_create_cropped_scaled_image(int source_x, int source_y,
    if (IMAGE_HAS_ALPHA(im_old))
      {
         SET_FLAG(im->flags, F_HAS_ALPHA);
+        UPDATE_FLAG(im->flags, F_ALPHA_PREMUL, IMAGE_ALPHA_PREMUL(im_old));
         __imlib_BlendImageToImage(im_old, im, ctx->anti_alias, 0, 1, source_x,
                                   source_y, source_width, source_height, 0, 0,
                                   destination_width, destination_height, NULL,
@@ -2512,17 +2894,19 @@ imlib_updates_merge(Imlib_Updates updates, int w, int h)
  * @param h The height of the rectangle.
  * @return The updates handle.
  *
- * Works almost exactly as imlib_updates_merge() but is more lenient
- * on the spacing between update rectangles - if they are very close it
- * amalgamates 2 smaller rectangles into 1 larger one.
+ * Clips the rectangles to @p w x @p h and amalgamates 2 rectangles into
+ * their bounding box when rendering the pixels between them costs less
+ * than rendering one more rectangle. Unlike imlib_updates_merge() the
+ * rectangles are not aligned to a grid, and they may overlap.
  **/
 EAPI                Imlib_Updates
 imlib_updates_merge_for_rendering(Imlib_Updates updates, int w, int h)
 {
    ImlibUpdate        *u;
 
-   u = (ImlibUpdate *) updates;
-   return (Imlib_Updates) __imlib_MergeUpdate(u, w, h, 3);
+   u = __imlib_ClipUpdates((ImlibUpdate *) updates, w, h);
+   /* one more rect costs about as much as a 32x32 block of pixels */
+   return (Imlib_Updates) __imlib_CoalesceUpdates(u, 32 * 32);
 }
 
 /**
@@ -2615,6 +2999,9 @@ imlib_updates_set_coordinates(Imlib_Updates updates, int x, int y, int width,
  * Given an updates list (preferable already merged for rendering)
  * this will render the corresponding parts of the image to the current
  * drawable at an offset of @p x, @p y in the drawable.
+ * The parts are converted into one XImage and, with shared memory, sent
+ * in a single request. Nearby parts are joined where that is cheaper than
+ * handling them separately.
  **/
 EAPI void
 imlib_render_image_updates_on_drawable(Imlib_Updates updates, int x, int y)
@@ -2633,13 +3020,9 @@ imlib_render_image_updates_on_drawable(Imlib_Updates updates, int x, int y)
    ximcs = __imlib_GetXImageCacheCountMax(ctx->display);        /* Save */
    if (ximcs == 0)              /* Only if we don't set this up elsewhere */
       __imlib_SetXImageCacheCountMax(ctx->display, 10);
-   for (; u; u = u->next)
-     {
-        __imlib_RenderImage(ctx->display, im, ctx->drawable, 0, ctx->visual,
-                            ctx->colormap, ctx->depth, u->x, u->y, u->w, u->h,
-                            x + u->x, y + u->y, u->w, u->h, 0, ctx->dither, 0,
-                            0, 0, ctx->color_modifier, OP_COPY);
-     }
+   __imlib_RenderImageUpdates(ctx->display, im, ctx->drawable, ctx->visual,
+                              ctx->colormap, ctx->depth, u, x, y, ctx->dither,
+                              ctx->color_modifier);
    if (ximcs == 0)
       __imlib_SetXImageCacheCountMax(ctx->display, ximcs);
 }
@@ -2821,6 +3204,7 @@ imlib_image_sharpen(int radius)
    CHECK_PARAM_POINTER("image", ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_SharpenImage(im, radius);
 }
@@ -3676,6 +4060,7 @@ imlib_apply_color_modifier(void)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_DataCmodApply(im->data, im->w, im->h, 0, &(im->flags),
                          (ImlibColorModifier *) ctx->color_modifier);
@@ -3722,6 +4107,7 @@ imlib_apply_color_modifier_to_rectangle(int x, int y, int width, int height)
       return;
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_DataCmodApply(im->data + (y * im->w) + x, width, height,
                          im->w - width, &(im->flags),
@@ -3737,6 +4123,7 @@ imlib_image_draw_pixel(int x, int y, char make_updates)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return NULL;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    return (Imlib_Updates) __imlib_Point_DrawToImage(x, y, ctx->pixel, im,
                                                     ctx->cliprect.x,
@@ -3770,6 +4157,7 @@ imlib_image_draw_line(int x1, int y1, int x2, int y2, char make_updates)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return NULL;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    return (Imlib_Updates) __imlib_Line_DrawToImage(x1, y1, x2, y2, ctx->pixel,
                                                    im, ctx->cliprect.x,
@@ -3801,6 +4189,7 @@ imlib_image_draw_rectangle(int x, int y, int width, int height)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_Rectangle_DrawToImage(x, y, width, height, ctx->pixel,
                                  im, ctx->cliprect.x, ctx->cliprect.y,
@@ -3827,6 +4216,7 @@ imlib_image_fill_rectangle(int x, int y, int width, int height)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_Rectangle_FillToImage(x, y, width, height, ctx->pixel,
                                  im, ctx->cliprect.x, ctx->cliprect.y,
@@ -3856,7 +4246,8 @@ imlib_image_copy_alpha_to_image(Imlib_Image image_source, int x, int y)
       return;
    if (__imlib_LoadImageData(im2))
       return;
-   __imlib_DirtyImage(im);
+   __imlib_SetAlphaPremul(im2, 0);
+   __imlib_DirtyImage(im2);
    __imlib_copy_alpha_data(im, im2, 0, 0, im->w, im->h, x, y);
 }
 
@@ -3888,7 +4279,8 @@ imlib_image_copy_alpha_rectangle_to_image(Imlib_Image image_source, int x,
       return;
    if (__imlib_LoadImageData(im2))
       return;
-   __imlib_DirtyImage(im);
+   __imlib_SetAlphaPremul(im2, 0);
+   __imlib_DirtyImage(im2);
    __imlib_copy_alpha_data(im, im2, x, y, width, height, destination_x,
                            destination_y);
 }
@@ -4031,6 +4423,7 @@ imlib_image_fill_color_range_rectangle(int x, int y, int width, int height,
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_DrawGradient(im, x, y, width, height,
                         (ImlibRange *) ctx->color_range, angle,
@@ -4064,6 +4457,7 @@ imlib_image_fill_hsva_color_range_rectangle(int x, int y, int width, int height,
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_DrawHsvaGradient(im, x, y, width, height,
                             (ImlibRange *) ctx->color_range, angle,
@@ -4084,7 +4478,7 @@ EAPI void
 imlib_image_query_pixel(int x, int y, Imlib_Color * color_return)
 {
    ImlibImage         *im;
-   DATA32             *p;
+   DATA32             *p, pixel;
 
    CHECK_PARAM_POINTER("image", ctx->image);
    CHECK_PARAM_POINTER("color_return", color_return);
@@ -4100,6 +4494,12 @@ imlib_image_query_pixel(int x, int y, Imlib_Color * color_return)
         return;
      }
    p = im->data + (im->w * y) + x;
+   if (IMAGE_ALPHA_PREMUL(im))
+     {
+        pixel = *p;
+        __imlib_UnpremulData(&pixel, 1);
+        p = &pixel;
+     }
    color_return->red = ((*p) >> 16) & 0xff;
    color_return->green = ((*p) >> 8) & 0xff;
    color_return->blue = (*p) & 0xff;
@@ -4122,7 +4522,7 @@ imlib_image_query_pixel_hsva(int x, int y, float *hue, float *saturation,
                              float *value, int *alpha)
 {
    ImlibImage         *im;
-   DATA32             *p;
+   DATA32             *p, pixel;
    int                 r, g, b;
 
    CHECK_PARAM_POINTER("image", ctx->image);
@@ -4138,6 +4538,12 @@ imlib_image_query_pixel_hsva(int x, int y, float *hue, float *saturation,
         return;
      }
    p = im->data + (im->w * y) + x;
+   if (IMAGE_ALPHA_PREMUL(im))
+     {
+        pixel = *p;
+        __imlib_UnpremulData(&pixel, 1);
+        p = &pixel;
+     }
    r = ((*p) >> 16) & 0xff;
    g = ((*p) >> 8) & 0xff;
    b = (*p) & 0xff;
@@ -4162,7 +4568,7 @@ imlib_image_query_pixel_hlsa(int x, int y, float *hue, float *lightness,
                              float *saturation, int *alpha)
 {
    ImlibImage         *im;
-   DATA32             *p;
+   DATA32             *p, pixel;
    int                 r, g, b;
 
    CHECK_PARAM_POINTER("image", ctx->image);
@@ -4178,6 +4584,12 @@ imlib_image_query_pixel_hlsa(int x, int y, float *hue, float *lightness,
         return;
      }
    p = im->data + (im->w * y) + x;
+   if (IMAGE_ALPHA_PREMUL(im))
+     {
+        pixel = *p;
+        __imlib_UnpremulData(&pixel, 1);
+        p = &pixel;
+     }
    r = ((*p) >> 16) & 0xff;
    g = ((*p) >> 8) & 0xff;
    b = (*p) & 0xff;
@@ -4203,7 +4615,7 @@ imlib_image_query_pixel_cmya(int x, int y, int *cyan, int *magenta, int *yellow,
                              int *alpha)
 {
    ImlibImage         *im;
-   DATA32             *p;
+   DATA32             *p, pixel;
 
    CHECK_PARAM_POINTER("image", ctx->image);
    CAST_IMAGE(im, ctx->image);
@@ -4218,6 +4630,12 @@ imlib_image_query_pixel_cmya(int x, int y, int *cyan, int *magenta, int *yellow,
         return;
      }
    p = im->data + (im->w * y) + x;
+   if (IMAGE_ALPHA_PREMUL(im))
+     {
+        pixel = *p;
+        __imlib_UnpremulData(&pixel, 1);
+        p = &pixel;
+     }
    *cyan = 255 - (((*p) >> 16) & 0xff);
    *magenta = 255 - (((*p) >> 8) & 0xff);
    *yellow = 255 - ((*p) & 0xff);
@@ -4388,7 +4806,8 @@ imlib_save_image_with_error_return(const char *filename,
  *
  * Creates an new copy of the current image, but rotated by @p angle
  * radians. On success it returns a valid image handle, otherwise
- * NULL.
+ * NULL. Rotations by multiples of 90 degrees are exact pixel copies when
+ * anti-aliasing is disabled.
  **/
 EAPI                Imlib_Image
 imlib_create_rotated_image(double angle)
@@ -4426,8 +4845,12 @@ imlib_create_rotated_image(double angle)
 
    if (ctx->anti_alias)
      {
-        __imlib_RotateAA(im_old->data, im->data, im_old->w, im_old->w,
-                         im_old->h, im->w, sz, sz, x, y, dx, dy, -dy, dx);
+        /* multiples of 90 degrees from a whole pixel need no interpolation */
+        if (!__imlib_RotateRightAngle(1, im_old->data, im->data, im_old->w,
+                                      im_old->w, im_old->h, im->w, sz, sz,
+                                      x, y, dx, dy, -dy, dx))
+           __imlib_RotateAA(im_old->data, im->data, im_old->w, im_old->w,
+                            im_old->h, im->w, sz, sz, x, y, dx, dy, -dy, dx);
      }
    else
      {
@@ -4435,6 +4858,7 @@ imlib_create_rotated_image(double angle)
                              im_old->h, im->w, sz, sz, x, y, dx, dy, -dy, dx);
      }
    SET_FLAG(im->flags, F_HAS_ALPHA);
+   UPDATE_FLAG(im->flags, F_ALPHA_PREMUL, IMAGE_ALPHA_PREMUL(im_old));
 
    return (Imlib_Image) im;
 }
@@ -4473,6 +4897,11 @@ imlib_rotate_image_from_buffer(double angle, Imlib_Image source_image)
    else
       sz = im->w;               // update sz with real width
 
+   if (__imlib_LoadImageData(im))
+      return;
+   __imlib_SetAlphaPremul(im, 0);
+   __imlib_DirtyImage(im);
+
 #if 0                           /* Not necessary 'cause destination is context */
    im = __imlib_CreateImage(sz, sz, NULL);
    im->data = calloc(sz * sz, sizeof(DATA32));
@@ -4485,8 +4914,12 @@ imlib_rotate_image_from_buffer(double angle, Imlib_Image source_image)
 
    if (ctx->anti_alias)
      {
-        __imlib_RotateAA(im_old->data, im->data, im_old->w, im_old->w,
-                         im_old->h, im->w, sz, sz, x, y, dx, dy, -dy, dx);
+        /* multiples of 90 degrees from a whole pixel need no interpolation */
+        if (!__imlib_RotateRightAngle(1, im_old->data, im->data, im_old->w,
+                                      im_old->w, im_old->h, im->w, sz, sz,
+                                      x, y, dx, dy, -dy, dx))
+           __imlib_RotateAA(im_old->data, im->data, im_old->w, im_old->w,
+                            im_old->h, im->w, sz, sz, x, y, dx, dy, -dy, dx);
      }
    else
      {
@@ -4494,6 +4927,7 @@ imlib_rotate_image_from_buffer(double angle, Imlib_Image source_image)
                              im_old->h, im->w, sz, sz, x, y, dx, dy, -dy, dx);
      }
    SET_FLAG(im->flags, F_HAS_ALPHA);
+   UPDATE_FLAG(im->flags, F_ALPHA_PREMUL, IMAGE_ALPHA_PREMUL(im_old));
 
    return;
 }
@@ -4711,6 +5145,7 @@ imlib_image_filter(void)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_FilterImage(im, (ImlibFilter *) ctx->filter);
 }
@@ -4829,12 +5264,284 @@ imlib_apply_filter(const char *script, ...)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    va_start(param_list, script);
    __imlib_script_parse(im, script, param_list);
    va_end(param_list);
 }
 
+/**
+ * @param script The filter script.
+ * @param ... Pointer variables, as for imlib_apply_filter().
+ * @return A compiled filter script handle, or NULL on failure.
+ *
+ * Parses @p script and resolves the filters it uses once, so it can be
+ * applied to many images with imlib_apply_filter_script() without being
+ * parsed again. Pointer variables ("[]") are bound to the pointers given
+ * here and are dereferenced each time the script is applied.
+ **/
+EAPI                Imlib_Filter_Script
+imlib_compile_filter_script(const char *script, ...)
+{
+   va_list             param_list;
+   IFunction          *funcs;
+
+   CHECK_PARAM_POINTER_RETURN("script", script, NULL);
+   __imlib_dynamic_filters_init();
+   va_start(param_list, script);
+   funcs = __imlib_script_compile(script, param_list);
+   va_end(param_list);
+
+   return (Imlib_Filter_Script) funcs;
+}
+
+/**
+ * @param script A compiled filter script.
+ *
+ * Applies the compiled filter script @p script to the current image.
+ **/
+EAPI void
+imlib_apply_filter_script(Imlib_Filter_Script script)
+{
+   ImlibImage         *im;
+
+   CHECK_PARAM_POINTER("image", ctx->image);
+   CHECK_PARAM_POINTER("script", script);
+   CAST_IMAGE(im, ctx->image);
+   if (__imlib_LoadImageData(im))
+      return;
+   __imlib_SetAlphaPremul(im, 0);
+   __imlib_DirtyImage(im);
+   __imlib_script_exec(im, (IFunction *) script);
+}
+
+/**
+ * @param script A compiled filter script.
+ *
+ * Frees a filter script returned by imlib_compile_filter_script().
+ **/
+EAPI void
+imlib_free_filter_script(Imlib_Filter_Script script)
+{
+   CHECK_PARAM_POINTER("script", script);
+   __imlib_script_free((IFunction *) script);
+}
+
+/**
+ * Returns a new, empty pipeline.
+ *
+ * A pipeline is a chain of scale, color modifier, blur, sharpen and filter
+ * steps that is run over an image in one pass. The image is processed in
+ * bands of rows small enough to stay in cache, each band going through all
+ * steps before the next one is started, so no full size intermediate images
+ * are needed.
+ **/
+EAPI                Imlib_Pipeline
+imlib_pipeline_new(void)
+{
+   return (Imlib_Pipeline) __imlib_PipelineNew();
+}
+
+/**
+ * @param pipeline A pipeline.
+ *
+ * Frees a pipeline.
+ **/
+EAPI void
+imlib_pipeline_free(Imlib_Pipeline pipeline)
+{
+   CHECK_PARAM_POINTER("pipeline", pipeline);
+   __imlib_PipelineFree((ImlibPipeline *) pipeline);
+}
+
+/**
+ * @param pipeline A pipeline.
+ *
+ * Removes all steps from the pipeline @p pipeline.
+ **/
+EAPI void
+imlib_pipeline_clear(Imlib_Pipeline pipeline)
+{
+   CHECK_PARAM_POINTER("pipeline", pipeline);
+   __imlib_PipelineClear((ImlibPipeline *) pipeline);
+}
+
+/**
+ * @param pipeline A pipeline.
+ * @param width The width to scale to.
+ * @param height The height to scale to.
+ *
+ * Adds a step scaling the image to @p width x @p height using the current
+ * scale filter, see imlib_context_set_scale_filter(). A negative width or
+ * height flips the image. Scaling is done best as the first step, a scale
+ * step after other steps has those run into a temporary image first.
+ **/
+EAPI void
+imlib_pipeline_add_scale(Imlib_Pipeline pipeline, int width, int height)
+{
+   CHECK_PARAM_POINTER("pipeline", pipeline);
+   __imlib_PipelineAddScale((ImlibPipeline *) pipeline, width, height,
+                            ctx->anti_alias);
+}
+
+/**
+ * @param pipeline A pipeline.
+ *
+ * Adds a step applying the current color modifier. The pipeline keeps a
+ * copy, later changes to the color modifier do not affect it.
+ **/
+EAPI void
+imlib_pipeline_add_color_modifier(Imlib_Pipeline pipeline)
+{
+   CHECK_PARAM_POINTER("pipeline", pipeline);
+   CHECK_PARAM_POINTER("color_modifier", ctx->color_modifier);
+   __imlib_PipelineAddCmod((ImlibPipeline *) pipeline,
+                           (ImlibColorModifier *) ctx->color_modifier);
+}
+
+/**
+ * @param pipeline A pipeline.
+ * @param radius The radius.
+ *
+ * Adds a blur step, see imlib_image_blur().
+ **/
+EAPI void
+imlib_pipeline_add_blur(Imlib_Pipeline pipeline, int radius)
+{
+   CHECK_PARAM_POINTER("pipeline", pipeline);
+   __imlib_PipelineAddBlur((ImlibPipeline *) pipeline, radius);
+}
+
+/**
+ * @param pipeline A pipeline.
+ * @param radius The radius.
+ *
+ * Adds a sharpen step, see imlib_image_sharpen().
+ **/
+EAPI void
+imlib_pipeline_add_sharpen(Imlib_Pipeline pipeline, int radius)
+{
+   CHECK_PARAM_POINTER("pipeline", pipeline);
+   __imlib_PipelineAddSharpen((ImlibPipeline *) pipeline, radius);
+}
+
+/**
+ * @param pipeline A pipeline.
+ *
+ * Adds a step applying the current filter, see imlib_image_filter(). The
+ * pipeline keeps a copy, later changes to the filter do not affect it.
+ **/
+EAPI void
+imlib_pipeline_add_filter(Imlib_Pipeline pipeline)
+{
+   CHECK_PARAM_POINTER("pipeline", pipeline);
+   CHECK_PARAM_POINTER("filter", ctx->filter);
+   __imlib_PipelineAddFilter((ImlibPipeline *) pipeline,
+                             (ImlibFilter *) ctx->filter);
+}
+
+/**
+ * @param pipeline A pipeline.
+ *
+ * Runs the steps of @p pipeline on the current image, replacing its
+ * contents (and size, if the pipeline scales) by the result.
+ **/
+EAPI void
+imlib_image_apply_pipeline(Imlib_Pipeline pipeline)
+{
+   ImlibImage         *im;
+   ImlibPipeline      *pl;
+
+   CHECK_PARAM_POINTER("image", ctx->image);
+   CHECK_PARAM_POINTER("pipeline", pipeline);
+   CAST_IMAGE(im, ctx->image);
+   pl = (ImlibPipeline *) pipeline;
+   if (__imlib_LoadImageData(im))
+      return;
+   __imlib_SetAlphaPremul(im, 0);
+   __imlib_DirtyImage(im);
+   __imlib_PipelineApply(pl->steps, pl->num, im);
+}
+
+/**
+ * @param pipeline A pipeline.
+ * @param x The top left x coordinate of the rectangle.
+ * @param y The top left y coordinate of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @return A new image, NULL on failure.
+ *
+ * Runs the steps of @p pipeline on the rectangle (@p x, @p y, @p width,
+ * @p height) of the current image and returns the result as a new image.
+ * The current image is not changed.
+ **/
+EAPI                Imlib_Image
+imlib_create_image_from_pipeline(Imlib_Pipeline pipeline, int x, int y,
+                                 int width, int height)
+{
+   ImlibImage         *im;
+   ImlibPipeline      *pl;
+
+   CHECK_PARAM_POINTER_RETURN("image", ctx->image, NULL);
+   CHECK_PARAM_POINTER_RETURN("pipeline", pipeline, NULL);
+   CAST_IMAGE(im, ctx->image);
+   pl = (ImlibPipeline *) pipeline;
+   if (__imlib_LoadImageData(im))
+      return NULL;
+   __imlib_SetAlphaPremul(im, 0);
+   return (Imlib_Image) __imlib_PipelineCreateImage(pl->steps, pl->num, im,
+                                                    x, y, width, height);
+}
+
+/**
+ * @param pipeline A pipeline.
+ * @param source_image The source image.
+ * @param merge_alpha Alpha flag.
+ * @param source_x The source x coordinate.
+ * @param source_y The source y coordinate.
+ * @param source_width The source width.
+ * @param source_height The source height.
+ * @param destination_x The destination x coordinate.
+ * @param destination_y The destination y coordinate.
+ *
+ * Runs the steps of @p pipeline on the rectangle (@p source_x,
+ * @p source_y, @p source_width, @p source_height) of @p source_image and
+ * blends the result onto the current image at (@p destination_x,
+ * @p destination_y) using the current operation, blending and clip
+ * rectangle. Only the rows that end up visible are computed, band by band,
+ * without making a full size intermediate image. If @p merge_alpha is set
+ * to 1 the destination alpha channel is modified too.
+ **/
+EAPI void
+imlib_blend_pipeline_onto_image(Imlib_Pipeline pipeline,
+                                Imlib_Image source_image, char merge_alpha,
+                                int source_x, int source_y,
+                                int source_width, int source_height,
+                                int destination_x, int destination_y)
+{
+   ImlibImage         *im_src, *im_dst;
+   ImlibPipeline      *pl;
+
+   CHECK_PARAM_POINTER("pipeline", pipeline);
+   CHECK_PARAM_POINTER("source_image", source_image);
+   CHECK_PARAM_POINTER("image", ctx->image);
+   CAST_IMAGE(im_src, source_image);
+   CAST_IMAGE(im_dst, ctx->image);
+   pl = (ImlibPipeline *) pipeline;
+   if (__imlib_LoadImageData(im_src))
+      return;
+   if (__imlib_LoadImageData(im_dst))
+      return;
+   __imlib_SetAlphaPremul(im_src, 0);
+   __imlib_DirtyImage(im_dst);
+   __imlib_PipelineBlend(pl->steps, pl->num, im_src, im_dst, ctx->blend,
+                         merge_alpha, source_x, source_y, source_width,
+                         source_height, destination_x, destination_y,
+                         ctx->operation, ctx->cliprect.x, ctx->cliprect.y,
+                         ctx->cliprect.w, ctx->cliprect.h);
+}
+
 /**
  * Returns a new polygon object with no points set.
  **/
@@ -4890,6 +5597,7 @@ imlib_image_draw_polygon(ImlibPolygon poly, unsigned char closed)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_Polygon_DrawToImage((ImlibPoly *) poly, closed, ctx->pixel,
                                im, ctx->cliprect.x, ctx->cliprect.y,
@@ -4902,6 +5610,10 @@ imlib_image_draw_polygon(ImlibPolygon poly, unsigned char closed)
  *
  * Fills the area defined by the polygon @p polyon the current context image
  * with the current context color.
+ * The pixels with centers inside the polygon (even-odd rule) are filled,
+ * along with the pixels its edges pass through, so a polygon drawn on the
+ * same points is covered by the fill. With anti-aliasing the edges are
+ * smoothed, an edge running through pixel centers still covers them fully.
  **/
 EAPI void
 imlib_image_fill_polygon(ImlibPolygon poly)
@@ -4912,6 +5624,7 @@ imlib_image_fill_polygon(ImlibPolygon poly)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_Polygon_FillToImage((ImlibPoly *) poly, ctx->pixel,
                                im, ctx->cliprect.x, ctx->cliprect.y,
@@ -4959,6 +5672,7 @@ imlib_image_draw_ellipse(int xc, int yc, int a, int b)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_Ellipse_DrawToImage(xc, yc, a, b, ctx->pixel,
                                im, ctx->cliprect.x, ctx->cliprect.y,
@@ -4988,6 +5702,7 @@ imlib_image_fill_ellipse(int xc, int yc, int a, int b)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    __imlib_Ellipse_FillToImage(xc, yc, a, b, ctx->pixel,
                                im, ctx->cliprect.x, ctx->cliprect.y,
@@ -4995,6 +5710,177 @@ imlib_image_fill_ellipse(int xc, int yc, int a, int b)
                                ctx->operation, ctx->blend, ctx->anti_alias);
 }
 
+/**
+ * Returns a new, empty draw list.
+ *
+ * A draw list records points, lines, rectangles and ellipses to be drawn
+ * in one go with imlib_image_draw_list(). This is much faster than drawing
+ * many small primitives one by one.
+ **/
+EAPI                Imlib_Draw_List
+imlib_draw_list_new(void)
+{
+   return (Imlib_Draw_List) __imlib_DrawListNew();
+}
+
+/**
+ * @param list A draw list.
+ *
+ * Frees a draw list.
+ **/
+EAPI void
+imlib_draw_list_free(Imlib_Draw_List list)
+{
+   CHECK_PARAM_POINTER("list", list);
+   __imlib_DrawListFree((ImlibDrawList *) list);
+}
+
+/**
+ * @param list A draw list.
+ *
+ * Removes all items from the draw list @p list, keeping its memory for
+ * reuse.
+ **/
+EAPI void
+imlib_draw_list_clear(Imlib_Draw_List list)
+{
+   CHECK_PARAM_POINTER("list", list);
+   __imlib_DrawListClear((ImlibDrawList *) list);
+}
+
+/**
+ * @param list A draw list.
+ * @param x The x coordinate.
+ * @param y The y coordinate.
+ *
+ * Adds the pixel at (@p x, @p y) to the draw list @p list, see
+ * imlib_image_draw_pixel().
+ **/
+EAPI void
+imlib_draw_list_add_pixel(Imlib_Draw_List list, int x, int y)
+{
+   CHECK_PARAM_POINTER("list", list);
+   __imlib_DrawListAdd((ImlibDrawList *) list, DRAW_POINT, x, y, 0, 0);
+}
+
+/**
+ * @param list A draw list.
+ * @param x1 The x coordinate of the first point.
+ * @param y1 The y coordinate of the first point.
+ * @param x2 The x coordinate of the second point.
+ * @param y2 The y coordinate of the second point.
+ *
+ * Adds a line from (@p x1, @p y1) to (@p x2, @p y2) to the draw list
+ * @p list, see imlib_image_draw_line().
+ **/
+EAPI void
+imlib_draw_list_add_line(Imlib_Draw_List list, int x1, int y1, int x2, int y2)
+{
+   CHECK_PARAM_POINTER("list", list);
+   __imlib_DrawListAdd((ImlibDrawList *) list, DRAW_LINE, x1, y1, x2, y2);
+}
+
+/**
+ * @param list A draw list.
+ * @param x The top left x coordinate of the rectangle.
+ * @param y The top left y coordinate of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ *
+ * Adds a rectangle outline to the draw list @p list, see
+ * imlib_image_draw_rectangle().
+ **/
+EAPI void
+imlib_draw_list_add_rectangle(Imlib_Draw_List list, int x, int y,
+                              int width, int height)
+{
+   CHECK_PARAM_POINTER("list", list);
+   __imlib_DrawListAdd((ImlibDrawList *) list, DRAW_RECT,
+                       x, y, width, height);
+}
+
+/**
+ * @param list A draw list.
+ * @param x The top left x coordinate of the rectangle.
+ * @param y The top left y coordinate of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ *
+ * Adds a filled rectangle to the draw list @p list, see
+ * imlib_image_fill_rectangle().
+ **/
+EAPI void
+imlib_draw_list_add_filled_rectangle(Imlib_Draw_List list, int x, int y,
+                                     int width, int height)
+{
+   CHECK_PARAM_POINTER("list", list);
+   __imlib_DrawListAdd((ImlibDrawList *) list, DRAW_FILL_RECT,
+                       x, y, width, height);
+}
+
+/**
+ * @param list A draw list.
+ * @param xc X coordinate of the center of the ellipse.
+ * @param yc Y coordinate of the center of the ellipse.
+ * @param a The horizontal amplitude of the ellipse.
+ * @param b The vertical amplitude of the ellipse.
+ *
+ * Adds an ellipse outline to the draw list @p list, see
+ * imlib_image_draw_ellipse().
+ **/
+EAPI void
+imlib_draw_list_add_ellipse(Imlib_Draw_List list, int xc, int yc, int a, int b)
+{
+   CHECK_PARAM_POINTER("list", list);
+   __imlib_DrawListAdd((ImlibDrawList *) list, DRAW_ELLIPSE, xc, yc, a, b);
+}
+
+/**
+ * @param list A draw list.
+ * @param xc X coordinate of the center of the ellipse.
+ * @param yc Y coordinate of the center of the ellipse.
+ * @param a The horizontal amplitude of the ellipse.
+ * @param b The vertical amplitude of the ellipse.
+ *
+ * Adds a filled ellipse to the draw list @p list, see
+ * imlib_image_fill_ellipse().
+ **/
+EAPI void
+imlib_draw_list_add_filled_ellipse(Imlib_Draw_List list, int xc, int yc,
+                                   int a, int b)
+{
+   CHECK_PARAM_POINTER("list", list);
+   __imlib_DrawListAdd((ImlibDrawList *) list, DRAW_FILL_ELLIPSE,
+                       xc, yc, a, b);
+}
+
+/**
+ * @param list A draw list.
+ *
+ * Draws all items of the draw list @p list on the current image using the
+ * current color, operation, blending, anti-aliasing and clip rectangle.
+ * The result is the same as drawing the items one by one in the order they
+ * were added. Large lists may be drawn using several threads, see
+ * imlib_set_thread_count().
+ **/
+EAPI void
+imlib_image_draw_list(Imlib_Draw_List list)
+{
+   ImlibImage         *im;
+
+   CHECK_PARAM_POINTER("image", ctx->image);
+   CHECK_PARAM_POINTER("list", list);
+   CAST_IMAGE(im, ctx->image);
+   if (__imlib_LoadImageData(im))
+      return;
+   __imlib_SetAlphaPremul(im, 0);
+   __imlib_DirtyImage(im);
+   __imlib_DrawList_DrawToImage((ImlibDrawList *) list, ctx->pixel,
+                                im, ctx->cliprect.x, ctx->cliprect.y,
+                                ctx->cliprect.w, ctx->cliprect.h,
+                                ctx->operation, ctx->blend, ctx->anti_alias);
+}
+
 /**
  * @param poly A polygon
  * @param x The X coordinate.
@@ -5034,6 +5920,7 @@ imlib_image_clear_color(int r, int g, int b, int a)
    CAST_IMAGE(im, ctx->image);
    if (__imlib_LoadImageData(im))
       return;
+   __imlib_SetAlphaPremul(im, 0);
    __imlib_DirtyImage(im);
    max = im->w * im->h;
    col = PIXEL_ARGB(a, r, g, b);
@@ -30,3 +30,26 @@ __imlib_do_asm(void)
 }
 
 #endif
+
+#ifdef DO_SIMD
+int
+__imlib_do_simd(void)
+{
+   static signed char  _cpu_simd = -1;
+
+   if (_cpu_simd < 0)
+     {
+        __builtin_cpu_init();
+        if (getenv("IMLIB2_ASM_OFF"))
+           _cpu_simd = SIMD_NONE;
+        else if (__builtin_cpu_supports("avx2") && !getenv("IMLIB2_AVX2_OFF"))
+           _cpu_simd = SIMD_AVX2;
+        else if (__builtin_cpu_supports("sse2"))
+           _cpu_simd = SIMD_SSE2;
+        else
+           _cpu_simd = SIMD_NONE;
+     }
+
+   return _cpu_simd;
+}
+#endif
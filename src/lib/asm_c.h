@@ -5,4 +5,11 @@
 int                 __imlib_do_asm(void);
 #endif
 
+#ifdef DO_SIMD
+#define SIMD_NONE 0
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+int                 __imlib_do_simd(void);
+#endif
+
 #endif /* ASM_C_H */
@@ -2,6 +2,9 @@
 
 #include "asm_c.h"
 #include "blend.h"
+#ifdef DO_SIMD
+#include "blend_simd.h"
+#endif
 #include "colormod.h"
 #include "image.h"
 #include "scale.h"
@@ -1456,6 +1459,158 @@ __imlib_ReCopyRGBToRGBACmod(DATA32 * src, int srcw, DATA32 * dst, int dstw,
      }
 }
 
+/* PREMULTIPLIED ALPHA */
+
+static void
+__imlib_BlendPremulRGBAToRGB(DATA32 * src, int srcw, DATA32 * dst, int dstw,
+                             int w, int h, ImlibColorModifier * cm)
+{
+   int                 src_step = (srcw - w), dst_step = (dstw - w), ww = w;
+
+   while (h--)
+     {
+        while (w--)
+          {
+             DATA32              tmp;
+             DATA8               na;
+
+             na = 255 - A_VAL(src);
+             switch (na)
+               {
+               case 255:
+                  break;
+               case 0:
+                  *dst = (*dst & 0xff000000) | (*src & 0x00ffffff);
+                  break;
+               default:
+                  PREMUL_BLEND(na, tmp, *src, *dst);
+                  *dst = (*dst & 0xff000000) | (tmp & 0x00ffffff);
+                  break;
+               }
+             src++;
+             dst++;
+          }
+        src += src_step;
+        dst += dst_step;
+        w = ww;
+     }
+}
+
+static void
+__imlib_BlendPremulRGBAToRGBA(DATA32 * src, int srcw, DATA32 * dst, int dstw,
+                              int w, int h, ImlibColorModifier * cm)
+{
+   int                 src_step = (srcw - w), dst_step = (dstw - w), ww = w;
+
+   while (h--)
+     {
+        while (w--)
+          {
+             DATA8               na;
+
+             na = 255 - A_VAL(src);
+             switch (na)
+               {
+               case 255:
+                  break;
+               case 0:
+                  *dst = *src;
+                  break;
+               default:
+                  PREMUL_BLEND(na, *dst, *src, *dst);
+                  break;
+               }
+             src++;
+             dst++;
+          }
+        src += src_step;
+        dst += dst_step;
+        w = ww;
+     }
+}
+
+void
+__imlib_PremulData(DATA32 * data, int len)
+{
+   DATA32              tmp;
+   DATA8               a;
+
+   for (; len > 0; len--, data++)
+     {
+        a = A_VAL(data);
+        switch (a)
+          {
+          case 0:
+             *data = 0;
+             break;
+          case 255:
+             break;
+          default:
+             MUL_COLOR(a, R_VAL(data), R_VAL(data));
+             MUL_COLOR(a, G_VAL(data), G_VAL(data));
+             MUL_COLOR(a, B_VAL(data), B_VAL(data));
+             break;
+          }
+     }
+}
+
+void
+__imlib_UnpremulData(DATA32 * data, int len)
+{
+   DATA32              tmp;
+   DATA8               a;
+
+   for (; len > 0; len--, data++)
+     {
+        a = A_VAL(data);
+        if (a == 0 || a == 255)
+           continue;
+        tmp = (R_VAL(data) * 255 + (a >> 1)) / a;
+        R_VAL(data) = tmp > 255 ? 255 : tmp;
+        tmp = (G_VAL(data) * 255 + (a >> 1)) / a;
+        G_VAL(data) = tmp > 255 ? 255 : tmp;
+        tmp = (B_VAL(data) * 255 + (a >> 1)) / a;
+        B_VAL(data) = tmp > 255 ? 255 : tmp;
+     }
+}
+
+/*
+ * Blend functions working directly on premultiplied data, NULL if there is
+ * none for the combination and the pixels must be converted.
+ */
+ImlibBlendFunction
+__imlib_GetPremulBlendFunction(ImlibOp op, char blend, char merge_alpha,
+                               ImlibColorModifier * cm, int premul)
+{
+   ImlibBlendFunction  bfun = NULL;
+
+   if (op != OP_COPY || cm || !(premul & PREMUL_SRC))
+      return NULL;
+
+   if (premul & PREMUL_DST)
+     {
+        if (!merge_alpha)
+           return NULL;
+        if (!blend)
+           return __imlib_GetBlendFunction(op, 0, 1, 0, NULL);
+     }
+   else if (merge_alpha || !blend)
+     {
+        /* straight destination, fine as long as its alpha is left alone */
+        return NULL;
+     }
+
+#ifdef DO_SIMD
+   bfun = __imlib_GetPremulBlendFunctionSimd(__imlib_do_simd(),
+                                             merge_alpha);
+#endif
+   if (!bfun)
+      bfun = merge_alpha ? __imlib_BlendPremulRGBAToRGBA :
+         __imlib_BlendPremulRGBAToRGB;
+
+   return bfun;
+}
+
 /*\ Equivalent functions \*/
 
 #define __imlib_CopyRGBToRGB			__imlib_CopyRGBToRGBA
@@ -1731,16 +1886,70 @@ __imlib_GetBlendFunction(ImlibOp op, char blend, char merge_alpha, char rgb_src,
    if (blend && cm && rgb_src && (A_CMOD(cm, 0xff) == 0))
       return NULL;
 
+#ifdef DO_SIMD
+   bfun = __imlib_GetBlendFunctionSimd(__imlib_do_simd(), op, blend,
+                                       merge_alpha, rgb_src, cm);
+   if (bfun)
+      return bfun;
+#endif
+
    bfun = ibfuncs[!!do_mmx][op][!!cm][!!merge_alpha][!!rgb_src][!!blend];
 
    return bfun;
 }
 
+static void
+__imlib_BlendPremulRGBAToData(DATA32 * src, int srcw, DATA32 * dst, int dstw,
+                              int w, int h, char blend, char merge_alpha,
+                              ImlibColorModifier * cm, ImlibOp op,
+                              char rgb_src, int premul)
+{
+   ImlibBlendFunction  blender;
+   DATA32             *buf = NULL, *s;
+
+   blender = __imlib_GetPremulBlendFunction(op, blend, merge_alpha, cm, premul);
+   if (blender)
+     {
+        blender(src, srcw, dst, dstw, w, h, cm);
+        return;
+     }
+
+   /* otherwise blend line by line with straight alpha */
+   blender = __imlib_GetBlendFunction(op, blend, merge_alpha, rgb_src, cm);
+   if (!blender)
+      return;
+   if (premul & PREMUL_SRC)
+     {
+        buf = malloc(w * sizeof(DATA32));
+        if (!buf)
+           return;
+     }
+
+   for (; h > 0; h--, src += srcw, dst += dstw)
+     {
+        s = src;
+        if (buf)
+          {
+             memcpy(buf, src, w * sizeof(DATA32));
+             __imlib_UnpremulData(buf, w);
+             s = buf;
+          }
+        if (premul & PREMUL_DST)
+           __imlib_UnpremulData(dst, w);
+        blender(s, w, dst, dstw, w, 1, cm);
+        if (premul & PREMUL_DST)
+           __imlib_PremulData(dst, w);
+     }
+
+   free(buf);
+}
+
 void
 __imlib_BlendRGBAToData(DATA32 * src, int src_w, int src_h, DATA32 * dst,
                         int dst_w, int dst_h, int sx, int sy, int dx, int dy,
                         int w, int h, char blend, char merge_alpha,
-                        ImlibColorModifier * cm, ImlibOp op, char rgb_src)
+                        ImlibColorModifier * cm, ImlibOp op, char rgb_src,
+                        int premul)
 {
    ImlibBlendFunction  blender;
 
@@ -1782,6 +1991,14 @@ __imlib_BlendRGBAToData(DATA32 * src, int src_w, int src_h, DATA32 * dst,
       return;
 
    __imlib_build_pow_lut();
+   if (premul)
+     {
+        __imlib_BlendPremulRGBAToData(src + (sy * src_w) + sx, src_w,
+                                      dst + (dy * dst_w) + dx, dst_w, w, h,
+                                      blend, merge_alpha, cm, op, rgb_src,
+                                      premul);
+        return;
+     }
    blender = __imlib_GetBlendFunction(op, blend, merge_alpha, rgb_src, cm);
    if (blender)
       blender(src + (sy * src_w) + sx, src_w,
@@ -1799,12 +2016,20 @@ __imlib_BlendImageToImage(ImlibImage * im_src, ImlibImage * im_dst,
                           int clx, int cly, int clw, int clh)
 {
    char                rgb_src = 0;
+   int                 premul;
 
    if (__imlib_LoadImageData(im_src))
       return;
    if (__imlib_LoadImageData(im_dst))
       return;
 
+   /* start heavy downscales from a smaller pyramid level */
+   if (aa && (ssw > abs(ddw) || ssh > abs(ddh)))
+      im_src = __imlib_MipmapSelect(im_src, &ssx, &ssy, &ssw, &ssh, ddw, ddh);
+
+   premul = (IMAGE_ALPHA_PREMUL(im_src) ? PREMUL_SRC : 0) |
+      (IMAGE_ALPHA_PREMUL(im_dst) ? PREMUL_DST : 0);
+
    if ((ssw == ddw) && (ssh == ddh))
      {
         if (!IMAGE_HAS_ALPHA(im_dst))
@@ -1836,7 +2061,8 @@ __imlib_BlendImageToImage(ImlibImage * im_src, ImlibImage * im_dst,
                                 im_dst->data, im_dst->w, im_dst->h,
                                 ssx, ssy,
                                 ddx, ddy,
-                                ddw, ddh, blend, merge_alpha, cm, op, rgb_src);
+                                ddw, ddh, blend, merge_alpha, cm, op, rgb_src,
+                                premul);
      }
    else
      {
@@ -1940,7 +2166,10 @@ __imlib_BlendImageToImage(ImlibImage * im_src, ImlibImage * im_dst,
              if (h < LINESIZE)
                 hh = h;
              /* scale the imagedata for this LINESIZE lines chunk of image */
-             if (aa)
+             if (aa >= SCALE_BICUBIC)
+                __imlib_ScaleFilterRGBA(scaleinfo, buf, dxx, dyy + y,
+                                        0, 0, dw, hh, dw, im_src->w);
+             else if (aa)
                {
                   if (IMAGE_HAS_ALPHA(im_src))
                      __imlib_ScaleAARGBA(scaleinfo, buf, dxx, dyy + y,
@@ -1956,7 +2185,8 @@ __imlib_BlendImageToImage(ImlibImage * im_src, ImlibImage * im_dst,
                                      im_dst->data, im_dst->w,
                                      im_dst->h,
                                      0, 0, dx, dy + y, dw, dh,
-                                     blend, merge_alpha, cm, op, rgb_src);
+                                     blend, merge_alpha, cm, op, rgb_src,
+                                     premul);
              h -= LINESIZE;
           }
         /* free up our buffers and point tables */
@@ -315,6 +315,38 @@ nc = (tmp | (-(tmp >> 8))) & (~(tmp >> 9));
 tmp = (cc) + (((c) - 127) << 1); \
 nc = (tmp | (-(tmp >> 8))) & (~(tmp >> 9));
 
+/*
+ * Premultiplied alpha
+ *
+ * With the color values already multiplied by alpha the "blend" version of
+ * the copy operation becomes, for all four channels:
+ *
+ *    nc = c + cc * (1 - alpha)
+ *
+ * which is one multiplication per channel and does not need the pow_lut
+ * correction for the destination alpha.  PREMUL_BLEND does this for two
+ * channels at a time in the 16 bit halves of a 32 bit value, rounding as
+ * BLEND_COLOR.  For valid premultiplied data (c <= alpha) the result is in
+ * the range [0, 255], saturation only guards against invalid data.
+ */
+
+#define MUL_COLOR(a, nc, c) \
+tmp = (c) * (a) + 0x80; \
+nc = (tmp + (tmp >> 8)) >> 8;
+
+#define PREMUL_BLEND_2(na, n2, c2, cc2) \
+n2 = (cc2) * (na); \
+n2 = ((n2 + ((n2 >> 8) & 0x00ff00ff) + 0x00800080) >> 8) & 0x00ff00ff; \
+n2 += (c2); \
+n2 = (n2 | (((n2 >> 8) & 0x00010001) * 0xff)) & 0x00ff00ff;
+
+#define PREMUL_BLEND(na, nc, c, cc) \
+{ DATA32 _rb, _ag; \
+PREMUL_BLEND_2(na, _rb, (c) & 0x00ff00ff, (cc) & 0x00ff00ff); \
+PREMUL_BLEND_2(na, _ag, ((c) >> 8) & 0x00ff00ff, ((cc) >> 8) & 0x00ff00ff); \
+nc = _rb | (_ag << 8); \
+}
+
 extern DATA8        pow_lut[256][256];
 
 #define BLEND_DST_ALPHA(r1, g1, b1, a1, dest) \
@@ -377,9 +409,20 @@ void                __imlib_BlendRGBAToData(DATA32 * src, int src_w, int src_h,
                                             int w, int h,
                                             char blend, char merge_alpha,
                                             ImlibColorModifier * cm, ImlibOp op,
-                                            char rgb_src);
+                                            char rgb_src, int premul);
 void                __imlib_build_pow_lut(void);
 
+/* __imlib_BlendRGBAToData() premul flags */
+#define PREMUL_SRC 1
+#define PREMUL_DST 2
+
+ImlibBlendFunction  __imlib_GetPremulBlendFunction(ImlibOp op, char blend,
+                                                   char merge_alpha,
+                                                   ImlibColorModifier * cm,
+                                                   int premul);
+void                __imlib_PremulData(DATA32 * data, int len);
+void                __imlib_UnpremulData(DATA32 * data, int len);
+
 /* *INDENT-OFF* */
 #ifdef DO_MMX_ASM
 void    __imlib_mmx_blend_rgba_to_rgb(DATA32 * src, int sw, DATA32 * dst, int dw,
@@ -0,0 +1,242 @@
+#include "common.h"
+
+#include <immintrin.h>
+#include <stdint.h>
+
+#include "asm_c.h"
+#include "blend.h"
+#include "blend_simd.h"
+#include "colormod.h"
+#include "span.h"
+
+/*
+ * SSE2 and AVX2 versions of the blend functions in blend.c.
+ *
+ * The kernels are written once (blend_simd_ops.h) in terms of the V_*
+ * operations and instantiated for both instruction sets. The AVX2 functions
+ * are compiled with the avx2 target attribute and only selected when the
+ * CPU supports it, so no special compiler flags are needed.
+ */
+
+#define CMOD_CHUNK 256
+
+/* map pixels through the color modifier, RGB sources get alpha 255 */
+static void
+__imlib_SimdCmodMap(DATA32 * dst, const DATA32 * src, int n,
+                    ImlibColorModifier * cm, int rgb_src)
+{
+   DATA8              *amod = cm->alpha_mapping, *rmod = cm->red_mapping,
+      *gmod = cm->green_mapping, *bmod = cm->blue_mapping;
+   DATA32              p;
+   int                 i;
+
+   for (i = 0; i < n; i++)
+     {
+        p = src[i];
+        dst[i] = (amod[rgb_src ? 0xff : p >> 24] << 24) |
+           (rmod[(p >> 16) & 0xff] << 16) |
+           (gmod[(p >> 8) & 0xff] << 8) | bmod[p & 0xff];
+     }
+}
+
+/* SSE2 */
+
+#define TARGET              __attribute__((target("sse2")))
+#define FN                  static inline TARGET
+#define F(name)             __imlib_sse2_##name
+#define N                   4
+#define V                   __m128i
+#define V_ALL               0xffff
+
+#define V_LOAD(p)           _mm_loadu_si128((const __m128i *)(p))
+#define V_STORE(p, v)       _mm_storeu_si128((__m128i *)(p), v)
+#define V_ZERO()            _mm_setzero_si128()
+#define V_SET16(x)          _mm_set1_epi16(x)
+#define V_SET32(x)          _mm_set1_epi32(x)
+#define V_AMASK()           _mm_set1_epi32(0xff000000)
+#define V_RGB16()           _mm_set1_epi64x(0x0000ffffffffffffLL)
+#define V_AND(a, b)         _mm_and_si128(a, b)
+#define V_ANDNOT(a, b)      _mm_andnot_si128(a, b)
+#define V_OR(a, b)          _mm_or_si128(a, b)
+#define V_ADD16(a, b)       _mm_add_epi16(a, b)
+#define V_SUB16(a, b)       _mm_sub_epi16(a, b)
+#define V_MULLO16(a, b)     _mm_mullo_epi16(a, b)
+#define V_MULHI16(a, b)     _mm_mulhi_epi16(a, b)
+#define V_SLLI16(a, n)      _mm_slli_epi16(a, n)
+#define V_SRLI16(a, n)      _mm_srli_epi16(a, n)
+#define V_SRAI16(a, n)      _mm_srai_epi16(a, n)
+#define V_ADD32(a, b)       _mm_add_epi32(a, b)
+#define V_SUB32(a, b)       _mm_sub_epi32(a, b)
+#define V_SLLI32(a, n)      _mm_slli_epi32(a, n)
+#define V_SRLI32(a, n)      _mm_srli_epi32(a, n)
+#define V_CVT32PS(a)        _mm_cvtepi32_ps(a)
+#define V_CVTTPS32(a)       _mm_cvttps_epi32(a)
+#define V_DIVPS(a, b)       _mm_div_ps(a, b)
+#define V_ADDS8(a, b)       _mm_adds_epu8(a, b)
+#define V_SUBS8(a, b)       _mm_subs_epu8(a, b)
+#define V_CMPEQ16(a, b)     _mm_cmpeq_epi16(a, b)
+#define V_CMPEQ32(a, b)     _mm_cmpeq_epi32(a, b)
+#define V_MOVEMASK8(a)      _mm_movemask_epi8(a)
+#define V_UNPACKLO8(a, b)   _mm_unpacklo_epi8(a, b)
+#define V_UNPACKHI8(a, b)   _mm_unpackhi_epi8(a, b)
+#define V_PACKUS16(a, b)    _mm_packus_epi16(a, b)
+#define V_SHUFFLE_ALPHA16(a) \
+   _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, 0xff), 0xff)
+#define COV_T               uint32_t
+#define V_COV32(m) \
+   _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(m), V_ZERO()), \
+                      V_ZERO())
+
+#include "blend_simd_ops.h"
+
+#undef TARGET
+#undef FN
+#undef F
+#undef N
+#undef V
+#undef V_ALL
+#undef V_LOAD
+#undef V_STORE
+#undef V_ZERO
+#undef V_SET16
+#undef V_SET32
+#undef V_AMASK
+#undef V_RGB16
+#undef V_AND
+#undef V_ANDNOT
+#undef V_OR
+#undef V_ADD16
+#undef V_SUB16
+#undef V_MULLO16
+#undef V_MULHI16
+#undef V_SLLI16
+#undef V_SRLI16
+#undef V_SRAI16
+#undef V_ADD32
+#undef V_SUB32
+#undef V_SLLI32
+#undef V_SRLI32
+#undef V_CVT32PS
+#undef V_CVTTPS32
+#undef V_DIVPS
+#undef V_ADDS8
+#undef V_SUBS8
+#undef V_CMPEQ16
+#undef V_CMPEQ32
+#undef V_MOVEMASK8
+#undef V_UNPACKLO8
+#undef V_UNPACKHI8
+#undef V_PACKUS16
+#undef V_SHUFFLE_ALPHA16
+#undef COV_T
+#undef V_COV32
+
+/* AVX2 */
+
+#define TARGET              __attribute__((target("avx2")))
+#define FN                  static inline TARGET
+#define F(name)             __imlib_avx2_##name
+#define N                   8
+#define V                   __m256i
+#define V_ALL               -1
+
+#define V_LOAD(p)           _mm256_loadu_si256((const __m256i *)(p))
+#define V_STORE(p, v)       _mm256_storeu_si256((__m256i *)(p), v)
+#define V_ZERO()            _mm256_setzero_si256()
+#define V_SET16(x)          _mm256_set1_epi16(x)
+#define V_SET32(x)          _mm256_set1_epi32(x)
+#define V_AMASK()           _mm256_set1_epi32(0xff000000)
+#define V_RGB16()           _mm256_set1_epi64x(0x0000ffffffffffffLL)
+#define V_AND(a, b)         _mm256_and_si256(a, b)
+#define V_ANDNOT(a, b)      _mm256_andnot_si256(a, b)
+#define V_OR(a, b)          _mm256_or_si256(a, b)
+#define V_ADD16(a, b)       _mm256_add_epi16(a, b)
+#define V_SUB16(a, b)       _mm256_sub_epi16(a, b)
+#define V_MULLO16(a, b)     _mm256_mullo_epi16(a, b)
+#define V_MULHI16(a, b)     _mm256_mulhi_epi16(a, b)
+#define V_SLLI16(a, n)      _mm256_slli_epi16(a, n)
+#define V_SRLI16(a, n)      _mm256_srli_epi16(a, n)
+#define V_SRAI16(a, n)      _mm256_srai_epi16(a, n)
+#define V_ADD32(a, b)       _mm256_add_epi32(a, b)
+#define V_SUB32(a, b)       _mm256_sub_epi32(a, b)
+#define V_SLLI32(a, n)      _mm256_slli_epi32(a, n)
+#define V_SRLI32(a, n)      _mm256_srli_epi32(a, n)
+#define V_CVT32PS(a)        _mm256_cvtepi32_ps(a)
+#define V_CVTTPS32(a)       _mm256_cvttps_epi32(a)
+#define V_DIVPS(a, b)       _mm256_div_ps(a, b)
+#define V_ADDS8(a, b)       _mm256_adds_epu8(a, b)
+#define V_SUBS8(a, b)       _mm256_subs_epu8(a, b)
+#define V_CMPEQ16(a, b)     _mm256_cmpeq_epi16(a, b)
+#define V_CMPEQ32(a, b)     _mm256_cmpeq_epi32(a, b)
+#define V_MOVEMASK8(a)      _mm256_movemask_epi8(a)
+#define V_UNPACKLO8(a, b)   _mm256_unpacklo_epi8(a, b)
+#define V_UNPACKHI8(a, b)   _mm256_unpackhi_epi8(a, b)
+#define V_PACKUS16(a, b)    _mm256_packus_epi16(a, b)
+#define V_SHUFFLE_ALPHA16(a) \
+   _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(a, 0xff), 0xff)
+#define COV_T               uint64_t
+#define V_COV32(m)          _mm256_cvtepu8_epi32(_mm_cvtsi64_si128(m))
+
+#include "blend_simd_ops.h"
+
+ImlibBlendFunction
+__imlib_GetBlendFunctionSimd(int simd, ImlibOp op, char blend,
+                             char merge_alpha, char rgb_src,
+                             ImlibColorModifier * cm)
+{
+   switch (simd)
+     {
+     default:
+        return NULL;
+     case SIMD_SSE2:
+        return
+           __imlib_sse2_blend_funcs[op][!!cm][!!merge_alpha][!!rgb_src][!!blend];
+     case SIMD_AVX2:
+        return
+           __imlib_avx2_blend_funcs[op][!!cm][!!merge_alpha][!!rgb_src][!!blend];
+     }
+}
+
+ImlibBlendFunction
+__imlib_GetPremulBlendFunctionSimd(int simd, char merge_alpha)
+{
+   switch (simd)
+     {
+     default:
+        return NULL;
+     case SIMD_SSE2:
+        return __imlib_sse2_premul_blend_funcs[!!merge_alpha];
+     case SIMD_AVX2:
+        return __imlib_avx2_premul_blend_funcs[!!merge_alpha];
+     }
+}
+
+ImlibSpanDrawFunction
+__imlib_GetSpanDrawFunctionSimd(int simd, ImlibOp op, char dst_alpha,
+                                char blend)
+{
+   switch (simd)
+     {
+     default:
+        return NULL;
+     case SIMD_SSE2:
+        return __imlib_sse2_span_funcs[op][!!dst_alpha][!!blend];
+     case SIMD_AVX2:
+        return __imlib_avx2_span_funcs[op][!!dst_alpha][!!blend];
+     }
+}
+
+ImlibShapedSpanDrawFunction
+__imlib_GetShapedSpanDrawFunctionSimd(int simd, ImlibOp op, char dst_alpha,
+                                      char blend)
+{
+   switch (simd)
+     {
+     default:
+        return NULL;
+     case SIMD_SSE2:
+        return __imlib_sse2_shaped_span_funcs[op][!!dst_alpha][!!blend];
+     case SIMD_AVX2:
+        return __imlib_avx2_shaped_span_funcs[op][!!dst_alpha][!!blend];
+     }
+}
@@ -0,0 +1,23 @@
+#ifndef __BLEND_SIMD
+#define __BLEND_SIMD 1
+
+#include "blend.h"
+#include "span.h"
+
+/* simd is one of the SIMD_* of asm_c.h, NULL is returned for SIMD_NONE */
+ImlibBlendFunction  __imlib_GetBlendFunctionSimd(int simd, ImlibOp op,
+                                                 char blend, char merge_alpha,
+                                                 char rgb_src,
+                                                 ImlibColorModifier * cm);
+ImlibBlendFunction  __imlib_GetPremulBlendFunctionSimd(int simd,
+                                                       char merge_alpha);
+ImlibSpanDrawFunction __imlib_GetSpanDrawFunctionSimd(int simd, ImlibOp op,
+                                                      char dst_alpha,
+                                                      char blend);
+ImlibShapedSpanDrawFunction __imlib_GetShapedSpanDrawFunctionSimd(int simd,
+                                                                  ImlibOp op,
+                                                                  char
+                                                                  dst_alpha,
+                                                                  char blend);
+
+#endif
@@ -0,0 +1,647 @@
+/*
+ * SIMD blend kernels - included by blend_simd.c once per instruction set.
+ *
+ * The includer defines:
+ *   F(name)   - Function name for the instruction set
+ *   FN        - Function attributes (static inline + target)
+ *   N         - Pixels per vector
+ *   V         - Vector type, and the V_* operations below
+ *
+ * Every kernel computes exactly what the C functions in blend.c compute.
+ * Pixels are widened to 16 bit lanes (two pixels per 128 bit lane) and the
+ * per channel arithmetic of the BLEND_COLOR etc. macros in blend.h is done
+ * in those lanes. The C functions special case alpha 0 and 255 - with the
+ * exception of reshade at alpha 255 the general formulas give identical
+ * results there, so those cases are only used to skip work.
+ */
+
+/* cc + ((c - cc) * f) / 255, as BLEND_COLOR */
+FN                  V
+F(blend16) (V c, V cc, V f)
+{
+   V                   d, lo, hi, q, r;
+
+   d = V_SUB16(c, cc);
+   lo = V_MULLO16(d, f);
+   hi = V_MULHI16(d, f);        /* 0 or -1 as |d * f| < 65536 */
+   q = V_OR(V_SLLI16(hi, 8), V_SRLI16(lo, 8));  /* tmp >> 8 */
+   r = V_AND(lo, V_SET16(0xff));        /* tmp & 0xff */
+   r = V_SRAI16(V_ADD16(V_ADD16(r, q), V_SET16(0x80)), 8);
+
+   return V_ADD16(cc, V_ADD16(q, r));
+}
+
+/* (c * f) / 255, as in ADD/SUB_COLOR_WITH_ALPHA */
+FN                  V
+F(mul16) (V c, V f)
+{
+   V                   t;
+
+   t = V_MULLO16(c, f);
+   t = V_ADD16(V_ADD16(t, V_SRLI16(t, 8)), V_SET16(0x80));
+
+   return V_SRLI16(t, 8);
+}
+
+/* source alpha in the color lanes, 0 in the alpha lane */
+FN                  V
+F(alpha16) (V s16)
+{
+   return V_AND(V_SHUFFLE_ALPHA16(s16), V_RGB16());
+}
+
+/* per pixel blend factors for RGBA destinations */
+/* color lanes: pow_lut[sa][da], alpha lane: sa */
+/* pow_lut is computed rather than looked up, the float division is exact
+ * for these operands, pow_lut[sa][255] is sa */
+FN                  V
+F(factors) (V s, V d)
+{
+   V                   sa, da, q, n;
+
+   sa = V_SRLI32(s, 24);
+   if (V_MOVEMASK8(V_CMPEQ32(V_AND(d, V_AMASK()), V_AMASK())) == V_ALL)
+     {
+        q = V_OR(sa, V_SLLI32(sa, 8));
+        return V_OR(q, V_SLLI32(q, 16));
+     }
+   da = V_SRLI32(d, 24);
+   /* da * (255 - sa) / 255 */
+   q = V_MULLO16(da, V_SUB32(V_SET32(255), sa));
+   q = V_SRLI32(V_ADD32(V_ADD32(q, V_SRLI32(q, 8)), V_SET32(1)), 8);
+   /* sa * 255 / (sa + q), 0 if sa is 0 */
+   q = V_ADD32(q, sa);
+   q = V_OR(q, V_AND(V_CMPEQ32(q, V_ZERO()), V_SET32(1)));
+   n = V_MULLO16(sa, V_SET32(255));
+   q = V_CVTTPS32(V_DIVPS(V_CVT32PS(n), V_CVT32PS(q)));
+
+   return V_OR(V_OR(V_SLLI32(sa, 24), V_SLLI32(q, 16)),
+               V_OR(V_SLLI32(q, 8), q));
+}
+
+/* alpha lanes of s are all 0 / all 255 */
+FN int
+F(alpha_none) (V s)
+{
+   return V_MOVEMASK8(V_CMPEQ32(V_AND(s, V_AMASK()), V_ZERO())) == V_ALL;
+}
+
+FN int
+F(alpha_full) (V s)
+{
+   return V_MOVEMASK8(V_CMPEQ32(V_AND(s, V_AMASK()), V_AMASK())) == V_ALL;
+}
+
+/* new destination alpha for RGBA blends, as BLEND_COLOR(sa, da, 255, da) */
+FN                  V
+F(blend_alpha) (V s, V d, V f)
+{
+   V                   s1, z, lo, hi;
+
+   z = V_ZERO();
+   s1 = V_OR(s, V_AMASK());
+   lo = F(blend16) (V_UNPACKLO8(s1, z), V_UNPACKLO8(d, z),
+                    V_UNPACKLO8(f, z));
+   hi = F(blend16) (V_UNPACKHI8(s1, z), V_UNPACKHI8(d, z),
+                    V_UNPACKHI8(f, z));
+
+   return V_AND(V_PACKUS16(lo, hi), V_AMASK());
+}
+
+/* COPY OPS */
+
+FN                  V
+F(copy_rgba_to_rgb) (V s, V d)
+{
+   return V_OR(V_AND(d, V_AMASK()), V_ANDNOT(V_AMASK(), s));
+}
+
+FN                  V
+F(copy_rgb_to_rgba) (V s, V d)
+{
+   return V_OR(s, V_AMASK());
+}
+
+FN                  V
+F(copy_rgba_to_rgba) (V s, V d)
+{
+   return s;
+}
+
+FN                  V
+F(blend_rgba_to_rgb) (V s, V d)
+{
+   V                   z, s16, lo, hi;
+
+   if (F(alpha_none) (s))
+      return d;
+   if (F(alpha_full) (s))
+      return F(copy_rgba_to_rgb) (s, d);
+
+   z = V_ZERO();
+   s16 = V_UNPACKLO8(s, z);
+   lo = F(blend16) (s16, V_UNPACKLO8(d, z), F(alpha16) (s16));
+   s16 = V_UNPACKHI8(s, z);
+   hi = F(blend16) (s16, V_UNPACKHI8(d, z), F(alpha16) (s16));
+
+   return V_PACKUS16(lo, hi);
+}
+
+FN                  V
+F(blend_rgba_to_rgba) (V s, V d)
+{
+   V                   z, f, s1, lo, hi;
+
+   if (F(alpha_none) (s))
+      return d;
+   if (F(alpha_full) (s))
+      return s;
+
+   z = V_ZERO();
+   f = F(factors) (s, d);
+   s1 = V_OR(s, V_AMASK());
+   lo = F(blend16) (V_UNPACKLO8(s1, z), V_UNPACKLO8(d, z),
+                    V_UNPACKLO8(f, z));
+   hi = F(blend16) (V_UNPACKHI8(s1, z), V_UNPACKHI8(d, z),
+                    V_UNPACKHI8(f, z));
+
+   return V_PACKUS16(lo, hi);
+}
+
+/* ADD/SUBTRACT OPS */
+
+#define ADDSUB_OPS(_op, _SAT8) \
+FN                  V \
+F(_op##_copy_rgba_to_rgb) (V s, V d) \
+{ \
+   return _SAT8(d, V_ANDNOT(V_AMASK(), s)); \
+} \
+\
+FN                  V \
+F(_op##_copy_rgba_to_rgba) (V s, V d) \
+{ \
+   return V_OR(V_ANDNOT(V_AMASK(), _SAT8(d, s)), V_AND(s, V_AMASK())); \
+} \
+\
+FN                  V \
+F(_op##_copy_rgb_to_rgba) (V s, V d) \
+{ \
+   return V_OR(_SAT8(d, s), V_AMASK()); \
+} \
+\
+FN                  V \
+F(_op##_blend_rgba_to_rgb) (V s, V d) \
+{ \
+   V                   z, s16, lo, hi; \
+\
+   if (F(alpha_none) (s)) \
+      return d; \
+   if (F(alpha_full) (s)) \
+      return F(_op##_copy_rgba_to_rgb) (s, d); \
+\
+   z = V_ZERO(); \
+   s16 = V_UNPACKLO8(s, z); \
+   lo = F(mul16) (s16, F(alpha16) (s16)); \
+   s16 = V_UNPACKHI8(s, z); \
+   hi = F(mul16) (s16, F(alpha16) (s16)); \
+\
+   return _SAT8(d, V_PACKUS16(lo, hi)); \
+} \
+\
+FN                  V \
+F(_op##_blend_rgba_to_rgba) (V s, V d) \
+{ \
+   V                   z, f, lo, hi; \
+\
+   if (F(alpha_none) (s)) \
+      return d; \
+   if (F(alpha_full) (s)) \
+      return F(_op##_copy_rgb_to_rgba) (s, d); \
+\
+   z = V_ZERO(); \
+   f = F(factors) (s, d); \
+   lo = F(mul16) (V_UNPACKLO8(s, z), V_UNPACKLO8(f, z)); \
+   hi = F(mul16) (V_UNPACKHI8(s, z), V_UNPACKHI8(f, z)); \
+\
+   return V_OR(V_ANDNOT(V_AMASK(), _SAT8(d, V_PACKUS16(lo, hi))), \
+               F(blend_alpha) (s, d, f)); \
+}
+
+ADDSUB_OPS(add, V_ADDS8)
+ADDSUB_OPS(subtract, V_SUBS8)
+#undef ADDSUB_OPS
+
+/* RESHADE OPS */
+
+/* d + ((s - 127) << 1) in the color lanes */
+FN                  V
+F(reshade_copy16) (V s16, V d16)
+{
+   V                   m;
+
+   m = V_SLLI16(V_SUB16(s16, V_SET16(127)), 1);
+
+   return V_ADD16(d16, V_AND(m, V_RGB16()));
+}
+
+/* d + (((s - 127) * f) >> 7) in the color lanes, f = 255 as copy */
+FN                  V
+F(reshade_blend16) (V s16, V d16, V f16, V sel)
+{
+   V                   c, m;
+
+   c = V_SUB16(s16, V_SET16(127));
+   m = V_SRAI16(V_MULLO16(c, f16), 7);
+   m = V_OR(V_AND(sel, V_SLLI16(c, 1)), V_ANDNOT(sel, m));
+
+   return V_ADD16(d16, V_AND(m, V_RGB16()));
+}
+
+FN                  V
+F(reshade_copy_rgba_to_rgb) (V s, V d)
+{
+   V                   z, lo, hi;
+
+   z = V_ZERO();
+   lo = F(reshade_copy16) (V_UNPACKLO8(s, z), V_UNPACKLO8(d, z));
+   hi = F(reshade_copy16) (V_UNPACKHI8(s, z), V_UNPACKHI8(d, z));
+
+   return V_PACKUS16(lo, hi);
+}
+
+FN                  V
+F(reshade_copy_rgba_to_rgba) (V s, V d)
+{
+   return V_OR(V_ANDNOT(V_AMASK(), F(reshade_copy_rgba_to_rgb) (s, d)),
+               V_AND(s, V_AMASK()));
+}
+
+FN                  V
+F(reshade_copy_rgb_to_rgba) (V s, V d)
+{
+   return V_OR(F(reshade_copy_rgba_to_rgb) (s, d), V_AMASK());
+}
+
+FN                  V
+F(reshade_blend_rgba_to_rgb) (V s, V d)
+{
+   V                   z, s16, a16, lo, hi;
+
+   if (F(alpha_none) (s))
+      return d;
+   if (F(alpha_full) (s))
+      return F(reshade_copy_rgba_to_rgb) (s, d);
+
+   z = V_ZERO();
+   s16 = V_UNPACKLO8(s, z);
+   a16 = V_SHUFFLE_ALPHA16(s16);
+   lo = F(reshade_blend16) (s16, V_UNPACKLO8(d, z), a16,
+                            V_CMPEQ16(a16, V_SET16(255)));
+   s16 = V_UNPACKHI8(s, z);
+   a16 = V_SHUFFLE_ALPHA16(s16);
+   hi = F(reshade_blend16) (s16, V_UNPACKHI8(d, z), a16,
+                            V_CMPEQ16(a16, V_SET16(255)));
+
+   return V_PACKUS16(lo, hi);
+}
+
+FN                  V
+F(reshade_blend_rgba_to_rgba) (V s, V d)
+{
+   V                   z, f, s16, lo, hi;
+
+   if (F(alpha_none) (s))
+      return d;
+   if (F(alpha_full) (s))
+      return F(reshade_copy_rgb_to_rgba) (s, d);
+
+   z = V_ZERO();
+   f = F(factors) (s, d);
+   s16 = V_UNPACKLO8(s, z);
+   lo = F(reshade_blend16) (s16, V_UNPACKLO8(d, z), V_UNPACKLO8(f, z),
+                            V_CMPEQ16(V_SHUFFLE_ALPHA16(s16), V_SET16(255)));
+   s16 = V_UNPACKHI8(s, z);
+   hi = F(reshade_blend16) (s16, V_UNPACKHI8(d, z), V_UNPACKHI8(f, z),
+                            V_CMPEQ16(V_SHUFFLE_ALPHA16(s16), V_SET16(255)));
+
+   return V_OR(V_ANDNOT(V_AMASK(), V_PACKUS16(lo, hi)),
+               F(blend_alpha) (s, d, f));
+}
+
+/* the span functions in span.c blend a color with alpha 255 too */
+FN                  V
+F(reshade_span_blend_rgba_to_rgb) (V s, V d)
+{
+   V                   z, s16, lo, hi;
+
+   if (F(alpha_none) (s))
+      return d;
+
+   z = V_ZERO();
+   s16 = V_UNPACKLO8(s, z);
+   lo = F(reshade_blend16) (s16, V_UNPACKLO8(d, z), V_SHUFFLE_ALPHA16(s16), z);
+   s16 = V_UNPACKHI8(s, z);
+   hi = F(reshade_blend16) (s16, V_UNPACKHI8(d, z), V_SHUFFLE_ALPHA16(s16), z);
+
+   return V_PACKUS16(lo, hi);
+}
+
+FN                  V
+F(reshade_span_blend_rgba_to_rgba) (V s, V d)
+{
+   V                   z, f, lo, hi;
+
+   if (F(alpha_none) (s))
+      return d;
+
+   z = V_ZERO();
+   f = F(factors) (s, d);
+   lo = F(reshade_blend16) (V_UNPACKLO8(s, z), V_UNPACKLO8(d, z),
+                            V_UNPACKLO8(f, z), z);
+   hi = F(reshade_blend16) (V_UNPACKHI8(s, z), V_UNPACKHI8(d, z),
+                            V_UNPACKHI8(f, z), z);
+
+   return V_OR(V_ANDNOT(V_AMASK(), V_PACKUS16(lo, hi)),
+               F(blend_alpha) (s, d, f));
+}
+
+/* PREMULTIPLIED ALPHA */
+
+/* s + (d * (255 - sa)) / 255 in all lanes, as PREMUL_BLEND */
+FN                  V
+F(premul_blend) (V s, V d)
+{
+   V                   z, s16, lo, hi, keep;
+
+   z = V_ZERO();
+   s16 = V_UNPACKLO8(s, z);
+   lo = V_ADD16(s16, F(mul16) (V_UNPACKLO8(d, z),
+                               V_SUB16(V_SET16(255), V_SHUFFLE_ALPHA16(s16))));
+   s16 = V_UNPACKHI8(s, z);
+   hi = V_ADD16(s16, F(mul16) (V_UNPACKHI8(d, z),
+                               V_SUB16(V_SET16(255), V_SHUFFLE_ALPHA16(s16))));
+
+   /* transparent source pixels leave the destination alone */
+   keep = V_CMPEQ32(V_AND(s, V_AMASK()), z);
+
+   return V_OR(V_AND(keep, d), V_ANDNOT(keep, V_PACKUS16(lo, hi)));
+}
+
+FN                  V
+F(premul_blend_rgba_to_rgb) (V s, V d)
+{
+   if (F(alpha_none) (s))
+      return d;
+   if (F(alpha_full) (s))
+      return F(copy_rgba_to_rgb) (s, d);
+
+   return V_OR(V_AND(d, V_AMASK()), V_ANDNOT(V_AMASK(), F(premul_blend) (s, d)));
+}
+
+FN                  V
+F(premul_blend_rgba_to_rgba) (V s, V d)
+{
+   if (F(alpha_none) (s))
+      return d;
+   if (F(alpha_full) (s))
+      return s;
+
+   return F(premul_blend) (s, d);
+}
+
+/* Row and rectangle functions */
+
+#define ROW_RECT(_op) \
+FN void \
+F(_op##_row) (const DATA32 * s, DATA32 * d, int n) \
+{ \
+   DATA32              sv[N], dv[N]; \
+\
+   for (; n >= N; n -= N, s += N, d += N) \
+      V_STORE(d, F(_op) (V_LOAD(s), V_LOAD(d))); \
+   if (n <= 0) \
+      return; \
+   memset(sv, 0, sizeof(sv)); \
+   memset(dv, 0, sizeof(dv)); \
+   memcpy(sv, s, n * sizeof(DATA32)); \
+   memcpy(dv, d, n * sizeof(DATA32)); \
+   V_STORE(dv, F(_op) (V_LOAD(sv), V_LOAD(dv))); \
+   memcpy(d, dv, n * sizeof(DATA32)); \
+} \
+\
+TARGET static void \
+F(_op##_rect) (DATA32 * src, int srcw, DATA32 * dst, int dstw, \
+               int w, int h, ImlibColorModifier * cm) \
+{ \
+   for (; h > 0; h--, src += srcw, dst += dstw) \
+      F(_op##_row) (src, dst, w); \
+}
+
+/* source mapped through the color modifier in chunks, then as RGBA */
+#define CMOD_RECT(_op, _name, _rgb_src) \
+TARGET static void \
+F(_name) (DATA32 * src, int srcw, DATA32 * dst, int dstw, \
+          int w, int h, ImlibColorModifier * cm) \
+{ \
+   DATA32              buf[CMOD_CHUNK]; \
+   int                 x, n; \
+\
+   for (; h > 0; h--, src += srcw, dst += dstw) \
+      for (x = 0; x < w; x += n) \
+        { \
+           n = (w - x < CMOD_CHUNK) ? w - x : CMOD_CHUNK; \
+           __imlib_SimdCmodMap(buf, src + x, n, cm, _rgb_src); \
+           F(_op##_row) (buf, dst + x, n); \
+        } \
+}
+
+#define OPS(_pfx) \
+ROW_RECT(_pfx##copy_rgba_to_rgb) \
+ROW_RECT(_pfx##copy_rgba_to_rgba) \
+ROW_RECT(_pfx##copy_rgb_to_rgba) \
+ROW_RECT(_pfx##blend_rgba_to_rgb) \
+ROW_RECT(_pfx##blend_rgba_to_rgba) \
+CMOD_RECT(_pfx##copy_rgba_to_rgb, _pfx##copy_rgba_to_rgb_cmod, 0) \
+CMOD_RECT(_pfx##copy_rgba_to_rgba, _pfx##copy_rgba_to_rgba_cmod, 0) \
+CMOD_RECT(_pfx##blend_rgba_to_rgb, _pfx##blend_rgba_to_rgb_cmod, 0) \
+CMOD_RECT(_pfx##blend_rgba_to_rgba, _pfx##blend_rgba_to_rgba_cmod, 0) \
+CMOD_RECT(_pfx##copy_rgba_to_rgba, _pfx##copy_rgb_to_rgba_cmod, 1) \
+CMOD_RECT(_pfx##blend_rgba_to_rgb, _pfx##blend_rgb_to_rgb_cmod, 1) \
+CMOD_RECT(_pfx##blend_rgba_to_rgba, _pfx##blend_rgb_to_rgba_cmod, 1)
+
+OPS()
+OPS(add_)
+OPS(subtract_)
+OPS(reshade_)
+#undef OPS
+ROW_RECT(premul_blend_rgba_to_rgb)
+ROW_RECT(premul_blend_rgba_to_rgba)
+#undef ROW_RECT
+#undef CMOD_RECT
+
+/*
+ * Span functions, see span.c - the source is one color, for shaped spans
+ * with its alpha multiplied by the coverage bytes. Blocks of N coverage
+ * bytes that are all 0 are skipped, all 255 use the color as is.
+ */
+
+/* coverage lanes to alpha, as MULT() in span.c */
+FN                  V
+F(cov_alpha) (V cov, V ca)
+{
+   V                   t;
+
+   t = V_ADD32(V_MULLO16(cov, ca), V_SET32(0x80));
+   t = V_SRLI32(V_ADD32(t, V_SRLI32(t, 8)), 8);
+
+   return V_SLLI32(t, 24);
+}
+
+#define SPAN(_op) \
+TARGET static void \
+F(_op##_span) (DATA32 color, DATA32 * dst, int len) \
+{ \
+   V                   s; \
+   DATA32              dv[N]; \
+\
+   s = V_SET32(color); \
+   for (; len >= N; len -= N, dst += N) \
+      V_STORE(dst, F(_op) (s, V_LOAD(dst))); \
+   if (len <= 0) \
+      return; \
+   memset(dv, 0, sizeof(dv)); \
+   memcpy(dv, dst, len * sizeof(DATA32)); \
+   V_STORE(dv, F(_op) (s, V_LOAD(dv))); \
+   memcpy(dst, dv, len * sizeof(DATA32)); \
+}
+
+#define SHAPED_SPAN(_op) \
+FN                  V \
+F(_op##_shaped) (COV_T m, V s, V c, V ca, V d) \
+{ \
+   V                   cov, keep; \
+\
+   if (m == (COV_T) - 1) \
+      return F(_op) (s, d); \
+   cov = V_COV32(m); \
+   keep = V_CMPEQ32(cov, V_ZERO()); \
+   s = V_OR(c, F(cov_alpha) (cov, ca)); \
+\
+   return V_OR(V_AND(keep, d), V_ANDNOT(keep, F(_op) (s, d))); \
+} \
+\
+TARGET static void \
+F(_op##_shaped_span) (DATA8 * src, DATA32 color, DATA32 * dst, int len) \
+{ \
+   V                   s, c, ca; \
+   COV_T               m; \
+   DATA32              dv[N]; \
+\
+   s = V_SET32(color); \
+   c = V_SET32(color & 0x00ffffff); \
+   ca = V_SET32(color >> 24); \
+   for (; len >= N; len -= N, src += N, dst += N) \
+     { \
+        memcpy(&m, src, N); \
+        if (m) \
+           V_STORE(dst, F(_op##_shaped) (m, s, c, ca, V_LOAD(dst))); \
+     } \
+   if (len <= 0) \
+      return; \
+   m = 0; \
+   memcpy(&m, src, len); \
+   if (!m) \
+      return; \
+   memset(dv, 0, sizeof(dv)); \
+   memcpy(dv, dst, len * sizeof(DATA32)); \
+   V_STORE(dv, F(_op##_shaped) (m, s, c, ca, V_LOAD(dv))); \
+   memcpy(dst, dv, len * sizeof(DATA32)); \
+}
+
+#define SPANS(_pfx) \
+SPAN(_pfx##copy_rgba_to_rgb) \
+SPAN(_pfx##copy_rgba_to_rgba) \
+SHAPED_SPAN(_pfx##copy_rgba_to_rgb) \
+SHAPED_SPAN(_pfx##copy_rgba_to_rgba) \
+SHAPED_SPAN(_pfx##blend_rgba_to_rgb) \
+SHAPED_SPAN(_pfx##blend_rgba_to_rgba)
+
+SPANS()
+SPANS(add_)
+SPANS(subtract_)
+SPANS(reshade_)
+SPAN(blend_rgba_to_rgb)
+SPAN(blend_rgba_to_rgba)
+SPAN(add_blend_rgba_to_rgb)
+SPAN(add_blend_rgba_to_rgba)
+SPAN(subtract_blend_rgba_to_rgb)
+SPAN(subtract_blend_rgba_to_rgba)
+SPAN(reshade_span_blend_rgba_to_rgb)
+SPAN(reshade_span_blend_rgba_to_rgba)
+#undef SPANS
+#undef SPAN
+#undef SHAPED_SPAN
+
+#define S(_op) F(_op##_span)
+#define SS(_op) F(_op##_shaped_span)
+
+/*\ [ operation ][ dst_alpha ][ blend ] \*/
+static const ImlibSpanDrawFunction F(span_funcs)[4][2][2] = {
+#define OP_SPANS(_pfx, _blend_pfx) \
+   {{S(_pfx##copy_rgba_to_rgb), S(_blend_pfx##blend_rgba_to_rgb)}, \
+    {S(_pfx##copy_rgba_to_rgba), S(_blend_pfx##blend_rgba_to_rgba)}}
+   OP_SPANS(,),                 /* OP_COPY */
+   OP_SPANS(add_, add_),        /* OP_ADD */
+   OP_SPANS(subtract_, subtract_),      /* OP_SUBTRACT */
+   OP_SPANS(reshade_, reshade_span_),   /* OP_RESHADE */
+#undef OP_SPANS
+};
+
+/*\ [ operation ][ dst_alpha ][ blend ] \*/
+static const ImlibShapedSpanDrawFunction F(shaped_span_funcs)[4][2][2] = {
+#define OP_SPANS(_pfx) \
+   {{SS(_pfx##copy_rgba_to_rgb), SS(_pfx##blend_rgba_to_rgb)}, \
+    {SS(_pfx##copy_rgba_to_rgba), SS(_pfx##blend_rgba_to_rgba)}}
+   OP_SPANS(),                  /* OP_COPY */
+   OP_SPANS(add_),              /* OP_ADD */
+   OP_SPANS(subtract_),         /* OP_SUBTRACT */
+   OP_SPANS(reshade_),          /* OP_RESHADE */
+#undef OP_SPANS
+};
+
+#undef S
+#undef SS
+
+/*
+ * The functions for RGB sources are the same as in blend.c (see the
+ * "Equivalent functions" there). With a color modifier an RGB source has
+ * its alpha mapped from 255 and is then handled as RGBA.
+ */
+#define R(_op) F(_op##_rect)
+#define C(_op) F(_op##_cmod)
+
+/*\ [ operation ][ cmod ][ merge_alpha ][ rgb_src ][ blend ] \*/
+static const ImlibBlendFunction F(blend_funcs)[4][2][2][2][2] = {
+#define OP_FUNCS(_pfx, _rgb_to_rgb) \
+   {{{{R(_pfx##copy_rgba_to_rgb), R(_pfx##blend_rgba_to_rgb)}, \
+      {R(_rgb_to_rgb), R(_rgb_to_rgb)}}, \
+     {{R(_pfx##copy_rgba_to_rgba), R(_pfx##blend_rgba_to_rgba)}, \
+      {R(_pfx##copy_rgb_to_rgba), R(_pfx##copy_rgb_to_rgba)}}}, \
+    {{{C(_pfx##copy_rgba_to_rgb), C(_pfx##blend_rgba_to_rgb)}, \
+      {C(_pfx##copy_rgba_to_rgb), C(_pfx##blend_rgb_to_rgb)}}, \
+     {{C(_pfx##copy_rgba_to_rgba), C(_pfx##blend_rgba_to_rgba)}, \
+      {C(_pfx##copy_rgb_to_rgba), C(_pfx##blend_rgb_to_rgba)}}}}
+   OP_FUNCS(, copy_rgb_to_rgba),        /* OP_COPY */
+   OP_FUNCS(add_, add_copy_rgba_to_rgb),        /* OP_ADD */
+   OP_FUNCS(subtract_, subtract_copy_rgba_to_rgb),      /* OP_SUBTRACT */
+   OP_FUNCS(reshade_, reshade_copy_rgba_to_rgb),        /* OP_RESHADE */
+#undef OP_FUNCS
+};
+
+/*\ [ merge_alpha ] \*/
+static const ImlibBlendFunction F(premul_blend_funcs)[2] = {
+   R(premul_blend_rgba_to_rgb), R(premul_blend_rgba_to_rgba)
+};
+
+#undef R
+#undef C
@@ -0,0 +1,420 @@
+#include "common.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "debug.h"
+#include "disk_cache.h"
+#include "image.h"
+#include "loaders.h"
+
+#define DBG_PFX "DCACHE"
+#define DP(fmt...) DC(DBG_LOAD, fmt)
+
+/*
+ * Persistent cache of decoded images.
+ *
+ * Each entry is one file, <dir>/<hash>.imc, where hash is taken from the
+ * canonical source path (plus key and frame). The file holds a header,
+ * the source identity, format and loader, and the pixels in native DATA32
+ * layout, so a hit is just a private mmap of the file. Entries are validated against the
+ * source modification date and size, a changed source simply gets its
+ * entry overwritten.
+ * Hits touch the entry's mtime, and the total size is bounded by removing
+ * the least recently used entries while holding an flock() on <dir>/.lock,
+ * so several processes can share one cache directory. Temporary files left
+ * behind by writers that died are removed then too.
+ * Trimming scans the directory, so it is not done on every store, but when
+ * our running estimate of the cache size exceeds the budget, and every
+ * DC_TRIM_STORES stores to catch up with what other processes added.
+ */
+
+#define DC_MAGIC "imlibdc2"
+#define DC_BOM   0x01020304
+#define DC_EXT   ".imc"
+#define DC_TMP   ".tmp-"
+#define DC_TMP_AGE 3600         /* Seconds before a temporary file is stale */
+#define DC_TRIM_STORES 64       /* Stores between unconditional trims */
+
+typedef struct {
+   char                magic[8];
+   uint32_t            bom;     /* Byte order (data is native) */
+   uint32_t            w, h;
+   uint32_t            flags;   /* F_HAS_ALPHA */
+   int32_t             frame;
+   uint32_t            ident_len;       /* Source identity, incl. NUL */
+   uint32_t            format_len;      /* Format name, incl. NUL */
+   uint32_t            loader_len;      /* Loader (first format), incl. NUL */
+   uint32_t            data_offset;     /* Pixel data, 16-byte aligned */
+   int64_t             moddate;
+   int64_t             fsize;
+} dc_hdr_t;
+
+typedef struct {
+   char               *name;
+   off_t               size;
+   struct timespec     mtime;
+} dc_entry_t;
+
+static char        *dc_path = NULL;
+static int          dc_size = 64 * 1024 * 1024;
+static off_t        dc_used = -1;       /* Estimated total, -1: unknown */
+static int          dc_stores = 0;      /* Stores since the last trim */
+
+void
+__imlib_DiskCacheSetPath(const char *path)
+{
+   free(dc_path);
+   dc_path = (path && path[0]) ? strdup(path) : NULL;
+   dc_used = -1;
+}
+
+const char         *
+__imlib_DiskCacheGetPath(void)
+{
+   return dc_path;
+}
+
+void
+__imlib_DiskCacheSetSize(int size)
+{
+   dc_size = size;
+}
+
+int
+__imlib_DiskCacheGetSize(void)
+{
+   return dc_size;
+}
+
+/* the identity of the image source - canonical path, key, frame and
+ * requested size */
+static char        *
+__imlib_DiskCacheIdent(ImlibImage * im)
+{
+   char               *path, *ident;
+   size_t              len;
+
+   path = realpath(im->real_file, NULL);
+   if (!path)
+      path = strdup(im->real_file);
+   if (!path)
+      return NULL;
+
+   len = strlen(path) + (im->key ? strlen(im->key) : 0) + 40;
+   ident = malloc(len);
+   if (ident && (im->load_w || im->load_h))
+      snprintf(ident, len, "%s\n%s\n%d\n%dx%d", path, im->key ? im->key : "",
+               im->frame_num, im->load_w, im->load_h);
+   else if (ident)
+      snprintf(ident, len, "%s\n%s\n%d", path, im->key ? im->key : "",
+               im->frame_num);
+   free(path);
+
+   return ident;
+}
+
+static void
+__imlib_DiskCacheFile(char *buf, size_t len, const char *ident)
+{
+   const unsigned char *p;
+   uint64_t            h = 0xcbf29ce484222325ULL;       /* FNV-1a */
+
+   for (p = (const unsigned char *)ident; *p; p++)
+      h = (h ^ *p) * 0x100000001b3ULL;
+
+   snprintf(buf, len, "%s/%016llx" DC_EXT, dc_path, (unsigned long long)h);
+}
+
+int
+__imlib_DiskCacheLoad(ImlibImage * im)
+{
+   char                file[PATH_MAX], *ident, *names = NULL;
+   int                 fd, ok = 0;
+   struct stat         st;
+   dc_hdr_t            hdr;
+   size_t              pgmask, off, names_len;
+   void               *map;
+   ImlibLoader        *loader;
+
+   if (!dc_path || !im->real_file)
+      return 0;
+
+   ident = __imlib_DiskCacheIdent(im);
+   if (!ident)
+      return 0;
+   __imlib_DiskCacheFile(file, sizeof(file), ident);
+
+   fd = open(file, O_RDONLY);
+   if (fd < 0)
+      goto quit;
+
+   if (fstat(fd, &st) ||
+       pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr))
+      goto quit;
+
+   if (memcmp(hdr.magic, DC_MAGIC, sizeof(hdr.magic)) || hdr.bom != DC_BOM)
+      goto quit;
+   if (hdr.moddate != (int64_t) im->moddate ||
+       hdr.fsize != (int64_t) im->fsize || hdr.frame != im->frame_num)
+      goto quit;
+   if (!IMAGE_DIMENSIONS_OK(hdr.w, hdr.h) || hdr.ident_len > PATH_MAX + 64 ||
+       hdr.format_len > 256 || hdr.loader_len > 256 ||
+       (hdr.data_offset & 15) ||
+       hdr.data_offset < sizeof(hdr) + hdr.ident_len + hdr.format_len +
+       hdr.loader_len ||
+       st.st_size != (off_t) hdr.data_offset + 4 * hdr.w * hdr.h)
+      goto quit;
+
+   /* guard against hash collisions */
+   names_len = hdr.ident_len + hdr.format_len + hdr.loader_len;
+   names = malloc(names_len);
+   if (!names ||
+       pread(fd, names, names_len, sizeof(hdr)) != (ssize_t) names_len)
+      goto quit;
+   if (hdr.ident_len == 0 || hdr.format_len == 0 || hdr.loader_len == 0 ||
+       names[hdr.ident_len - 1] != '\0' ||
+       names[hdr.ident_len + hdr.format_len - 1] != '\0' ||
+       names[names_len - 1] != '\0' || strcmp(names, ident))
+      goto quit;
+
+   /* the loader is needed for saving without a format and for reloading,
+    * an entry from a loader we don't have is decoded again */
+   loader = __imlib_FindBestLoaderForFormat(names + hdr.ident_len +
+                                            hdr.format_len, 0);
+   if (!loader)
+      goto quit;
+
+   /* map from the page holding the first pixel */
+   pgmask = sysconf(_SC_PAGESIZE) - 1;
+   off = hdr.data_offset & ~pgmask;
+   map = mmap(NULL, st.st_size - off, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+              fd, off);
+   if (map == MAP_FAILED)
+      goto quit;
+
+   im->w = hdr.w;
+   im->h = hdr.h;
+   UPDATE_FLAG(im->flags, F_HAS_ALPHA, hdr.flags & F_HAS_ALPHA);
+   free(im->format);
+   im->format = strdup(names + hdr.ident_len);
+   im->loader = loader;
+   __imlib_SetMappedData(im, map, hdr.data_offset - off);
+
+   /* mark as recently used */
+   futimens(fd, NULL);
+
+   DP("%s: hit '%s' -> %s\n", __func__, im->real_file, file);
+   ok = 1;
+
+ quit:
+   if (fd >= 0)
+      close(fd);
+   free(names);
+   free(ident);
+
+   return ok;
+}
+
+static int
+__imlib_DiskCacheWrite(int fd, const void *data, size_t len)
+{
+   const char         *p = data;
+   ssize_t             n;
+
+   while (len > 0)
+     {
+        n = write(fd, p, len);
+        if (n < 0)
+          {
+             if (errno == EINTR)
+                continue;
+             return 1;
+          }
+        p += n;
+        len -= n;
+     }
+
+   return 0;
+}
+
+static int
+__imlib_DiskCacheEntryCmp(const void *a, const void *b)
+{
+   const dc_entry_t   *ea = a, *eb = b;
+
+   if (ea->mtime.tv_sec != eb->mtime.tv_sec)
+      return (ea->mtime.tv_sec > eb->mtime.tv_sec) ? 1 : -1;
+   return (ea->mtime.tv_nsec > eb->mtime.tv_nsec) -
+      (ea->mtime.tv_nsec < eb->mtime.tv_nsec);
+}
+
+/* remove least recently used entries until the cache fits dc_size, and
+ * stale temporary files */
+static void
+__imlib_DiskCacheTrim(void)
+{
+   char                file[PATH_MAX];
+   int                 fd, i, n = 0, nalloc = 0;
+   DIR                *dir;
+   struct dirent      *de;
+   struct stat         st;
+   dc_entry_t         *ents = NULL, *tmp;
+   off_t               total = 0;
+   size_t              len;
+   time_t              now;
+
+   snprintf(file, sizeof(file), "%s/.lock", dc_path);
+   fd = open(file, O_RDWR | O_CREAT, 0600);
+   if (fd < 0)
+      return;
+   if (flock(fd, LOCK_EX))
+      goto quit;
+
+   dir = opendir(dc_path);
+   if (!dir)
+      goto quit;
+
+   now = time(NULL);
+   while ((de = readdir(dir)))
+     {
+        if (!strncmp(de->d_name, DC_TMP, sizeof(DC_TMP) - 1))
+          {
+             /* recent ones may still be written to */
+             if (!fstatat(dirfd(dir), de->d_name, &st, 0) &&
+                 st.st_mtime < now - DC_TMP_AGE)
+               {
+                  DP("%s: remove stale %s\n", __func__, de->d_name);
+                  unlinkat(dirfd(dir), de->d_name, 0);
+               }
+             continue;
+          }
+        len = strlen(de->d_name);
+        if (len <= sizeof(DC_EXT) - 1 ||
+            strcmp(de->d_name + len - (sizeof(DC_EXT) - 1), DC_EXT))
+           continue;
+        if (fstatat(dirfd(dir), de->d_name, &st, 0))
+           continue;
+        if (n >= nalloc)
+          {
+             nalloc = nalloc ? 2 * nalloc : 64;
+             tmp = realloc(ents, nalloc * sizeof(dc_entry_t));
+             if (!tmp)
+                break;
+             ents = tmp;
+          }
+        ents[n].name = strdup(de->d_name);
+        ents[n].size = st.st_size;
+        ents[n].mtime = st.st_mtim;
+        total += st.st_size;
+        n++;
+     }
+   closedir(dir);
+
+   if (total > dc_size)
+     {
+        qsort(ents, n, sizeof(dc_entry_t), __imlib_DiskCacheEntryCmp);
+        for (i = 0; i < n && total > dc_size; i++)
+          {
+             snprintf(file, sizeof(file), "%s/%s", dc_path, ents[i].name);
+             DP("%s: evict %s\n", __func__, file);
+             if (!unlink(file))
+                total -= ents[i].size;
+          }
+     }
+   dc_used = total;
+
+   for (i = 0; i < n; i++)
+      free(ents[i].name);
+   free(ents);
+
+ quit:
+   close(fd);                   /* Releases the lock */
+}
+
+void
+__imlib_DiskCacheStore(ImlibImage * im)
+{
+   char                file[PATH_MAX], tmp[PATH_MAX], *ident;
+   static const char   zeros[16];
+   const char         *format, *loader;
+   dc_hdr_t            hdr;
+   size_t              size;
+   int                 fd, err;
+
+   if (!dc_path || !im->real_file || !im->data || im->frame_count > 1)
+      return;
+
+   size = (size_t)im->w * im->h * sizeof(DATA32);
+   if (size > (size_t)dc_size)
+      return;
+
+   ident = __imlib_DiskCacheIdent(im);
+   if (!ident)
+      return;
+   __imlib_DiskCacheFile(file, sizeof(file), ident);
+   format = im->format ? im->format : "";
+   loader = im->loader && im->loader->formats ? im->loader->formats[0] : "";
+
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, DC_MAGIC, sizeof(hdr.magic));
+   hdr.bom = DC_BOM;
+   hdr.w = im->w;
+   hdr.h = im->h;
+   hdr.flags = im->flags & F_HAS_ALPHA;
+   hdr.frame = im->frame_num;
+   hdr.ident_len = strlen(ident) + 1;
+   hdr.format_len = strlen(format) + 1;
+   hdr.loader_len = strlen(loader) + 1;
+   hdr.data_offset = (sizeof(hdr) + hdr.ident_len + hdr.format_len +
+                      hdr.loader_len + 15) & ~15;
+   hdr.moddate = im->moddate;
+   hdr.fsize = im->fsize;
+
+   mkdir(dc_path, 0700);
+
+   /* write to a temporary file and rename so readers never see a partial
+    * entry */
+   snprintf(tmp, sizeof(tmp), "%s/" DC_TMP "XXXXXX", dc_path);
+   fd = mkstemp(tmp);
+   if (fd < 0)
+      goto quit;
+
+   err = __imlib_DiskCacheWrite(fd, &hdr, sizeof(hdr)) ||
+      __imlib_DiskCacheWrite(fd, ident, hdr.ident_len) ||
+      __imlib_DiskCacheWrite(fd, format, hdr.format_len) ||
+      __imlib_DiskCacheWrite(fd, loader, hdr.loader_len) ||
+      __imlib_DiskCacheWrite(fd, zeros, hdr.data_offset - sizeof(hdr) -
+                             hdr.ident_len - hdr.format_len -
+                             hdr.loader_len) ||
+      __imlib_DiskCacheWrite(fd, im->data, size);
+   err |= close(fd);
+
+   if (err || rename(tmp, file))
+     {
+        unlink(tmp);
+        goto quit;
+     }
+
+   DP("%s: stored '%s' -> %s\n", __func__, im->real_file, file);
+
+   /* an overwritten entry is counted twice until the next trim */
+   if (dc_used >= 0)
+      dc_used += hdr.data_offset + size;
+   if (dc_used < 0 || dc_used > dc_size || ++dc_stores >= DC_TRIM_STORES)
+     {
+        dc_stores = 0;
+        __imlib_DiskCacheTrim();
+     }
+
+ quit:
+   free(ident);
+}
@@ -0,0 +1,15 @@
+#ifndef __DISK_CACHE
+#define __DISK_CACHE 1
+
+#include "common.h"
+#include "image.h"
+
+void                __imlib_DiskCacheSetPath(const char *path);
+const char         *__imlib_DiskCacheGetPath(void);
+void                __imlib_DiskCacheSetSize(int size);
+int                 __imlib_DiskCacheGetSize(void);
+
+int                 __imlib_DiskCacheLoad(ImlibImage * im);
+void                __imlib_DiskCacheStore(ImlibImage * im);
+
+#endif
@@ -0,0 +1,271 @@
+#include "common.h"
+
+#include "blend.h"
+#include "image.h"
+#include "rgbadraw.h"
+#include "span.h"
+#include "threads.h"
+
+/*
+ * Draw lists - batches of points, lines, rectangles and ellipses drawn
+ * with the same color, operation and clip rectangle.
+ *
+ * The items are binned into bands of rows small enough to stay in cache,
+ * then the bands are drawn one after another (or in parallel), each band
+ * drawing its items in list order with the clip rectangle narrowed to the
+ * band. As all primitives clip exactly, and every pixel sees the items
+ * covering it in the original order, the result is identical to drawing
+ * the items one by one.
+ */
+
+#define DL_BAND_SIZE    (256 * 1024)    /* Target band size in bytes */
+#define DL_BAND_ROWS    8       /* Minimum band height */
+#define DL_MT_ITEMS     4096    /* Minimum binned items for threading */
+
+typedef struct {
+   const ImlibDrawList *dl;
+   const int          *start;   /* Items of band i: idx[start[i]..start[i+1]] */
+   const int          *idx;
+   int                 band_h;
+   DATA32              color;
+   ImlibImage         *im;
+   int                 clx, cly, clw, clh;
+   ImlibOp             op;
+   char                blend, anti_alias;
+} ImlibDrawListRun;
+
+ImlibDrawList      *
+__imlib_DrawListNew(void)
+{
+   return calloc(1, sizeof(ImlibDrawList));
+}
+
+void
+__imlib_DrawListFree(ImlibDrawList * dl)
+{
+   free(dl->items);
+   free(dl);
+}
+
+void
+__imlib_DrawListClear(ImlibDrawList * dl)
+{
+   dl->num = 0;
+}
+
+void
+__imlib_DrawListAdd(ImlibDrawList * dl, ImlibDrawType type,
+                    int x, int y, int a, int b)
+{
+   ImlibDrawItem      *item;
+
+   if (dl->num >= dl->alloc)
+     {
+        int                 alloc = dl->alloc ? 2 * dl->alloc : 256;
+
+        item = realloc(dl->items, alloc * sizeof(ImlibDrawItem));
+        if (!item)
+           return;
+        dl->items = item;
+        dl->alloc = alloc;
+     }
+
+   item = &dl->items[dl->num++];
+   item->type = type;
+   item->x = x;
+   item->y = y;
+   item->a = a;
+   item->b = b;
+}
+
+/* rows in [y, y + h) an item may touch, 0 if none (anti-aliased lines
+ * spill one row past their end points and ellipses up to two rows past
+ * their axis, allow for two) */
+static int
+__imlib_DrawItemRows(const ImlibDrawItem * item, int y, int h,
+                     int *py0, int *py1)
+{
+   int                 y0, y1, b;
+
+   switch (item->type)
+     {
+     default:
+        y0 = y1 = item->y;
+        break;
+     case DRAW_LINE:
+        y0 = MIN(item->y, item->b) - 2;
+        y1 = MAX(item->y, item->b) + 2;
+        break;
+     case DRAW_RECT:
+     case DRAW_FILL_RECT:
+        y0 = item->y;
+        y1 = item->y + item->b - 1;
+        break;
+     case DRAW_ELLIPSE:
+     case DRAW_FILL_ELLIPSE:
+        b = MIN(abs(item->b), 65535) + 2;
+        y0 = item->y - b;
+        y1 = item->y + b;
+        break;
+     }
+
+   *py0 = MAX(y0, y);
+   *py1 = MIN(y1, y + h - 1);
+
+   return *py1 >= *py0;
+}
+
+static void
+__imlib_DrawItem(const ImlibDrawItem * item, DATA32 color, ImlibImage * im,
+                 int clx, int cly, int clw, int clh,
+                 ImlibOp op, char blend, char anti_alias)
+{
+   switch (item->type)
+     {
+     case DRAW_POINT:
+        (void)__imlib_Point_DrawToImage(item->x, item->y, color, im,
+                                        clx, cly, clw, clh, op, blend, 0);
+        break;
+     case DRAW_LINE:
+        (void)__imlib_Line_DrawToImage(item->x, item->y, item->a, item->b,
+                                       color, im, clx, cly, clw, clh,
+                                       op, blend, anti_alias, 0);
+        break;
+     case DRAW_RECT:
+        __imlib_Rectangle_DrawToImage(item->x, item->y, item->a, item->b,
+                                      color, im, clx, cly, clw, clh,
+                                      op, blend);
+        break;
+     case DRAW_FILL_RECT:
+        __imlib_Rectangle_FillToImage(item->x, item->y, item->a, item->b,
+                                      color, im, clx, cly, clw, clh,
+                                      op, blend);
+        break;
+     case DRAW_ELLIPSE:
+        __imlib_Ellipse_DrawToImage(item->x, item->y, item->a, item->b,
+                                    color, im, clx, cly, clw, clh,
+                                    op, blend, anti_alias);
+        break;
+     case DRAW_FILL_ELLIPSE:
+        __imlib_Ellipse_FillToImage(item->x, item->y, item->a, item->b,
+                                    color, im, clx, cly, clw, clh,
+                                    op, blend, anti_alias);
+        break;
+     }
+}
+
+static void
+__imlib_DrawListBand(void *data, int band)
+{
+   const ImlibDrawListRun *run = data;
+   int                 i, y, h;
+
+   y = run->cly + band * run->band_h;
+   h = MIN(run->band_h, run->cly + run->clh - y);
+
+   for (i = run->start[band]; i < run->start[band + 1]; i++)
+      __imlib_DrawItem(&run->dl->items[run->idx[i]], run->color, run->im,
+                       run->clx, y, run->clw, h,
+                       run->op, run->blend, run->anti_alias);
+}
+
+void
+__imlib_DrawList_DrawToImage(const ImlibDrawList * dl, DATA32 color,
+                             ImlibImage * im, int clx, int cly, int clw,
+                             int clh, ImlibOp op, char blend, char anti_alias)
+{
+   ImlibDrawListRun    run;
+   int                 i, j, y0, y1, nbands, band_h, total;
+   int                *start, *idx;
+   DATA64              rows;
+
+   if (dl->num <= 0 || clw < 0)
+      return;
+   if (blend && (!A_VAL(&color)))
+      return;
+   if (clw == 0)
+     {
+        clw = im->w;
+        clx = 0;
+        clh = im->h;
+        cly = 0;
+     }
+   CLIP_RECT_TO_RECT(clx, cly, clw, clh, 0, 0, im->w, im->h);
+   if ((clw < 1) || (clh < 1))
+      return;
+
+   /* bands fitting in cache, but not much lower than the average item */
+   rows = 0;
+   for (i = 0; i < dl->num; i++)
+      if (__imlib_DrawItemRows(&dl->items[i], cly, clh, &y0, &y1))
+         rows += y1 - y0 + 1;
+   band_h = MAX(DL_BAND_SIZE / (clw * (int)sizeof(DATA32)), DL_BAND_ROWS);
+   band_h = MAX(band_h, (int)(rows / dl->num));
+   nbands = (clh + band_h - 1) / band_h;
+
+   start = NULL;
+   idx = NULL;
+   if (nbands <= 1)
+      goto draw_all;
+
+   /* count items per band, then list them band by band in order */
+   start = calloc(nbands + 1, sizeof(int));
+   if (!start)
+      goto draw_all;
+   for (i = 0; i < dl->num; i++)
+      if (__imlib_DrawItemRows(&dl->items[i], cly, clh, &y0, &y1))
+         for (j = (y0 - cly) / band_h; j <= (y1 - cly) / band_h; j++)
+            start[j + 1]++;
+   for (j = 0; j < nbands; j++)
+      start[j + 1] += start[j];
+   total = start[nbands];
+
+   idx = malloc(total * sizeof(int));
+   if (!idx)
+      goto draw_all;
+   for (i = 0; i < dl->num; i++)
+      if (__imlib_DrawItemRows(&dl->items[i], cly, clh, &y0, &y1))
+         for (j = (y0 - cly) / band_h; j <= (y1 - cly) / band_h; j++)
+            idx[start[j]++] = i;
+   /* start[j] now holds the end of band j */
+   memmove(start + 1, start, nbands * sizeof(int));
+   start[0] = 0;
+
+   run.dl = dl;
+   run.start = start;
+   run.idx = idx;
+   run.band_h = band_h;
+   run.color = color;
+   run.im = im;
+   run.clx = clx;
+   run.cly = cly;
+   run.clw = clw;
+   run.clh = clh;
+   run.op = op;
+   run.blend = blend;
+   run.anti_alias = anti_alias;
+
+   if (total >= DL_MT_ITEMS && __imlib_GetThreadCount() > 1)
+     {
+        /* set up the lazily initialized tables before going parallel */
+        if (blend)
+           __imlib_build_pow_lut();
+        (void)__imlib_GetSpanDrawFunction(op, IMAGE_HAS_ALPHA(im), blend);
+        __imlib_RunJobs(nbands, __imlib_DrawListBand, &run);
+     }
+   else
+     {
+        for (j = 0; j < nbands; j++)
+           __imlib_DrawListBand(&run, j);
+     }
+   goto quit;
+
+ draw_all:
+   for (i = 0; i < dl->num; i++)
+      __imlib_DrawItem(&dl->items[i], color, im, clx, cly, clw, clh,
+                       op, blend, anti_alias);
+
+ quit:
+   free(idx);
+   free(start);
+}
@@ -48,6 +48,7 @@ __imlib_LoadFilter(char *file)
    ptr->init_filter = dlsym(ptr->handle, "init");
    ptr->deinit_filter = dlsym(ptr->handle, "deinit");
    ptr->exec_filter = dlsym(ptr->handle, "exec");
+   ptr->cmod_filter = dlsym(ptr->handle, "cmod");
    if (!ptr->init_filter || !ptr->deinit_filter || !ptr->exec_filter)
      {
         dlclose(ptr->handle);
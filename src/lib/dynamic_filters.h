@@ -23,6 +23,13 @@ typedef struct _ImlibExternalFilter {
    void                (*deinit_filter)(void);
    void               *(*exec_filter)(char *filter, void *im,
                                       IFunctionParam * params);
+   /* Optional - for filters that are pure per-channel table lookups.
+    * Fills in the tables and the affected rectangle and returns 1, or
+    * returns 0 if the filter must be run through exec_filter. */
+   int                 (*cmod_filter)(char *filter, void *im,
+                                      IFunctionParam * params, DATA8 * r,
+                                      DATA8 * g, DATA8 * b, DATA8 * a,
+                                      int *x, int *y, int *w, int *h);
    struct _ImlibExternalFilter *next;
 } ImlibExternalFilter;
 
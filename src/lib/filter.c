@@ -4,6 +4,7 @@
 #include "colormod.h"
 #include "filter.h"
 #include "image.h"
+#include "pipeline.h"
 
 /*\ Create and return an empty filter struct \*/
 ImlibFilter        *
@@ -60,6 +61,42 @@ __imlib_FreeFilter(ImlibFilter * fil)
    free(fil);
 }
 
+static int
+__imlib_DupFilterColor(ImlibFilterColor * dst, const ImlibFilterColor * src)
+{
+   *dst = *src;
+   dst->pixels = NULL;
+   if (src->size <= 0)
+      return 0;
+   dst->pixels = malloc(src->size * sizeof(ImlibFilterPixel));
+   if (!dst->pixels)
+      return 1;
+   memcpy(dst->pixels, src->pixels, src->entries * sizeof(ImlibFilterPixel));
+   return 0;
+}
+
+/*\ Return a copy of a filter struct \*/
+ImlibFilter        *
+__imlib_DupFilter(const ImlibFilter * fil)
+{
+   ImlibFilter        *nf;
+   int                 err;
+
+   nf = calloc(1, sizeof(ImlibFilter));
+   if (!nf)
+      return NULL;
+   err = __imlib_DupFilterColor(&nf->alpha, &fil->alpha);
+   err |= __imlib_DupFilterColor(&nf->red, &fil->red);
+   err |= __imlib_DupFilterColor(&nf->green, &fil->green);
+   err |= __imlib_DupFilterColor(&nf->blue, &fil->blue);
+   if (err)
+     {
+        __imlib_FreeFilter(nf);
+        return NULL;
+     }
+   return nf;
+}
+
 void
 __imlib_FilterSetColor(ImlibFilterColor * fil, int x, int y,
                        int a, int r, int g, int b)
@@ -145,13 +182,14 @@ __imlib_FilterCalcDiv(ImlibFilterColor * fil)
    return ret;
 }
 
+/*\ src holds the rows from sy on, far enough for all filter pixels \*/
 static int
-__imlib_FilterGet(ImlibFilterColor * fil, DATA32 * data,
+__imlib_FilterGet(ImlibFilterColor * fil, const DATA32 * src, int sow, int sy,
                   int w, int h, int x, int y)
 {
    int                 i, off, ret;
    ImlibFilterPixel   *pix;
-   DATA32             *p;
+   const DATA32       *p;
 
    ret = fil->cons;
    pix = fil->pixels;
@@ -162,13 +200,13 @@ __imlib_FilterGet(ImlibFilterColor * fil, DATA32 * data,
            off = 0;
         if (off >= w)
            off = w - 1;
-        p = data + off;
+        p = src + off;
         off = y + pix->yoff;
         if (off < 0)
            off = 0;
         if (off >= h)
            off = h - 1;
-        p += off * w;
+        p += (off - sy) * sow;
         ret += A_VAL(p) * pix->a + R_VAL(p) * pix->r +
            G_VAL(p) * pix->g + B_VAL(p) * pix->b;
         pix++;
@@ -179,57 +217,51 @@ __imlib_FilterGet(ImlibFilterColor * fil, DATA32 * data,
 /*\ Correct saturation from [-32768, 32767] to [0, 255] \*/
 #define SATURATE(x) ((((x) | (!((x) >> 8) - 1)) & (~((x) >> 31))) & 0xff)
 
-/*\ Filter an image with the a, r, g, b filters in fil
-|*|  NB: This is currently not very optimal, and could probably be improved
+/*\ Rows [y, y + n) of a w x h image filtered with the a, r, g, b filters
+|*|  in fil, src holding the input rows from sy on
 \*/
 void
-__imlib_FilterImage(ImlibImage * im, ImlibFilter * fil)
+__imlib_FilterRows(ImlibFilter * fil, DATA32 * dst, int dow,
+                   const DATA32 * src, int sow, int sy,
+                   int w, int h, int y, int n)
 {
-   int                 x, y, a, r, g, b, ad, rd, gd, bd;
-   DATA32             *data, *p1, *p2;
-
-   data = malloc(im->w * im->h * sizeof(DATA32));
-   if (!data)
-      return;
+   int                 x, a, r, g, b, ad, rd, gd, bd;
+   const DATA32       *p1;
+   DATA32             *p2;
 
    ad = __imlib_FilterCalcDiv(&fil->alpha);
    rd = __imlib_FilterCalcDiv(&fil->red);
    gd = __imlib_FilterCalcDiv(&fil->green);
    bd = __imlib_FilterCalcDiv(&fil->blue);
 
-   p1 = im->data;
-   p2 = data;
-
-   for (y = 0; y < im->h; y++)
+   for (; n > 0; n--, y++, dst += dow)
      {
-        for (x = 0; x < im->w; x++)
+        p1 = src + (y - sy) * sow;
+        p2 = dst;
+        for (x = 0; x < w; x++)
           {
              *p2 = *p1;
              if (ad)
                {
-                  a = __imlib_FilterGet(&fil->alpha, im->data, im->w, im->h, x,
-                                        y);
+                  a = __imlib_FilterGet(&fil->alpha, src, sow, sy, w, h, x, y);
                   a /= ad;
                   A_VAL(p2) = SATURATE(a);
                }
              if (rd)
                {
-                  r = __imlib_FilterGet(&fil->red, im->data, im->w, im->h, x,
-                                        y);
+                  r = __imlib_FilterGet(&fil->red, src, sow, sy, w, h, x, y);
                   r /= rd;
                   R_VAL(p2) = SATURATE(r);
                }
              if (gd)
                {
-                  g = __imlib_FilterGet(&fil->green, im->data, im->w, im->h, x,
-                                        y);
+                  g = __imlib_FilterGet(&fil->green, src, sow, sy, w, h, x, y);
                   g /= gd;
                   G_VAL(p2) = SATURATE(g);
                }
              if (bd)
                {
-                  b = __imlib_FilterGet(&fil->blue, im->data, im->w, im->h, x,
-                                        y);
+                  b = __imlib_FilterGet(&fil->blue, src, sow, sy, w, h, x, y);
                   b /= bd;
                   B_VAL(p2) = SATURATE(b);
                }
@@ -237,5 +269,28 @@ __imlib_FilterImage(ImlibImage * im, ImlibFilter * fil)
              p2++;
           }
      }
-   __imlib_ReplaceData(im, data);
+}
+
+/*\ How many rows above and below a pixel the filter reaches \*/
+int
+__imlib_FilterMargin(ImlibFilter * fil)
+{
+   ImlibFilterColor   *fc[4] = { &fil->alpha, &fil->red, &fil->green,
+      &fil->blue
+   };
+   int                 i, j, m = 0;
+
+   for (i = 0; i < 4; i++)
+      for (j = 0; j < fc[i]->entries; j++)
+         m = MAX(m, abs(fc[i]->pixels[j].yoff));
+   return m;
+}
+
+/*\ Filter an image with the a, r, g, b filters in fil \*/
+void
+__imlib_FilterImage(ImlibImage * im, ImlibFilter * fil)
+{
+   ImlibPipeStep       step = {.op = PIPE_FILTER,.fil = fil };
+
+   __imlib_PipelineApply(&step, 1, im);
 }
@@ -20,6 +20,7 @@ typedef struct {
 
 ImlibFilter        *__imlib_CreateFilter(int size);
 void                __imlib_FreeFilter(ImlibFilter * fil);
+ImlibFilter        *__imlib_DupFilter(const ImlibFilter * fil);
 void                __imlib_FilterSet(ImlibFilterColor * fil, int x, int y,
                                       int a, int r, int g, int b);
 void                __imlib_FilterSetColor(ImlibFilterColor * fil, int x, int y,
@@ -29,5 +30,9 @@ void                __imlib_FilterDivisors(ImlibFilter * fil,
 void                __imlib_FilterConstants(ImlibFilter * fil,
                                             int a, int r, int g, int b);
 void                __imlib_FilterImage(ImlibImage * im, ImlibFilter * fil);
+void                __imlib_FilterRows(ImlibFilter * fil, DATA32 * dst, int dow,
+                                       const DATA32 * src, int sow, int sy,
+                                       int w, int h, int y, int n);
+int                 __imlib_FilterMargin(ImlibFilter * fil);
 
 #endif
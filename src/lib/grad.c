@@ -2,27 +2,29 @@
 
 #include <math.h>
 
+#ifdef DO_SIMD
+#include <immintrin.h>
+#endif
+
+#include "asm_c.h"
 #include "blend.h"
 #include "colormod.h"
 #include "color_helpers.h"
 #include "grad.h"
 #include "image.h"
 
-#define ARGB_TO_R_G_B_A(argb, r, g, b, a) \
-    do { \
-        r = PIXEL_R(argb); \
-        g = PIXEL_G(argb); \
-        b = PIXEL_B(argb); \
-        a = PIXEL_A(argb); \
-    } while(0)
-
 ImlibRange         *
 __imlib_CreateRange(void)
 {
    ImlibRange         *rg = NULL;
 
    rg = malloc(sizeof(ImlibRange));
+   if (!rg)
+      return NULL;
    rg->color = NULL;
+   rg->map = NULL;
+   rg->map_len = 0;
+   rg->map_hsva = 0;
    return rg;
 }
 
@@ -38,6 +40,7 @@ __imlib_FreeRange(ImlibRange * rg)
         p = p->next;
         free(pp);
      }
+   free(rg->map);
    free(rg);
 }
 
@@ -53,6 +56,8 @@ __imlib_AddRangeColor(ImlibRange * rg, DATA8 r, DATA8 g, DATA8 b, DATA8 a,
       dist = 0;
 
    rc = malloc(sizeof(ImlibRangeColor));
+   if (!rc)
+      return;
    rc->red = r;
    rc->green = g;
    rc->blue = b;
@@ -77,6 +82,10 @@ __imlib_AddRangeColor(ImlibRange * rg, DATA8 r, DATA8 g, DATA8 b, DATA8 a,
      }
    else
       rg->color = rc;
+
+   /* the cached map no longer matches */
+   free(rg->map);
+   rg->map = NULL;
 }
 
 static DATA32      *
@@ -95,6 +104,12 @@ __imlib_MapRange(ImlibRange * rg, int len)
       ll += p->distance;
    map = malloc(len * sizeof(DATA32));
    pmap = calloc(ll, sizeof(DATA32));
+   if (!map || !pmap)
+     {
+        free(map);
+        free(pmap);
+        return NULL;
+     }
    i = 0;
    for (p = rg->color; p; p = p->next)
      {
@@ -125,7 +140,7 @@ __imlib_MapRange(ImlibRange * rg, int len)
    for (i = 0; i < len; i++)
      {
         v = pmap[l >> 16];
-        if ((l >> 16) < ll)
+        if ((l >> 16) < ll - 1)
            vv = pmap[(l >> 16) + 1];
         else
            vv = pmap[(l >> 16)];
@@ -154,9 +169,10 @@ static DATA32      *
 __imlib_MapHsvaRange(ImlibRange * rg, int len)
 {
    ImlibRangeColor    *p;
-   DATA32             *map, *pmap, k, kk;
-   int                 r, g, b, a, rr, gg, bb, aa, i, l, ll, inc, j;
+   DATA32             *map, *pmap, k;
+   int                 r, g, b, a, aa, i, l, ll, inc, j, n;
    float               h1, s1, v1, h2, s2, v2, h, s, v, k1, k2;
+   float              *phsv;
 
    if (!rg->color)
       return NULL;
@@ -167,23 +183,26 @@ __imlib_MapHsvaRange(ImlibRange * rg, int len)
       ll += p->distance;
    map = malloc(len * sizeof(DATA32));
    pmap = calloc(ll, sizeof(DATA32));
+   phsv = malloc(3 * ll * sizeof(float));
+   if (!map || !pmap || !phsv)
+     {
+        free(map);
+        free(pmap);
+        free(phsv);
+        return NULL;
+     }
    i = 0;
    for (p = rg->color; p; p = p->next)
      {
         if (p->next)
           {
+             __imlib_rgb_to_hsv(p->red, p->green, p->blue, &h1, &s1, &v1);
+             __imlib_rgb_to_hsv(p->next->red, p->next->green, p->next->blue,
+                                &h2, &s2, &v2);
              for (j = 0; j < p->distance; j++)
                {
                   k1 = (j << 16) / (float)p->distance;
                   k2 = 65536 - k1;
-                  r = p->red;
-                  rr = p->next->red;
-                  g = p->green;
-                  gg = p->next->green;
-                  b = p->blue;
-                  bb = p->next->blue;
-                  __imlib_rgb_to_hsv(r, g, b, &h1, &s1, &v1);
-                  __imlib_rgb_to_hsv(rr, gg, bb, &h2, &s2, &v2);
                   h = ((h1 * k2) + (h2 * k1)) / 65536.0;
                   s = ((s1 * k2) + (s2 * k1)) / 65536.0;
                   v = ((v1 * k2) + (v2 * k1)) / 65536.0;
@@ -202,251 +221,109 @@ __imlib_MapHsvaRange(ImlibRange * rg, int len)
              pmap[i++] = PIXEL_ARGB(a, r, g, b);
           }
      }
+
+   /* the stops in HSV, converted once rather than for every map entry */
+   for (i = 0; i < ll; i++)
+      __imlib_rgb_to_hsv(PIXEL_R(pmap[i]), PIXEL_G(pmap[i]), PIXEL_B(pmap[i]),
+                         &phsv[3 * i], &phsv[3 * i + 1], &phsv[3 * i + 2]);
+
    inc = ((ll - 1) << 16) / (len - 1);
    l = 0;
    for (i = 0; i < len; i++)
      {
-        k = pmap[l >> 16];
-        if ((l >> 16) < ll)
-           kk = pmap[(l >> 16) + 1];
-        else
-           kk = pmap[(l >> 16)];
+        j = l >> 16;
+        n = (j < ll - 1) ? j + 1 : j;
+        k = pmap[j];
         k1 = l - (float)((l >> 16) << 16);
         k2 = 65536 - k1;
-        b = ((k)) & 0xff;
-        g = ((k) >> 8) & 0xff;
-        r = ((k) >> 16) & 0xff;
         a = ((k) >> 24) & 0xff;
-        bb = ((kk)) & 0xff;
-        gg = ((kk) >> 8) & 0xff;
-        rr = ((kk) >> 16) & 0xff;
-        aa = ((kk) >> 24) & 0xff;
-        __imlib_rgb_to_hsv(r, g, b, &h1, &s1, &v1);
-        __imlib_rgb_to_hsv(rr, gg, bb, &h2, &s2, &v2);
-        h = ((h1 * k2) + (h2 * k1)) / 65536.0;
-        s = ((s1 * k2) + (s2 * k1)) / 65536.0;
-        v = ((v1 * k2) + (v2 * k1)) / 65536.0;
+        aa = (pmap[n] >> 24) & 0xff;
+        h = ((phsv[3 * j] * k2) + (phsv[3 * n] * k1)) / 65536.0;
+        s = ((phsv[3 * j + 1] * k2) + (phsv[3 * n + 1] * k1)) / 65536.0;
+        v = ((phsv[3 * j + 2] * k2) + (phsv[3 * n + 2] * k1)) / 65536.0;
         __imlib_hsv_to_rgb(h, s, v, &r, &g, &b);
         a = (unsigned long int)((a * k2) + (aa * k1)) >> 16;
         map[i] = PIXEL_ARGB(a, r, g, b);
         l += inc;
      }
+   free(phsv);
    free(pmap);
    return map;
 }
 
-void
-__imlib_DrawGradient(ImlibImage * im, int x, int y, int w, int h,
-                     ImlibRange * rg, double angle, ImlibOp op,
-                     int clx, int cly, int clw, int clh)
+/* the color map of len entries, rebuilt only when the range, the length or
+ * the color space changed since the last gradient drawn with it */
+static DATA32      *
+__imlib_GetRangeMap(ImlibRange * rg, int len, char hsva)
 {
-   DATA32             *map, *p;
-   int                *hlut, *vlut, len = 0, xx, yy, xoff = 0, yoff =
-      0, ww, hh, jump;
-   int                 tmp, i, divw, divh;
-   DATA8               r, g, b, a;
+   if (rg->map && rg->map_len == len && rg->map_hsva == hsva)
+      return rg->map;
 
-   ww = w;
-   hh = h;
-   if (x < 0)
-     {
-        w += x;
-        xoff = -x;
-        x = 0;
-     }
-   if (w <= 0)
-      return;
-   if ((x + w) > im->w)
-      w = (im->w - x);
-   if (w <= 0)
-      return;
-   if (y < 0)
-     {
-        h += y;
-        yoff = -y;
-        y = 0;
-     }
-   if (h <= 0)
-      return;
-   if ((y + h) > im->h)
-      h = (im->h - y);
-   if (h <= 0)
-      return;
-   if (clw)
-     {
-        int                 px, py;
+   free(rg->map);
+   rg->map = hsva ? __imlib_MapHsvaRange(rg, len) : __imlib_MapRange(rg, len);
+   rg->map_len = len;
+   rg->map_hsva = hsva;
 
-        CLIP_TO(clx, cly, clw, clh, 0, 0, im->w, im->h);
-        px = x;
-        py = y;
-        CLIP_TO(x, y, w, h, clx, cly, clw, clh);
-        if ((w < 1) || (h < 1))
-           return;
-        xoff += (x - px);
-        yoff += (y - py);
-     }
-
-   vlut = NULL;
-   map = NULL;
-
-   hlut = malloc(sizeof(int) * ww);
-   if (!hlut)
-      goto quit;
-   vlut = malloc(sizeof(int) * hh);
-   if (!vlut)
-      goto quit;
+   return rg->map;
+}
 
-   if (ww > hh)
-      len = ww * 16;
-   else
-      len = hh * 16;
-   map = __imlib_MapRange(rg, len);
-   if (!map)
-      goto quit;
+/* one row of the gradient, v being the row's offset into the map */
+static void
+__imlib_GradientRow(DATA32 * dest, const DATA32 * map, int len,
+                    const int *hlut, int w, int v)
+{
+   int                 i, j;
 
-   xx = (int)(32 * sin(((angle + 180) * 2 * 3.141592654) / 360));
-   yy = -(int)(32 * cos(((angle + 180) * 2 * 3.141592654) / 360));
-   divw = ((ww - 1) << 5);
-   divh = ((hh - 1) << 5);
-   if (divw < 1)
-      divw = 1;
-   if (divh < 1)
-      divh = 1;
-   if (xx < 0)
+   for (i = 0; i < w; i++)
      {
-        for (i = 0; i < ww; i++)
-           hlut[i] = (-xx * (ww - 1 - i) * len) / divw;
+        j = v + hlut[i];
+        if (j < 0)
+           j = 0;
+        else if (j >= len)
+           j = len - 1;
+        dest[i] = map[j];
      }
-   else
-     {
-        for (i = 0; i < ww; i++)
-           hlut[i] = (xx * i * len) / divw;
-     }
-   if (yy < 0)
-     {
-        for (i = 0; i < hh; i++)
-           vlut[i] = (-yy * (hh - 1 - i) * len) / divh;
-     }
-   else
-     {
-        for (i = 0; i < hh; i++)
-           vlut[i] = (yy * i * len) / divh;
-     }
-   jump = im->w - w;
+}
 
-   p = im->data + (y * im->w) + x;
-   switch (op)
+#ifdef DO_SIMD
+__attribute__((target("avx2")))
+static void
+__imlib_GradientRow_avx2(DATA32 * dest, const DATA32 * map, int len,
+                         const int *hlut, int w, int v)
+{
+   __m256i             vv, lo, hi, idx;
+
+   vv = _mm256_set1_epi32(v);
+   lo = _mm256_setzero_si256();
+   hi = _mm256_set1_epi32(len - 1);
+
+   for (; w >= 8; w -= 8, dest += 8, hlut += 8)
      {
-     case OP_COPY:
-        if (IMAGE_HAS_ALPHA(im))
-          {
-             __imlib_build_pow_lut();
-             for (yy = 0; yy < h; yy++)
-               {
-                  for (xx = 0; xx < w; xx++)
-                    {
-                       i = vlut[yoff + yy] + hlut[xoff + xx];
-                       if (i < 0)
-                          i = 0;
-                       else if (i >= len)
-                          i = len - 1;
-                       ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                       BLEND_DST_ALPHA(r, g, b, a, p);
-                       p++;
-                    }
-                  p += jump;
-               }
-          }
-        else
-          {
-             for (yy = 0; yy < h; yy++)
-               {
-                  for (xx = 0; xx < w; xx++)
-                    {
-                       i = vlut[yoff + yy] + hlut[xoff + xx];
-                       if (i < 0)
-                          i = 0;
-                       else if (i >= len)
-                          i = len - 1;
-                       ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                       BLEND(r, g, b, a, p);
-                       p++;
-                    }
-                  p += jump;
-               }
-          }
-        break;
-     case OP_ADD:
-        for (yy = 0; yy < h; yy++)
-          {
-             for (xx = 0; xx < w; xx++)
-               {
-                  i = vlut[yoff + yy] + hlut[xoff + xx];
-                  if (i < 0)
-                     i = 0;
-                  else if (i >= len)
-                     i = len - 1;
-                  ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                  BLEND_SUB(r, g, b, a, p);
-                  p++;
-               }
-             p += jump;
-          }
-        break;
-     case OP_SUBTRACT:
-        for (yy = 0; yy < h; yy++)
-          {
-             for (xx = 0; xx < w; xx++)
-               {
-                  i = vlut[yoff + yy] + hlut[xoff + xx];
-                  if (i < 0)
-                     i = 0;
-                  else if (i >= len)
-                     i = len - 1;
-                  ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                  BLEND_SUB(r, g, b, a, p);
-                  p++;
-               }
-             p += jump;
-          }
-        break;
-     case OP_RESHADE:
-        for (yy = 0; yy < h; yy++)
-          {
-             for (xx = 0; xx < w; xx++)
-               {
-                  i = vlut[yoff + yy] + hlut[xoff + xx];
-                  if (i < 0)
-                     i = 0;
-                  else if (i >= len)
-                     i = len - 1;
-                  ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                  BLEND_RE(r, g, b, a, p);
-                  p++;
-               }
-             p += jump;
-          }
-        break;
-     default:
-        break;
+        idx = _mm256_add_epi32(vv,
+                               _mm256_loadu_si256((const __m256i *)hlut));
+        idx = _mm256_min_epi32(_mm256_max_epi32(idx, lo), hi);
+        _mm256_storeu_si256((__m256i *) dest,
+                            _mm256_i32gather_epi32((const int *)map, idx, 4));
      }
 
- quit:
-   free(vlut);
-   free(hlut);
-   free(map);
+   __imlib_GradientRow(dest, map, len, hlut, w, v);
 }
+#endif
 
-void
-__imlib_DrawHsvaGradient(ImlibImage * im, int x, int y, int w, int h,
-                         ImlibRange * rg, double angle, ImlibOp op,
-                         int clx, int cly, int clw, int clh)
+static void
+__imlib_DrawRangeGradient(ImlibImage * im, int x, int y, int w, int h,
+                          ImlibRange * rg, char hsva, double angle,
+                          ImlibOp op, int clx, int cly, int clw, int clh)
 {
-   DATA32             *map, *p;
+   ImlibBlendFunction  blender;
+   DATA32             *map, *buf, *p;
    int                *hlut, *vlut, len = 0, xx, yy, xoff = 0, yoff =
-      0, ww, hh, jump;
-   int                 tmp, i, divw, divh;
-   DATA8               r, g, b, a;
+      0, ww, hh;
+   int                 i, v, vprev, divw, divh, merge_alpha;
+
+#ifdef DO_SIMD
+   int                 avx2 = __imlib_do_simd() == SIMD_AVX2;
+#endif
 
    ww = w;
    hh = h;
@@ -488,8 +365,17 @@ __imlib_DrawHsvaGradient(ImlibImage * im, int x, int y, int w, int h,
         yoff += (y - py);
      }
 
+   /* blend the gradient rows like an image, destination alpha only
+    * changes when copying */
+   merge_alpha = (op == OP_COPY) && IMAGE_HAS_ALPHA(im);
+   blender = __imlib_GetBlendFunction(op, 1, merge_alpha, 0, NULL);
+   if (!blender)
+      return;
+   if (merge_alpha)
+      __imlib_build_pow_lut();
+
    vlut = NULL;
-   map = NULL;
+   buf = NULL;
 
    hlut = malloc(sizeof(int) * ww);
    if (!hlut)
@@ -497,12 +383,15 @@ __imlib_DrawHsvaGradient(ImlibImage * im, int x, int y, int w, int h,
    vlut = malloc(sizeof(int) * hh);
    if (!vlut)
       goto quit;
+   buf = malloc(sizeof(DATA32) * w);
+   if (!buf)
+      goto quit;
 
    if (ww > hh)
       len = ww * 16;
    else
       len = hh * 16;
-   map = __imlib_MapHsvaRange(rg, len);
+   map = __imlib_GetRangeMap(rg, len, hsva);
    if (!map)
       goto quit;
 
@@ -534,107 +423,55 @@ __imlib_DrawHsvaGradient(ImlibImage * im, int x, int y, int w, int h,
         for (i = 0; i < hh; i++)
            vlut[i] = (yy * i * len) / divh;
      }
-   jump = im->w - w;
 
+   /* a row only depends on its map offset, so horizontal gradients are
+    * generated once and vertical ones are plain color fills */
+   vprev = 0;
    p = im->data + (y * im->w) + x;
-   switch (op)
+   for (yy = 0; yy < h; yy++, p += im->w)
      {
-     case OP_COPY:
-        if (IMAGE_HAS_ALPHA(im))
-          {
-             __imlib_build_pow_lut();
-             for (yy = 0; yy < h; yy++)
-               {
-                  for (xx = 0; xx < w; xx++)
-                    {
-                       i = vlut[yoff + yy] + hlut[xoff + xx];
-                       if (i < 0)
-                          i = 0;
-                       else if (i >= len)
-                          i = len - 1;
-                       ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                       BLEND_DST_ALPHA(r, g, b, a, p);
-                       p++;
-                    }
-                  p += jump;
-               }
-          }
-        else
-          {
-             for (yy = 0; yy < h; yy++)
-               {
-                  for (xx = 0; xx < w; xx++)
-                    {
-                       i = vlut[yoff + yy] + hlut[xoff + xx];
-                       if (i < 0)
-                          i = 0;
-                       else if (i >= len)
-                          i = len - 1;
-                       ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                       BLEND(r, g, b, a, p);
-                       p++;
-                    }
-                  p += jump;
-               }
-          }
-        break;
-     case OP_ADD:
-        for (yy = 0; yy < h; yy++)
-          {
-             for (xx = 0; xx < w; xx++)
-               {
-                  i = vlut[yoff + yy] + hlut[xoff + xx];
-                  if (i < 0)
-                     i = 0;
-                  else if (i >= len)
-                     i = len - 1;
-                  ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                  BLEND_SUB(r, g, b, a, p);
-                  p++;
-               }
-             p += jump;
-          }
-        break;
-     case OP_SUBTRACT:
-        for (yy = 0; yy < h; yy++)
-          {
-             for (xx = 0; xx < w; xx++)
-               {
-                  i = vlut[yoff + yy] + hlut[xoff + xx];
-                  if (i < 0)
-                     i = 0;
-                  else if (i >= len)
-                     i = len - 1;
-                  ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                  BLEND_SUB(r, g, b, a, p);
-                  p++;
-               }
-             p += jump;
-          }
-        break;
-     case OP_RESHADE:
-        for (yy = 0; yy < h; yy++)
+        v = vlut[yoff + yy];
+        if (yy == 0 || v != vprev)
           {
-             for (xx = 0; xx < w; xx++)
+             if (xx == 0)
                {
-                  i = vlut[yoff + yy] + hlut[xoff + xx];
-                  if (i < 0)
-                     i = 0;
-                  else if (i >= len)
-                     i = len - 1;
-                  ARGB_TO_R_G_B_A(map[i], r, g, b, a);
-                  BLEND_RE(r, g, b, a, p);
-                  p++;
+                  DATA32              c;
+
+                  c = map[(v < 0) ? 0 : (v >= len) ? len - 1 : v];
+                  for (i = 0; i < w; i++)
+                     buf[i] = c;
                }
-             p += jump;
+#ifdef DO_SIMD
+             else if (avx2)
+                __imlib_GradientRow_avx2(buf, map, len, hlut + xoff, w, v);
+#endif
+             else
+                __imlib_GradientRow(buf, map, len, hlut + xoff, w, v);
+             vprev = v;
           }
-        break;
-     default:
-        break;
+        blender(buf, w, p, im->w, w, 1, NULL);
      }
 
  quit:
+   free(buf);
    free(vlut);
    free(hlut);
-   free(map);
+}
+
+void
+__imlib_DrawGradient(ImlibImage * im, int x, int y, int w, int h,
+                     ImlibRange * rg, double angle, ImlibOp op,
+                     int clx, int cly, int clw, int clh)
+{
+   __imlib_DrawRangeGradient(im, x, y, w, h, rg, 0, angle, op,
+                             clx, cly, clw, clh);
+}
+
+void
+__imlib_DrawHsvaGradient(ImlibImage * im, int x, int y, int w, int h,
+                         ImlibRange * rg, double angle, ImlibOp op,
+                         int clx, int cly, int clw, int clh)
+{
+   __imlib_DrawRangeGradient(im, x, y, w, h, rg, 1, angle, op,
+                             clx, cly, clw, clh);
 }
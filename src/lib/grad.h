@@ -11,6 +11,9 @@ typedef struct _ImlibRangeColor {
 
 typedef struct {
    ImlibRangeColor    *color;
+   DATA32             *map;     /* Cached color map, NULL if none */
+   int                 map_len;
+   char                map_hsva;
 } ImlibRange;
 
 ImlibRange         *__imlib_CreateRange(void);
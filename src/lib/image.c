@@ -1,3 +1,4 @@
+#define _GNU_SOURCE             /* memfd_create() */
 #include "common.h"
 
 #include <ctype.h>
@@ -5,14 +6,19 @@
 #include <fcntl.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "Imlib2.h"
+#include "blend.h"
 #include "debug.h"
+#include "disk_cache.h"
 #include "file.h"
 #include "image.h"
 #include "loaders.h"
+#include "scale.h"
 #ifdef BUILD_X11
 #include "x11_pixmap.h"
 #endif
@@ -32,6 +38,32 @@ static ImlibImage  *images = NULL;
 
 static int          cache_size = 4096 * 1024;
 
+/* data_memory_func for pixel data living in a private file mapping */
+/* it is only called to release the data (see __imlib_SetMappedData) */
+static void        *
+__imlib_MappedDataMemory(void *p, size_t size)
+{
+   uintptr_t           pgmask = sysconf(_SC_PAGESIZE) - 1;
+   char               *base;
+
+   if (p)
+     {
+        base = (char *)((uintptr_t) p & ~pgmask);
+        munmap(base, size + ((char *)p - base));
+     }
+
+   return NULL;
+}
+
+/* use the pixels at offset in a private file mapping as image data */
+/* writes are copy-on-write per page, the mapping is unmapped with the data */
+__EXPORT__ void
+__imlib_SetMappedData(ImlibImage * im, void *map, size_t offset)
+{
+   im->data = (DATA32 *) ((char *)map + offset);
+   im->data_memory_func = __imlib_MappedDataMemory;
+}
+
 __EXPORT__ DATA32  *
 __imlib_AllocateData(ImlibImage * im)
 {
@@ -41,6 +73,10 @@ __imlib_AllocateData(ImlibImage * im)
    if (w <= 0 || h <= 0)
       return NULL;
 
+   /* previous data was mapped, allocate new data normally */
+   if (im->data_memory_func == __imlib_MappedDataMemory)
+      im->data_memory_func = NULL;
+
    if (im->data_memory_func)
       im->data = im->data_memory_func(NULL, w * h * sizeof(DATA32));
    else
@@ -49,10 +85,30 @@ __imlib_AllocateData(ImlibImage * im)
    return im->data;
 }
 
+/* drop a reference to shared pixel data, freeing it with the last one */
+static void
+__imlib_DataUnref(ImlibImageData * sd)
+{
+   if (--sd->references > 0)
+      return;
+
+   if (sd->data_memory_func)
+      sd->data_memory_func(sd->data, sd->size);
+   else
+      free(sd->data);
+   free(sd);
+}
+
 __EXPORT__ void
 __imlib_FreeData(ImlibImage * im)
 {
-   if (im->data)
+   if (im->shared)
+     {
+        __imlib_DataUnref(im->shared);
+        im->shared = NULL;
+        im->data = NULL;
+     }
+   else if (im->data)
      {
         if (im->data_memory_func)
            im->data_memory_func(im->data, im->w * im->h * sizeof(DATA32));
@@ -61,6 +117,7 @@ __imlib_FreeData(ImlibImage * im)
 
         im->data = NULL;
      }
+   __imlib_MipmapFree(im);
    im->w = 0;
    im->h = 0;
 }
@@ -68,17 +125,91 @@ __imlib_FreeData(ImlibImage * im)
 __EXPORT__ void
 __imlib_ReplaceData(ImlibImage * im, unsigned int *new_data)
 {
-   if (im->data)
+   if (im->shared)
+     {
+        __imlib_DataUnref(im->shared);
+        im->shared = NULL;
+     }
+   else if (im->data)
      {
         if (im->data_memory_func)
            im->data_memory_func(im->data, im->w * im->h * sizeof(DATA32));
         else
            free(im->data);
      }
+   __imlib_MipmapFree(im);
    im->data = new_data;
    im->data_memory_func = NULL;
 }
 
+/* make im use the pixel data of im_src, starting at pixel offset */
+/* returns 0 on success, 1 if the data cannot be shared */
+int
+__imlib_ShareData(ImlibImage * im, ImlibImage * im_src, int offset)
+{
+   ImlibImageData     *sd;
+
+   /* we don't own data supplied by the application */
+   if (!im_src->data || !IMAGE_FREE_DATA(im_src))
+      return 1;
+
+   sd = im_src->shared;
+   if (!sd)
+     {
+        sd = malloc(sizeof(ImlibImageData));
+        if (!sd)
+           return 1;
+        sd->data = im_src->data;
+        sd->size = im_src->w * im_src->h * sizeof(DATA32);
+        sd->data_memory_func = im_src->data_memory_func;
+        sd->references = 1;
+        im_src->shared = sd;
+     }
+
+   sd->references++;
+   im->shared = sd;
+   im->data = im_src->data + offset;
+   im->data_memory_func = NULL;
+
+   return 0;
+}
+
+/* give im its own copy of its pixel data if it is shared */
+/* returns 0 on success, 1 if out of memory */
+int
+__imlib_UnshareData(ImlibImage * im)
+{
+   ImlibImageData     *sd = im->shared;
+   DATA32             *data;
+
+   if (!sd)
+      return 0;
+
+   if (sd->references == 1 && im->data == sd->data &&
+       sd->size == im->w * im->h * sizeof(DATA32))
+     {
+        /* last user of the whole allocation - just take it over (not if
+         * it is a band of rows at the top, the allocation is freed with
+         * im's size then) */
+        im->data_memory_func = sd->data_memory_func;
+        free(sd);
+        im->shared = NULL;
+        return 0;
+     }
+
+   data = malloc(im->w * im->h * sizeof(DATA32));
+   if (!data)
+      return 1;
+   memcpy(data, im->data, im->w * im->h * sizeof(DATA32));
+
+   __imlib_DataUnref(sd);
+   im->shared = NULL;
+   im->data = data;
+   im->data_memory_func = NULL;
+
+   return 0;
+}
+
 /* create an image data struct and fill it in */
 static ImlibImage  *
 __imlib_ProduceImage(void)
@@ -103,6 +234,7 @@ __imlib_ConsumeImage(ImlibImage * im)
    free(im->key);
    if ((IMAGE_FREE_DATA(im)) && (im->data))
       __imlib_FreeData(im);
+   __imlib_MipmapFree(im);
    free(im->format);
 
    free(im);
@@ -113,7 +245,7 @@ __imlib_ConsumeImage(ImlibImage * im)
 }
 
 static ImlibImage  *
-__imlib_FindCachedImage(const char *file, int frame)
+__imlib_FindCachedImage(const char *file, int frame, int load_w, int load_h)
 {
    ImlibImage         *im, *im_prev;
 
@@ -123,7 +255,8 @@ __imlib_FindCachedImage(const char *file, int frame)
      {
         /* if the filenames match and it's valid */
         if (!strcmp(file, im->file) && IMAGE_IS_VALID(im) &&
-            frame == im->frame_num)
+            frame == im->frame_num && load_w == im->load_w &&
+            load_h == im->load_h)
           {
              /* move the image to the head of the image list */
              if (im_prev)
@@ -193,7 +326,8 @@ __imlib_CurrentCacheSize(void)
                }
              /* it's valid but has 0 ref's - append to cache size count */
              else
-                current_cache += im->w * im->h * sizeof(DATA32);
+                current_cache += im->w * im->h * sizeof(DATA32) +
+                   __imlib_MipmapSize(im);
           }
      }
 
@@ -433,12 +567,64 @@ __imlib_LoadEmbedded(ImlibLoader * l, ImlibImage * im, const char *file,
    return rc;
 }
 
+/* load an image held in memory, e.g. embedded in another file, through an
+ * anonymous file the loaders can read or map like a real one */
+__EXPORT__ int
+__imlib_LoadEmbeddedMem(ImlibLoader * l, ImlibImage * im, const void *data,
+                        size_t size, int load_data)
+{
+   int                 rc;
+   FILE               *fp, *fp_save;
+   off_t               fsize_save;
+
+   if (!l || !im || !data || size == 0)
+      return 0;
+
+   fp = NULL;
+#ifdef HAVE_MEMFD_CREATE
+   {
+      int                 fd;
+
+      fd = memfd_create("imlib2-embedded", MFD_CLOEXEC);
+      if (fd >= 0)
+        {
+           fp = fdopen(fd, "w+b");
+           if (!fp)
+              close(fd);
+        }
+   }
+#endif
+   if (!fp)
+      fp = tmpfile();
+   if (!fp)
+      return 0;
+
+   rc = 0;
+   if (fwrite(data, 1, size, fp) != size || fflush(fp) != 0)
+      goto quit;
+   rewind(fp);
+
+   fp_save = im->fp;
+   im->fp = fp;
+   fsize_save = im->fsize;
+   im->fsize = size;
+
+   rc = __imlib_LoadImageWrapper(l, im, load_data);
+
+   im->fp = fp_save;
+   im->fsize = fsize_save;
+
+ quit:
+   fclose(fp);
+   return rc;
+}
+
 ImlibImage         *
 __imlib_LoadImage(const char *file, ImlibLoadArgs * ila)
 {
    ImlibImage         *im;
    ImlibLoader        *best_loader;
-   int                 err, loader_ret;
+   int                 err, loader_ret, disk_cached;
    ImlibLdCtx          ilc;
    struct stat         st;
    char               *im_file, *im_key;
@@ -447,7 +633,7 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs * ila)
       return NULL;
 
    /* see if we already have the image cached */
-   im = __imlib_FindCachedImage(file, ila->frame);
+   im = __imlib_FindCachedImage(file, ila->frame, ila->load_w, ila->load_h);
 
    /* if we found a cached image and we should always check that it is */
    /* accurate to the disk conents if they changed since we last loaded */
@@ -524,6 +710,8 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs * ila)
    im->real_file = im_file ? im_file : im->file;
    im->key = im_key;
    im->frame_num = ila->frame;
+   im->load_w = ila->load_w;
+   im->load_h = ila->load_h;
 
    if (ila->fp)
       im->fp = ila->fp;
@@ -548,12 +736,26 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs * ila)
      }
 
    loader_ret = LOAD_FAIL;
+   best_loader = NULL;
+   disk_cached = 0;
 
-   /* take a guess by extension on the best loader to use */
-   best_loader = __imlib_FindBestLoaderForFile(im->real_file, 0);
-   errno = 0;
-   if (best_loader)
-      loader_ret = __imlib_LoadImageWrapper(best_loader, im, ila->immed);
+   /* see if the decoded image is in the persistent cache */
+   if (!ila->fp && !im->data_memory_func && __imlib_DiskCacheLoad(im))
+     {
+        disk_cached = 1;
+        loader_ret = LOAD_SUCCESS;
+        best_loader = im->loader;       /* As recorded in the entry */
+        if (ila->pfunc)
+           ila->pfunc(im, 100, 0, 0, im->w, im->h);
+     }
+   else
+     {
+        /* take a guess by extension on the best loader to use */
+        best_loader = __imlib_FindBestLoaderForFile(im->real_file, 0);
+        errno = 0;
+        if (best_loader)
+           loader_ret = __imlib_LoadImageWrapper(best_loader, im, ila->immed);
+     }
 
    switch (loader_ret)
      {
@@ -641,6 +843,9 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs * ila)
         return NULL;
      }
 
+   if (loader_ret == LOAD_SUCCESS && !disk_cached && !ila->fp)
+      __imlib_DiskCacheStore(im);
+
    /* the load succeeded - make sure the image is referenced then add */
    /* it to our cache unless nocache is set */
    im->references = 1;
@@ -657,9 +862,16 @@ __imlib_LoadImage(const char *file, ImlibLoadArgs * ila)
 int
 __imlib_LoadImageData(ImlibImage * im)
 {
+   int                 rc;
+
    if (!im->data && im->loader)
-      if (__imlib_LoadImageWrapper(im->loader, im, 1) <= LOAD_FAIL)
-         return 1;              /* Load failed */
+     {
+        rc = __imlib_LoadImageWrapper(im->loader, im, 1);
+        if (rc <= LOAD_FAIL)
+           return 1;            /* Load failed */
+        if (rc == LOAD_SUCCESS && im->real_file)
+           __imlib_DiskCacheStore(im);
+     }
    return im->data == NULL;
 }
 
@@ -742,16 +954,39 @@ __imlib_FreeImage(ImlibImage * im)
 }
 
 /* dirty and image by settings its invalid flag */
+/* the image is about to be modified so it also gets its own pixel data */
 void
 __imlib_DirtyImage(ImlibImage * im)
 {
    SET_FLAG(im->flags, F_INVALID);
+   __imlib_UnshareData(im);
+   __imlib_MipmapFree(im);
 #ifdef BUILD_X11
    /* and dirty all pixmaps generated from it */
    __imlib_DirtyPixmapsForImage(im);
 #endif
 }
 
+/* convert the image data between straight and premultiplied alpha */
+void
+__imlib_SetAlphaPremul(ImlibImage * im, int premul)
+{
+   if (!IMAGE_HAS_ALPHA(im))
+      premul = 0;
+   if (!premul == !(im->flags & F_ALPHA_PREMUL))
+      return;
+
+   if (im->data)
+     {
+        __imlib_DirtyImage(im);
+        if (premul)
+           __imlib_PremulData(im->data, im->w * im->h);
+        else
+           __imlib_UnpremulData(im->data, im->w * im->h);
+     }
+   UPDATE_FLAG(im->flags, F_ALPHA_PREMUL, premul);
+}
+
 void
 __imlib_SaveImage(ImlibImage * im, const char *file,
                   ImlibProgressFunction progress, char progress_granularity,
@@ -760,6 +995,7 @@ __imlib_SaveImage(ImlibImage * im, const char *file,
    ImlibLoader        *l;
    char                e, *pfile;
    ImlibLdCtx          ilc;
+   DATA32             *data;
 
    if (!file)
      {
@@ -778,6 +1014,22 @@ __imlib_SaveImage(ImlibImage * im, const char *file,
         return;
      }
 
+   /* savers expect straight alpha */
+   data = im->data;
+   if (IMAGE_ALPHA_PREMUL(im))
+     {
+        im->data = malloc(im->w * im->h * sizeof(DATA32));
+        if (!im->data)
+          {
+             im->data = data;
+             if (er)
+                *er = IMLIB_LOAD_ERROR_OUT_OF_MEMORY;
+             return;
+          }
+        memcpy(im->data, data, im->w * im->h * sizeof(DATA32));
+        __imlib_UnpremulData(im->data, im->w * im->h);
+     }
+
    if (progress)
       __imlib_LoadCtxInit(im, &ilc, progress, progress_granularity);
 
@@ -792,6 +1044,12 @@ __imlib_SaveImage(ImlibImage * im, const char *file,
    free(im->real_file);
    im->real_file = pfile;
 
+   if (im->data != data)
+     {
+        free(im->data);
+        im->data = data;
+     }
+
    im->lc = NULL;
 
    if (er)
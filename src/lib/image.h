@@ -24,7 +24,9 @@ enum _iflags {
    F_DONT_FREE_DATA = (1 << 5),
    F_FORMAT_IRRELEVANT = (1 << 6),
    F_BORDER_IRRELEVANT = (1 << 7),
-   F_ALPHA_IRRELEVANT = (1 << 8)
+   F_ALPHA_IRRELEVANT = (1 << 8),
+   F_USE_MIPMAP = (1 << 9),
+   F_ALPHA_PREMUL = (1 << 10)
 };
 
 typedef enum _iflags ImlibImageFlags;
@@ -47,6 +49,14 @@ typedef struct _ImlibImageTag {
    struct _ImlibImageTag *next;
 } ImlibImageTag;
 
+/* Pixel data shared copy-on-write between images */
+typedef struct {
+   DATA32             *data;    /* Start of allocation */
+   size_t              size;    /* Allocation size (bytes) */
+   ImlibImageDataMemoryFunction data_memory_func;
+   int                 references;
+} ImlibImageData;
+
 struct _ImlibImage {
    char               *file;
    int                 w, h;
@@ -73,6 +83,10 @@ struct _ImlibImage {
    int                 frame_y;
    int                 frame_flags;     /* Frame flags      */
    int                 frame_delay;     /* Frame delay (ms) */
+   int                 load_w;  /* Requested size (0: natural) */
+   int                 load_h;
+   ImlibImageData     *shared;  /* Set if data is shared with other images */
+   ImlibImage         *mipmap;  /* Half size level, see F_USE_MIPMAP */
 };
 
 typedef struct {
@@ -83,6 +97,7 @@ typedef struct {
    char                nocache;
    int                 err;
    int                 frame;
+   int                 load_w, load_h;
 } ImlibLoadArgs;
 
 void                __imlib_RemoveAllLoaders(void);
@@ -102,16 +117,28 @@ ImlibImage         *__imlib_CreateImage(int w, int h, DATA32 * data);
 ImlibImage         *__imlib_LoadImage(const char *file, ImlibLoadArgs * ila);
 int                 __imlib_LoadEmbedded(ImlibLoader * l, ImlibImage * im,
                                          const char *file, int load_data);
+int                 __imlib_LoadEmbeddedMem(ImlibLoader * l, ImlibImage * im,
+                                            const void *data, size_t size,
+                                            int load_data);
 int                 __imlib_LoadImageData(ImlibImage * im);
 void                __imlib_DirtyImage(ImlibImage * im);
+void                __imlib_SetAlphaPremul(ImlibImage * im, int premul);
 void                __imlib_FreeImage(ImlibImage * im);
 void                __imlib_SaveImage(ImlibImage * im, const char *file,
                                       ImlibProgressFunction progress,
                                       char progress_granularity, int *er);
 
 DATA32             *__imlib_AllocateData(ImlibImage * im);
+void                __imlib_SetMappedData(ImlibImage * im, void *map,
+                                          size_t offset);
 void                __imlib_FreeData(ImlibImage * im);
 void                __imlib_ReplaceData(ImlibImage * im, DATA32 * new_data);
+int                 __imlib_ShareData(ImlibImage * im, ImlibImage * im_src,
+                                      int offset);
+int                 __imlib_UnshareData(ImlibImage * im);
+void                __imlib_TransposeData(DATA32 * dst, int dxs, int dys,
+                                          const DATA32 * src, int sstride,
+                                          int w, int h);
 
 void                __imlib_LoadProgressSetPass(ImlibImage * im,
                                                 int pass, int n_pass);
@@ -138,6 +165,10 @@ int                 __imlib_CurrentCacheSize(void);
 #define IMAGE_ALWAYS_CHECK_DISK(im) ((im)->flags & F_ALWAYS_CHECK_DISK)
 #define IMAGE_IS_VALID(im) (!((im)->flags & F_INVALID))
 #define IMAGE_FREE_DATA(im) (!((im)->flags & F_DONT_FREE_DATA))
+#define IMAGE_USE_MIPMAP(im) ((im)->flags & F_USE_MIPMAP)
+#define IMAGE_ALPHA_PREMUL(im) \
+   (((im)->flags & (F_HAS_ALPHA | F_ALPHA_PREMUL)) == \
+    (F_HAS_ALPHA | F_ALPHA_PREMUL))
 
 #define SET_FLAG(flags, f) ((flags) |= (f))
 #define UNSET_FLAG(flags, f) ((flags) &= (~f))
@@ -241,6 +241,40 @@ __imlib_SimpleLine_DrawToData(int x0, int y0, int x1, int y1, DATA32 color,
    return 1;
 }
 
+/* offset along the minor axis after t steps along the major one, computed
+ * exactly like the drawing loops do */
+static inline int
+__imlib_Line_Step(int t, int d, int a_a)
+{
+   int                 tt, s;
+
+   tt = t * d;
+   s = tt >> 16;
+   if (!a_a)
+      s += (tt - (s << 16)) >> 15;
+   return s;
+}
+
+/* first major position in [lo, hi] where the minor position has reached
+ * [smin, smax] (moving in direction dir) */
+static int
+__imlib_Line_ClipStart(int t0, int s0, int d, int dir, int lo, int hi,
+                       int smin, int smax, int a_a)
+{
+   int                 mid, s;
+
+   while (lo < hi)
+     {
+        mid = lo + (hi - lo) / 2;
+        s = s0 + __imlib_Line_Step(mid - t0, d, a_a);
+        if ((dir > 0) ? (s >= smin) : (s <= smax))
+           hi = mid;
+        else
+           lo = mid + 1;
+     }
+   return lo;
+}
+
 #define SETUP_LINE_SHALLOW() \
 do { \
 	if (x0 > x1)                                         \
@@ -250,10 +284,6 @@ do { \
 	   dy = -dy;                                         \
 	  }                                                  \
                                                              \
-	px = x0;                                             \
-	py = y0;                                             \
-                                                             \
-	p0_in = (IN_RANGE(x0 ,y0 , clw, clh) ? 1 : 0);       \
 	p1_in = (IN_RANGE(x1 ,y1 , clw, clh) ? 1 : 0);       \
                                                              \
 	dely = 1;                                            \
@@ -266,55 +296,22 @@ do { \
                                                              \
 	dyy = (dy << 16) / dx;                               \
                                                              \
-	if (!p0_in)                                          \
-	  {                                                  \
-	   dxx = (dx << 16) / dy;                            \
-	   if (px < 0)                                       \
-	     {                                               \
-		x = -px;  px = 0;                            \
-		yy = x * dyy;                                \
-		y = yy >> 16;                                \
-	        if (!a_a)                                    \
-                   y += (yy - (y << 16)) >> 15;              \
-		py += y;                                     \
-		if ((dely > 0) && (py >= clh))               \
-		   return 0;                                 \
-		else if ((dely < 0) && (py < -1))            \
-                   return 0;                                 \
-	     }                                               \
-                                                             \
-	   y = 0;                                            \
-	   if ((dely > 0) && (py < -1))                      \
-		y = (-1 - py);                               \
-	   else if ((dely < 0) && (py >= clh))               \
-		y = (clh - 1 - py);                          \
-                                                             \
-	   xx = y * dxx;                                     \
-	   x = xx >> 16;                                     \
-	   if (!a_a)                                         \
-              x += (xx - (x << 16)) >> 15;                   \
-	   px += x;                                          \
-	   if (px >= clw) return 0;                          \
+	rx = MIN(x1 + 1, clw);                               \
+	by = clh - 1;                                        \
                                                              \
-	   yy = x * dyy;                                     \
-	   y = yy >> 16;                                     \
-	   if (!a_a)                                         \
-              y += (yy - (y << 16)) >> 15;                   \
-	   py += y;                                          \
-	   if ((dely > 0) && (py >= clh))                    \
-		 return 0;                                   \
-	   else if ((dely < 0) && (py < -1))                 \
-		 return 0;                                   \
-	  }                                                  \
+	/* start where the unclipped line enters the clip */ \
+	px = MAX(x0, 0);                                     \
+	if (px >= rx)                                        \
+	   return 0;                                         \
+	px = __imlib_Line_ClipStart(x0, y0, dyy, dely, px,   \
+				    rx - 1, -a_a, by, a_a);  \
+	prev_y = __imlib_Line_Step(px - x0, dyy, a_a);       \
+	py = y0 + prev_y;                                    \
+	if ((py < -a_a) || (py > by))                        \
+	   return 0;                                         \
                                                              \
+	yy = (px - x0) * dyy;                                \
 	p = dst + (dstw * py) + px;                          \
-                                                             \
-	x = px - x0;                                         \
-	yy = x * dyy;                                        \
-	prev_y = (yy >> 16);                                 \
-                                                             \
-	rx = MIN(x1 + 1, clw);                               \
-	by = clh - 1;                                        \
 } while (0)
 
 #define SETUP_LINE_STEEP() \
@@ -326,10 +323,6 @@ do { \
 	dy = -dy;                                            \
      }                                                       \
                                                              \
-   px = x0;                                                  \
-   py = y0;                                                  \
-                                                             \
-   p0_in = (IN_RANGE(x0 ,y0 , clw, clh) ? 1 : 0);            \
    p1_in = (IN_RANGE(x1 ,y1 , clw, clh) ? 1 : 0);            \
                                                              \
    delx = 1;                                                 \
@@ -338,56 +331,22 @@ do { \
                                                              \
    dxx = (dx << 16) / dy;                                    \
                                                              \
-   if (!p0_in)                                               \
-     {                                                       \
-	dyy = (dy << 16) / dx;                               \
-                                                             \
-	if (py < 0)                                          \
-	  {                                                  \
-	   y = -py;  py = 0;                                 \
-	   xx = y * dxx;                                     \
-	   x = xx >> 16;                                     \
-	   if (!a_a)                                         \
-              x += (xx - (x << 16)) >> 15;                   \
-	   px += x;                                          \
-	   if ((delx > 0) && (px >= clw))                    \
-		return 0;                                    \
-	   else if ((delx < 0) && (px < -1))                 \
-		return 0;                                    \
-	  }                                                  \
-                                                             \
-	x = 0;                                               \
-	if ((delx > 0) && (px < -1))                         \
-	   x = (-1 - px);                                    \
-	else if ((delx < 0) && (px >= clw))                  \
-	   x = (clw - 1 - px);                               \
-                                                             \
-	yy = x * dyy;                                        \
-	y = yy >> 16;                                        \
-	if (!a_a)                                            \
-           y += (yy - (y << 16)) >> 15;                      \
-	py += y;                                             \
-	if (py >= clh) return 0;                             \
+   by = MIN(y1 + 1, clh);                                    \
+   rx = clw - 1;                                             \
                                                              \
-	xx = y * dxx;                                        \
-	x = xx >> 16;                                        \
-        if (!a_a)                                            \
-           x += (xx - (x << 16)) >> 15;                      \
-	px += x;                                             \
-	if ((delx > 0) && (px >= clw))                       \
-	   return 0;                                         \
-	else if ((delx < 0) && (px < -1))                    \
-	   return 0;                                         \
-     }                                                       \
+   /* start where the unclipped line enters the clip */      \
+   py = MAX(y0, 0);                                          \
+   if (py >= by)                                             \
+      return 0;                                              \
+   py = __imlib_Line_ClipStart(y0, x0, dxx, delx, py,        \
+			       by - 1, -a_a, rx, a_a);       \
+   prev_x = __imlib_Line_Step(py - y0, dxx, a_a);            \
+   px = x0 + prev_x;                                         \
+   if ((px < -a_a) || (px > rx))                             \
+      return 0;                                              \
                                                              \
+   xx = (py - y0) * dxx;                                     \
    p = dst + (dstw * py) + px;                               \
-                                                             \
-   y = py - y0;                                              \
-   xx = y * dxx;                                             \
-   prev_x = (xx >> 16);                                      \
-                                                             \
-   by = MIN(y1 + 1, clh);                                    \
-   rx = clw - 1;                                             \
 } while (0)
 
 static int
@@ -398,7 +357,7 @@ __imlib_Line_DrawToData(int x0, int y0, int x1, int y1, DATA32 color,
 {
    ImlibPointDrawFunction pfunc;
    int                 px, py, x, y, prev_x, prev_y;
-   int                 dx, dy, rx, by, p0_in, p1_in, dh, a_a = 0;
+   int                 dx, dy, rx, by, p1_in, dh, a_a = 0;
    int                 delx, dely, xx, yy, dxx, dyy;
    DATA32             *p;
 
@@ -513,7 +472,7 @@ __imlib_Line_DrawToData_AA(int x0, int y0, int x1, int y1, DATA32 color,
 {
    ImlibPointDrawFunction pfunc;
    int                 px, py, x, y, prev_x, prev_y;
-   int                 dx, dy, rx, by, p0_in, p1_in, dh, a_a = 1;
+   int                 dx, dy, rx, by, p1_in, dh, a_a = 1;
    int                 delx, dely, xx, yy, dxx, dyy;
    DATA32             *p;
    DATA8               ca = A_VAL(&color);
@@ -0,0 +1,590 @@
+#include "common.h"
+
+#include "blend.h"
+#include "colormod.h"
+#include "filter.h"
+#include "image.h"
+#include "pipeline.h"
+#include "rgbadraw.h"
+#include "scale.h"
+
+/*
+ * Pipelines - chains of scale, color modifier, blur, sharpen and filter
+ * steps run over an image in one streaming pass.
+ *
+ * Each step becomes a stage holding a window of its output rows. The sink
+ * asks the last stage for bands of rows, every stage in turn asks the one
+ * before it for the input rows the band needs (plus the rows above and
+ * below its kernel reaches), keeping rows still needed by the next band.
+ * So the intermediate results only ever exist as a few cache sized bands
+ * instead of full size images.
+ *
+ * Scaling reads its source image directly, a scale step after other steps
+ * has the steps before it run into a temporary image first.
+ */
+
+#define PIPE_BAND_SIZE  (128 * 1024)    /* Target band size in bytes */
+#define PIPE_BAND_ROWS  4       /* Minimum band height */
+
+typedef struct _ImlibPipeStage ImlibPipeStage;
+
+struct _ImlibPipeStage {
+   const ImlibPipeStep *step;   /* NULL for the source */
+   ImlibPipeStage     *prev;
+   int                 w, h;    /* Output size */
+   int                 margin;  /* Input rows needed above and below */
+   char                has_alpha;
+   char                copy;    /* Source: copy rows, the image is written */
+   DATA32             *buf;     /* Output rows [y, y + n) */
+   int                 y, n, rows;
+   ImlibImage         *im;      /* Source/scale source image */
+   int                 sx, sy;  /* Source: offset, scale: dxx, dyy */
+   ImlibScaleInfo     *isi;
+};
+
+ImlibPipeline      *
+__imlib_PipelineNew(void)
+{
+   return calloc(1, sizeof(ImlibPipeline));
+}
+
+void
+__imlib_PipelineClear(ImlibPipeline * pl)
+{
+   int                 i;
+
+   for (i = 0; i < pl->num; i++)
+     {
+        if (pl->steps[i].cm)
+           __imlib_FreeCmod(pl->steps[i].cm);
+        if (pl->steps[i].fil)
+           __imlib_FreeFilter(pl->steps[i].fil);
+     }
+   pl->num = 0;
+}
+
+void
+__imlib_PipelineFree(ImlibPipeline * pl)
+{
+   __imlib_PipelineClear(pl);
+   free(pl->steps);
+   free(pl);
+}
+
+static ImlibPipeStep *
+__imlib_PipelineAdd(ImlibPipeline * pl, ImlibPipeOp op)
+{
+   ImlibPipeStep      *step;
+
+   if (pl->num >= pl->alloc)
+     {
+        int                 alloc = pl->alloc ? 2 * pl->alloc : 8;
+
+        step = realloc(pl->steps, alloc * sizeof(ImlibPipeStep));
+        if (!step)
+           return NULL;
+        pl->steps = step;
+        pl->alloc = alloc;
+     }
+
+   step = &pl->steps[pl->num++];
+   memset(step, 0, sizeof(ImlibPipeStep));
+   step->op = op;
+
+   return step;
+}
+
+void
+__imlib_PipelineAddScale(ImlibPipeline * pl, int w, int h, char aa)
+{
+   ImlibPipeStep      *step;
+
+   if (!IMAGE_DIMENSIONS_OK(abs(w), abs(h)))
+      return;
+   step = __imlib_PipelineAdd(pl, PIPE_SCALE);
+   if (!step)
+      return;
+   step->w = w;
+   step->h = h;
+   step->aa = aa;
+}
+
+void
+__imlib_PipelineAddCmod(ImlibPipeline * pl, ImlibColorModifier * cm)
+{
+   ImlibPipeStep      *step;
+   ImlibColorModifier *ncm;
+
+   ncm = malloc(sizeof(ImlibColorModifier));
+   if (!ncm)
+      return;
+   *ncm = *cm;
+   step = __imlib_PipelineAdd(pl, PIPE_CMOD);
+   if (!step)
+     {
+        __imlib_FreeCmod(ncm);
+        return;
+     }
+   step->cm = ncm;
+}
+
+void
+__imlib_PipelineAddBlur(ImlibPipeline * pl, int rad)
+{
+   ImlibPipeStep      *step;
+
+   if (rad < 1)
+      return;
+   step = __imlib_PipelineAdd(pl, PIPE_BLUR);
+   if (step)
+      step->rad = rad;
+}
+
+void
+__imlib_PipelineAddSharpen(ImlibPipeline * pl, int rad)
+{
+   ImlibPipeStep      *step;
+
+   if (rad == 0)
+      return;
+   step = __imlib_PipelineAdd(pl, PIPE_SHARPEN);
+   if (step)
+      step->rad = rad;
+}
+
+void
+__imlib_PipelineAddFilter(ImlibPipeline * pl, ImlibFilter * fil)
+{
+   ImlibPipeStep      *step;
+   ImlibFilter        *nf;
+
+   nf = __imlib_DupFilter(fil);
+   if (!nf)
+      return;
+   step = __imlib_PipelineAdd(pl, PIPE_FILTER);
+   if (!step)
+     {
+        __imlib_FreeFilter(nf);
+        return;
+     }
+   step->fil = nf;
+}
+
+static int          __imlib_PipeProduce(ImlibPipeStage * st, DATA32 * dst,
+                                        int dow, int y, int n);
+
+/* rows [y0, y1) of the output of stage st, requests must move down the
+ * image */
+static const DATA32 *
+__imlib_PipeRows(ImlibPipeStage * st, int y0, int y1, int *stride)
+{
+   DATA32             *buf;
+   int                 drop;
+
+   if (!st->step && !st->copy)
+     {
+        *stride = st->im->w;
+        return st->im->data + (st->sy + y0) * st->im->w + st->sx;
+     }
+
+   /* drop the rows above y0, keep the ones still needed */
+   if (y0 < st->y || y0 >= st->y + st->n)
+     {
+        st->y = y0;
+        st->n = 0;
+     }
+   else if (y0 > st->y)
+     {
+        drop = y0 - st->y;
+        st->n -= drop;
+        memmove(st->buf, st->buf + drop * st->w,
+                st->n * st->w * sizeof(DATA32));
+        st->y = y0;
+     }
+
+   if (y1 - y0 > st->rows)
+     {
+        buf = realloc(st->buf, (y1 - y0) * st->w * sizeof(DATA32));
+        if (!buf)
+           return NULL;
+        st->buf = buf;
+        st->rows = y1 - y0;
+     }
+
+   if (st->y + st->n < y1)
+     {
+        if (__imlib_PipeProduce(st, st->buf + st->n * st->w, st->w,
+                                st->y + st->n, y1 - st->y - st->n))
+           return NULL;
+        st->n = y1 - st->y;
+     }
+
+   *stride = st->w;
+   return st->buf;
+}
+
+/* make rows [y, y + n) of the output of stage st in dst */
+static int
+__imlib_PipeProduce(ImlibPipeStage * st, DATA32 * dst, int dow, int y, int n)
+{
+   const ImlibPipeStep *step = st->step;
+   const DATA32       *src;
+   ImlibImageFlags     fl;
+   int                 i, x, sy, sow;
+
+   if (!step)
+     {
+        /* copying source */
+        for (i = 0; i < n; i++)
+           memcpy(dst + i * dow,
+                  st->im->data + (st->sy + y + i) * st->im->w + st->sx,
+                  st->w * sizeof(DATA32));
+        return 0;
+     }
+
+   if (step->op == PIPE_SCALE)
+     {
+        if (step->aa >= SCALE_BICUBIC)
+           __imlib_ScaleFilterRGBA(st->isi, dst, st->sx, st->sy + y,
+                                   0, 0, st->w, n, dow, st->im->w);
+        else if (step->aa && st->has_alpha)
+           __imlib_ScaleAARGBA(st->isi, dst, st->sx, st->sy + y,
+                               0, 0, st->w, n, dow, st->im->w);
+        else if (step->aa)
+           __imlib_ScaleAARGB(st->isi, dst, st->sx, st->sy + y,
+                              0, 0, st->w, n, dow, st->im->w);
+        else
+           __imlib_ScaleSampleRGBA(st->isi, dst, st->sx, st->sy + y,
+                                   0, 0, st->w, n, dow);
+        /* the RGB scalers leave alpha undefined */
+        if (!st->has_alpha)
+           for (i = 0; i < n; i++)
+              for (x = 0; x < st->w; x++)
+                 dst[i * dow + x] |= 0xff000000;
+        return 0;
+     }
+
+   sy = MAX(y - st->margin, 0);
+   src = __imlib_PipeRows(st->prev, sy, MIN(y + n + st->margin, st->h), &sow);
+   if (!src)
+      return 1;
+
+   switch (step->op)
+     {
+     default:
+        break;
+     case PIPE_CMOD:
+        for (i = 0; i < n; i++)
+           memcpy(dst + i * dow, src + i * sow, st->w * sizeof(DATA32));
+        fl = st->has_alpha ? F_HAS_ALPHA : F_NONE;
+        __imlib_DataCmodApply(dst, st->w, n, dow - st->w, &fl, step->cm);
+        break;
+     case PIPE_BLUR:
+        __imlib_BlurRows(dst, dow, src, sow, sy, st->w, st->h, y, n,
+                         step->rad);
+        break;
+     case PIPE_SHARPEN:
+        __imlib_SharpenRows(dst, dow, src, sow, sy, st->w, st->h, y, n);
+        break;
+     case PIPE_FILTER:
+        __imlib_FilterRows(step->fil, dst, dow, src, sow, sy,
+                           st->w, st->h, y, n);
+        break;
+     }
+
+   return 0;
+}
+
+static void
+__imlib_PipeFree(ImlibPipeStage * stages, int nstages)
+{
+   int                 i;
+
+   for (i = 0; i < nstages; i++)
+     {
+        free(stages[i].buf);
+        if (stages[i].isi)
+           __imlib_FreeScaleInfo(stages[i].isi);
+     }
+   free(stages);
+}
+
+/* stages for steps run on the w x h rectangle at (x, y) of im, a scale step
+ * may only come first, NULL on failure */
+static ImlibPipeStage *
+__imlib_PipeSetup(const ImlibPipeStep * steps, int nsteps, ImlibImage * im,
+                  int x, int y, int w, int h, char copy)
+{
+   ImlibPipeStage     *stages, *st;
+   const ImlibPipeStep *step;
+   int                 i, sx, sy, sw, sh;
+
+   stages = calloc(nsteps + 1, sizeof(ImlibPipeStage));
+   if (!stages)
+      return NULL;
+
+   st = stages;
+   st->im = im;
+   st->sx = x;
+   st->sy = y;
+   st->w = w;
+   st->h = h;
+   st->has_alpha = IMAGE_HAS_ALPHA(im);
+   st->copy = copy;
+
+   for (i = 0; i < nsteps; i++)
+     {
+        step = &steps[i];
+        st = &stages[i + 1];
+        st->step = step;
+        st->prev = st - 1;
+        st->w = st->prev->w;
+        st->h = st->prev->h;
+        st->has_alpha = st->prev->has_alpha;
+
+        switch (step->op)
+          {
+          case PIPE_SCALE:
+             if (i > 0)
+                goto fail;
+             st->w = abs(step->w);
+             st->h = abs(step->h);
+             sx = x;
+             sy = y;
+             sw = w;
+             sh = h;
+             st->im = im;
+             if (step->aa && (sw > st->w || sh > st->h))
+                st->im = __imlib_MipmapSelect(im, &sx, &sy, &sw, &sh,
+                                              step->w, step->h);
+             st->isi = __imlib_CalcScaleInfo(st->im, sw, sh, step->w, step->h,
+                                             step->aa);
+             if (!st->isi)
+                goto fail;
+             st->sx = (sx * st->w) / sw;
+             st->sy = (sy * st->h) / sh;
+             break;
+          case PIPE_CMOD:
+             st->margin = 0;
+             break;
+          case PIPE_BLUR:
+             st->margin = step->rad;
+             break;
+          case PIPE_SHARPEN:
+             st->margin = 1;
+             break;
+          case PIPE_FILTER:
+             st->margin = __imlib_FilterMargin(step->fil);
+             break;
+          }
+     }
+
+   return stages;
+
+ fail:
+   __imlib_PipeFree(stages, nsteps + 1);
+   return NULL;
+}
+
+static int
+__imlib_PipeBandRows(int w)
+{
+   return MAX(PIPE_BAND_SIZE / (w * (int)sizeof(DATA32)), PIPE_BAND_ROWS);
+}
+
+/* index of the last scale step that is not the first step, 0 if none */
+static int
+__imlib_PipeSplit(const ImlibPipeStep * steps, int nsteps)
+{
+   int                 i;
+
+   for (i = nsteps - 1; i > 0; i--)
+      if (steps[i].op == PIPE_SCALE)
+         return i;
+   return 0;
+}
+
+/*
+ * Runs steps on the w x h rectangle at (x, y) of im (clipped to the
+ * image) and returns the result as a new image.
+ */
+ImlibImage         *
+__imlib_PipelineCreateImage(const ImlibPipeStep * steps, int nsteps,
+                            ImlibImage * im, int x, int y, int w, int h)
+{
+   ImlibPipeStage     *stages, *st;
+   ImlibImage         *im_new, *im_tmp;
+   int                 k, yy, n, band;
+
+   CLIP(x, y, w, h, 0, 0, im->w, im->h);
+   if (w <= 0 || h <= 0)
+      return NULL;
+
+   k = __imlib_PipeSplit(steps, nsteps);
+   if (k > 0)
+     {
+        im_tmp = __imlib_PipelineCreateImage(steps, k, im, x, y, w, h);
+        if (!im_tmp)
+           return NULL;
+        im_new = __imlib_PipelineCreateImage(steps + k, nsteps - k, im_tmp,
+                                             0, 0, im_tmp->w, im_tmp->h);
+        __imlib_FreeImage(im_tmp);
+        return im_new;
+     }
+
+   stages = __imlib_PipeSetup(steps, nsteps, im, x, y, w, h, 0);
+   if (!stages)
+      return NULL;
+   st = &stages[nsteps];
+
+   im_new = __imlib_CreateImage(st->w, st->h, NULL);
+   if (!im_new)
+      goto quit;
+   im_new->data = malloc(st->w * st->h * sizeof(DATA32));
+   if (!im_new->data)
+      goto fail;
+   UPDATE_FLAG(im_new->flags, F_HAS_ALPHA, st->has_alpha);
+
+   band = __imlib_PipeBandRows(st->w);
+   for (yy = 0; yy < st->h; yy += n)
+     {
+        n = MIN(band, st->h - yy);
+        if (__imlib_PipeProduce(st, im_new->data + yy * st->w, st->w, yy, n))
+           goto fail;
+     }
+   goto quit;
+
+ fail:
+   __imlib_FreeImage(im_new);
+   im_new = NULL;
+
+ quit:
+   __imlib_PipeFree(stages, nsteps + 1);
+   return im_new;
+}
+
+/*
+ * Runs steps on all of im, replacing its pixels by the result. Without
+ * scaling this works in place, only holding copies of the source rows the
+ * bands not yet written need.
+ */
+void
+__imlib_PipelineApply(const ImlibPipeStep * steps, int nsteps,
+                      ImlibImage * im)
+{
+   ImlibPipeStage     *stages, *st;
+   ImlibImage         *im_new;
+   int                 i, yy, n, band;
+
+   if (nsteps <= 0)
+      return;
+
+   for (i = 0; i < nsteps; i++)
+      if (steps[i].op == PIPE_SCALE)
+         break;
+   if (i < nsteps)
+     {
+        im_new = __imlib_PipelineCreateImage(steps, nsteps, im,
+                                             0, 0, im->w, im->h);
+        if (!im_new)
+           return;
+        __imlib_ReplaceData(im, im_new->data);
+        im->w = im_new->w;
+        im->h = im_new->h;
+        im_new->data = NULL;
+        __imlib_FreeImage(im_new);
+        return;
+     }
+
+   stages = __imlib_PipeSetup(steps, nsteps, im, 0, 0, im->w, im->h, 1);
+   if (!stages)
+      return;
+   st = &stages[nsteps];
+
+   band = __imlib_PipeBandRows(st->w);
+   for (yy = 0; yy < st->h; yy += n)
+     {
+        n = MIN(band, st->h - yy);
+        if (__imlib_PipeProduce(st, im->data + yy * st->w, st->w, yy, n))
+           break;
+     }
+
+   __imlib_PipeFree(stages, nsteps + 1);
+}
+
+/*
+ * Runs steps on the sw x sh rectangle at (sx, sy) of im_src and blends the
+ * result onto im_dst at (dx, dy), band by band.
+ */
+void
+__imlib_PipelineBlend(const ImlibPipeStep * steps, int nsteps,
+                      ImlibImage * im_src, ImlibImage * im_dst, char blend,
+                      char merge_alpha, int sx, int sy, int sw, int sh,
+                      int dx, int dy, ImlibOp op,
+                      int clx, int cly, int clw, int clh)
+{
+   ImlibPipeStage     *stages, *st;
+   ImlibImage         *im_tmp;
+   DATA32             *buf;
+   int                 k, x, y, w, h, yy, n, band, premul;
+
+   CLIP(sx, sy, sw, sh, 0, 0, im_src->w, im_src->h);
+   if (sw <= 0 || sh <= 0)
+      return;
+
+   k = __imlib_PipeSplit(steps, nsteps);
+   if (k > 0)
+     {
+        im_tmp = __imlib_PipelineCreateImage(steps, k, im_src, sx, sy, sw, sh);
+        if (!im_tmp)
+           return;
+        __imlib_PipelineBlend(steps + k, nsteps - k, im_tmp, im_dst, blend,
+                              merge_alpha, 0, 0, im_tmp->w, im_tmp->h,
+                              dx, dy, op, clx, cly, clw, clh);
+        __imlib_FreeImage(im_tmp);
+        return;
+     }
+
+   stages = __imlib_PipeSetup(steps, nsteps, im_src, sx, sy, sw, sh, 0);
+   if (!stages)
+      return;
+   st = &stages[nsteps];
+   buf = NULL;
+
+   /* only make the rows that end up visible */
+   x = dx;
+   y = dy;
+   w = st->w;
+   h = st->h;
+   CLIP(x, y, w, h, 0, 0, im_dst->w, im_dst->h);
+   if (clw)
+      CLIP_TO(x, y, w, h, clx, cly, clw, clh);
+   if (w <= 0 || h <= 0)
+      goto quit;
+
+   band = __imlib_PipeBandRows(st->w);
+   buf = malloc(MIN(band, h) * st->w * sizeof(DATA32));
+   if (!buf)
+      goto quit;
+
+   if (!IMAGE_HAS_ALPHA(im_dst))
+      merge_alpha = 0;
+   if (!st->has_alpha && merge_alpha)
+      blend = 1;
+   premul = IMAGE_ALPHA_PREMUL(im_dst) ? PREMUL_DST : 0;
+
+   for (yy = y - dy; yy < y - dy + h; yy += n)
+     {
+        n = MIN(band, y - dy + h - yy);
+        if (__imlib_PipeProduce(st, buf, st->w, yy, n))
+           break;
+        __imlib_BlendRGBAToData(buf, st->w, n, im_dst->data,
+                                im_dst->w, im_dst->h, x - dx, 0, x, dy + yy,
+                                w, n, blend, merge_alpha, NULL, op,
+                                !st->has_alpha, premul);
+     }
+
+ quit:
+   free(buf);
+   __imlib_PipeFree(stages, nsteps + 1);
+}
@@ -0,0 +1,57 @@
+#ifndef __PIPELINE
+#define __PIPELINE 1
+
+#include "common.h"
+#include "blend.h"
+#include "colormod.h"
+#include "filter.h"
+#include "image.h"
+
+typedef enum {
+   PIPE_SCALE,
+   PIPE_CMOD,
+   PIPE_BLUR,
+   PIPE_SHARPEN,
+   PIPE_FILTER,
+} ImlibPipeOp;
+
+typedef struct {
+   ImlibPipeOp         op;
+   int                 w, h;    /* PIPE_SCALE: Output size, < 0 flips */
+   char                aa;      /* PIPE_SCALE: Scale filter */
+   int                 rad;     /* PIPE_BLUR, PIPE_SHARPEN: Radius */
+   ImlibColorModifier *cm;      /* PIPE_CMOD */
+   ImlibFilter        *fil;     /* PIPE_FILTER */
+} ImlibPipeStep;
+
+typedef struct {
+   ImlibPipeStep      *steps;
+   int                 num, alloc;
+} ImlibPipeline;
+
+ImlibPipeline      *__imlib_PipelineNew(void);
+void                __imlib_PipelineFree(ImlibPipeline * pl);
+void                __imlib_PipelineClear(ImlibPipeline * pl);
+void                __imlib_PipelineAddScale(ImlibPipeline * pl, int w, int h,
+                                             char aa);
+void                __imlib_PipelineAddCmod(ImlibPipeline * pl,
+                                            ImlibColorModifier * cm);
+void                __imlib_PipelineAddBlur(ImlibPipeline * pl, int rad);
+void                __imlib_PipelineAddSharpen(ImlibPipeline * pl, int rad);
+void                __imlib_PipelineAddFilter(ImlibPipeline * pl,
+                                              ImlibFilter * fil);
+
+ImlibImage         *__imlib_PipelineCreateImage(const ImlibPipeStep * steps,
+                                                int nsteps, ImlibImage * im,
+                                                int x, int y, int w, int h);
+void                __imlib_PipelineApply(const ImlibPipeStep * steps,
+                                          int nsteps, ImlibImage * im);
+void                __imlib_PipelineBlend(const ImlibPipeStep * steps,
+                                          int nsteps, ImlibImage * im_src,
+                                          ImlibImage * im_dst, char blend,
+                                          char merge_alpha, int sx, int sy,
+                                          int sw, int sh, int dx, int dy,
+                                          ImlibOp op, int clx, int cly,
+                                          int clw, int clh);
+
+#endif
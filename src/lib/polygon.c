@@ -1091,6 +1091,206 @@ __imlib_Polygon_DrawToImage(ImlibPoly * poly, char close, DATA32 color,
 
 /** Polygon Filling **/
 
+/*
+ * Polygons are filled by a scanline rasteriser using the even-odd rule,
+ * vertices are at the pixel centers.
+ *
+ * The edges enter the active edge table from per row buckets, and the
+ * active edges are kept sorted by x with an insertion sort, as the order
+ * rarely changes much from one scanline to the next.
+ *
+ * Aliased fills cover the pixels with centers inside the polygon plus the
+ * pixels the edges pass through, like the outline does.
+ *
+ * Anti-aliased fills accumulate the coverage in a buffer, the coverage of
+ * a pixel being the sum of the entries up to it. The rows are filled in
+ * bands without vertices inside - the whole row, or the halves above and
+ * below the vertices at its middle. If no edges cross within a band every
+ * edge adds the exact area right of it, with alternating sign. Otherwise
+ * the band is sampled at POLY_AA_SUB sub-scanlines per row, adding the
+ * exact horizontal coverage of the spans.
+ * To keep the pixel convention of aliased fills, a pixel is then covered at
+ * least as much as an anti-aliased line along the edges covers it. Edges on
+ * pixel centers (e.g. integer rectangles) therefore come out solid, and the
+ * result is the aliased fill with smoothed edges.
+ *
+ * The scratch memory is kept for the next fill.
+ */
+
+#define POLY_AA_SHIFT	4
+#define POLY_AA_SUB	(1 << POLY_AA_SHIFT)
+
+/* the coverage accumulated for a pixel to alpha */
+#define POLY_AA_COV(c) \
+   (((c) * 255 + (128 << POLY_AA_SHIFT)) >> (8 + POLY_AA_SHIFT))
+
+/* floor() for values well inside the int range */
+#define IFLOOR(v)	((int)(v) - ((v) < (int)(v)))
+
+typedef struct {
+   double              x;       /* x at the current scanline, band top */
+   double              xb;      /* x at the band bottom */
+   double              x0, x1;  /* x at y0 and y1 */
+   double              dxdy;
+   int                 y0, y1;  /* y0 <= y1 */
+   int                 next;    /* Next edge entering at the same row */
+} PolyFillEdge;
+
+static struct {
+   PolyFillEdge       *edges;
+   PolyFillEdge      **active;
+   int                 nedges;
+   int                *rows;    /* First edge entering at row */
+   int                 nrows;
+   DATA8              *mask;    /* Coverage, all 0 between fills */
+   int                *acc;     /* Accumulated coverage, all 0 between fills */
+   DATA8              *touched; /* Blocks of 32 acc entries changed */
+   int                 nx;
+} fill_scratch;
+
+static int
+__imlib_Polygon_FillScratch(int nedges, int nrows, int nx)
+{
+   void               *p;
+
+   if (nedges > fill_scratch.nedges)
+     {
+        p = realloc(fill_scratch.edges, nedges * sizeof(PolyFillEdge));
+        if (!p)
+           return 0;
+        fill_scratch.edges = p;
+        p = realloc(fill_scratch.active, nedges * sizeof(PolyFillEdge *));
+        if (!p)
+           return 0;
+        fill_scratch.active = p;
+        fill_scratch.nedges = nedges;
+     }
+
+   if (nrows > fill_scratch.nrows)
+     {
+        p = realloc(fill_scratch.rows, nrows * sizeof(int));
+        if (!p)
+           return 0;
+        fill_scratch.rows = p;
+        fill_scratch.nrows = nrows;
+     }
+
+   /* the coverage may touch the two entries past the end */
+   if (nx > fill_scratch.nx)
+     {
+        p = realloc(fill_scratch.mask, nx + 2);
+        if (!p)
+           return 0;
+        fill_scratch.mask = p;
+        memset(fill_scratch.mask, 0, nx + 2);
+        p = realloc(fill_scratch.acc, (nx + 2) * sizeof(int));
+        if (!p)
+           return 0;
+        fill_scratch.acc = p;
+        memset(fill_scratch.acc, 0, (nx + 2) * sizeof(int));
+        p = realloc(fill_scratch.touched, (nx + 2 + 31) >> 5);
+        if (!p)
+           return 0;
+        fill_scratch.touched = p;
+        memset(fill_scratch.touched, 0, (nx + 2 + 31) >> 5);
+        fill_scratch.nx = nx;
+     }
+
+   return 1;
+}
+
+/* set up the edges touching rows ty to by, bucketed by the first row */
+static void
+__imlib_Polygon_FillEdges(ImlibPoly * poly, int ty, int by, char horz)
+{
+   ImlibPoint         *v0, *v1, *w;
+   PolyFillEdge       *e;
+   int                 i, n, row;
+
+   for (row = 0; row <= by - ty; row++)
+      fill_scratch.rows[row] = -1;
+
+   for (i = n = 0; i < poly->pointcount; i++)
+     {
+        v0 = poly->points + i;
+        v1 = poly->points + ((i < poly->pointcount - 1) ? i + 1 : 0);
+        if (v1->y < v0->y)
+          {
+             w = v0;
+             v0 = v1;
+             v1 = w;
+          }
+        if ((v1->y < ty) || (v0->y > by))
+           continue;
+        if ((v0->y == v1->y) && !horz)
+           continue;
+
+        e = fill_scratch.edges + n;
+        e->x0 = v0->x;
+        e->x1 = v1->x;
+        e->y0 = v0->y;
+        e->y1 = v1->y;
+        e->dxdy = (v0->y == v1->y) ? 0 :
+           (double)(v1->x - v0->x) / (v1->y - v0->y);
+        e->xb = 0;
+
+        row = MAX(v0->y, ty) - ty;
+        e->next = fill_scratch.rows[row];
+        fill_scratch.rows[row] = n;
+        n++;
+     }
+}
+
+/* add the edges entering at row, drop the ones ending before it */
+static int
+__imlib_Polygon_FillActive(int nactive, int row, int y)
+{
+   PolyFillEdge      **active = fill_scratch.active;
+   int                 i, j;
+
+   for (i = j = 0; i < nactive; i++)
+     {
+        if (active[i]->y1 >= y)
+           active[j++] = active[i];
+     }
+   for (i = fill_scratch.rows[row]; i >= 0; i = fill_scratch.edges[i].next)
+      active[j++] = fill_scratch.edges + i;
+
+   return j;
+}
+
+/* sort by x, edges leaving the same vertex by xb */
+static void
+__imlib_Polygon_FillSort(PolyFillEdge ** active, int nactive)
+{
+   PolyFillEdge       *e;
+   int                 i, j;
+
+   for (i = 1; i < nactive; i++)
+     {
+        e = active[i];
+        for (j = i; j > 0; j--)
+          {
+             if ((active[j - 1]->x < e->x) ||
+                 ((active[j - 1]->x == e->x) && (active[j - 1]->xb <= e->xb)))
+                break;
+             active[j] = active[j - 1];
+          }
+        active[j] = e;
+     }
+}
+
+#define FILL_SPAN(lx, rx)			\
+do {						\
+   CLIP_SPAN(lx, rx, clx, clrx);		\
+   if (lx <= rx)				\
+     {						\
+	memset(mask + lx, 255, rx - lx + 1);	\
+	if (lx < x0)  x0 = lx;			\
+	if (rx > x1)  x1 = rx;			\
+     }						\
+} while (0)
+
 /* aliased filling */
 
 static void
@@ -1100,316 +1300,407 @@ __imlib_Polygon_FillToData(ImlibPoly * poly, DATA32 color,
                            ImlibOp op, char dst_alpha, char blend)
 {
    ImlibShapedSpanDrawFunction sfunc;
-   IndexedValue       *ysort;
-   PolyEdge           *edge;
-   int                 k, a_a = 0;
-   int                 nactive_edges, nactive_horz_edges, nvertices;
-   int                 clrx, clby, ty, by, y;
-   int                 x0, x1, nx0, nx1;
+   PolyFillEdge      **active, *e;
+   int                 i, in, nactive, clrx, clby, y;
+   int                 x0, x1, lx, rx;
+   double              xl, xr;
    DATA32             *p;
-   DATA8              *s0, *s1, *ps;
+   DATA8              *mask;
 
-   INIT_POLY();
+   sfunc = __imlib_GetShapedSpanDrawFunction(op, dst_alpha, blend);
+   if (!sfunc)
+      return;
 
-   while (y <= by)
-     {
-        int                 j;
+   clrx = clx + clw - 1;
+   clby = cly + clh - 1;
+   CLIP_SPAN(clx, clrx, poly->lx, poly->rx);
+   if (clrx < clx)
+      return;
+   CLIP_SPAN(cly, clby, poly->ty, poly->by);
+   if (clby < cly)
+      return;
+   clw = clrx - clx + 1;
 
-        while ((k < nvertices) && (poly->points[ysort[k].index].y <= y))
-          {
-             int                 i = ysort[k].index;
+   if (!__imlib_Polygon_FillScratch(poly->pointcount, clby - cly + 1, clw))
+      return;
+   __imlib_Polygon_FillEdges(poly, cly, clby, 1);
 
-             if (i > 0)
-                j = i - 1;
-             else
-                j = nvertices - 1;
+   active = fill_scratch.active;
+   mask = fill_scratch.mask - clx;
+   nactive = 0;
+   xl = 0;
+   p = dst + (dstw * cly);
 
-             if (poly->points[j].y < y)
-                DEL_EDGE(j);
-             else
-                ADD_EDGE(j);
+   for (y = cly; y <= clby; y++, p += dstw)
+     {
+        nactive = __imlib_Polygon_FillActive(nactive, y - cly, y);
+        for (i = 0; i < nactive; i++)
+          {
+             e = active[i];
+             e->x = e->x0 + (y - e->y0) * e->dxdy;
+          }
+        __imlib_Polygon_FillSort(active, nactive);
 
-             if (i < (nvertices - 1))
-                j = i + 1;
-             else
-                j = 0;
+        x0 = clrx + 1;
+        x1 = clx - 1;
 
-             if (poly->points[j].y < y)
-                DEL_EDGE(i);
+        /* the pixel centers inside, edges cross the scanline in [y0, y1) */
+        for (i = in = 0; i < nactive; i++)
+          {
+             e = active[i];
+             if (y == e->y1)
+                continue;
+             if (in)
+               {
+                  lx = -IFLOOR(-xl);
+                  rx = IFLOOR(e->x);
+                  FILL_SPAN(lx, rx);
+               }
              else
-                ADD_EDGE(i);
-
-             k++;
+                xl = e->x;
+             in = !in;
           }
 
-        qsort(edge, nactive_edges, sizeof(PolyEdge), poly_edge_sorter);
-
-        /* clear alpha buffer */
-        if (x0 <= x1)
-           memset(s1 + x0, 0, x1 - x0 + 1);
-
-        x0 = nx0;
-        x1 = nx1;
-        nx0 = clrx + 1;
-        nx1 = clx - 1;
-
-        /* draw to alpha buffer */
-        j = 0;
-        while (j < nactive_edges)
+        /* the pixels the edges pass through in [y - .5, y + .5] */
+        for (i = 0; i < nactive; i++)
           {
-             int                 lx, rx;
-             int                 le_lx, le_rx;
-             int                 re_lx, re_rx;
-             PolyEdge           *le, *re;
-
-             if (j < (nactive_edges - 1))
+             e = active[i];
+             if (e->y0 == e->y1)
+               {
+                  xl = e->x0;
+                  xr = e->x1;
+               }
+             else if ((e->dxdy >= -1.) && (e->dxdy <= 1.))
                {
-                  le = edge + j;
-                  re = le + 1;
+                  xl = xr = e->x;
                }
-             else if (j > 0)
+             else
+               {
+                  xl = (y > e->y0) ? e->x - .5 * e->dxdy : e->x0;
+                  xr = (y < e->y1) ? e->x + .5 * e->dxdy : e->x1;
+               }
+             if (xl > xr)
                {
-                  le = edge + (j - 1);
-                  le->xx -= le->dxx;
-                  re = le + 1;
+                  lx = IFLOOR(xr + .5);
+                  rx = IFLOOR(xl + .5);
                }
              else
                {
-                  re = le = edge;
+                  lx = IFLOOR(xl + .5);
+                  rx = IFLOOR(xr + .5);
                }
+             FILL_SPAN(lx, rx);
+          }
 
-             GET_EDGE_RANGE(le, le_lx, le_rx);
-             if ((le_lx < le->v0->x) && (le->dxx > 0))
-                le_lx = le->v0->x;
-             GET_EDGE_RANGE(re, re_lx, re_rx);
-             if ((re_rx > re->v0->x) && (re->dxx < 0))
-                re_rx = re->v0->x;
+        if (x0 > x1)
+           continue;
+        sfunc(mask + x0, color, p + x0, x1 - x0 + 1);
+        memset(mask + x0, 0, x1 - x0 + 1);
+     }
+}
 
-             /* draw left edge */
-             switch (le->type)
-               {
-               case STEEP_EDGE:
-                  {
-                     le_rx += (le->xx - (le_rx << 16)) >> 15;
-                     if (le_rx < x0)
-                        x0 = le_rx;
+/* anti-aliased filling */
 
-                     if ((le->v1->y == (y + 1)) && (y < clby))
-                       {
-                          lx = le->v1->x;
-                          if (IN_SEGMENT(lx, clx, clw))
-                            {
-                               *(s1 + lx) = 255;
-                               if (lx < nx0)
-                                  nx0 = lx;
-                            }
-                       }
-                     break;
-                  }
-               case SHALLOW_EDGE:
-                  {
-                     int                 x, ey, eyy;
+/* add the coverage of xl to xr, x relative to the clip rectangle */
+static void
+__imlib_Polygon_FillAccSpan(int *acc, double xl, double xr, int w,
+                            int *x0, int *x1)
+{
+   int                 l, r;
+
+   /* pixel i covers [i - .5, i + .5), in units of 1/256 */
+   xl += .5;
+   xr += .5;
+   if (xl < 0)
+      xl = 0;
+   if (xr > w)
+      xr = w;
+   if (xl >= xr)
+      return;
 
-                     x = le_lx;
-                     eyy = ((le->v0->y) << 16) + (x - (le->v0->x)) * (le->dyy);
-                     ey = eyy >> 16;
-                     ey += (eyy - (ey << 16)) >> 15;
+   l = xl * 256;
+   r = xr * 256;
+   acc[l >> 8] += 256 - (l & 0xff);
+   acc[(l >> 8) + 1] += l & 0xff;
+   acc[r >> 8] -= 256 - (r & 0xff);
+   acc[(r >> 8) + 1] -= r & 0xff;
+   fill_scratch.touched[l >> 13] = 1;
+   fill_scratch.touched[((l >> 8) + 1) >> 5] = 1;
+   fill_scratch.touched[r >> 13] = 1;
+   fill_scratch.touched[((r >> 8) + 1) >> 5] = 1;
+
+   if ((l >> 8) < *x0)
+      *x0 = l >> 8;
+   if ((r >> 8) + 1 > *x1)
+      *x1 = (r >> 8) + 1;
+}
 
-                     if (le->dyy > 0)
-                       {
-                          while (ey < y)
-                            {
-                               eyy += le->dyy;
-                               ey = eyy >> 16;
-                               ey += (eyy - (ey << 16)) >> 15;
-                               x++;
-                            }
-                          le_rx = x;
-                          if (x < x0)
-                             x0 = x;
+/* add the area right of an edge crossing the band from xt at the top to xb
+ * at the bottom, full being the coverage of a pixel right of it */
+static void
+__imlib_Polygon_FillAccEdge(int *acc, double xt, double xb, int full, int w,
+                            int *x0, int *x1)
+{
+   int                 i, i0, i1, prev, cur, cumf, stepf;
+   double              s, h, hr, f0, f1, a0, a1, am, cum;
 
-                          if (((y + 1) == le->v1->y) && (y < clby))
-                            {
-                               if (x < nx0)
-                                  nx0 = x;
-                               rx = le->v1->x;
-                               while ((ey <= (y + 1)) && (x <= rx))
-                                 {
-                                    if ((ey == (y + 1))
-                                        && IN_SEGMENT(x, clx, clw))
-                                       *(s1 + x) = 255;
-                                    eyy += le->dyy;
-                                    ey = eyy >> 16;
-                                    ey += (eyy - (ey << 16)) >> 15;
-                                    x++;
-                                 }
-                               if (x > nx1)
-                                  nx1 = x;
-                            }
-                          break;
-                       }
+#define ACC(i, a) \
+do { \
+   cum += (a); \
+   cur = IFLOOR(cum * full + .5); \
+   acc[i] += cur - prev; \
+   fill_scratch.touched[(i) >> 5] = 1; \
+   prev = cur; \
+} while (0)
 
-                     while (ey > y)
-                       {
-                          eyy += le->dyy;
-                          ey = eyy >> 16;
-                          ey += (eyy - (ey << 16)) >> 15;
-                          x++;
-                       }
-                     le_rx = x;
-                     if (x < x0)
-                        x0 = x;
-                     break;
-                  }
-               case HORZ_EDGE:
-                  {
-                     lx = le_lx;
-                     rx = le_rx;
-                     CLIP_SPAN(lx, rx, clx, clrx);
-                     if (lx <= rx)
-                       {
-                          memset(s0 + lx, 255, rx - lx + 1);
-                          if (lx < x0)
-                             x0 = lx;
-                       }
-                     le_rx++;
-                     break;
-                  }
+   /* pixel i covers [i - .5, i + .5) */
+   xt += .5;
+   xb += .5;
+   if (xt > xb)
+     {
+        s = xt;
+        xt = xb;
+        xb = s;
+     }
+   cum = 0;
+   prev = 0;
+   h = 1;
+   hr = 0;
+
+   /* the parts left and right of the clip rectangle cover all or none of
+    * it, the part inside covers its share h of the band */
+   if ((xt < 0) || (xb > w))
+     {
+        if ((xb <= 0) || (xt >= w))
+          {
+             i0 = (xb <= 0) ? 0 : w;
+             ACC(i0, 1);
+             if (i0 < *x0)
+                *x0 = i0;
+             if (i0 > *x1)
+                *x1 = i0;
+             return;
+          }
+        s = 1 / (xb - xt);
+        if (xt < 0)
+          {
+             ACC(0, -xt * s);
+             h -= -xt * s;
+             xt = 0;
+          }
+        if (xb > w)
+          {
+             hr = (xb - w) * s;
+             h -= hr;
+             xb = w;
+          }
+     }
 
-               default:
-                  break;
-               }
+   i0 = xt;
+   i1 = -IFLOOR(-xb);
 
-             /* draw right edge */
-             switch (re->type)
+   if (i1 <= i0 + 1)
+     {
+        /* within one pixel */
+        i1 = i0 + 1;
+        ACC(i0, h * (i1 - .5 * (xt + xb)));
+        ACC(i1, h * (.5 * (xt + xb) - i0));
+     }
+   else
+     {
+        s = h / (xb - xt);
+        f0 = xt - i0;
+        a0 = .5 * s * (1 - f0) * (1 - f0);
+        f1 = xb - i1 + 1;
+        am = .5 * s * f1 * f1;
+        ACC(i0, a0);
+        if (i1 == i0 + 2)
+          {
+             ACC(i0 + 1, h - a0 - am);
+          }
+        else
+          {
+             a1 = s * (1.5 - f0);
+             ACC(i0 + 1, a1 - a0);
+             /* s per pixel in between, in 16.16 fixed point */
+             cumf = cum * full * 65536;
+             stepf = s * full * 65536;
+             for (i = i0 + 2; i < i1 - 1; i++)
                {
-               case STEEP_EDGE:
-                  {
-                     re_lx += (re->xx - (re_lx << 16)) >> 15;
-                     if (re_lx > x1)
-                        x1 = re_lx;
+                  cumf += stepf;
+                  cur = (cumf + 32768) >> 16;
+                  acc[i] += cur - prev;
+                  prev = cur;
+               }
+             memset(fill_scratch.touched + ((i0 + 2) >> 5), 1,
+                    ((i1 - 2) >> 5) - ((i0 + 2) >> 5) + 1);
+             cum += (i1 - i0 - 3) * s;
+             ACC(i1 - 1, h - a1 - (i1 - i0 - 3) * s - am);
+          }
+        ACC(i1, am);
+     }
+   if (hr > 0)
+     {
+        i1 = w;
+        ACC(i1, hr);
+     }
+#undef ACC
 
-                     if ((re->v1->y == (y + 1)) && (y < clby))
-                       {
-                          rx = re->v1->x;
-                          if (IN_SEGMENT(rx, clx, clw))
-                            {
-                               *(s1 + rx) = 255;
-                               if (rx > nx1)
-                                  nx1 = rx;
-                            }
-                       }
-                     break;
-                  }
-               case SHALLOW_EDGE:
-                  {
-                     int                 x, ey, eyy;
+   if (i0 < *x0)
+      *x0 = i0;
+   if (i1 > *x1)
+      *x1 = i1;
+}
 
-                     x = re_rx;
-                     eyy = ((re->v0->y) << 16) + (x - (re->v0->x)) * (re->dyy);
-                     ey = eyy >> 16;
-                     ey += (eyy - (ey << 16)) >> 15;
+/* add the coverage of sub-scanlines k0 to k1 - 1 of row y */
+static void
+__imlib_Polygon_FillAccBand(int nactive, int y, int k0, int k1, int clx,
+                            int w, int *x0, int *x1)
+{
+   PolyFillEdge      **active = fill_scratch.active, *e;
+   int                 i, k, in, full;
+   double              yt, yb, ys, xl;
 
-                     if (re->dyy > 0)
-                       {
-                          while (ey > y)
-                            {
-                               eyy -= re->dyy;
-                               ey = eyy >> 16;
-                               ey += (eyy - (ey << 16)) >> 15;
-                               x--;
-                            }
-                          re_lx = x;
-                          if (x > x1)
-                             x1 = x;
-                          break;
-                       }
+   yt = y + (double)(2 * k0 - POLY_AA_SUB) / (2 * POLY_AA_SUB);
+   yb = y + (double)(2 * k1 - POLY_AA_SUB) / (2 * POLY_AA_SUB);
 
-                     while (ey < y)
-                       {
-                          eyy -= re->dyy;
-                          ey = eyy >> 16;
-                          ey += (eyy - (ey << 16)) >> 15;
-                          x--;
-                       }
-                     re_lx = x;
-                     if (x > x1)
-                        x1 = x;
+   for (i = 0; i < nactive; i++)
+     {
+        e = active[i];
+        e->x = e->x0 + (yt - e->y0) * e->dxdy;
+        e->xb = e->x0 + (yb - e->y0) * e->dxdy;
+     }
+   __imlib_Polygon_FillSort(active, nactive);
 
-                     if (((y + 1) == re->v1->y) && (y < clby))
-                       {
-                          if (x > nx1)
-                             nx1 = x;
-                          lx = re->v1->x;
-                          while ((ey <= (y + 1)) && (x >= lx))
-                            {
-                               if ((ey == (y + 1)) && IN_SEGMENT(x, clx, clw))
-                                  *(s1 + x) = 255;
-                               eyy -= re->dyy;
-                               ey = eyy >> 16;
-                               ey += (eyy - (ey << 16)) >> 15;
-                               x--;
-                            }
-                          if (x < nx0)
-                             nx0 = x;
-                       }
-                     break;
-                  }
-               case HORZ_EDGE:
-                  {
-                     lx = re_lx;
-                     rx = re_rx;
-                     CLIP_SPAN(lx, rx, clx, clrx);
-                     if (lx <= rx)
-                       {
-                          memset(s0 + lx, 255, rx - lx + 1);
-                          if (rx > x1)
-                             x1 = rx;
-                       }
-                     re_lx--;
-                     break;
-                  }
-
-               default:
-                  break;
-               }
+   /* the edges in the band span it, if they don't cross the area right of
+    * each is added with alternating sign */
+   xl = 0;
+   for (i = in = 0; i < nactive; i++)
+     {
+        e = active[i];
+        if ((e->y0 >= yb) || (e->y1 <= yt))
+           continue;
+        if (in && (e->xb < xl))
+           break;
+        xl = e->xb;
+        in = 1;
+     }
 
-             /* draw span between edges */
-             lx = le_rx;
-             rx = re_lx;
-             CLIP_SPAN(lx, rx, clx, clrx);
-             if ((lx <= rx) && (y >= cly))
-                memset(s0 + lx, 255, rx - lx + 1);
+   if (i >= nactive)
+     {
+        full = (k1 - k0) << 8;
+        for (i = 0; i < nactive; i++)
+          {
+             e = active[i];
+             if ((e->y0 >= yb) || (e->y1 <= yt))
+                continue;
+             __imlib_Polygon_FillAccEdge(fill_scratch.acc, e->x - clx,
+                                         e->xb - clx, full, w, x0, x1);
+             full = -full;
+          }
+        return;
+     }
 
-             le->xx += le->dxx;
-             if (le != re)
-                re->xx += re->dxx;
+   for (k = k0; k < k1; k++)
+     {
+        /* edges cross the sub-scanline in [y0, y1) */
+        ys = y + (double)(2 * k + 1 - POLY_AA_SUB) / (2 * POLY_AA_SUB);
+        for (i = 0; i < nactive; i++)
+          {
+             e = active[i];
+             e->x = e->x0 + (ys - e->y0) * e->dxdy;
+          }
+        __imlib_Polygon_FillSort(active, nactive);
 
-             j += 2;
+        for (i = in = 0; i < nactive; i++)
+          {
+             e = active[i];
+             if ((ys < e->y0) || (ys >= e->y1))
+                continue;
+             if (in)
+                __imlib_Polygon_FillAccSpan(fill_scratch.acc, xl - clx,
+                                            e->x - clx, w, x0, x1);
+             else
+                xl = e->x;
+             in = !in;
           }
+     }
+}
 
-        if (nactive_horz_edges > 0)
-           DEL_HORZ_EDGES();
+/* raise the coverage of row y to that of anti-aliased lines along the edges,
+ * x relative to the clip rectangle */
+static void
+__imlib_Polygon_FillAccLines(DATA8 * mask, int nactive, int y, int clx,
+                             int w, int *x0, int *x1)
+{
+   PolyFillEdge      **active = fill_scratch.active, *e;
+   int                 i, j, xi, xa, xb, cov;
+   double              x, yy, f;
 
-        /* draw alpha buffer to dst */
-        CLIP_SPAN(x0, x1, clx, clrx);
-        if ((x0 <= x1) && (y >= cly))
-           sfunc(s0 + x0, color, p + x0, x1 - x0 + 1);
+#define COVER(i, c) \
+do { \
+   if ((i) >= 0 && (i) < w && (c) > 0) \
+     { \
+        if ((c) > mask[i]) \
+           mask[i] = (c); \
+        if ((i) < *x0) \
+           *x0 = (i); \
+        if ((i) > *x1) \
+           *x1 = (i); \
+     } \
+} while (0)
 
-        /* exchange alpha buffers */
-        ps = s0;
-        s0 = s1;
-        s1 = ps;
+   for (i = 0; i < nactive; i++)
+     {
+        e = active[i];
+        if ((y < e->y0) || (y > e->y1))
+           continue;
 
-        y++;
-        p += dstw;
+        if (e->y0 == e->y1)
+          {
+             /* horizontal, the whole edge */
+             xa = MAX(MIN(e->x0, e->x1) - clx, 0);
+             xb = MIN(MAX(e->x0, e->x1) - clx, w - 1);
+             for (xi = xa; xi <= xb; xi++)
+                COVER(xi, 255);
+          }
+        else if ((e->dxdy >= -1.) && (e->dxdy <= 1.))
+          {
+             /* steep, split between the two pixels around x */
+             x = e->x0 + (y - e->y0) * e->dxdy - clx;
+             j = IFLOOR(x);
+             f = x - j;
+             COVER(j, (int)((1 - f) * 255 + .5));
+             COVER(j + 1, (int)(f * 255 + .5));
+          }
+        else
+          {
+             /* flat, the columns where the edge is within a row of y */
+             x = e->x0 + (y - e->y0) * e->dxdy;
+             xa = IFLOOR(x - fabs(e->dxdy));
+             xb = -IFLOOR(-(x + fabs(e->dxdy)));
+             xa = MAX(xa, MIN(e->x0, e->x1));
+             xb = MIN(xb, MAX(e->x0, e->x1));
+             xa = MAX(xa, clx);
+             xb = MIN(xb, clx + w - 1);
+             for (xi = xa; xi <= xb; xi++)
+               {
+                  yy = e->y0 + (xi - e->x0) / e->dxdy;
+                  j = IFLOOR(yy);
+                  f = yy - j;
+                  if (j == y)
+                     cov = (1 - f) * 255 + .5;
+                  else if (j + 1 == y)
+                     cov = f * 255 + .5;
+                  else
+                     continue;
+                  COVER(xi - clx, cov);
+               }
+          }
      }
-
-   DE_INIT_POLY();
+#undef COVER
 }
 
-/* anti-aliased filling */
-
 static void
 __imlib_Polygon_FillToData_AA(ImlibPoly * poly, DATA32 color,
                               DATA32 * dst, int dstw,
@@ -1417,379 +1708,94 @@ __imlib_Polygon_FillToData_AA(ImlibPoly * poly, DATA32 color,
                               ImlibOp op, char dst_alpha, char blend)
 {
    ImlibShapedSpanDrawFunction sfunc;
-   IndexedValue       *ysort;
-   PolyEdge           *edge;
-   int                 k, a_a = 1;
-   int                 nactive_edges, nactive_horz_edges, nvertices;
-   int                 clrx, clby, ty, by, y, yy, prev_y, prev_yy;
-   int                 x0, x1, nx0, nx1;
+   PolyFillEdge      **active;
+   int                 i, j, nactive, clrx, clby, y;
+   int                 x0, x1, c, *acc;
    DATA32             *p;
-   DATA8              *s0, *s1, *ps;
+   DATA8              *mask;
 
-   INIT_POLY();
-
-   yy = y << 16;
-   prev_y = y - 1;
-   prev_yy = prev_y << 16;
-
-   while (y <= by)
-     {
-        int                 j;
+   sfunc = __imlib_GetShapedSpanDrawFunction(op, dst_alpha, blend);
+   if (!sfunc)
+      return;
 
-        while ((k < nvertices) && (poly->points[ysort[k].index].y <= y))
-          {
-             int                 i = ysort[k].index;
+   clrx = clx + clw - 1;
+   clby = cly + clh - 1;
+   CLIP_SPAN(clx, clrx, poly->lx, poly->rx);
+   if (clrx < clx)
+      return;
+   CLIP_SPAN(cly, clby, poly->ty, poly->by);
+   if (clby < cly)
+      return;
+   clw = clrx - clx + 1;
 
-             if (i > 0)
-                j = i - 1;
-             else
-                j = nvertices - 1;
+   if (!__imlib_Polygon_FillScratch(poly->pointcount, clby - cly + 1, clw))
+      return;
+   __imlib_Polygon_FillEdges(poly, cly, clby, 1);
 
-             if (poly->points[j].y < y)
-                DEL_EDGE(j);
-             else
-                ADD_EDGE(j);
+   active = fill_scratch.active;
+   mask = fill_scratch.mask;
+   acc = fill_scratch.acc;
+   nactive = 0;
+   p = dst + (dstw * cly) + clx;
 
-             if (i < (nvertices - 1))
-                j = i + 1;
-             else
-                j = 0;
+   for (y = cly; y <= clby; y++, p += dstw)
+     {
+        nactive = __imlib_Polygon_FillActive(nactive, y - cly, y);
 
-             if (poly->points[j].y < y)
-                DEL_EDGE(i);
-             else
-                ADD_EDGE(i);
+        x0 = clw + 2;
+        x1 = -1;
 
-             k++;
+        /* split the row at vertices */
+        for (i = 0; i < nactive; i++)
+          {
+             if ((active[i]->y0 == y) || (active[i]->y1 == y))
+                break;
           }
-
-        qsort(edge, nactive_edges, sizeof(PolyEdge), poly_edge_sorter);
-
-        /* clear alpha buffer */
-        if (x0 <= x1)
-           memset(s1 + x0, 0, x1 - x0 + 1);
-
-        x0 = nx0;
-        x1 = nx1;
-        nx0 = clrx + 1;
-        nx1 = clx - 1;
-        /* draw to alpha buffer */
-        j = 0;
-        while (j < nactive_edges)
+        if (i < nactive)
           {
-             int                 lx, rx;
-             int                 le_lx, le_rx;
-             int                 re_lx, re_rx;
-             PolyEdge           *le, *re;
+             __imlib_Polygon_FillAccBand(nactive, y, 0, POLY_AA_SUB / 2,
+                                         clx, clw, &x0, &x1);
+             __imlib_Polygon_FillAccBand(nactive, y, POLY_AA_SUB / 2,
+                                         POLY_AA_SUB, clx, clw, &x0, &x1);
+          }
+        else
+          {
+             __imlib_Polygon_FillAccBand(nactive, y, 0, POLY_AA_SUB,
+                                         clx, clw, &x0, &x1);
+          }
 
-             if (j < (nactive_edges - 1))
-               {
-                  le = edge + j;
-                  re = le + 1;
-               }
-             else if (j > 0)
+        for (i = x0, c = 0; i <= x1; i = j)
+          {
+             j = MIN((i | 31) + 1, x1 + 1);
+             if (!fill_scratch.touched[i >> 5])
                {
-                  le = edge + (j - 1);
-                  le->xx -= le->dxx;
-                  re = le + 1;
+                  memset(mask + i, POLY_AA_COV(c), j - i);
+                  continue;
                }
-             else
+             fill_scratch.touched[i >> 5] = 0;
+             for (; i < j; i++)
                {
-                  re = le = edge;
+                  c += acc[i];
+                  acc[i] = 0;
+                  mask[i] = POLY_AA_COV(c);
                }
-
-             GET_EDGE_RANGE(le, le_lx, le_rx);
-             if ((le_lx < le->v0->x) && (le->dxx > 0))
-                le_lx = le->v0->x;
-             GET_EDGE_RANGE(re, re_lx, re_rx);
-             if ((re_rx > re->v0->x) && (re->dxx < 0))
-                re_rx = re->v0->x;
-
-             /* draw left aa edge */
-             switch (le->type)
-               {
-               case STEEP_EDGE:
-                  {
-                     DATA32              tmp;
-                     DATA8               aa;
-
-                     if (le_lx < x0)
-                        x0 = le_lx;
-                     le_rx = le_lx + 1;
-
-                     if (IN_SEGMENT(le_lx, clx, clw))
-                       {
-                          aa = 255 - ((le->xx - (le_lx << 16)) >> 8);
-                          ps = s0 + le_lx;
-                          BLEND_ALPHA(ps, aa, tmp);
-                       }
-
-                     if ((le->v1->y == (y + 1)) && (y < clby))
-                       {
-                          lx = (le->xx + le->dxx) >> 16;
-                          if (IN_SEGMENT(lx, clx, clw))
-                            {
-                               aa =
-                                  255 - ((le->xx + le->dxx - (lx << 16)) >> 8);
-                               ps = s1 + lx;
-                               BLEND_ALPHA(ps, aa, tmp);
-                               if (lx < nx0)
-                                  nx0 = lx;
-                            }
-                       }
-                     break;
-                  }
-               case SHALLOW_EDGE:
-                  {
-                     int                 x, ey, eyy;
-
-                     if (le_lx < x0)
-                        x0 = le_lx;
-                     x = le_lx;
-                     eyy = ((le->v0->y) << 16) + (x - (le->v0->x)) * (le->dyy);
-                     ey = eyy >> 16;
-
-                     if (le->dyy > 0)
-                       {
-                          while (ey < y)
-                            {
-                               DATA32              tmp;
-                               DATA8               aa;
-
-                               if ((ey == prev_y) && IN_SEGMENT(x, clx, clw))
-                                 {
-                                    aa = ((eyy - prev_yy) >> 8);
-                                    ps = s0 + x;
-                                    BLEND_ALPHA(ps, aa, tmp);
-                                 }
-                               eyy += le->dyy;
-                               ey = eyy >> 16;
-                               x++;
-                            }
-                          le_rx = x;
-
-                          if (((y + 1) == le->v1->y) && (y < clby))
-                            {
-                               if (x < nx0)
-                                  nx0 = x;
-                               rx = le->v1->x;
-                               while ((ey == y) && (x <= rx))
-                                 {
-                                    DATA32              tmp;
-                                    DATA8               aa;
-
-                                    if (IN_SEGMENT(x, clx, clw))
-                                      {
-                                         aa = ((eyy - yy) >> 8);
-                                         ps = s1 + x;
-                                         BLEND_ALPHA(ps, aa, tmp);
-                                      }
-                                    eyy += le->dyy;
-                                    ey = eyy >> 16;
-                                    x++;
-                                 }
-                            }
-                          break;
-                       }
-
-                     while (ey >= y)
-                       {
-                          DATA32              tmp;
-                          DATA8               aa;
-
-                          if ((ey == y) && IN_SEGMENT(x, clx, clw))
-                            {
-                               aa = 255 - ((eyy - yy) >> 8);
-                               ps = s0 + x;
-                               BLEND_ALPHA(ps, aa, tmp);
-                            }
-                          eyy += le->dyy;
-                          ey = eyy >> 16;
-                          x++;
-                       }
-                     le_rx = x;
-                     break;
-                  }
-               case HORZ_EDGE:
-                  {
-                     lx = le_lx;
-                     rx = le_rx;
-                     CLIP_SPAN(lx, rx, clx, clrx);
-                     if (lx <= rx)
-                       {
-                          memset(s0 + lx, 255, rx - lx + 1);
-                          if (lx < x0)
-                             x0 = lx;
-                       }
-                     le_rx++;
-                     break;
-                  }
-
-               default:
-                  break;
-               }
-
-             /* draw right aa edge */
-             switch (re->type)
-               {
-               case STEEP_EDGE:
-                  {
-                     DATA32              tmp;
-                     DATA8               aa;
-
-                     rx = re_lx + 1;
-                     if (rx > x1)
-                        x1 = rx;
-
-                     if (IN_SEGMENT(rx, clx, clw))
-                       {
-                          aa = (re->xx - (re_lx << 16)) >> 8;
-                          ps = s0 + rx;
-                          BLEND_ALPHA(ps, aa, tmp);
-                       }
-
-                     if ((re->v1->y == (y + 1)) && (y < clby))
-                       {
-                          lx = (re->xx + re->dxx) >> 16;
-                          rx = lx + 1;
-                          if (IN_SEGMENT(rx, clx, clw))
-                            {
-                               aa = ((re->xx + re->dxx - (lx << 16)) >> 8);
-                               ps = s1 + rx;
-                               BLEND_ALPHA(ps, aa, tmp);
-                               if (rx > nx1)
-                                  nx1 = rx;
-                            }
-                       }
-                     break;
-                  }
-               case SHALLOW_EDGE:
-                  {
-                     int                 x, ey, eyy;
-
-                     if (re_rx > x1)
-                        x1 = re_rx;
-                     x = re_rx;
-                     eyy = ((re->v0->y) << 16) + (x - (re->v0->x)) * (re->dyy);
-                     ey = eyy >> 16;
-
-                     if (re->dyy > 0)
-                       {
-                          while (ey >= y)
-                            {
-                               DATA32              tmp;
-                               DATA8               aa;
-
-                               if ((ey == y) && IN_SEGMENT(x, clx, clw))
-                                 {
-                                    aa = 255 - ((eyy - yy) >> 8);
-                                    ps = s0 + x;
-                                    BLEND_ALPHA(ps, aa, tmp);
-                                 }
-                               eyy -= re->dyy;
-                               ey = eyy >> 16;
-                               x--;
-                            }
-                          re_lx = x;
-                          break;
-                       }
-
-                     while (ey < y)
-                       {
-                          DATA32              tmp;
-                          DATA8               aa;
-
-                          if ((ey == prev_y) && IN_SEGMENT(x, clx, clw))
-                            {
-                               aa = ((eyy - prev_yy) >> 8);
-                               ps = s0 + x;
-                               BLEND_ALPHA(ps, aa, tmp);
-                            }
-                          eyy -= re->dyy;
-                          ey = eyy >> 16;
-                          x--;
-                       }
-                     re_lx = x;
-
-                     if (((y + 1) == re->v1->y) && (y < clby))
-                       {
-                          if (x > nx1)
-                             nx1 = x;
-                          lx = re->v1->x;
-                          while ((ey == y) && (x >= lx))
-                            {
-                               DATA32              tmp;
-                               DATA8               aa;
-
-                               if (IN_SEGMENT(x, clx, clw))
-                                 {
-                                    aa = ((eyy - yy) >> 8);
-                                    ps = s1 + x;
-                                    BLEND_ALPHA(ps, aa, tmp);
-                                 }
-                               eyy -= re->dyy;
-                               ey = eyy >> 16;
-                               x--;
-                            }
-                       }
-                     break;
-                  }
-               case HORZ_EDGE:
-                  {
-                     lx = re_lx;
-                     rx = re_rx;
-                     CLIP_SPAN(lx, rx, clx, clrx);
-                     if (lx <= rx)
-                       {
-                          memset(s0 + lx, 255, rx - lx + 1);
-                          if (rx > x1)
-                             x1 = rx;
-                       }
-                     re_lx--;
-                     break;
-                  }
-
-               default:
-                  break;
-               }
-
-             /* draw span between edges */
-             lx = le_rx;
-             rx = re_lx;
-             CLIP_SPAN(lx, rx, clx, clrx);
-             if ((lx <= rx) && (y >= cly))
-                memset(s0 + lx, 255, rx - lx + 1);
-
-             le->xx += le->dxx;
-             if (le != re)
-                re->xx += re->dxx;
-
-             j += 2;
+          }
+        if (x1 >= clw)
+          {
+             /* keep the mask clear past the clip rectangle */
+             i = MAX(x0, clw);
+             if (i <= x1)
+                memset(mask + i, 0, x1 - i + 1);
+             x1 = clw - 1;
           }
 
-        if (nactive_horz_edges > 0)
-           DEL_HORZ_EDGES();
-
-        /* draw alpha buffer to dst */
-        CLIP_SPAN(x0, x1, clx, clrx);
-        if ((x0 <= x1) && (y >= cly))
-           sfunc(s0 + x0, color, p + x0, x1 - x0 + 1);
-
-        /* exchange alpha buffers */
-        ps = s0;
-        s0 = s1;
-        s1 = ps;
-
-        prev_yy = yy;
-        prev_y = y;
-
-        y++;
-        yy = y << 16;
+        __imlib_Polygon_FillAccLines(mask, nactive, y, clx, clw, &x0, &x1);
 
-        p += dstw;
+        if (x0 > x1)
+           continue;
+        sfunc(mask + x0, color, p + x0, x1 - x0 + 1);
+        memset(mask + x0, 0, x1 - x0 + 1);
      }
-
-   DE_INIT_POLY();
 }
 
 void
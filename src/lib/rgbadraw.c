@@ -1,25 +1,30 @@
 #include "common.h"
 
 #include <math.h>
+#ifdef DO_SIMD
+#include <immintrin.h>
+#endif
 
+#include "asm_c.h"
 #include "blend.h"
 #include "colormod.h"
 #include "image.h"
+#include "pipeline.h"
 #include "rgbadraw.h"
 #include "scale.h"
 #include "updates.h"
 
-void
-__imlib_FlipImageHoriz(ImlibImage * im)
+static void
+__imlib_FlipDataHoriz(DATA32 * data, int w, int h)
 {
    DATA32             *p1, *p2, tmp;
    int                 x, y;
 
-   for (y = 0; y < im->h; y++)
+   for (y = 0; y < h; y++)
      {
-        p1 = im->data + (y * im->w);
-        p2 = im->data + ((y + 1) * im->w) - 1;
-        for (x = 0; x < (im->w >> 1); x++)
+        p1 = data + (y * w);
+        p2 = data + ((y + 1) * w) - 1;
+        for (x = 0; x < (w >> 1); x++)
           {
              tmp = *p1;
              *p1 = *p2;
@@ -28,22 +33,19 @@ __imlib_FlipImageHoriz(ImlibImage * im)
              p2--;
           }
      }
-   x = im->border.left;
-   im->border.left = im->border.right;
-   im->border.right = x;
 }
 
-void
-__imlib_FlipImageVert(ImlibImage * im)
+static void
+__imlib_FlipDataVert(DATA32 * data, int w, int h)
 {
    DATA32             *p1, *p2, tmp;
    int                 x, y;
 
-   for (y = 0; y < (im->h >> 1); y++)
+   for (y = 0; y < (h >> 1); y++)
      {
-        p1 = im->data + (y * im->w);
-        p2 = im->data + ((im->h - 1 - y) * im->w);
-        for (x = 0; x < im->w; x++)
+        p1 = data + (y * w);
+        p2 = data + ((h - 1 - y) * w);
+        for (x = 0; x < w; x++)
           {
              tmp = *p1;
              *p1 = *p2;
@@ -52,20 +54,17 @@ __imlib_FlipImageVert(ImlibImage * im)
              p2++;
           }
      }
-   x = im->border.top;
-   im->border.top = im->border.bottom;
-   im->border.bottom = x;
 }
 
-void
-__imlib_FlipImageBoth(ImlibImage * im)
+static void
+__imlib_FlipDataBoth(DATA32 * data, int w, int h)
 {
    DATA32             *p1, *p2, tmp;
    int                 x;
 
-   p1 = im->data;
-   p2 = im->data + (im->h * im->w) - 1;
-   for (x = (im->w * im->h) / 2; --x >= 0;)
+   p1 = data;
+   p2 = data + (h * w) - 1;
+   for (x = (w * h) / 2; --x >= 0;)
      {
         tmp = *p1;
         *p1 = *p2;
@@ -73,12 +72,240 @@ __imlib_FlipImageBoth(ImlibImage * im)
         p1++;
         p2--;
      }
-   x = im->border.top;
+}
+
+void
+__imlib_FlipImageHoriz(ImlibImage * im)
+{
+   int                 tmp;
+
+   __imlib_FlipDataHoriz(im->data, im->w, im->h);
+   tmp = im->border.left;
+   im->border.left = im->border.right;
+   im->border.right = tmp;
+}
+
+void
+__imlib_FlipImageVert(ImlibImage * im)
+{
+   int                 tmp;
+
+   __imlib_FlipDataVert(im->data, im->w, im->h);
+   tmp = im->border.top;
+   im->border.top = im->border.bottom;
+   im->border.bottom = tmp;
+}
+
+void
+__imlib_FlipImageBoth(ImlibImage * im)
+{
+   int                 tmp;
+
+   __imlib_FlipDataBoth(im->data, im->w, im->h);
+   tmp = im->border.top;
    im->border.top = im->border.bottom;
-   im->border.bottom = x;
-   x = im->border.left;
+   im->border.bottom = tmp;
+   tmp = im->border.left;
    im->border.left = im->border.right;
-   im->border.right = x;
+   im->border.right = tmp;
+}
+
+/*
+ * Transposing is done in TR_TILE x TR_TILE tiles so both the rows read and
+ * the rows written stay in cache (and TLB), with 4x4 SSE2 register
+ * transposes inside the tiles where available.
+ */
+
+#define TR_TILE 32
+
+#ifdef DO_SIMD
+#define TR4X4(r0, r1, r2, r3) \
+do { \
+   __m128i _t0 = _mm_unpacklo_epi32(r0, r1); \
+   __m128i _t1 = _mm_unpacklo_epi32(r2, r3); \
+   __m128i _t2 = _mm_unpackhi_epi32(r0, r1); \
+   __m128i _t3 = _mm_unpackhi_epi32(r2, r3); \
+   r0 = _mm_unpacklo_epi64(_t0, _t1); \
+   r1 = _mm_unpackhi_epi64(_t0, _t1); \
+   r2 = _mm_unpacklo_epi64(_t2, _t3); \
+   r3 = _mm_unpackhi_epi64(_t2, _t3); \
+} while (0)
+
+#define LOAD4(p)     _mm_loadu_si128((const __m128i *)(p))
+#define STORE4(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define REV4(v)      _mm_shuffle_epi32(v, 0x1b)
+
+/* transposed copy of the 4x4 block at s, see __imlib_TransposeData() */
+__attribute__((target("sse2")))
+static void
+__imlib_Transpose4x4(DATA32 * d, int dxs, int dys, const DATA32 * s,
+                     int sstride)
+{
+   __m128i             r0, r1, r2, r3;
+
+   r0 = LOAD4(s);
+   r1 = LOAD4(s + sstride);
+   r2 = LOAD4(s + 2 * sstride);
+   r3 = LOAD4(s + 3 * sstride);
+   TR4X4(r0, r1, r2, r3);
+   if (dys < 0)
+     {
+        r0 = REV4(r0);
+        r1 = REV4(r1);
+        r2 = REV4(r2);
+        r3 = REV4(r3);
+        d -= 3;
+     }
+   STORE4(d, r0);
+   STORE4(d + dxs, r1);
+   STORE4(d + 2 * dxs, r2);
+   STORE4(d + 3 * dxs, r3);
+}
+
+/* transpose the 4x4 blocks at a and b and swap them */
+__attribute__((target("sse2")))
+static void
+__imlib_TransposeSwap4x4(DATA32 * a, DATA32 * b, int stride)
+{
+   __m128i             a0, a1, a2, a3, b0, b1, b2, b3;
+
+   a0 = LOAD4(a);
+   a1 = LOAD4(a + stride);
+   a2 = LOAD4(a + 2 * stride);
+   a3 = LOAD4(a + 3 * stride);
+   b0 = LOAD4(b);
+   b1 = LOAD4(b + stride);
+   b2 = LOAD4(b + 2 * stride);
+   b3 = LOAD4(b + 3 * stride);
+   TR4X4(a0, a1, a2, a3);
+   TR4X4(b0, b1, b2, b3);
+   STORE4(a, b0);
+   STORE4(a + stride, b1);
+   STORE4(a + 2 * stride, b2);
+   STORE4(a + 3 * stride, b3);
+   STORE4(b, a0);
+   STORE4(b + stride, a1);
+   STORE4(b + 2 * stride, a2);
+   STORE4(b + 3 * stride, a3);
+}
+#endif
+
+static void
+__imlib_TransposeRect(DATA32 * dst, int dxs, int dys, const DATA32 * src,
+                      int sstride, int x0, int y0, int x1, int y1)
+{
+   const DATA32       *s;
+   DATA32             *d;
+   int                 x, y;
+
+   for (x = x0; x < x1; x++)
+     {
+        s = src + (y0 * sstride) + x;
+        d = dst + (x * dxs) + (y0 * dys);
+        for (y = y0; y < y1; y++)
+          {
+             *d = *s;
+             s += sstride;
+             d += dys;
+          }
+     }
+}
+
+/*
+ * Transposed copy of w x h pixels: the source pixel at (x, y) goes to
+ * dst[x * dxs + y * dys], where dys is 1 or -1 and dxs is +- the
+ * destination row stride.
+ */
+__EXPORT__ void
+__imlib_TransposeData(DATA32 * dst, int dxs, int dys, const DATA32 * src,
+                      int sstride, int w, int h)
+{
+   int                 tx, ty, tw, th, w4, h4;
+
+#ifdef DO_SIMD
+   int                 x, y, simd = __imlib_do_simd() != SIMD_NONE;
+#endif
+
+   for (ty = 0; ty < h; ty += TR_TILE)
+     {
+        th = MIN(TR_TILE, h - ty);
+        for (tx = 0; tx < w; tx += TR_TILE)
+          {
+             tw = MIN(TR_TILE, w - tx);
+             w4 = h4 = 0;
+#ifdef DO_SIMD
+             if (simd)
+               {
+                  w4 = tw & ~3;
+                  h4 = th & ~3;
+                  for (x = 0; x < w4; x += 4)
+                     for (y = 0; y < h4; y += 4)
+                        __imlib_Transpose4x4(dst + ((tx + x) * dxs) +
+                                             ((ty + y) * dys), dxs, dys,
+                                             src + ((ty + y) * sstride) +
+                                             tx + x, sstride);
+               }
+#endif
+             /* the right and bottom edges not done in 4x4 blocks */
+             __imlib_TransposeRect(dst, dxs, dys, src, sstride,
+                                   tx + w4, ty, tx + tw, ty + th);
+             __imlib_TransposeRect(dst, dxs, dys, src, sstride,
+                                   tx, ty + h4, tx + w4, ty + th);
+          }
+     }
+}
+
+/* in-place transpose of a square n x n image */
+static void
+__imlib_TransposeSquare(DATA32 * data, int n)
+{
+   DATA32             *a, *b, tmp;
+   int                 tx, ty, tw, th, x, y, x0, w4, h4;
+
+#ifdef DO_SIMD
+   int                 simd = __imlib_do_simd() != SIMD_NONE;
+#endif
+
+   /* swap the pixels of tile (tx, ty) with those of tile (ty, tx), on the
+    * diagonal tiles only the ones above the diagonal */
+   for (ty = 0; ty < n; ty += TR_TILE)
+     {
+        th = MIN(TR_TILE, n - ty);
+        for (tx = ty; tx < n; tx += TR_TILE)
+          {
+             tw = MIN(TR_TILE, n - tx);
+             w4 = h4 = 0;
+#ifdef DO_SIMD
+             if (simd)
+               {
+                  w4 = tw & ~3;
+                  h4 = th & ~3;
+                  for (y = 0; y < h4; y += 4)
+                     for (x = (tx == ty) ? y : 0; x < w4; x += 4)
+                        __imlib_TransposeSwap4x4(data + (ty + y) * n + tx + x,
+                                                 data + (tx + x) * n + ty + y,
+                                                 n);
+               }
+#endif
+             for (y = 0; y < th; y++)
+               {
+                  if (tx == ty)
+                     x0 = MAX(y + 1, w4);
+                  else
+                     x0 = (y < h4) ? w4 : 0;
+                  a = data + (ty + y) * n + tx + x0;
+                  b = data + (tx + x0) * n + ty + y;
+                  for (x = x0; x < tw; x++)
+                    {
+                       tmp = *a;
+                       *a = *b;
+                       *b = tmp;
+                       a++;
+                       b += n;
+                    }
+               }
+          }
+     }
 }
 
 /*\ Directions (source is right/down):
@@ -90,14 +317,25 @@ __imlib_FlipImageBoth(ImlibImage * im)
 void
 __imlib_FlipImageDiagonal(ImlibImage * im, int direction)
 {
-   DATA32             *data, *to, *from;
-   int                 x, y, w, hw, tmp;
+   DATA32             *data;
+   int                 w, h, off, dxs, dys, tmp;
+
+   w = im->w;
+   h = im->h;
+
+   /* square images are transposed in place and then flipped */
+   data = NULL;
+   if (w != h)
+     {
+        data = malloc(w * h * sizeof(DATA32));
+        if (!data)
+           return;
+     }
+   else
+     {
+        __imlib_TransposeSquare(im->data, w);
+     }
 
-   data = malloc(im->w * im->h * sizeof(DATA32));
-   w = im->h;
-   im->h = im->w;
-   im->w = w;
-   hw = w * im->h;
    switch (direction)
      {
      default:
@@ -108,8 +346,9 @@ __imlib_FlipImageDiagonal(ImlibImage * im, int direction)
         tmp = im->border.bottom;
         im->border.bottom = im->border.right;
         im->border.right = tmp;
-        to = data;
-        hw = -hw + 1;
+        off = 0;
+        dxs = h;
+        dys = 1;
         break;
      case 1:                   /*\ DOWN_LEFT \ */
         tmp = im->border.top;
@@ -117,8 +356,11 @@ __imlib_FlipImageDiagonal(ImlibImage * im, int direction)
         im->border.left = im->border.bottom;
         im->border.bottom = im->border.right;
         im->border.right = tmp;
-        to = data + w - 1;
-        hw = -hw - 1;
+        if (!data)
+           __imlib_FlipDataHoriz(im->data, w, h);
+        off = h - 1;
+        dxs = h;
+        dys = -1;
         break;
      case 2:                   /*\ UP_RIGHT \ */
         tmp = im->border.top;
@@ -126,9 +368,11 @@ __imlib_FlipImageDiagonal(ImlibImage * im, int direction)
         im->border.right = im->border.bottom;
         im->border.bottom = im->border.left;
         im->border.left = tmp;
-        to = data + hw - w;
-        w = -w;
-        hw = hw + 1;
+        if (!data)
+           __imlib_FlipDataVert(im->data, w, h);
+        off = (w - 1) * h;
+        dxs = -h;
+        dys = 1;
         break;
      case 3:                   /*\ UP_LEFT \ */
         tmp = im->border.top;
@@ -137,134 +381,145 @@ __imlib_FlipImageDiagonal(ImlibImage * im, int direction)
         tmp = im->border.bottom;
         im->border.bottom = im->border.left;
         im->border.left = tmp;
-        to = data + hw - 1;
-        w = -w;
-        hw = hw - 1;
+        if (!data)
+           __imlib_FlipDataBoth(im->data, w, h);
+        off = (w * h) - 1;
+        dxs = -h;
+        dys = -1;
         break;
      }
 
-   from = im->data;
-   for (x = im->w; --x >= 0;)
+   im->w = h;
+   im->h = w;
+
+   if (data)
      {
-        for (y = im->h; --y >= 0;)
-          {
-             *to = *from;
-             from++;
-             to += w;
-          }
-        to += hw;
+        __imlib_TransposeData(data + off, dxs, dys, im->data, w, w, h);
+        __imlib_ReplaceData(im, data);
      }
-   __imlib_ReplaceData(im, data);
 }
 
+/* rows [y, y + n) of the box blur of a w x h image, src holding the input
+ * rows from sy on (as far as the blur reaches) */
 void
-__imlib_BlurImage(ImlibImage * im, int rad)
+__imlib_BlurRows(DATA32 * dst, int dow, const DATA32 * src, int sow, int sy,
+                 int w, int h, int y, int n, int rad)
 {
-   DATA32             *p1, *p2, *data;
-   int                 x, y, mx, my, mw, mh, mt, xx, yy;
-   int                 a, r, g, b;
+   const DATA32       *p;
+   int                 x, yy, mh, mt, a, r, g, b;
    int                *as, *rs, *gs, *bs;
 
-   if (rad < 1)
+   as = calloc(4 * w, sizeof(int));
+   if (!as)
       return;
-   data = malloc(im->w * im->h * sizeof(DATA32));
-   as = malloc(sizeof(int) * im->w);
-   rs = malloc(sizeof(int) * im->w);
-   gs = malloc(sizeof(int) * im->w);
-   bs = malloc(sizeof(int) * im->w);
-
-   for (y = 0; y < im->h; y++)
+   rs = as + w;
+   gs = rs + w;
+   bs = gs + w;
+
+#define COL_ADD(p, s) \
+   as[x] s ((p)[x] >> 24) & 0xff; \
+   rs[x] s ((p)[x] >> 16) & 0xff; \
+   gs[x] s ((p)[x] >> 8) & 0xff; \
+   bs[x] s (p)[x] & 0xff;
+#define ROW_ADD(x, s) \
+   a s as[x]; \
+   r s rs[x]; \
+   g s gs[x]; \
+   b s bs[x];
+
+   /* column sums over the rows in reach of the first row, then moved down
+    * row by row */
+   for (yy = MAX(y - rad, 0); yy < MIN(y + rad + 1, h); yy++)
      {
-        my = y - rad;
-        mh = (rad << 1) + 1;
-        if (my < 0)
+        p = src + (yy - sy) * sow;
+        for (x = 0; x < w; x++)
           {
-             mh += my;
-             my = 0;
+             COL_ADD(p, +=);
           }
-        if ((my + mh) > im->h)
-           mh = im->h - my;
+     }
 
-        p1 = data + (y * im->w);
-        memset(as, 0, im->w * sizeof(int));
-        memset(rs, 0, im->w * sizeof(int));
-        memset(gs, 0, im->w * sizeof(int));
-        memset(bs, 0, im->w * sizeof(int));
+   for (; n > 0; n--, y++, dst += dow)
+     {
+        mh = MIN(y + rad + 1, h) - MAX(y - rad, 0);
 
-        for (yy = 0; yy < mh; yy++)
+        a = r = g = b = 0;
+        for (x = 0; x < rad && x < w; x++)
           {
-             p2 = im->data + ((yy + my) * im->w);
-             for (x = 0; x < im->w; x++)
+             ROW_ADD(x, +=);
+          }
+        for (x = 0; x < w; x++)
+          {
+             if (x + rad < w)
                {
-                  as[x] += (*p2 >> 24) & 0xff;
-                  rs[x] += (*p2 >> 16) & 0xff;
-                  gs[x] += (*p2 >> 8) & 0xff;
-                  bs[x] += *p2 & 0xff;
-                  p2++;
+                  ROW_ADD(x + rad, +=);
+               }
+             if (x - rad - 1 >= 0)
+               {
+                  ROW_ADD(x - rad - 1, -=);
                }
+             mt = (MIN(x + rad + 1, w) - MAX(x - rad, 0)) * mh;
+             dst[x] = PIXEL_ARGB(a / mt, r / mt, g / mt, b / mt);
           }
-        if (im->w > ((rad << 1) + 1))
+
+        if (n == 1)
+           break;
+        if (y + rad + 1 < h)
           {
-             for (x = 0; x < im->w; x++)
+             p = src + (y + rad + 1 - sy) * sow;
+             for (x = 0; x < w; x++)
                {
-                  a = 0;
-                  r = 0;
-                  g = 0;
-                  b = 0;
-                  mx = x - rad;
-                  mw = (rad << 1) + 1;
-                  if (mx < 0)
-                    {
-                       mw += mx;
-                       mx = 0;
-                    }
-                  if ((mx + mw) > im->w)
-                     mw = im->w - mx;
-                  mt = mw * mh;
-                  for (xx = mx; xx < (mw + mx); xx++)
-                    {
-                       a += as[xx];
-                       r += rs[xx];
-                       g += gs[xx];
-                       b += bs[xx];
-                    }
-                  a = a / mt;
-                  r = r / mt;
-                  g = g / mt;
-                  b = b / mt;
-                  *p1 = PIXEL_ARGB(a, r, g, b);
-                  p1++;
+                  COL_ADD(p, +=);
                }
           }
-        else
+        if (y - rad >= 0)
           {
+             p = src + (y - rad - sy) * sow;
+             for (x = 0; x < w; x++)
+               {
+                  COL_ADD(p, -=);
+               }
           }
      }
+
+#undef COL_ADD
+#undef ROW_ADD
+
    free(as);
-   free(rs);
-   free(gs);
-   free(bs);
-   __imlib_ReplaceData(im, data);
 }
 
 void
-__imlib_SharpenImage(ImlibImage * im, int rad)
+__imlib_BlurImage(ImlibImage * im, int rad)
 {
-   DATA32             *data, *p1, *p2;
-   int                 a, r, g, b, x, y;
+   ImlibPipeStep       step = {.op = PIPE_BLUR,.rad = rad };
 
-   if (rad == 0)
+   if (rad < 1)
       return;
+   __imlib_PipelineApply(&step, 1, im);
+}
 
-   data = malloc(im->w * im->h * sizeof(DATA32));
-   if (!data)
-      return;
+/* rows [y, y + n) of the sharpened w x h image, src holding the input rows
+ * from sy on (one more above and below), edge pixels are copied */
+void
+__imlib_SharpenRows(DATA32 * dst, int dow, const DATA32 * src, int sow,
+                    int sy, int w, int h, int y, int n)
+{
+   const DATA32       *p1;
+   DATA32             *p2;
+   int                 a, r, g, b, x;
 
-   for (y = 1; y < (im->h - 1); y++)
+   for (; n > 0; n--, y++, dst += dow)
      {
-        p1 = im->data + 1 + (y * im->w);
-        p2 = data + 1 + (y * im->w);
-        for (x = 1; x < (im->w - 1); x++)
+        p1 = src + (y - sy) * sow;
+        if (y == 0 || y == h - 1 || w < 3)
+          {
+             memcpy(dst, p1, w * sizeof(DATA32));
+             continue;
+          }
+        dst[0] = p1[0];
+        dst[w - 1] = p1[w - 1];
+        p1++;
+        p2 = dst + 1;
+        for (x = 1; x < (w - 1); x++)
           {
              b = (int)((p1[0]) & 0xff) * 5;
              g = (int)((p1[0] >> 8) & 0xff) * 5;
@@ -278,14 +533,14 @@ __imlib_SharpenImage(ImlibImage * im, int rad)
              g -= (int)((p1[1] >> 8) & 0xff);
              r -= (int)((p1[1] >> 16) & 0xff);
              a -= (int)((p1[1] >> 24) & 0xff);
-             b -= (int)((p1[-im->w]) & 0xff);
-             g -= (int)((p1[-im->w] >> 8) & 0xff);
-             r -= (int)((p1[-im->w] >> 16) & 0xff);
-             a -= (int)((p1[-im->w] >> 24) & 0xff);
-             b -= (int)((p1[im->w]) & 0xff);
-             g -= (int)((p1[im->w] >> 8) & 0xff);
-             r -= (int)((p1[im->w] >> 16) & 0xff);
-             a -= (int)((p1[im->w] >> 24) & 0xff);
+             b -= (int)((p1[-sow]) & 0xff);
+             g -= (int)((p1[-sow] >> 8) & 0xff);
+             r -= (int)((p1[-sow] >> 16) & 0xff);
+             a -= (int)((p1[-sow] >> 24) & 0xff);
+             b -= (int)((p1[sow]) & 0xff);
+             g -= (int)((p1[sow] >> 8) & 0xff);
+             r -= (int)((p1[sow] >> 16) & 0xff);
+             a -= (int)((p1[sow] >> 24) & 0xff);
 
              a = (a & ((~a) >> 16));
              a = ((a | ((a & 256) - ((a & 256) >> 8))));
@@ -301,8 +556,16 @@ __imlib_SharpenImage(ImlibImage * im, int rad)
              p1++;
           }
      }
+}
 
-   __imlib_ReplaceData(im, data);
+void
+__imlib_SharpenImage(ImlibImage * im, int rad)
+{
+   ImlibPipeStep       step = {.op = PIPE_SHARPEN,.rad = rad };
+
+   if (rad == 0)
+      return;
+   __imlib_PipelineApply(&step, 1, im);
 }
 
 void
@@ -52,6 +52,26 @@ typedef struct {
    int                 ty, by;
 } ImlibPoly;
 
+typedef enum {
+   DRAW_POINT,
+   DRAW_LINE,
+   DRAW_RECT,
+   DRAW_FILL_RECT,
+   DRAW_ELLIPSE,
+   DRAW_FILL_ELLIPSE
+} ImlibDrawType;
+
+typedef struct {
+   ImlibDrawType       type;
+   int                 x, y;    /* Point, line start, corner or center */
+   int                 a, b;    /* Line end, size or amplitudes */
+} ImlibDrawItem;
+
+typedef struct {
+   ImlibDrawItem      *items;
+   int                 num, alloc;
+} ImlibDrawList;
+
 /* image related operations: in rgbadraw.c */
 
 void                __imlib_FlipImageHoriz(ImlibImage * im);
@@ -59,7 +79,13 @@ void                __imlib_FlipImageVert(ImlibImage * im);
 void                __imlib_FlipImageBoth(ImlibImage * im);
 void                __imlib_FlipImageDiagonal(ImlibImage * im, int direction);
 void                __imlib_BlurImage(ImlibImage * im, int rad);
+void                __imlib_BlurRows(DATA32 * dst, int dow, const DATA32 * src,
+                                     int sow, int sy, int w, int h,
+                                     int y, int n, int rad);
 void                __imlib_SharpenImage(ImlibImage * im, int rad);
+void                __imlib_SharpenRows(DATA32 * dst, int dow,
+                                        const DATA32 * src, int sow, int sy,
+                                        int w, int h, int y, int n);
 void                __imlib_TileImageHoriz(ImlibImage * im);
 void                __imlib_TileImageVert(ImlibImage * im);
 
@@ -142,4 +168,18 @@ void                __imlib_Polygon_FillToImage(ImlibPoly * poly, DATA32 color,
                                                 ImlibOp op, char blend,
                                                 char anti_alias);
 
+/* draw lists: in drawlist.c */
+
+ImlibDrawList      *__imlib_DrawListNew(void);
+void                __imlib_DrawListFree(ImlibDrawList * dl);
+void                __imlib_DrawListClear(ImlibDrawList * dl);
+void                __imlib_DrawListAdd(ImlibDrawList * dl, ImlibDrawType type,
+                                        int x, int y, int a, int b);
+void                __imlib_DrawList_DrawToImage(const ImlibDrawList * dl,
+                                                 DATA32 color, ImlibImage * im,
+                                                 int clx, int cly,
+                                                 int clw, int clh,
+                                                 ImlibOp op, char blend,
+                                                 char anti_alias);
+
 #endif
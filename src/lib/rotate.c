@@ -1,8 +1,13 @@
 #include "common.h"
 
+#ifdef DO_SIMD
+#include <immintrin.h>
+#endif
+
 #include "asm_c.h"
 #include "blend.h"
 #include "rotate.h"
+#include "threads.h"
 
 /*\ Linear interpolation functions \*/
 /*\ Between two values \*/
@@ -50,149 +55,413 @@
 		((f1) & _ROTATE_PREC_BITS) * ((f2) & _ROTATE_PREC_BITS)) >> (2 * _ROTATE_PREC);	\
 	} while (0)
 
-/*\ Rotate by pixel sampling only, target inside source \*/
+#define ROT_BAND       32       /* Rows per job when threading */
+#define ROT_MT_PIXELS  (256 * 256)      /* Minimum size for threading */
+
+typedef struct {
+   DATA32             *src, *dest;
+   int                 sow, sw, sh, dow, dw, dh;
+   int                 x, y, dxh, dyh, dxv, dyv;
+   char                aa;
+} ImlibRotateRun;
+
+/*\ Division rounding towards -infinity, b > 0 \*/
+static inline int
+__imlib_DivFloor(int a, int b)
+{
+   return (a >= 0) ? a / b : -((b - 1 - a) / b);
+}
+
+/*\ Narrow [*l .. *r) to the steps i where v + i * dv is in [0 .. t) \*/
 static void
-__imlib_RotateSampleInside(DATA32 * src, DATA32 * dest, int sow, int dow,
-                           int dw, int dh, int x, int y,
-                           int dxh, int dyh, int dxv, int dyv)
+__imlib_RotateClip(int v, int dv, int t, int *l, int *r)
 {
-   int                 i;
+   int                 lo, hi;
 
-   if ((dw < 1) || (dh < 1))
-      return;
+   if (dv > 0)
+     {
+        lo = -__imlib_DivFloor(v, dv);
+        hi = __imlib_DivFloor(t - 1 - v, dv) + 1;
+     }
+   else if (dv < 0)
+     {
+        lo = -__imlib_DivFloor(t - 1 - v, -dv);
+        hi = __imlib_DivFloor(v, -dv) + 1;
+     }
+   else
+     {
+        lo = 0;
+        hi = ((unsigned)v < (unsigned)t) ? *r : 0;
+     }
+
+   lo = MAX(*l, lo);
+   hi = MIN(*r, hi);
+   if (hi < lo)
+      lo = hi = *l;
+   *l = lo;
+   *r = hi;
+}
 
-   while (1)
+/*\ Rotate by pixel sampling only, n pixels of a row inside source \*/
+static void
+__imlib_RotateSampleInside(DATA32 * src, DATA32 * dest, int sow, int n,
+                           int x, int y, int dxh, int dyh)
+{
+   for (; n > 0; n--)
      {
-        i = dw - 1;
-        do
-          {
-             *dest = src[(x >> _ROTATE_PREC) + ((y >> _ROTATE_PREC) * sow)];
-             /*\ RIGHT; \ */
-             x += dxh;
-             y += dyh;
-             dest++;
-          }
-        while (--i >= 0);
-        if (--dh <= 0)
-           break;
-        /*\ DOWN/LEFT; \ */
-        x += dxv - dw * dxh;
-        y += dyv - dw * dyh;
-        dest += (dow - dw);
+        *dest++ = src[(x >> _ROTATE_PREC) + ((y >> _ROTATE_PREC) * sow)];
+        /*\ RIGHT; \ */
+        x += dxh;
+        y += dyh;
      }
 }
 
 /*\ Same as last function, but with antialiasing \*/
 static void
-__imlib_RotateAAInside(DATA32 * src, DATA32 * dest, int sow, int dow,
-                       int dw, int dh, int x, int y,
-                       int dxh, int dyh, int dxv, int dyv)
+__imlib_RotateAAInside(DATA32 * src, DATA32 * dest, int sow, int n,
+                       int x, int y, int dxh, int dyh)
 {
-   int                 i;
+   for (; n > 0; n--)
+     {
+        DATA32             *src_x_y = (src + (x >> _ROTATE_PREC) +
+                                       ((y >> _ROTATE_PREC) * sow));
+        INTERP_ARGB(dest, src_x_y, sow, x, y);
+        /*\ RIGHT; \ */
+        x += dxh;
+        y += dyh;
+        dest++;
+     }
+}
 
-   if ((dw < 1) || (dh < 1))
-      return;
+#ifdef DO_SIMD
+/*\ AVX2 versions of the above, 8 pixels at a time using gathers.
+|*| The interpolation is done in 32 bits per channel, wrapping the same way
+|*| as the C code, so the results are identical.
+\*/
+__attribute__((target("avx2")))
+static inline __m256i
+__imlib_RotateIndex_avx2(__m256i vx, __m256i vy, __m256i vsow)
+{
+   return _mm256_add_epi32(_mm256_srai_epi32(vx, _ROTATE_PREC),
+                           _mm256_mullo_epi32(_mm256_srai_epi32(vy,
+                                                                _ROTATE_PREC),
+                                              vsow));
+}
 
-   while (1)
+__attribute__((target("avx2")))
+static void
+__imlib_RotateSampleInside_avx2(DATA32 * src, DATA32 * dest, int sow, int n,
+                                int x, int y, int dxh, int dyh)
+{
+   const __m256i       ramp = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+   __m256i             vsow, sx, sy, idx;
+
+   vsow = _mm256_set1_epi32(sow);
+   sx = _mm256_mullo_epi32(ramp, _mm256_set1_epi32(dxh));
+   sy = _mm256_mullo_epi32(ramp, _mm256_set1_epi32(dyh));
+
+   for (; n >= 8; n -= 8, dest += 8)
      {
-        i = dw - 1;
-        do
-          {
-             DATA32             *src_x_y = (src + (x >> _ROTATE_PREC) +
-                                            ((y >> _ROTATE_PREC) * sow));
-             INTERP_ARGB(dest, src_x_y, sow, x, y);
-             /*\ RIGHT; \ */
-             x += dxh;
-             y += dyh;
-             dest++;
-          }
-        while (--i >= 0);
-        if (--dh <= 0)
-           break;
-        /*\ DOWN/LEFT; \ */
-        x += dxv - dw * dxh;
-        y += dyv - dw * dyh;
-        dest += (dow - dw);
+        idx = __imlib_RotateIndex_avx2(_mm256_add_epi32
+                                       (_mm256_set1_epi32(x), sx),
+                                       _mm256_add_epi32(_mm256_set1_epi32(y),
+                                                        sy), vsow);
+        _mm256_storeu_si256((__m256i *) dest,
+                            _mm256_i32gather_epi32((const int *)src, idx, 4));
+        x += 8 * dxh;
+        y += 8 * dyh;
      }
+
+   __imlib_RotateSampleInside(src, dest, sow, n, x, y, dxh, dyh);
 }
 
-/*\ NOTE: To check if v is in [b .. t) ((v >= b) && (v < t))
-|*|  it's quicker to do ((unsigned)(v - b) < (t - b))
-|*|  as negative values, cast to unsigned, become large positive
-|*|  values, and fall through the compare.
-|*|  v in [0 .. t) is a special case: ((unsigned)v < t)
-|*|  v in [-t .. 0) is also special, as its the same as ~v in [0 .. t)
+/*\ One channel (at bit s) of INTERP_VAL2, ORed into res \*/
+#define INTERP_CH_AVX2(res, ul, ur, ll, lr, fx, fy, s) do { \
+	__m256i m = _mm256_set1_epi32(0xff), a, b, c, d, t, u; \
+	a = _mm256_and_si256(_mm256_srli_epi32(ul, s), m); \
+	b = _mm256_and_si256(_mm256_srli_epi32(ur, s), m); \
+	c = _mm256_and_si256(_mm256_srli_epi32(ll, s), m); \
+	d = _mm256_and_si256(_mm256_srli_epi32(lr, s), m); \
+	t = _mm256_add_epi32(_mm256_slli_epi32(a, _ROTATE_PREC), \
+			     _mm256_mullo_epi32(_mm256_sub_epi32(b, a), fx)); \
+	u = _mm256_add_epi32(_mm256_slli_epi32(c, _ROTATE_PREC), \
+			     _mm256_mullo_epi32(_mm256_sub_epi32(d, c), fx)); \
+	t = _mm256_add_epi32(_mm256_slli_epi32(t, _ROTATE_PREC), \
+			     _mm256_mullo_epi32(_mm256_sub_epi32(u, t), fy)); \
+	res = _mm256_or_si256(res, _mm256_slli_epi32( \
+			      _mm256_srli_epi32(t, 2 * _ROTATE_PREC), s)); \
+	} while (0)
+
+__attribute__((target("avx2")))
+static void
+__imlib_RotateAAInside_avx2(DATA32 * src, DATA32 * dest, int sow, int n,
+                            int x, int y, int dxh, int dyh)
+{
+   const __m256i       ramp = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+   const __m256i       bits = _mm256_set1_epi32(_ROTATE_PREC_BITS);
+   __m256i             vsow, sx, sy, vx, vy, idx, fx, fy;
+   __m256i             ul, ur, ll, lr, res;
+
+   vsow = _mm256_set1_epi32(sow);
+   sx = _mm256_mullo_epi32(ramp, _mm256_set1_epi32(dxh));
+   sy = _mm256_mullo_epi32(ramp, _mm256_set1_epi32(dyh));
+
+   for (; n >= 8; n -= 8, dest += 8)
+     {
+        vx = _mm256_add_epi32(_mm256_set1_epi32(x), sx);
+        vy = _mm256_add_epi32(_mm256_set1_epi32(y), sy);
+        idx = __imlib_RotateIndex_avx2(vx, vy, vsow);
+        ul = _mm256_i32gather_epi32((const int *)src, idx, 4);
+        ur = _mm256_i32gather_epi32((const int *)(src + 1), idx, 4);
+        ll = _mm256_i32gather_epi32((const int *)(src + sow), idx, 4);
+        lr = _mm256_i32gather_epi32((const int *)(src + sow + 1), idx, 4);
+        fx = _mm256_and_si256(vx, bits);
+        fy = _mm256_and_si256(vy, bits);
+
+        res = _mm256_setzero_si256();
+        INTERP_CH_AVX2(res, ul, ur, ll, lr, fx, fy, 0);
+        INTERP_CH_AVX2(res, ul, ur, ll, lr, fx, fy, 8);
+        INTERP_CH_AVX2(res, ul, ur, ll, lr, fx, fy, 16);
+        INTERP_CH_AVX2(res, ul, ur, ll, lr, fx, fy, 24);
+        _mm256_storeu_si256((__m256i *) dest, res);
+
+        x += 8 * dxh;
+        y += 8 * dyh;
+     }
+
+   __imlib_RotateAAInside(src, dest, sow, n, x, y, dxh, dyh);
+}
+#endif
+
+/*\ Rotate by a multiple of 90 degrees (possibly mirrored), i.e. with steps
+|*| of exactly one pixel along the axes. This is a plain copy of the source
+|*| with its origin at (x, y) rounded down, done without interpolation.
+|*| When anti-aliasing, the origin must also be on a whole pixel, as a
+|*| fractional one is interpolated between neighbours.
+|*| Returns 0 if the steps (or the origin) are not of that kind.
 \*/
-static int
-__check_inside_coords(int x, int y, int dxh, int dyh, int dxv, int dyv,
-                      int dw, int dh, int sw, int sh)
+int
+__imlib_RotateRightAngle(int aa, DATA32 * src, DATA32 * dest, int sow, int sw,
+                         int sh, int dow, int dw, int dh, int x, int y,
+                         int dxh, int dyh, int dxv, int dyv)
 {
-   sw <<= _ROTATE_PREC;
-   sh <<= _ROTATE_PREC;
+   int                 ux, uy, vx, vy, i0, i1, j0, j1, j;
+   int                 sx0, sy0, sx1, sy1, nw, nh, xs, ys;
+   DATA32             *s, *d;
 
-   if (((unsigned)x >= (unsigned)sw) || ((unsigned)y >= (unsigned)sh))
-      return 0;
-   x += dxh * dw;
-   y += dyh * dw;
-   if (((unsigned)x >= (unsigned)sw) || ((unsigned)y >= (unsigned)sh))
+   if ((abs(dxh) + abs(dyh) != _ROTATE_PREC_MAX) || (dxh && dyh) ||
+       (abs(dxv) + abs(dyv) != _ROTATE_PREC_MAX) || (dxv && dyv) ||
+       (dxh * dxv + dyh * dyv))
       return 0;
-   x += dxv * dh;
-   y += dyv * dh;
-   if (((unsigned)x >= (unsigned)sw) || ((unsigned)y >= (unsigned)sh))
-      return 0;
-   x -= dxh * dw;
-   y -= dyh * dw;
-   if (((unsigned)x >= (unsigned)sw) || ((unsigned)y >= (unsigned)sh))
+   if (aa && ((x | y) & _ROTATE_PREC_BITS))
       return 0;
 
+   ux = dxh / _ROTATE_PREC_MAX;
+   uy = dyh / _ROTATE_PREC_MAX;
+   vx = dxv / _ROTATE_PREC_MAX;
+   vy = dyv / _ROTATE_PREC_MAX;
+   x >>= _ROTATE_PREC;
+   y >>= _ROTATE_PREC;
+
+   /*\ Destination pixel (i, j) is source (x + i * ux + j * vx,
+    * |*| y + i * uy + j * vy), find the rectangle covered by the source \ */
+   i0 = 0;
+   i1 = dw;
+   if (ux)
+      __imlib_RotateClip(x, ux, sw, &i0, &i1);
+   else
+      __imlib_RotateClip(y, uy, sh, &i0, &i1);
+   j0 = 0;
+   j1 = dh;
+   if (vx)
+      __imlib_RotateClip(x, vx, sw, &j0, &j1);
+   else
+      __imlib_RotateClip(y, vy, sh, &j0, &j1);
+   if (i0 >= i1)
+      j0 = j1 = 0;
+
+   for (j = 0; j < dh; j++)
+     {
+        d = dest + j * dow;
+        if ((j < j0) || (j >= j1))
+          {
+             memset(d, 0, dw * sizeof(DATA32));
+             continue;
+          }
+        memset(d, 0, i0 * sizeof(DATA32));
+        memset(d + i1, 0, (dw - i1) * sizeof(DATA32));
+     }
+   if (j0 >= j1)
+      return 1;
+
+   /*\ The matching source rectangle, and where its origin goes \ */
+   sx0 = x + i0 * ux + j0 * vx;
+   sx1 = x + (i1 - 1) * ux + (j1 - 1) * vx;
+   sy0 = y + i0 * uy + j0 * vy;
+   sy1 = y + (i1 - 1) * uy + (j1 - 1) * vy;
+   nw = abs(sx1 - sx0) + 1;
+   nh = abs(sy1 - sy0) + 1;
+   sx0 = MIN(sx0, sx1);
+   sy0 = MIN(sy0, sy1);
+
+   /*\ Destination steps per source column and row \ */
+   xs = vx * dow + ux;
+   ys = vy * dow + uy;
+   s = src + sx0 + sy0 * sow;
+   d = dest + ((sx0 - x) * vx + (sy0 - y) * vy) * dow +
+      (sx0 - x) * ux + (sy0 - y) * uy;
+
+   if (ux)
+     {
+        /*\ Rows stay rows \ */
+        for (j = 0; j < nh; j++, s += sow, d += ys)
+          {
+             if (ux > 0)
+                memcpy(d, s, nw * sizeof(DATA32));
+             else
+               {
+                  int                 i;
+
+                  for (i = 0; i < nw; i++)
+                     d[-i] = s[i];
+               }
+          }
+     }
+   else
+     {
+        __imlib_TransposeData(d, xs, ys, s, sow, nw, nh);
+     }
+
    return 1;
 }
 
-/*\ These ones don't need the target to be inside the source \*/
-void
-__imlib_RotateSample(DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
-                     int dow, int dw, int dh, int x, int y,
-                     int dxh, int dyh, int dxv, int dyv)
+static void
+__imlib_RotateSampleRows(DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
+                         int dow, int dw, int dh, int x, int y,
+                         int dxh, int dyh, int dxv, int dyv)
 {
-   int                 i;
+   int                 i, l, r;
 
-   if ((dw < 1) || (dh < 1))
-      return;
+#ifdef DO_SIMD
+   int                 avx2 = __imlib_do_simd() == SIMD_AVX2;
+#endif
 
-   if (__check_inside_coords(x, y, dxh, dyh, dxv, dyv, dw, dh, sw, sh))
+   sw <<= _ROTATE_PREC;
+   sh <<= _ROTATE_PREC;
+   for (; dh > 0; dh--, x += dxv, y += dyv, dest += dow)
      {
-        __imlib_RotateSampleInside(src, dest, sow, dow, dw, dh, x, y,
-                                   dxh, dyh, dxv, dyv);
-        return;
-
+        /*\ Pixels [l .. r) are inside the source \ */
+        l = 0;
+        r = dw;
+        __imlib_RotateClip(x, dxh, sw, &l, &r);
+        __imlib_RotateClip(y, dyh, sh, &l, &r);
+
+        for (i = 0; i < l; i++)
+           dest[i] = 0;
+#ifdef DO_SIMD
+        if (avx2)
+           __imlib_RotateSampleInside_avx2(src, dest + l, sow, r - l,
+                                           x + l * dxh, y + l * dyh,
+                                           dxh, dyh);
+        else
+#endif
+           __imlib_RotateSampleInside(src, dest + l, sow, r - l,
+                                      x + l * dxh, y + l * dyh, dxh, dyh);
+        for (i = r; i < dw; i++)
+           dest[i] = 0;
      }
+}
 
-   sw <<= _ROTATE_PREC;
-   sh <<= _ROTATE_PREC;
-   while (1)
+/*\ One pixel not inside the source, seeing a transparent border
+|*| (sw and sh are the last column and row, in fixed point)
+\*/
+static void
+__imlib_RotateAAEdge(DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
+                     int x, int y)
+{
+   DATA32             *src_x_y = (src + (x >> _ROTATE_PREC) +
+                                  ((y >> _ROTATE_PREC) * sow));
+
+   if ((unsigned)x < (unsigned)sw)
      {
-        i = dw - 1;
-        do
+        if ((unsigned)y < (unsigned)sh)
           {
-             if (((unsigned)x < (unsigned)sw) && ((unsigned)y < (unsigned)sh))
-                *dest = src[(x >> _ROTATE_PREC) + ((y >> _ROTATE_PREC) * sow)];
-             else
-                *dest = 0;
-             /*\ RIGHT; \ */
-             x += dxh;
-             y += dyh;
-             dest++;
-
+             /*\  12
+              * |*|  34
+              * \ */
+             INTERP_ARGB(dest, src_x_y, sow, x, y);
           }
-        while (--i >= 0);
-        if (--dh <= 0)
-           break;
-        /*\ DOWN/LEFT; \ */
-        x += dxv - dw * dxh;
-        y += dyv - dw * dyh;
-        dest += (dow - dw);
-
+        else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
+          {
+             /*\  12
+              * |*|  ..
+              * \ */
+             INTERP_RGB_A0(dest, src_x_y, src_x_y + 1, x, ~y);
+          }
+        else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
+          {
+             /*\  ..
+              * |*|  34
+              * \ */
+             INTERP_RGB_A0(dest, src_x_y + sow, src_x_y + sow + 1, x, y);
+          }
+        else
+           *dest = 0;
+     }
+   else if ((unsigned)(x - sw) < (_ROTATE_PREC_MAX))
+     {
+        if ((unsigned)y < (unsigned)sh)
+          {
+             /*\  1.
+              * |*|  3.
+              * \ */
+             INTERP_RGB_A0(dest, src_x_y, src_x_y + sow, y, ~x);
+          }
+        else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
+          {
+             /*\  1.
+              * |*|  ..
+              * \ */
+             INTERP_A000(dest, src_x_y, ~x, ~y);
+          }
+        else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
+          {
+             /*\  ..
+              * |*|  3.
+              * \ */
+             INTERP_A000(dest, src_x_y + sow, ~x, y);
+          }
+        else
+           *dest = 0;
      }
+   else if ((unsigned)(~x) < _ROTATE_PREC_MAX)
+     {
+        if ((unsigned)y < (unsigned)sh)
+          {
+             /*\  .2
+              * |*|  .4
+              * \ */
+             INTERP_RGB_A0(dest, src_x_y + 1, src_x_y + sow + 1, y, x);
+          }
+        else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
+          {
+             /*\  .2
+              * |*|  ..
+              * \ */
+             INTERP_A000(dest, src_x_y + 1, x, ~y);
+          }
+        else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
+          {
+             /*\  ..
+              * |*|  .4
+              * \ */
+             INTERP_A000(dest, src_x_y + sow + 1, x, y);
+          }
+        else
+           *dest = 0;
+     }
+   else
+      *dest = 0;
 }
 
 /*\ With antialiasing.
@@ -201,15 +470,16 @@ __imlib_RotateSample(DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
 |*|     anything special, but remember to account for this when calculating
 |*|     the bounding box.
 \*/
-void
-__imlib_RotateAA(DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
-                 int dow, int dw, int dh, int x, int y,
-                 int dxh, int dyh, int dxv, int dyv)
+static void
+__imlib_RotateAARows(DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
+                     int dow, int dw, int dh, int x, int y,
+                     int dxh, int dyh, int dxv, int dyv)
 {
-   int                 i;
+   int                 i, l, r;
 
-   if ((dw < 1) || (dh < 1))
-      return;
+#ifdef DO_SIMD
+   int                 avx2 = __imlib_do_simd() == SIMD_AVX2;
+#endif
 
 #ifdef DO_MMX_ASM
    if (__imlib_do_asm())
@@ -220,126 +490,276 @@ __imlib_RotateAA(DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
      }
 #endif
 
-   if (__check_inside_coords(x, y, dxh, dyh, dxv, dyv, dw, dh, sw - 1, sh - 1))
+   sw--;
+   sh--;
+   sw <<= _ROTATE_PREC;
+   sh <<= _ROTATE_PREC;
+   for (; dh > 0; dh--, x += dxv, y += dyv, dest += dow)
      {
-        __imlib_RotateAAInside(src, dest, sow, dow, dw, dh, x, y,
+        /*\ Pixels [l .. r) have all four neighbours inside the source \ */
+        l = 0;
+        r = dw;
+        __imlib_RotateClip(x, dxh, sw, &l, &r);
+        __imlib_RotateClip(y, dyh, sh, &l, &r);
+
+        for (i = 0; i < l; i++)
+           __imlib_RotateAAEdge(src, dest + i, sow, sw, sh,
+                                x + i * dxh, y + i * dyh);
+#ifdef DO_SIMD
+        if (avx2)
+           __imlib_RotateAAInside_avx2(src, dest + l, sow, r - l,
+                                       x + l * dxh, y + l * dyh, dxh, dyh);
+        else
+#endif
+           __imlib_RotateAAInside(src, dest + l, sow, r - l,
+                                  x + l * dxh, y + l * dyh, dxh, dyh);
+        for (i = r; i < dw; i++)
+           __imlib_RotateAAEdge(src, dest + i, sow, sw, sh,
+                                x + i * dxh, y + i * dyh);
+     }
+}
+
+static void
+__imlib_RotateBand(void *data, int band)
+{
+   const ImlibRotateRun *run = data;
+   int                 j, h;
+
+   j = band * ROT_BAND;
+   h = MIN(ROT_BAND, run->dh - j);
+
+   if (run->aa)
+      __imlib_RotateAARows(run->src, run->dest + j * run->dow, run->sow,
+                           run->sw, run->sh, run->dow, run->dw, h,
+                           run->x + j * run->dxv, run->y + j * run->dyv,
+                           run->dxh, run->dyh, run->dxv, run->dyv);
+   else
+      __imlib_RotateSampleRows(run->src, run->dest + j * run->dow, run->sow,
+                               run->sw, run->sh, run->dow, run->dw, h,
+                               run->x + j * run->dxv, run->y + j * run->dyv,
+                               run->dxh, run->dyh, run->dxv, run->dyv);
+}
+
+/*\ Large targets are done in bands of rows, in parallel \*/
+static void
+__imlib_Rotate(char aa, DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
+               int dow, int dw, int dh, int x, int y,
+               int dxh, int dyh, int dxv, int dyv)
+{
+   ImlibRotateRun      run;
+
+   if ((dw < 1) || (dh < 1))
+      return;
+
+   run.src = src;
+   run.dest = dest;
+   run.sow = sow;
+   run.sw = sw;
+   run.sh = sh;
+   run.dow = dow;
+   run.dw = dw;
+   run.dh = dh;
+   run.x = x;
+   run.y = y;
+   run.dxh = dxh;
+   run.dyh = dyh;
+   run.dxv = dxv;
+   run.dyv = dyv;
+   run.aa = aa;
+
+   if ((dw * dh >= ROT_MT_PIXELS) && (dh > ROT_BAND) &&
+       (__imlib_GetThreadCount() > 1))
+      __imlib_RunJobs((dh + ROT_BAND - 1) / ROT_BAND, __imlib_RotateBand,
+                      &run);
+   else if (aa)
+      __imlib_RotateAARows(src, dest, sow, sw, sh, dow, dw, dh, x, y,
+                           dxh, dyh, dxv, dyv);
+   else
+      __imlib_RotateSampleRows(src, dest, sow, sw, sh, dow, dw, dh, x, y,
                                dxh, dyh, dxv, dyv);
-        return;
+}
+
+/*\ These ones don't need the target to be inside the source \*/
+void
+__imlib_RotateSample(DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
+                     int dow, int dw, int dh, int x, int y,
+                     int dxh, int dyh, int dxv, int dyv)
+{
+   if ((dw < 1) || (dh < 1))
+      return;
+
+   /*\ Sampling with whole pixel steps is a plain copy \ */
+   if (__imlib_RotateRightAngle(0, src, dest, sow, sw, sh, dow, dw, dh, x, y,
+                                dxh, dyh, dxv, dyv))
+      return;
+
+   __imlib_Rotate(0, src, dest, sow, sw, sh, dow, dw, dh, x, y,
+                  dxh, dyh, dxv, dyv);
+}
+
+void
+__imlib_RotateAA(DATA32 * src, DATA32 * dest, int sow, int sw, int sh,
+                 int dow, int dw, int dh, int x, int y,
+                 int dxh, int dyh, int dxv, int dyv)
+{
+   __imlib_Rotate(1, src, dest, sow, sw, sh, dow, dw, dh, x, y,
+                  dxh, dyh, dxv, dyv);
+}
+
+/*\ Should this be in blend.c ?? \*/
+#define LINESIZE 16
+
+typedef struct {
+   ImlibImage         *im_dst;
+   DATA32             *src;
+   int                 sow, ssw, ssh;
+   int                 x, y, dxh, dyh, dxv, dyv;
+   int                 nbands, nchunks;
+   char                aa, blend, merge_alpha;
+   ImlibColorModifier *cm;
+   ImlibOp             op;
+   int                 premul;
+} ImlibSkewRun;
+
+/*\ Rotate and blend the rows [i .. i + LINESIZE), using data for temp \*/
+static void
+__imlib_SkewedBand(const ImlibSkewRun * run, DATA32 * data, int i)
+{
+   ImlibImage         *im_dst = run->im_dst;
+   int                 ssw = run->ssw, ssh = run->ssh;
+   int                 dxh = run->dxh, dyh = run->dyh;
+   int                 x, y, x2, y2, w, h, l, r;
+
+   h = MIN(LINESIZE, im_dst->h - i);
 
+   x = run->x + i * run->dxv;
+   y = run->y + i * run->dyv;
+   x2 = x + h * run->dxv;
+   y2 = y + h * run->dyv;
+
+   w = ssw << _ROTATE_PREC;
+   h = ssh << _ROTATE_PREC;
+   if (run->aa)
+     {
+        /*\ Account for virtual transparent border \ */
+        w += 2 << _ROTATE_PREC;
+        h += 2 << _ROTATE_PREC;
      }
+   /*\ Pretty similar code \ */
+   if (dxh > 0)
+     {
+        if (dyh > 0)
+          {
+             l = MAX(-MAX(y, y2) / dyh, -MAX(x, x2) / dxh);
+             r = MIN((h - MIN(y, y2)) / dyh, (w - MIN(x, x2)) / dxh);
 
-   sw--;
-   sh--;
-   sw <<= _ROTATE_PREC;
-   sh <<= _ROTATE_PREC;
-   while (1)
+          }
+        else if (dyh < 0)
+          {
+             l = MAX(-MAX(x, x2) / dxh, (h - MIN(y, y2)) / dyh);
+             r = MIN(-MAX(y, y2) / dyh, (w - MIN(x, x2)) / dxh);
+
+          }
+        else
+          {
+             l = -MAX(x, x2) / dxh;
+             r = (w - MIN(x, x2)) / dxh;
+
+          }
+     }
+   else if (dxh < 0)
      {
-        i = dw - 1;
-        do
+        if (dyh > 0)
           {
-             DATA32             *src_x_y = (src + (x >> _ROTATE_PREC) +
-                                            ((y >> _ROTATE_PREC) * sow));
-             if ((unsigned)x < (unsigned)sw)
-               {
-                  if ((unsigned)y < (unsigned)sh)
-                    {
-                       /*\  12
-                        * |*|  34
-                        * \ */
-                       INTERP_ARGB(dest, src_x_y, sow, x, y);
-                    }
-                  else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
-                    {
-                       /*\  12
-                        * |*|  ..
-                        * \ */
-                       INTERP_RGB_A0(dest, src_x_y, src_x_y + 1, x, ~y);
-                    }
-                  else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
-                    {
-                       /*\  ..
-                        * |*|  34
-                        * \ */
-                       INTERP_RGB_A0(dest, src_x_y + sow, src_x_y + sow + 1, x,
-                                     y);
-                    }
-                  else
-                     *dest = 0;
-               }
-             else if ((unsigned)(x - sw) < (_ROTATE_PREC_MAX))
-               {
-                  if ((unsigned)y < (unsigned)sh)
-                    {
-                       /*\  1.
-                        * |*|  3.
-                        * \ */
-                       INTERP_RGB_A0(dest, src_x_y, src_x_y + sow, y, ~x);
-                    }
-                  else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
-                    {
-                       /*\  1.
-                        * |*|  ..
-                        * \ */
-                       INTERP_A000(dest, src_x_y, ~x, ~y);
-                    }
-                  else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
-                    {
-                       /*\  ..
-                        * |*|  3.
-                        * \ */
-                       INTERP_A000(dest, src_x_y + sow, ~x, y);
-                    }
-                  else
-                     *dest = 0;
-               }
-             else if ((unsigned)(~x) < _ROTATE_PREC_MAX)
-               {
-                  if ((unsigned)y < (unsigned)sh)
-                    {
-                       /*\  .2
-                        * |*|  .4
-                        * \ */
-                       INTERP_RGB_A0(dest, src_x_y + 1, src_x_y + sow + 1, y,
-                                     x);
-                    }
-                  else if ((unsigned)(y - sh) < _ROTATE_PREC_MAX)
-                    {
-                       /*\  .2
-                        * |*|  ..
-                        * \ */
-                       INTERP_A000(dest, src_x_y + 1, x, ~y);
-                    }
-                  else if ((unsigned)(~y) < _ROTATE_PREC_MAX)
-                    {
-                       /*\  ..
-                        * |*|  .4
-                        * \ */
-                       INTERP_A000(dest, src_x_y + sow + 1, x, y);
-                    }
-                  else
-                     *dest = 0;
-               }
-             else
-                *dest = 0;
-             /*\ RIGHT; \ */
-             x += dxh;
-             y += dyh;
-             dest++;
+             l = MAX(-MAX(y, y2) / dyh, (w - MIN(x, x2)) / dxh);
+             r = MIN(-MAX(x, x2) / dxh, (h - MIN(y, y2)) / dyh);
+
+          }
+        else if (dyh < 0)
+          {
+             l = MAX((h - MIN(y, y2)) / dyh, (w - MIN(x, x2)) / dxh);
+             r = MIN(-MAX(y, y2) / dyh, -MAX(x, x2) / dxh);
+
+          }
+        else
+          {
+             l = (w - MIN(x, x2)) / dxh;
+             r = -MAX(x, x2) / dxh;
 
           }
-        while (--i >= 0);
-        if (--dh <= 0)
-           break;
-        /*\ DOWN/LEFT; \ */
-        x += dxv - dw * dxh;
-        y += dyv - dw * dyh;
-        dest += (dow - dw);
 
      }
+   else
+     {
+        if (dyh > 0)
+          {
+             l = -MAX(y, y2) / dyh;
+             r = (h - MIN(y, y2)) / dyh;
+
+          }
+        else if (dyh < 0)
+          {
+             l = (h - MIN(y, y2)) / dyh;
+             r = -MAX(y, y2) / dyh;
+
+          }
+        else
+          {
+             l = 0;
+             r = 0;
+
+          }
+
+     }
+   l--;
+   r += 2;                 /*\ Be paranoid about roundoff errors \ */
+   if (l < 0)
+      l = 0;
+   if (r > im_dst->w)
+      r = im_dst->w;
+   if (r <= l)
+      return;
+
+   w = r - l;
+   h = MIN(LINESIZE, im_dst->h - i);
+   x += l * dxh;
+   y += l * dyh;
+   if (run->aa)
+     {
+        x -= _ROTATE_PREC_MAX;
+        y -= _ROTATE_PREC_MAX;
+        __imlib_RotateAARows(run->src, data, run->sow, ssw, ssh, w, w, h,
+                             x, y, dxh, dyh, run->dxv, run->dyv);
+     }
+   else
+     {
+        __imlib_RotateSampleRows(run->src, data, run->sow, ssw, ssh, w, w, h,
+                                 x, y, dxh, dyh, run->dxv, run->dyv);
+     }
+   __imlib_BlendRGBAToData(data, w, h, im_dst->data,
+                           im_dst->w, im_dst->h, 0, 0, l, i, w, h,
+                           run->blend, run->merge_alpha, run->cm, run->op, 0,
+                           run->premul);
 }
 
-/*\ Should this be in blend.c ?? \*/
-#define LINESIZE 16
+/*\ A run of consecutive bands, sharing one temp buffer \*/
+static void
+__imlib_SkewedChunk(void *arg, int chunk)
+{
+   const ImlibSkewRun *run = arg;
+   DATA32             *data;
+   int                 b, b1;
+
+   data = malloc(run->im_dst->w * LINESIZE * sizeof(DATA32));
+   if (!data)
+      return;
+
+   b1 = (chunk + 1) * run->nbands / run->nchunks;
+   for (b = chunk * run->nbands / run->nchunks; b < b1; b++)
+      __imlib_SkewedBand(run, data, b * LINESIZE);
+
+   free(data);
+}
 
 void
 __imlib_BlendImageToImageSkewed(ImlibImage * im_src, ImlibImage * im_dst,
@@ -350,9 +770,9 @@ __imlib_BlendImageToImageSkewed(ImlibImage * im_src, ImlibImage * im_dst,
                                 ImlibColorModifier * cm, ImlibOp op,
                                 int clx, int cly, int clw, int clh)
 {
-   int                 x, y, dxh, dyh, dxv, dyv, i;
+   ImlibSkewRun        run;
+   int                 x, y, dxh, dyh, dxv, dyv, premul, nth;
    double              xy2;
-   DATA32             *data, *src;
 
    if ((ssw < 0) || (ssh < 0))
       return;
@@ -362,6 +782,9 @@ __imlib_BlendImageToImageSkewed(ImlibImage * im_src, ImlibImage * im_dst,
    if (__imlib_LoadImageData(im_dst))
       return;
 
+   premul = (IMAGE_ALPHA_PREMUL(im_src) ? PREMUL_SRC : 0) |
+      (IMAGE_ALPHA_PREMUL(im_dst) ? PREMUL_DST : 0);
+
    /*\ Complicated gonio.  Works on paper..
     * |*| Too bad it doesn't all fit into integer math.. 
     * \ */
@@ -407,11 +830,6 @@ __imlib_BlendImageToImageSkewed(ImlibImage * im_src, ImlibImage * im_dst,
    if ((ssh + ssy) > im_src->h)
       ssh = im_src->h - ssy;
 
-   src = im_src->data + ssx + ssy * im_src->w;
-   data = malloc(im_dst->w * LINESIZE * sizeof(DATA32));
-   if (!data)
-      return;
-
    if (aa)
      {
         /*\ Account for virtual transparent border \ */
@@ -419,127 +837,36 @@ __imlib_BlendImageToImageSkewed(ImlibImage * im_src, ImlibImage * im_dst,
         y += _ROTATE_PREC_MAX;
      }
 
-   for (i = 0; i < im_dst->h; i += LINESIZE)
+   run.im_dst = im_dst;
+   run.src = im_src->data + ssx + ssy * im_src->w;
+   run.sow = im_src->w;
+   run.ssw = ssw;
+   run.ssh = ssh;
+   run.x = x;
+   run.y = y;
+   run.dxh = dxh;
+   run.dyh = dyh;
+   run.dxv = dxv;
+   run.dyv = dyv;
+   run.aa = aa;
+   run.blend = blend;
+   run.merge_alpha = merge_alpha;
+   run.cm = cm;
+   run.op = op;
+   run.premul = premul;
+   run.nbands = (im_dst->h + LINESIZE - 1) / LINESIZE;
+   run.nchunks = 1;
+
+   nth = __imlib_GetThreadCount();
+   if ((im_dst->w * im_dst->h >= ROT_MT_PIXELS) && (nth > 1))
      {
-        int                 x2, y2, w, h, l, r;
-
-        h = MIN(LINESIZE, im_dst->h - i);
-
-        x2 = x + h * dxv;
-        y2 = y + h * dyv;
-
-        w = ssw << _ROTATE_PREC;
-        h = ssh << _ROTATE_PREC;
-        if (aa)
-          {
-             /*\ Account for virtual transparent border \ */
-             w += 2 << _ROTATE_PREC;
-             h += 2 << _ROTATE_PREC;
-          }
-        /*\ Pretty similar code \ */
-        if (dxh > 0)
-          {
-             if (dyh > 0)
-               {
-                  l = MAX(-MAX(y, y2) / dyh, -MAX(x, x2) / dxh);
-                  r = MIN((h - MIN(y, y2)) / dyh, (w - MIN(x, x2)) / dxh);
-
-               }
-             else if (dyh < 0)
-               {
-                  l = MAX(-MAX(x, x2) / dxh, (h - MIN(y, y2)) / dyh);
-                  r = MIN(-MAX(y, y2) / dyh, (w - MIN(x, x2)) / dxh);
-
-               }
-             else
-               {
-                  l = -MAX(x, x2) / dxh;
-                  r = (w - MIN(x, x2)) / dxh;
-
-               }
-          }
-        else if (dxh < 0)
-          {
-             if (dyh > 0)
-               {
-                  l = MAX(-MAX(y, y2) / dyh, (w - MIN(x, x2)) / dxh);
-                  r = MIN(-MAX(x, x2) / dxh, (h - MIN(y, y2)) / dyh);
-
-               }
-             else if (dyh < 0)
-               {
-                  l = MAX((h - MIN(y, y2)) / dyh, (w - MIN(x, x2)) / dxh);
-                  r = MIN(-MAX(y, y2) / dyh, -MAX(x, x2) / dxh);
-
-               }
-             else
-               {
-                  l = (w - MIN(x, x2)) / dxh;
-                  r = -MAX(x, x2) / dxh;
-
-               }
-
-          }
-        else
-          {
-             if (dyh > 0)
-               {
-                  l = -MAX(y, y2) / dyh;
-                  r = (h - MIN(y, y2)) / dyh;
-
-               }
-             else if (dyh < 0)
-               {
-                  l = (h - MIN(y, y2)) / dyh;
-                  r = -MAX(y, y2) / dyh;
-
-               }
-             else
-               {
-                  l = 0;
-                  r = 0;
-
-               }
-
-          }
-        l--;
-        r += 2;                 /*\ Be paranoid about roundoff errors \ */
-        if (l < 0)
-           l = 0;
-        if (r > im_dst->w)
-           r = im_dst->w;
-        if (r <= l)
-          {
-             x = x2;
-             y = y2;
-             continue;
-
-          }
-
-        w = r - l;
-        h = MIN(LINESIZE, im_dst->h - i);
-        x += l * dxh;
-        y += l * dyh;
-        if (aa)
-          {
-             x -= _ROTATE_PREC_MAX;
-             y -= _ROTATE_PREC_MAX;
-             __imlib_RotateAA(src, data, im_src->w, ssw, ssh, w, w, h,
-                              x, y, dxh, dyh, dxv, dyv);
-
-          }
-        else
-          {
-             __imlib_RotateSample(src, data, im_src->w, ssw, ssh, w, w, h,
-                                  x, y, dxh, dyh, dxv, dyv);
-
-          }
-        __imlib_BlendRGBAToData(data, w, h, im_dst->data,
-                                im_dst->w, im_dst->h, 0, 0, l, i, w, h,
-                                blend, merge_alpha, cm, op, 0);
-        x = x2;
-        y = y2;
-
+        /*\ A few chunks per thread to even out the load \ */
+        run.nchunks = MIN(run.nbands, 4 * nth);
+        __imlib_build_pow_lut();
+        __imlib_RunJobs(run.nchunks, __imlib_SkewedChunk, &run);
+     }
+   else
+     {
+        __imlib_SkewedChunk(&run, 0);
      }
-   free(data);
 }
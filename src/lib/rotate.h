@@ -21,6 +21,12 @@ void                __imlib_RotateAA(DATA32 * src, DATA32 * dest,
                                      int dow, int dw, int dh,
                                      int x, int y, int dx, int dy,
                                      int dxv, int dyv);
+int                 __imlib_RotateRightAngle(int aa, DATA32 * src,
+                                             DATA32 * dest,
+                                             int sow, int sw, int sh,
+                                             int dow, int dw, int dh,
+                                             int x, int y, int dxh, int dyh,
+                                             int dxv, int dyv);
 void                __imlib_BlendImageToImageSkewed(ImlibImage * im_src,
                                                     ImlibImage * im_dst,
                                                     char aa, char blend,
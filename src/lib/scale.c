@@ -1,6 +1,12 @@
 #include "common.h"
 
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#ifdef DO_SIMD
+#include <immintrin.h>
+#endif
 
 #include "asm_c.h"
 #include "blend.h"
@@ -8,6 +14,15 @@
 #include "image.h"
 #include "scale.h"
 
+#define FILTER_BITS 14          /* Filter weight precision */
+#define TILE_BITS   6           /* Extra precision of filtered rows */
+
+typedef struct {
+   int                 n;       /* Taps per output pixel */
+   int                *start;   /* First source pixel of each output pixel */
+   short              *w;       /* n weights per output pixel */
+} ImlibFilterTaps;
+
 /*\ NB: If you change this, don't forget asm_scale.S \*/
 struct _imlib_scale_info {
    int                *xpoints;
@@ -15,6 +30,12 @@ struct _imlib_scale_info {
    int                *xapoints, *yapoints;
    int                 xup_yup;
    DATA32             *pix_assert;
+   /* separable filters (SCALE_BICUBIC, SCALE_LANCZOS) */
+   char                has_alpha;
+   DATA32             *src;
+   ImlibFilterTaps    *xtaps, *ytaps;
+   short              *tile;    /* Horizontally filtered source rows */
+   int                 tile_y, tile_h, tile_x, tile_w, tile_size;
 };
 
 #define INV_XAP                   (256 - xapoints[x])
@@ -224,6 +245,131 @@ __imlib_CalcApoints(int s, int d, int b1, int b2, int up)
    return p;
 }
 
+static ImlibFilterTaps *
+__imlib_FreeFilterTaps(ImlibFilterTaps * ft)
+{
+   if (ft)
+     {
+        free(ft->start);
+        free(ft->w);
+        free(ft);
+     }
+   return NULL;
+}
+
+/* Catmull-Rom cubic (Keys, a = -0.5) */
+static double
+__imlib_FilterCubic(double x)
+{
+   x = fabs(x);
+   if (x < 1.)
+      return (1.5 * x - 2.5) * x * x + 1.;
+   if (x < 2.)
+      return ((-0.5 * x + 2.5) * x - 4.) * x + 2.;
+   return 0.;
+}
+
+static double
+__imlib_FilterLanczos3(double x)
+{
+   x = fabs(x);
+   if (x < 1e-8)
+      return 1.;
+   if (x >= 3.)
+      return 0.;
+   x *= M_PI;
+   return 3. * sin(x) * sin(x / 3.) / (x * x);
+}
+
+/* taps for scaling s pixels to d (mirrored if d < 0) - the kernel is
+ * stretched when scaling down, taps outside the source are folded onto the
+ * edge pixels */
+static ImlibFilterTaps *
+__imlib_CalcFilterTaps(int s, int d, int filter)
+{
+   ImlibFilterTaps    *ft;
+   double              (*kernel)(double);
+   double              support, scale, fs, center, v, sum, *wf;
+   int                 i, j, k, n, lo, hi, start, kmax, tot, rv = 0;
+   short              *w;
+
+   if (d < 0)
+     {
+        d = -d;
+        rv = 1;
+     }
+
+   if (filter == SCALE_LANCZOS)
+     {
+        kernel = __imlib_FilterLanczos3;
+        support = 3.;
+     }
+   else
+     {
+        kernel = __imlib_FilterCubic;
+        support = 2.;
+     }
+   scale = (double)s / d;
+   fs = MAX(scale, 1.);
+   support *= fs;
+   n = MIN((int)ceil(2 * support) + 1, s);
+
+   ft = calloc(1, sizeof(ImlibFilterTaps));
+   if (!ft)
+      return NULL;
+   ft->n = n;
+   /* like the point tables, one spare entry for callers rounding up */
+   ft->start = malloc((d + 1) * sizeof(int));
+   ft->w = calloc((d + 1) * n, sizeof(short));
+   wf = malloc(n * sizeof(double));
+   if (!ft->start || !ft->w || !wf)
+     {
+        free(wf);
+        return __imlib_FreeFilterTaps(ft);
+     }
+
+   for (i = 0; i < d; i++)
+     {
+        center = (i + 0.5) * scale - 0.5;
+        lo = (int)ceil(center - support);
+        hi = (int)floor(center + support);
+        start = MAX(MIN(lo, s - n), 0);
+
+        memset(wf, 0, n * sizeof(double));
+        sum = 0.;
+        for (j = lo; j <= hi; j++)
+          {
+             k = MAX(MIN(j, s - 1), 0) - start;
+             if (k < 0 || k >= n)
+                continue;
+             v = kernel((j - center) / fs);
+             wf[k] += v;
+             sum += v;
+          }
+
+        /* to fixed point, rounding error goes to the largest tap */
+        j = rv ? d - 1 - i : i;
+        ft->start[j] = start;
+        w = ft->w + j * n;
+        kmax = 0;
+        tot = 0;
+        for (k = 0; k < n; k++)
+          {
+             w[k] = (sum != 0.) ?
+                lround(wf[k] / sum * (1 << FILTER_BITS)) : 0;
+             tot += w[k];
+             if (fabs(wf[k]) > fabs(wf[kmax]))
+                kmax = k;
+          }
+        w[kmax] += (1 << FILTER_BITS) - tot;
+     }
+   ft->start[d] = ft->start[d - 1];
+   memcpy(ft->w + d * n, ft->w + (d - 1) * n, n * sizeof(short));
+
+   free(wf);
+   return ft;
+}
+
 ImlibScaleInfo     *
 __imlib_FreeScaleInfo(ImlibScaleInfo * isi)
 {
@@ -233,6 +379,37 @@ __imlib_FreeScaleInfo(ImlibScaleInfo * isi)
         free(isi->ypoints);
         free(isi->xapoints);
         free(isi->yapoints);
+        __imlib_FreeFilterTaps(isi->xtaps);
+        __imlib_FreeFilterTaps(isi->ytaps);
+        free(isi->tile);
+        free(isi);
+     }
+   return NULL;
+}
+
+/* a view of isi sharing its tables, with its own filter tile, so that
+ * another thread can scale different rows at the same time */
+ImlibScaleInfo     *
+__imlib_ShareScaleInfo(ImlibScaleInfo * isi)
+{
+   ImlibScaleInfo     *sh;
+
+   sh = malloc(sizeof(ImlibScaleInfo));
+   if (!sh)
+      return NULL;
+   *sh = *isi;
+   sh->tile = NULL;
+   sh->tile_size = sh->tile_h = 0;
+
+   return sh;
+}
+
+ImlibScaleInfo     *
+__imlib_FreeSharedScaleInfo(ImlibScaleInfo * isi)
+{
+   if (isi)
+     {
+        free(isi->tile);
         free(isi);
      }
    return NULL;
@@ -253,9 +430,24 @@ __imlib_CalcScaleInfo(ImlibImage * im, int sw, int sh, int dw, int dh, char aa)
    memset(isi, 0, sizeof(ImlibScaleInfo));
 
    isi->pix_assert = im->data + im->w * im->h;
+   isi->has_alpha = IMAGE_HAS_ALPHA(im);
 
    isi->xup_yup = (abs(dw) >= sw) + ((abs(dh) >= sh) << 1);
 
+   /* the separable filters don't do borders, those get area averaging */
+   if (aa >= SCALE_BICUBIC && !(im->border.left | im->border.right |
+                                im->border.top | im->border.bottom))
+     {
+        isi->src = im->data;
+        isi->xtaps = __imlib_CalcFilterTaps(im->w, scw, aa);
+        if (!isi->xtaps)
+           return __imlib_FreeScaleInfo(isi);
+        isi->ytaps = __imlib_CalcFilterTaps(im->h, sch, aa);
+        if (!isi->ytaps)
+           return __imlib_FreeScaleInfo(isi);
+        return isi;
+     }
+
    isi->xpoints = __imlib_CalcXPoints(im->w, scw,
                                       im->border.left, im->border.right);
    if (!isi->xpoints)
@@ -1557,3 +1749,400 @@ __imlib_ScaleAARGB(ImlibScaleInfo * isi, DATA32 * dest, int dxx, int dyy,
      }
 #endif
 }
+
+/*
+ * Separable filters
+ *
+ * Bicubic and Lanczos scaling is done in two passes, with the taps of every
+ * output column and row computed once per geometry as 16-bit fixed point
+ * weights. Source rows are filtered horizontally into a tile of 16-bit
+ * intermediates, which is kept across the LINESIZE chunks of a render so
+ * rows shared by neighbouring chunks are filtered once, then the output
+ * rows are filtered vertically out of the tile. The SSE2 passes do the
+ * same integer arithmetic as the C ones.
+ */
+
+static void
+__imlib_FilterRowH(const ImlibFilterTaps * xt, const DATA32 * src,
+                   short *dst, int x0, int w)
+{
+   const DATA32       *s;
+   const short        *wt;
+   int                 x, k, b, g, r, a;
+
+   for (x = x0; x < x0 + w; x++, dst += 4)
+     {
+        s = src + xt->start[x];
+        wt = xt->w + x * xt->n;
+        b = g = r = a = 1 << (FILTER_BITS - TILE_BITS - 1);
+        for (k = 0; k < xt->n; k++)
+          {
+             b += (int)(s[k] & 0xff) * wt[k];
+             g += (int)((s[k] >> 8) & 0xff) * wt[k];
+             r += (int)((s[k] >> 16) & 0xff) * wt[k];
+             a += (int)(s[k] >> 24) * wt[k];
+          }
+        dst[0] = b >> (FILTER_BITS - TILE_BITS);
+        dst[1] = g >> (FILTER_BITS - TILE_BITS);
+        dst[2] = r >> (FILTER_BITS - TILE_BITS);
+        dst[3] = a >> (FILTER_BITS - TILE_BITS);
+     }
+}
+
+static void
+__imlib_FilterRowV(const short *tile, int stride, const short *wt, int n,
+                   DATA32 * dst, int w, char has_alpha)
+{
+   int                 x, c, k, v;
+   DATA32              p;
+
+   for (x = 0; x < w; x++, tile += 4)
+     {
+        p = 0;
+        for (c = 0; c < 4; c++)
+          {
+             v = 1 << (FILTER_BITS + TILE_BITS - 1);
+             for (k = 0; k < n; k++)
+                v += tile[k * stride + c] * wt[k];
+             v >>= FILTER_BITS + TILE_BITS;
+             p |= (DATA32) (v < 0 ? 0 : v > 255 ? 255 : v) << (8 * c);
+          }
+        dst[x] = has_alpha ? p : p | 0xff000000;
+     }
+}
+
+#ifdef DO_SIMD
+/* two weights as one madd operand */
+#define WPAIR(wt, k) \
+   _mm_set1_epi32((uint16_t)(wt)[k] | ((uint32_t)(uint16_t)(wt)[(k) + 1] << 16))
+
+__attribute__((target("sse2")))
+static void
+__imlib_FilterRowH_sse2(const ImlibFilterTaps * xt, const DATA32 * src,
+                        short *dst, int x0, int w)
+{
+   const __m128i       zero = _mm_setzero_si128();
+   const __m128i       rnd = _mm_set1_epi32(1 << (FILTER_BITS - TILE_BITS - 1));
+   const DATA32       *s;
+   const short        *wt;
+   __m128i             acc, p;
+   int                 x, k, n = xt->n;
+
+   for (x = x0; x < x0 + w; x++, dst += 4)
+     {
+        s = src + xt->start[x];
+        wt = xt->w + x * n;
+        acc = rnd;
+        for (k = 0; k + 1 < n; k += 2)
+          {
+             /* b0 b1 g0 g1 r0 r1 a0 a1 */
+             p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(s + k)),
+                                   zero);
+             p = _mm_unpacklo_epi16(p, _mm_srli_si128(p, 8));
+             acc = _mm_add_epi32(acc, _mm_madd_epi16(p, WPAIR(wt, k)));
+          }
+        if (k < n)
+          {
+             p = _mm_unpacklo_epi8(_mm_cvtsi32_si128(s[k]), zero);
+             p = _mm_unpacklo_epi16(p, zero);
+             acc = _mm_add_epi32(acc, _mm_madd_epi16(p,
+                                                     _mm_set1_epi32((uint16_t)
+                                                                    wt[k])));
+          }
+        acc = _mm_srai_epi32(acc, FILTER_BITS - TILE_BITS);
+        _mm_storel_epi64((__m128i *) dst, _mm_packs_epi32(acc, acc));
+     }
+}
+
+__attribute__((target("sse2")))
+static void
+__imlib_FilterRowV_sse2(const short *tile, int stride, const short *wt, int n,
+                        DATA32 * dst, int w, char has_alpha)
+{
+   const __m128i       rnd = _mm_set1_epi32(1 << (FILTER_BITS + TILE_BITS - 1));
+   const __m128i       amask = _mm_set1_epi32(has_alpha ? 0 : 0xff000000);
+   const short        *t;
+   __m128i             acc0, acc1, a, b, wp;
+   int                 x, k;
+
+   /* two pixels (8 channels) at a time */
+   for (x = 0; x + 2 <= w; x += 2, tile += 8)
+     {
+        acc0 = acc1 = rnd;
+        for (k = 0, t = tile; k + 1 < n; k += 2, t += 2 * stride)
+          {
+             a = _mm_loadu_si128((const __m128i *)t);
+             b = _mm_loadu_si128((const __m128i *)(t + stride));
+             wp = WPAIR(wt, k);
+             acc0 = _mm_add_epi32(acc0,
+                                  _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wp));
+             acc1 = _mm_add_epi32(acc1,
+                                  _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wp));
+          }
+        if (k < n)
+          {
+             a = _mm_loadu_si128((const __m128i *)t);
+             b = _mm_setzero_si128();
+             wp = _mm_set1_epi32((uint16_t) wt[k]);
+             acc0 = _mm_add_epi32(acc0,
+                                  _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wp));
+             acc1 = _mm_add_epi32(acc1,
+                                  _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wp));
+          }
+        acc0 = _mm_srai_epi32(acc0, FILTER_BITS + TILE_BITS);
+        acc1 = _mm_srai_epi32(acc1, FILTER_BITS + TILE_BITS);
+        a = _mm_packs_epi32(acc0, acc1);
+        a = _mm_or_si128(_mm_packus_epi16(a, a), amask);
+        _mm_storel_epi64((__m128i *) (dst + x), a);
+     }
+
+   if (x < w)
+      __imlib_FilterRowV(tile, stride, wt, n, dst + x, w - x, has_alpha);
+}
+#endif
+
+/* scale with a separable filter */
+void
+__imlib_ScaleFilterRGBA(ImlibScaleInfo * isi, DATA32 * dest, int dxx, int dyy,
+                        int dx, int dy, int dw, int dh, int dow, int sow)
+{
+   ImlibFilterTaps    *xt = isi->xtaps, *yt = isi->ytaps;
+   int                 y, y0, y1, o0, o1, size, stride;
+   short              *tile;
+   DATA32             *src;
+
+#ifdef DO_SIMD
+   int                 simd = __imlib_do_simd() != SIMD_NONE;
+#endif
+
+   if (!xt)
+     {
+        /* no filter taps (bordered image) */
+        if (isi->has_alpha)
+           __imlib_ScaleAARGBA(isi, dest, dxx, dyy, dx, dy, dw, dh, dow, sow);
+        else
+           __imlib_ScaleAARGB(isi, dest, dxx, dyy, dx, dy, dw, dh, dow, sow);
+        return;
+     }
+
+   /* source rows needed for these output rows */
+   y0 = INT_MAX;
+   y1 = 0;
+   for (y = dyy; y < dyy + dh; y++)
+     {
+        y0 = MIN(y0, yt->start[y]);
+        y1 = MAX(y1, yt->start[y] + yt->n);
+     }
+   if (y1 <= y0)
+      return;
+
+   /* keep the rows already in the tile, filter the others */
+   if (isi->tile_x != dxx || isi->tile_w != dw)
+      isi->tile_h = 0;
+   o0 = MAX(y0, isi->tile_y);
+   o1 = MIN(y1, isi->tile_y + isi->tile_h);
+   stride = dw * 4;
+   size = (y1 - y0) * stride;
+   if (size > isi->tile_size)
+     {
+        tile = malloc(size * sizeof(short));
+        if (!tile)
+           return;
+        if (o0 < o1)
+           memcpy(tile + (o0 - y0) * stride,
+                  isi->tile + (o0 - isi->tile_y) * stride,
+                  (o1 - o0) * stride * sizeof(short));
+        free(isi->tile);
+        isi->tile = tile;
+        isi->tile_size = size;
+     }
+   else if (o0 < o1)
+     {
+        memmove(isi->tile + (o0 - y0) * stride,
+                isi->tile + (o0 - isi->tile_y) * stride,
+                (o1 - o0) * stride * sizeof(short));
+     }
+   tile = isi->tile;
+
+   src = isi->src;
+   for (y = y0; y < y1; y++)
+     {
+        if (y >= o0 && y < o1)
+           continue;
+#ifdef DO_SIMD
+        if (simd)
+           __imlib_FilterRowH_sse2(xt, src + y * sow, tile + (y - y0) * stride,
+                                   dxx, dw);
+        else
+#endif
+           __imlib_FilterRowH(xt, src + y * sow, tile + (y - y0) * stride,
+                              dxx, dw);
+     }
+   isi->tile_y = y0;
+   isi->tile_h = y1 - y0;
+   isi->tile_x = dxx;
+   isi->tile_w = dw;
+
+   for (y = 0; y < dh; y++)
+     {
+        const short        *t = tile + (yt->start[dyy + y] - y0) * stride;
+        const short        *wt = yt->w + (dyy + y) * yt->n;
+
+#ifdef DO_SIMD
+        if (simd)
+           __imlib_FilterRowV_sse2(t, stride, wt, yt->n,
+                                   dest + dx + (y + dy) * dow, dw,
+                                   isi->has_alpha);
+        else
+#endif
+           __imlib_FilterRowV(t, stride, wt, yt->n,
+                              dest + dx + (y + dy) * dow, dw, isi->has_alpha);
+     }
+}
+
+/*
+ * Mipmap pyramid
+ *
+ * Images flagged F_USE_MIPMAP keep a chain of successively 2x2 box filtered
+ * levels (im->mipmap, im->mipmap->mipmap, ...). Levels are built on demand
+ * when an anti-aliased downscale can start from a smaller level, so the
+ * scaler only has to average over roughly the output size. They are dropped
+ * when the image is dirtied or freed.
+ */
+
+/* average of four pixels, per channel, rounded */
+static              DATA32
+__imlib_Avg4(DATA32 p0, DATA32 p1, DATA32 p2, DATA32 p3)
+{
+   DATA32              rb, ag;
+
+   rb = (p0 & 0x00ff00ff) + (p1 & 0x00ff00ff) +
+      (p2 & 0x00ff00ff) + (p3 & 0x00ff00ff) + 0x00020002;
+   ag = ((p0 >> 8) & 0x00ff00ff) + ((p1 >> 8) & 0x00ff00ff) +
+      ((p2 >> 8) & 0x00ff00ff) + ((p3 >> 8) & 0x00ff00ff) + 0x00020002;
+
+   return ((rb >> 2) & 0x00ff00ff) | (((ag >> 2) & 0x00ff00ff) << 8);
+}
+
+/* make the next level - odd last rows/columns are replicated */
+static ImlibImage  *
+__imlib_MipmapBuild(ImlibImage * im)
+{
+   ImlibImage         *lv;
+   DATA32             *s0, *s1, *p;
+   int                 x, y, x0, x1;
+
+   lv = calloc(1, sizeof(ImlibImage));
+   if (!lv)
+      return NULL;
+
+   lv->w = (im->w + 1) >> 1;
+   lv->h = (im->h + 1) >> 1;
+   lv->data = malloc(lv->w * lv->h * sizeof(DATA32));
+   if (!lv->data)
+     {
+        free(lv);
+        return NULL;
+     }
+   lv->flags = im->flags & (F_HAS_ALPHA | F_ALPHA_PREMUL);
+   lv->references = 1;
+
+   p = lv->data;
+   for (y = 0; y < lv->h; y++)
+     {
+        s0 = im->data + 2 * y * im->w;
+        s1 = (2 * y + 1 < im->h) ? s0 + im->w : s0;
+        for (x = 0; x < lv->w; x++)
+          {
+             x0 = 2 * x;
+             x1 = (x0 + 1 < im->w) ? x0 + 1 : x0;
+             *p++ = __imlib_Avg4(s0[x0], s0[x1], s1[x0], s1[x1]);
+          }
+     }
+
+   return lv;
+}
+
+/* pick the smallest level whose source rectangle still covers dw x dh */
+/* the rectangle is converted to the coordinates of the returned image */
+ImlibImage         *
+__imlib_MipmapSelect(ImlibImage * im, int *sx, int *sy, int *sw, int *sh,
+                     int dw, int dh)
+{
+   ImlibImage         *lv;
+   int                 x0, y0, x1, y1, nx0, ny0, nx1, ny1;
+
+   if (!IMAGE_USE_MIPMAP(im) || !im->data)
+      return im;
+   /* borders are given in pixels of the full size image */
+   if (im->border.left || im->border.right ||
+       im->border.top || im->border.bottom)
+      return im;
+
+   dw = abs(dw);
+   dh = abs(dh);
+   x0 = *sx;
+   y0 = *sy;
+   x1 = *sx + *sw;
+   y1 = *sy + *sh;
+
+   for (lv = im;;)
+     {
+        nx0 = x0 >> 1;
+        ny0 = y0 >> 1;
+        nx1 = (x1 + 1) >> 1;
+        ny1 = (y1 + 1) >> 1;
+        if (nx1 - nx0 < dw || ny1 - ny0 < dh)
+           break;
+        if (lv->w < 2 && lv->h < 2)
+           break;
+
+        if (!lv->mipmap)
+           lv->mipmap = __imlib_MipmapBuild(lv);
+        if (!lv->mipmap)
+           break;
+        lv = lv->mipmap;
+        UPDATE_FLAG(lv->flags, F_HAS_ALPHA, IMAGE_HAS_ALPHA(im));
+        UPDATE_FLAG(lv->flags, F_ALPHA_PREMUL, IMAGE_ALPHA_PREMUL(im));
+
+        x0 = nx0;
+        y0 = ny0;
+        x1 = nx1;
+        y1 = ny1;
+     }
+
+   *sx = x0;
+   *sy = y0;
+   *sw = x1 - x0;
+   *sh = y1 - y0;
+
+   return lv;
+}
+
+/* free all levels below im */
+void
+__imlib_MipmapFree(ImlibImage * im)
+{
+   ImlibImage         *lv, *lv_next;
+
+   for (lv = im->mipmap; lv; lv = lv_next)
+     {
+        lv_next = lv->mipmap;
+        free(lv->data);
+        free(lv);
+     }
+   im->mipmap = NULL;
+}
+
+/* memory used by the levels below im */
+int
+__imlib_MipmapSize(ImlibImage * im)
+{
+   ImlibImage         *lv;
+   int                 size = 0;
+
+   for (lv = im->mipmap; lv; lv = lv->mipmap)
+      size += lv->w * lv->h * sizeof(DATA32);
+
+   return size;
+}
@@ -5,10 +5,18 @@
 
 typedef struct _imlib_scale_info ImlibScaleInfo;
 
+/* Scaling filters, the aa argument below (values match Imlib_Scale_Filter) */
+#define SCALE_SAMPLE    0
+#define SCALE_AREA      1
+#define SCALE_BICUBIC   2
+#define SCALE_LANCZOS   3
+
 ImlibScaleInfo     *__imlib_CalcScaleInfo(ImlibImage * im,
                                           int sw, int sh,
                                           int dw, int dh, char aa);
 ImlibScaleInfo     *__imlib_FreeScaleInfo(ImlibScaleInfo * isi);
+ImlibScaleInfo     *__imlib_ShareScaleInfo(ImlibScaleInfo * isi);
+ImlibScaleInfo     *__imlib_FreeSharedScaleInfo(ImlibScaleInfo * isi);
 void                __imlib_ScaleSampleRGBA(ImlibScaleInfo * isi, DATA32 * dest,
                                             int dxx, int dyy, int dx, int dy,
                                             int dw, int dh, int dow);
@@ -18,6 +26,16 @@ void                __imlib_ScaleAARGBA(ImlibScaleInfo * isi, DATA32 * dest,
 void                __imlib_ScaleAARGB(ImlibScaleInfo * isi, DATA32 * dest,
                                        int dxx, int dyy, int dx, int dy,
                                        int dw, int dh, int dow, int sow);
+void                __imlib_ScaleFilterRGBA(ImlibScaleInfo * isi,
+                                            DATA32 * dest, int dxx, int dyy,
+                                            int dx, int dy, int dw, int dh,
+                                            int dow, int sow);
+
+ImlibImage         *__imlib_MipmapSelect(ImlibImage * im,
+                                         int *sx, int *sy, int *sw, int *sh,
+                                         int dw, int dh);
+void                __imlib_MipmapFree(ImlibImage * im);
+int                 __imlib_MipmapSize(ImlibImage * im);
 
 #ifdef DO_MMX_ASM
 void                __imlib_Scale_mmx_AARGBA(ImlibScaleInfo * isi,
@@ -12,6 +12,7 @@
 #include <sys/stat.h>
 
 #include "Imlib2.h"
+#include "colormod.h"
 #include "dynamic_filters.h"
 #include "image.h"
 #include "script.h"
@@ -64,7 +65,7 @@ __imlib_copystr(const char *str, int start, int end)
    if (start > end || end >= (int)strlen(str))
       return NULL;
 
-   rstr = calloc(1024, sizeof(char));
+   rstr = calloc(end - start + 2, sizeof(char));
    for (i = start; i <= end; i++)
       rstr[i - start] = str[i];
    return rstr;
@@ -80,6 +81,8 @@ __imlib_script_tidyup_params(IFunctionParam * param)
    free(param->key);
    if (param->type == VAR_CHAR)
       free(param->data);
+   if (param->func)
+      __imlib_script_free(param->func);
    free(param);
 }
 
@@ -118,7 +121,7 @@ __imlib_script_add_var(void *ptr)
 }
 
 IFunctionParam     *
-__imlib_script_parse_parameters(ImlibImage * im, const char *parameters)
+__imlib_script_parse_parameters(const char *parameters)
 {
    int                 i = 0, in_quote = 0, depth = 0, start = 0, value_start =
       0;
@@ -133,6 +136,7 @@ __imlib_script_parse_parameters(ImlibImage * im, const char *parameters)
    rootptr->type = VAR_CHAR;
    rootptr->data = strdup("NO-VALUE");
    rootptr->next = NULL;
+   rootptr->func = NULL;
    ptr = rootptr;
 
    param_len = strlen(parameters);
@@ -148,19 +152,35 @@ __imlib_script_parse_parameters(ImlibImage * im, const char *parameters)
            value_start = i + 1;
         if (!in_quote && (parameters[i] == ',' || i == param_len) && depth == 0)
           {
+             if (i == start)
+               {
+                  /* Empty parameter */
+                  start = i + 1;
+                  continue;
+               }
              ptr->next = malloc(sizeof(IFunctionParam));
              ptr = ptr->next;
+             ptr->func = NULL;
              ptr->key = __imlib_copystr(parameters, start, value_start - 2);
+             if (!ptr->key)
+                ptr->key = strdup("");
              value = __imlib_copystr(parameters, value_start, i - 1);
 #ifdef FDEBUG
              printf("DEBUG: (--)    --> Variable \"%s\" = \"%s\"\n", ptr->key,
                     value);
 #endif
-             if (__imlib_find_string(value, "(") <
-                 __imlib_find_string(value, "\""))
+             if (!value)
+               {
+                  ptr->data = strdup("");
+                  ptr->type = VAR_CHAR;
+               }
+             else if (__imlib_find_string(value, "(") <
+                      __imlib_find_string(value, "\""))
                {
                   D("(--)   Found a function");
-                  ptr->data = __imlib_script_parse_function(im, value);
+                  /* Evaluated into data each time the script is run */
+                  ptr->func = __imlib_script_parse_function(value);
+                  ptr->data = NULL;
                   ptr->type = VAR_PTR;
                   free(value);
                }
@@ -191,109 +211,236 @@ __imlib_script_parse_parameters(ImlibImage * im, const char *parameters)
    return rootptr;
 }
 
-ImlibImage         *
-__imlib_script_parse_function(ImlibImage * im, const char *function)
+IFunction          *
+__imlib_script_parse_function(const char *function)
 {
-   char               *funcname, *funcparams;
-   IFunctionParam     *params;
-   ImlibExternalFilter *filter = NULL;
-   ImlibImage         *retval;
+   char               *funcparams;
+   IFunction          *func;
 
    D("(--) ===> Entering __imlib_script_parse_function()");
-   funcname =
+   func = malloc(sizeof(IFunction));
+   func->next = NULL;
+   func->name =
       __imlib_copystr(function, 0, __imlib_find_string(function, "(") - 1);
+   if (!func->name)
+      func->name = strdup(function);
    funcparams =
       __imlib_copystr(function, __imlib_find_string(function, "(") + 1,
                       strlen(function) - 2);
 #ifdef FDEBUG
-   printf("DEBUG: (?\?)   = function <%s>( \"%s\" )\n", funcname, funcparams);
+   printf("DEBUG: (?\?)   = function <%s>( \"%s\" )\n", func->name, funcparams);
 #endif
-   params = __imlib_script_parse_parameters(im, funcparams);
-   /* excute the filter */
-   filter = __imlib_get_dynamic_filter(funcname);
-   if (filter)
-     {
-#ifdef FDEBUG
-        printf("DEBUG: (--)   Executing Filter \"%s\".\n", funcname);
-#endif
-        retval = filter->exec_filter(funcname, im, params);
-     }
-   else
-     {
+   func->params = __imlib_script_parse_parameters(funcparams ? funcparams : "");
+   /* resolve the filter once, not on every run */
+   func->filter = __imlib_get_dynamic_filter(func->name);
 #ifdef FDEBUG
-        printf
-           ("DEBUG: (!!)   Can't find filter \"%s\", returning given image.\n",
-            funcname);
+   if (!func->filter)
+      printf("DEBUG: (!!)   Can't find filter \"%s\", will be skipped.\n",
+             func->name);
 #endif
-        retval = im;
-     }
-   D("Get Here");
-   /* clean up params */
-   free(funcname);
    free(funcparams);
-   __imlib_script_tidyup_params(params);
    D("(--) <=== Leaving __imlib_script_parse_function()");
-   return retval;
+   return func;
 }
 
-ImlibImage         *
-__imlib_script_parse(ImlibImage * im, const char *script, va_list param_list)
+IFunction          *
+__imlib_script_compile(const char *script, va_list param_list)
 {
    int                 i = 0, in_quote = 0, start = 0, depth = 0;
    int                 script_len;
    char               *scriptbuf = NULL, *function;
+   IFunction          *funcs = NULL, **tail = &funcs;
 
-   D("(--) Script Parser Start.");
-   if (script && script[0] != 0)
+   D("(--) Script Compiler Start.");
+   if (!script || script[0] == 0)
      {
-        vars = malloc(sizeof(IVariable));
-        vars->ptr = NULL;
-        vars->next = NULL;
-        curtail = vars;
-        current_var = vars;
-        /* gather up variable from the command line */
-        D("(--) String Whitespace from script.");
-        scriptbuf = __imlib_stripwhitespace(strdup(script));
+        D("(!!) Script Compiler Failed.");
+        return NULL;
+     }
 
-        i = __imlib_find_string(scriptbuf + start, "=[]") - 1;
-        while (i > 0)
-          {
-             __imlib_script_add_var(va_arg(param_list, void *));
+   vars = malloc(sizeof(IVariable));
+   vars->ptr = NULL;
+   vars->next = NULL;
+   curtail = vars;
+   current_var = vars;
+   /* gather up variable from the command line */
+   D("(--) String Whitespace from script.");
+   scriptbuf = __imlib_stripwhitespace(strdup(script));
 
-             start = start + i + 2;
-             i = __imlib_find_string(scriptbuf + start, "=[]") - 1;
-             i = (i == 0 ? 0 : i);
-             D("(?\?)   Found pointer variable");
-          }
+   i = __imlib_find_string(scriptbuf + start, "=[]") - 1;
+   while (i > 0)
+     {
+        __imlib_script_add_var(va_arg(param_list, void *));
 
-        start = 0;
-        script_len = strlen(scriptbuf);
-        for (i = 0; i < script_len; i++)
+        start = start + i + 2;
+        i = __imlib_find_string(scriptbuf + start, "=[]") - 1;
+        i = (i == 0 ? 0 : i);
+        D("(?\?)   Found pointer variable");
+     }
+
+   start = 0;
+   script_len = strlen(scriptbuf);
+   for (i = 0; i < script_len; i++)
+     {
+        if (scriptbuf[i] == '\"')
+           in_quote = (in_quote == 0 ? 1 : 0);
+        if (!in_quote && scriptbuf[i] == '(')
+           depth++;
+        if (!in_quote && scriptbuf[i] == ')')
+           depth--;
+        if (!in_quote && (scriptbuf[i] == ';') && depth == 0)
           {
-             if (script[i] == '\"')
-                in_quote = (in_quote == 0 ? 1 : 0);
-             if (!in_quote && script[i] == '(')
-                depth++;
-             if (!in_quote && script[i] == ')')
-                depth--;
-             if (!in_quote && (script[i] == ';') && depth == 0)
+             function = __imlib_copystr(scriptbuf, start, i - 1);
+             if (function)
                {
-                  function = __imlib_copystr(scriptbuf, start, i - 1);
-                  im = __imlib_script_parse_function(im, function);
-                  imlib_context_set_image(im);
-                  start = i + 1;
+                  *tail = __imlib_script_parse_function(function);
+                  tail = &(*tail)->next;
                   free(function);
                }
+             start = i + 1;
           }
-        D("(--) Cleaning up parameter list");
-        __imlib_script_tidyup();
-        D("(--) Script Parser Successful.");
-        free(scriptbuf);
-        return im;
      }
-   else
+   D("(--) Cleaning up parameter list");
+   __imlib_script_tidyup();
+   D("(--) Script Compiler Successful.");
+   free(scriptbuf);
+   return funcs;
+}
+
+void
+__imlib_script_free(IFunction * funcs)
+{
+   IFunction          *next;
+
+   for (; funcs; funcs = next)
      {
-        D("(!!) Script Parser Failed.");
-        return NULL;
+        next = funcs->next;
+        free(funcs->name);
+        __imlib_script_tidyup_params(funcs->params);
+        free(funcs);
+     }
+}
+
+static ImlibImage  *__imlib_script_exec_function(ImlibImage * im,
+                                                 IFunction * func);
+
+static void
+__imlib_script_eval_params(ImlibImage * im, IFunction * func)
+{
+   IFunctionParam     *ptr;
+
+   for (ptr = func->params; ptr; ptr = ptr->next)
+     {
+        if (ptr->func)
+           ptr->data = __imlib_script_exec_function(im, ptr->func);
      }
 }
+
+static ImlibImage  *
+__imlib_script_exec_function(ImlibImage * im, IFunction * func)
+{
+   if (!func->filter)
+      return im;
+   __imlib_script_eval_params(im, func);
+#ifdef FDEBUG
+   printf("DEBUG: (--)   Executing Filter \"%s\".\n", func->name);
+#endif
+   return func->filter->exec_filter(func->name, im, func->params);
+}
+
+static void
+__imlib_script_cmod_flush(ImlibImage * im, ImlibColorModifier * cm,
+                          int x, int y, int w, int h)
+{
+   CLIP(x, y, w, h, 0, 0, im->w, im->h);
+   if (w <= 0 || h <= 0 || !im->data)
+      return;
+   __imlib_DataCmodApply(im->data + (y * im->w) + x, w, h, im->w - w,
+                         &(im->flags), cm);
+}
+
+/*
+ * Runs a compiled script.
+ * Consecutive table filters (see cmod_filter) working on the same
+ * rectangle are composed into one color modifier and applied in a single
+ * pass over the pixels.
+ */
+ImlibImage         *
+__imlib_script_exec(ImlibImage * im, IFunction * funcs)
+{
+   IFunction          *func;
+   ImlibColorModifier  cm;
+   DATA8               r[256], g[256], b[256], a[256];
+   int                 x = 0, y = 0, w = 0, h = 0, nx, ny, nw, nh, i;
+   int                 pending = 0;
+
+   for (func = funcs; func; func = func->next)
+     {
+        if (func->filter && func->filter->cmod_filter)
+          {
+             __imlib_script_eval_params(im, func);
+             nx = ny = nw = nh = 0;
+             if (func->filter->cmod_filter(func->name, im, func->params,
+                                           r, g, b, a, &nx, &ny, &nw, &nh))
+               {
+                  if (pending &&
+                      (nx != x || ny != y || nw != w || nh != h))
+                    {
+                       __imlib_script_cmod_flush(im, &cm, x, y, w, h);
+                       pending = 0;
+                    }
+                  if (!pending)
+                    {
+                       memcpy(cm.red_mapping, r, sizeof(r));
+                       memcpy(cm.green_mapping, g, sizeof(g));
+                       memcpy(cm.blue_mapping, b, sizeof(b));
+                       memcpy(cm.alpha_mapping, a, sizeof(a));
+                       x = nx;
+                       y = ny;
+                       w = nw;
+                       h = nh;
+                       pending = 1;
+                    }
+                  else
+                    {
+                       for (i = 0; i < 256; i++)
+                         {
+                            cm.red_mapping[i] = r[cm.red_mapping[i]];
+                            cm.green_mapping[i] = g[cm.green_mapping[i]];
+                            cm.blue_mapping[i] = b[cm.blue_mapping[i]];
+                            cm.alpha_mapping[i] = a[cm.alpha_mapping[i]];
+                         }
+                    }
+                  continue;
+               }
+          }
+
+        if (pending)
+          {
+             __imlib_script_cmod_flush(im, &cm, x, y, w, h);
+             pending = 0;
+          }
+        im = __imlib_script_exec_function(im, func);
+        imlib_context_set_image(im);
+     }
+
+   if (pending)
+      __imlib_script_cmod_flush(im, &cm, x, y, w, h);
+
+   return im;
+}
+
+ImlibImage         *
+__imlib_script_parse(ImlibImage * im, const char *script, va_list param_list)
+{
+   IFunction          *funcs;
+
+   if (!script || script[0] == 0)
+      return NULL;
+
+   funcs = __imlib_script_compile(script, param_list);
+   im = __imlib_script_exec(im, funcs);
+   __imlib_script_free(funcs);
+
+   return im;
+}
@@ -34,11 +34,13 @@ typedef struct _IFunctionParam {
    int                 type;
    void               *data;
    struct _IFunctionParam *next;
+   struct _IFunction  *func;    /* Nested function, evaluated into data */
 } IFunctionParam;
 
 typedef struct _IFunction {
    char               *name;
    IFunctionParam     *params;
+   struct _ImlibExternalFilter *filter;
    struct _IFunction  *next;
 } IFunction;
 
@@ -49,10 +51,11 @@ typedef struct _imlib_variable {
 
 ImlibImage         *__imlib_script_parse(ImlibImage * im, const char *script,
                                          va_list);
-IFunctionParam     *__imlib_script_parse_parameters(ImlibImage * im,
-                                                    const char *parameters);
-ImlibImage         *__imlib_script_parse_function(ImlibImage * im,
-                                                  const char *function);
+IFunction          *__imlib_script_compile(const char *script, va_list);
+ImlibImage         *__imlib_script_exec(ImlibImage * im, IFunction * funcs);
+void                __imlib_script_free(IFunction * funcs);
+IFunctionParam     *__imlib_script_parse_parameters(const char *parameters);
+IFunction          *__imlib_script_parse_function(const char *function);
 void                __imlib_script_tidyup(void);
 void               *__imlib_script_get_next_var(void);
 void                __imlib_script_add_var(void *ptr);
@@ -1,6 +1,10 @@
 #include "common.h"
 
+#include "asm_c.h"
 #include "blend.h"
+#ifdef DO_SIMD
+#include "blend_simd.h"
+#endif
 #include "colormod.h"
 #include "image.h"
 #include "span.h"
@@ -1223,6 +1227,17 @@ __imlib_GetSpanDrawFunction(ImlibOp op, char dst_alpha, char blend)
    if (opi == -1)
       return NULL;
 
+#ifdef DO_SIMD
+   {
+      ImlibSpanDrawFunction sfun;
+
+      sfun = __imlib_GetSpanDrawFunctionSimd(__imlib_do_simd(), op,
+                                             dst_alpha, blend);
+      if (sfun)
+         return sfun;
+   }
+#endif
+
    return spanfuncs[opi][!!dst_alpha][!!blend];
 }
 
@@ -1251,5 +1266,16 @@ __imlib_GetShapedSpanDrawFunction(ImlibOp op, char dst_alpha, char blend)
    if (opi == -1)
       return NULL;
 
+#ifdef DO_SIMD
+   {
+      ImlibShapedSpanDrawFunction sfun;
+
+      sfun = __imlib_GetShapedSpanDrawFunctionSimd(__imlib_do_simd(), op,
+                                                   dst_alpha, blend);
+      if (sfun)
+         return sfun;
+   }
+#endif
+
    return shapedspanfuncs[opi][!!dst_alpha][!!blend];
 }
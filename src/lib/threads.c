@@ -0,0 +1,102 @@
+#include "common.h"
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "threads.h"
+
+/*
+ * Minimal parallel job runner.
+ *
+ * __imlib_RunJobs() runs func(data, job) for job = 0..njobs-1, spread over
+ * up to __imlib_GetThreadCount() threads (the calling thread included).
+ * Jobs are handed out in order from a shared counter, so callers should
+ * split work into independent jobs of similar size, e.g. bands of rows.
+ * The job functions must not touch shared state that is not set up before
+ * the call.
+ */
+
+#define MAX_THREADS 32
+
+static int          _thread_count = -1;
+
+void
+__imlib_SetThreadCount(int n)
+{
+   _thread_count = (n <= 0) ? -1 : MIN(n, MAX_THREADS);
+}
+
+int
+__imlib_GetThreadCount(void)
+{
+#ifdef HAVE_PTHREAD
+   const char         *s;
+   long                n;
+
+   if (_thread_count > 0)
+      return _thread_count;
+
+   s = getenv("IMLIB2_THREADS");
+   if (s)
+      n = atoi(s);
+   else
+      n = sysconf(_SC_NPROCESSORS_ONLN);
+   _thread_count = (n < 1) ? 1 : MIN(n, MAX_THREADS);
+
+   return _thread_count;
+#else
+   return 1;
+#endif
+}
+
+typedef struct {
+   ImlibJobFunction    func;
+   void               *data;
+   int                 njobs;
+   int                 next;
+} ImlibJobs;
+
+static void        *
+__imlib_JobsWorker(void *arg)
+{
+   ImlibJobs          *jobs = arg;
+   int                 job;
+
+   while ((job = __atomic_fetch_add(&jobs->next, 1, __ATOMIC_RELAXED)) <
+          jobs->njobs)
+      jobs->func(jobs->data, job);
+
+   return NULL;
+}
+
+void
+__imlib_RunJobs(int njobs, ImlibJobFunction func, void *data)
+{
+   ImlibJobs           jobs;
+
+#ifdef HAVE_PTHREAD
+   pthread_t           th[MAX_THREADS];
+   int                 i, nth;
+#endif
+
+   jobs.func = func;
+   jobs.data = data;
+   jobs.njobs = njobs;
+   jobs.next = 0;
+
+#ifdef HAVE_PTHREAD
+   nth = MIN(__imlib_GetThreadCount(), njobs) - 1;
+   for (i = 0; i < nth; i++)
+      if (pthread_create(&th[i], NULL, __imlib_JobsWorker, &jobs))
+         break;
+   nth = i;
+#endif
+
+   __imlib_JobsWorker(&jobs);
+
+#ifdef HAVE_PTHREAD
+   for (i = 0; i < nth; i++)
+      pthread_join(th[i], NULL);
+#endif
+}
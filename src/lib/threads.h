@@ -0,0 +1,12 @@
+#ifndef __THREADS
+#define __THREADS 1
+
+typedef void        (*ImlibJobFunction) (void *data, int job);
+
+void                __imlib_SetThreadCount(int n);
+int                 __imlib_GetThreadCount(void);
+
+void                __imlib_RunJobs(int njobs, ImlibJobFunction func,
+                                    void *data);
+
+#endif
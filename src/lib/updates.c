@@ -135,6 +135,75 @@ __imlib_MergeUpdate(ImlibUpdate * u, int w, int h, int hgapmax)
    return nu;
 }
 
+/*
+ * Merge rects where handling their bounding box costs less than handling
+ * them separately.
+ * cost is the overhead of one more rect, counted in pixels: a pair is merged
+ * when its bounding box adds at most cost pixels that are in neither rect.
+ */
+ImlibUpdate        *
+__imlib_CoalesceUpdates(ImlibUpdate * u, int cost)
+{
+   ImlibUpdate        *ua, *ub, **pb;
+   int                 x0, y0, x1, y1, ox, oy, waste, merged;
+
+   do
+     {
+        merged = 0;
+        for (ua = u; ua; ua = ua->next)
+          {
+             for (pb = &ua->next; (ub = *pb);)
+               {
+                  x0 = MIN(ua->x, ub->x);
+                  y0 = MIN(ua->y, ub->y);
+                  x1 = MAX(ua->x + ua->w, ub->x + ub->w);
+                  y1 = MAX(ua->y + ua->h, ub->y + ub->h);
+                  ox = MIN(ua->x + ua->w, ub->x + ub->w) - MAX(ua->x, ub->x);
+                  oy = MIN(ua->y + ua->h, ub->y + ub->h) - MAX(ua->y, ub->y);
+                  waste = (x1 - x0) * (y1 - y0) - ua->w * ua->h - ub->w * ub->h;
+                  if ((ox > 0) && (oy > 0))
+                     waste += ox * oy;
+                  if (waste > cost)
+                    {
+                       pb = &ub->next;
+                       continue;
+                    }
+                  ua->x = x0;
+                  ua->y = y0;
+                  ua->w = x1 - x0;
+                  ua->h = y1 - y0;
+                  *pb = ub->next;
+                  free(ub);
+                  merged = 1;
+               }
+          }
+     }
+   while (merged);
+
+   return u;
+}
+
+/* clip rects to w x h, dropping the ones left empty */
+ImlibUpdate        *
+__imlib_ClipUpdates(ImlibUpdate * u, int w, int h)
+{
+   ImlibUpdate        *uu, **pu;
+
+   for (pu = &u; (uu = *pu);)
+     {
+        CLIP(uu->x, uu->y, uu->w, uu->h, 0, 0, w, h);
+        if ((uu->w < 1) || (uu->h < 1))
+          {
+             *pu = uu->next;
+             free(uu);
+             continue;
+          }
+        pu = &uu->next;
+     }
+
+   return u;
+}
+
 ImlibUpdate        *
 __imlib_AddUpdate(ImlibUpdate * u, int x, int y, int w, int h)
 {
@@ -12,6 +12,8 @@ ImlibUpdate        *__imlib_AddUpdate(ImlibUpdate * u,
                                       int x, int y, int w, int h);
 ImlibUpdate        *__imlib_MergeUpdate(ImlibUpdate * u,
                                         int w, int h, int hgapmax);
+ImlibUpdate        *__imlib_CoalesceUpdates(ImlibUpdate * u, int cost);
+ImlibUpdate        *__imlib_ClipUpdates(ImlibUpdate * u, int w, int h);
 void                __imlib_FreeUpdates(ImlibUpdate * u);
 ImlibUpdate        *__imlib_DupUpdates(ImlibUpdate * u);
 
@@ -34,7 +34,6 @@ __imlib_CreatePixmapsForImage(Display * d, Drawable w, Visual * v, int depth,
            *p = ip->pixmap;
         if (m)
            *m = ip->mask;
-        ip->references++;
 #ifdef DEBUG_CACHE
         fprintf(stderr,
                 "[Imlib2]  Match found in cache.  Reference count is %d, pixmap 0x%08lx, mask 0x%08lx\n",
@@ -4,9 +4,15 @@
 #include <X11/Xutil.h>
 #include <X11/extensions/shape.h>
 #include <X11/extensions/XShm.h>
+#ifdef HAVE_X11_XDAMAGE
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#endif
 #include <sys/ipc.h>
 #include <sys/shm.h>
 
+#include "image.h"
+#include "updates.h"
 #include "x11_grab.h"
 #include "x11_ximage.h"
 
@@ -633,6 +639,41 @@ _WindowGetShapeMask(Display * d, Window p,
    return mask;
 }
 
+/* set up the tables converting pixels of depth <= 8 drawables */
+static void
+_GrabColorTables(Display * d, Colormap cm, int depth, int is_pixmap)
+{
+   XColor              cols[256];
+   int                 i;
+
+   if ((depth == 1) && (!cm) && (is_pixmap))
+     {
+        rtab[0] = 255;
+        gtab[0] = 255;
+        btab[0] = 255;
+        rtab[1] = 0;
+        gtab[1] = 0;
+        btab[1] = 0;
+        return;
+     }
+
+   if (!cm)
+      cm = DefaultColormap(d, DefaultScreen(d));
+
+   for (i = 0; i < (1 << depth); i++)
+     {
+        cols[i].pixel = i;
+        cols[i].flags = DoRed | DoGreen | DoBlue;
+     }
+   XQueryColors(d, cm, cols, 1 << depth);
+   for (i = 0; i < (1 << depth); i++)
+     {
+        rtab[i] = cols[i].red >> 8;
+        gtab[i] = cols[i].green >> 8;
+        btab[i] = cols[i].blue >> 8;
+     }
+}
+
 int
 __imlib_GrabDrawableToRGBA(DATA32 * data, int x_dst, int y_dst, int w_dst,
                            int h_dst, Display * d, Drawable p, Pixmap m_,
@@ -644,13 +685,11 @@ __imlib_GrabDrawableToRGBA(DATA32 * data, int x_dst, int y_dst, int w_dst,
    XWindowAttributes   xatt, ratt;
    char                is_pixmap = 0, is_shm = 0, is_mshm = 0;
    char                domask;
-   int                 i;
    int                 src_x, src_y, src_w, src_h;
    int                 width, height, clipx, clipy;
    Pixmap              m = m_;
    XShmSegmentInfo     shminfo, mshminfo;
    XImage             *xim, *mxim;
-   XColor              cols[256];
 
    domask = (pdomask) ? *pdomask : 0;
 
@@ -792,43 +831,15 @@ __imlib_GrabDrawableToRGBA(DATA32 * data, int x_dst, int y_dst, int w_dst,
    else if (grab)
       XUngrabServer(d);
 
-   if ((xatt.depth == 1) && (!cm) && (is_pixmap))
+   if (xatt.depth <= 8)
      {
-        rtab[0] = 255;
-        gtab[0] = 255;
-        btab[0] = 255;
-        rtab[1] = 0;
-        gtab[1] = 0;
-        btab[1] = 0;
-     }
-   else if (xatt.depth <= 8)
-     {
-        if (!cm)
+        if (!cm && !is_pixmap)
           {
-             if (is_pixmap)
-               {
-                  cm = DefaultColormap(d, DefaultScreen(d));
-               }
-             else
-               {
-                  cm = xatt.colormap;
-                  if (cm == None)
-                     cm = ratt.colormap;
-               }
-          }
-
-        for (i = 0; i < (1 << xatt.depth); i++)
-          {
-             cols[i].pixel = i;
-             cols[i].flags = DoRed | DoGreen | DoBlue;
-          }
-        XQueryColors(d, cm, cols, 1 << xatt.depth);
-        for (i = 0; i < (1 << xatt.depth); i++)
-          {
-             rtab[i] = cols[i].red >> 8;
-             gtab[i] = cols[i].green >> 8;
-             btab[i] = cols[i].blue >> 8;
+             cm = xatt.colormap;
+             if (cm == None)
+                cm = ratt.colormap;
           }
+        _GrabColorTables(d, cm, xatt.depth, is_pixmap);
      }
 
    __imlib_GrabXImageToRGBA(data, x_dst + clipx, y_dst + clipy, w_dst, h_dst,
@@ -967,3 +978,314 @@ __imlib_GrabDrawableScaledToRGBA(DATA32 * data, int nu_x_dst, int nu_y_dst,
 
    return rc;
 }
+
+/*
+ * Capture sessions - repeated grabs of the same drawable area.
+ *
+ * The drawable type, clipping, visual conversion tables and SHM segment are
+ * set up once. With XDamage only the areas changed since the previous update
+ * are fetched and converted into the session image, otherwise each update
+ * refetches the whole area (still reusing the segment).
+ */
+struct _ImlibCapture {
+   Display            *d;
+   Drawable            draw;
+   Visual             *v;
+   int                 depth;
+   int                 x, y, w, h;      /* Captured area in the drawable */
+   ImlibImage         *im;
+   XImage             *xim;     /* SHM segment, NULL if no SHM */
+   XShmSegmentInfo     si;
+   DATA8               rtab[256], gtab[256], btab[256];
+   char                full;    /* Next update fetches everything */
+#ifdef HAVE_X11_XDAMAGE
+   Damage              damage;
+   XserverRegion       region;
+   int                 damage_event;
+#endif
+};
+
+#ifdef HAVE_X11_XDAMAGE
+static void
+_CaptureDamageInit(ImlibCapture * cap)
+{
+   int                 event_base, error_base, major, minor;
+
+   if (getenv("IMLIB2_XDAMAGE_OFF"))
+      return;
+   if (!XDamageQueryExtension(cap->d, &event_base, &error_base))
+      return;
+   if (!XFixesQueryExtension(cap->d, &major, &minor))
+      return;
+   if (!XFixesQueryVersion(cap->d, &major, &minor) || major < 2)
+      return;
+   if (!XDamageQueryVersion(cap->d, &major, &minor))
+      return;
+
+   cap->damage_event = event_base + XDamageNotify;
+   cap->damage = XDamageCreate(cap->d, cap->draw, XDamageReportNonEmpty);
+   cap->region = XFixesCreateRegion(cap->d, NULL, 0);
+}
+
+static              Bool
+_CaptureDamageMatch(Display * d, XEvent * ev, XPointer arg)
+{
+   ImlibCapture       *cap = (ImlibCapture *) arg;
+
+   return ev->type == cap->damage_event &&
+      ((XDamageNotifyEvent *) ev)->damage == cap->damage;
+}
+
+/* take the damage accumulated since the last call, in session coordinates */
+static ImlibUpdate *
+_CaptureDamageFetch(ImlibCapture * cap)
+{
+   ImlibUpdate        *u = NULL;
+   XRectangle         *rect;
+   XEvent              ev;
+   int                 i, n, x, y, w, h;
+
+   /* the notifications only say there is damage, drop them */
+   while (XCheckIfEvent(cap->d, &ev, _CaptureDamageMatch, (XPointer) cap))
+      ;
+
+   XDamageSubtract(cap->d, cap->damage, None, cap->region);
+   rect = XFixesFetchRegion(cap->d, cap->region, &n);
+   if (!rect)
+      return NULL;
+
+   for (i = 0; i < n; i++)
+     {
+        x = rect[i].x - cap->x;
+        y = rect[i].y - cap->y;
+        w = rect[i].width;
+        h = rect[i].height;
+        CLIP(x, y, w, h, 0, 0, cap->w, cap->h);
+        if (w > 0 && h > 0)
+           u = __imlib_AddUpdate(u, x, y, w, h);
+     }
+   XFree(rect);
+
+   return u;
+}
+#endif
+
+ImlibCapture       *
+__imlib_CaptureNew(Display * d, Drawable p, Visual * v, Colormap cm,
+                   int x, int y, int w, int h)
+{
+   ImlibCapture       *cap;
+   XErrorHandler       prev_erh;
+   XWindowAttributes   xatt, ratt;
+   Window              dw;
+   char                is_pixmap;
+   int                 rx, ry, pw, ph;
+
+   /* find out once whether it is a window or a pixmap */
+   XSync(d, False);
+   prev_erh = XSetErrorHandler(Tmp_HandleXError);
+   _x_err = 0;
+   XGetWindowAttributes(d, p, &xatt);
+   XSync(d, False);
+   is_pixmap = _x_err;
+   XSetErrorHandler(prev_erh);
+
+   if (is_pixmap)
+     {
+        if (!XGetGeometry(d, p, &dw, &rx, &ry, (unsigned int *)&pw,
+                          (unsigned int *)&ph, (unsigned int *)&rx,
+                          (unsigned int *)&xatt.depth))
+           return NULL;
+     }
+   else
+     {
+        pw = xatt.width;
+        ph = xatt.height;
+        /* keep to the part on screen */
+        XGetWindowAttributes(d, xatt.root, &ratt);
+        XTranslateCoordinates(d, p, xatt.root, 0, 0, &rx, &ry, &dw);
+        CLIP(x, y, w, h, -rx, -ry, ratt.width, ratt.height);
+     }
+   CLIP(x, y, w, h, 0, 0, pw, ph);
+   if (!IMAGE_DIMENSIONS_OK(w, h))
+      return NULL;
+
+   cap = calloc(1, sizeof(ImlibCapture));
+   if (!cap)
+      return NULL;
+
+   cap->d = d;
+   cap->draw = p;
+   cap->v = v;
+   cap->depth = xatt.depth;
+   cap->x = x;
+   cap->y = y;
+   cap->w = w;
+   cap->h = h;
+   cap->full = 1;
+
+   cap->im = __imlib_CreateImage(w, h, NULL);
+   if (!cap->im)
+      goto bail;
+   cap->im->data = calloc(w * h, sizeof(DATA32));
+   if (!cap->im->data)
+      goto bail;
+   UPDATE_FLAG(cap->im->flags, F_HAS_ALPHA, cap->depth == 32);
+
+   if (cap->depth <= 8)
+     {
+        if (!cm && !is_pixmap)
+          {
+             cm = xatt.colormap;
+             if (cm == None)
+                cm = ratt.colormap;
+          }
+        _GrabColorTables(d, cm, cap->depth, is_pixmap);
+        memcpy(cap->rtab, rtab, sizeof(rtab));
+        memcpy(cap->gtab, gtab, sizeof(gtab));
+        memcpy(cap->btab, btab, sizeof(btab));
+     }
+
+   cap->xim = __imlib_ShmGetXImage(d, v, None, cap->depth, 0, 0, w, h,
+                                   &cap->si);
+
+#ifdef HAVE_X11_XDAMAGE
+   _CaptureDamageInit(cap);
+#endif
+
+   return cap;
+
+ bail:
+   __imlib_CaptureFree(cap);
+   return NULL;
+}
+
+void
+__imlib_CaptureFree(ImlibCapture * cap)
+{
+#ifdef HAVE_X11_XDAMAGE
+   if (cap->damage)
+      XDamageDestroy(cap->d, cap->damage);
+   if (cap->region)
+      XFixesDestroyRegion(cap->d, cap->region);
+#endif
+   if (cap->xim)
+      __imlib_ShmDestroyXImage(cap->d, cap->xim, &cap->si);
+   if (cap->im)
+      __imlib_FreeImage(cap->im);
+   free(cap);
+}
+
+ImlibImage         *
+__imlib_CaptureImage(ImlibCapture * cap)
+{
+   return cap->im;
+}
+
+/* fetch one rectangle of the session area and convert it into the image */
+static int
+_CaptureFetch(ImlibCapture * cap, int x, int y, int w, int h)
+{
+   XImage             *xim;
+
+   if (cap->xim)
+     {
+        /* a header for the w x h rectangle at the start of the segment */
+        xim = XShmCreateImage(cap->d, cap->v, cap->depth, ZPixmap,
+                              cap->xim->data, &cap->si, w, h);
+        if (!xim)
+           return 0;
+        XShmGetImage(cap->d, cap->draw, xim, cap->x + x, cap->y + y,
+                     AllPlanes);
+     }
+   else
+     {
+        xim = XGetImage(cap->d, cap->draw, cap->x + x, cap->y + y, w, h,
+                        AllPlanes, ZPixmap);
+        if (!xim)
+           return 0;
+     }
+
+   if (!_x_err)
+      __imlib_GrabXImageToRGBA(cap->im->data, x, y, cap->w, cap->h,
+                               cap->d, xim, NULL, cap->v, cap->depth,
+                               0, 0, w, h, 0);
+
+   if (cap->xim)
+      xim->data = NULL;         /* The segment is ours */
+   XDestroyImage(xim);
+
+   return !_x_err;
+}
+
+ImlibUpdate        *
+__imlib_CaptureUpdate(ImlibCapture * cap, int grab)
+{
+   ImlibUpdate        *u, *uu;
+   XErrorHandler       prev_erh;
+   int                 ok;
+
+   if (grab)
+      XGrabServer(cap->d);
+   XSync(cap->d, False);
+   prev_erh = XSetErrorHandler(Tmp_HandleXError);
+   _x_err = 0;
+
+   u = NULL;
+#ifdef HAVE_X11_XDAMAGE
+   if (cap->damage)
+     {
+        u = _CaptureDamageFetch(cap);
+        if (cap->full)
+          {
+             __imlib_FreeUpdates(u);
+             u = NULL;
+          }
+     }
+   else
+#endif
+      cap->full = 1;
+
+   if (cap->full)
+      u = __imlib_AddUpdate(NULL, 0, 0, cap->w, cap->h);
+   else
+      u = __imlib_MergeUpdate(u, cap->w, cap->h, 3);
+
+   if (u)
+     {
+        __imlib_SetAlphaPremul(cap->im, 0);
+        __imlib_DirtyImage(cap->im);
+     }
+   if (cap->depth <= 8)
+     {
+        memcpy(rtab, cap->rtab, sizeof(rtab));
+        memcpy(gtab, cap->gtab, sizeof(gtab));
+        memcpy(btab, cap->btab, sizeof(btab));
+     }
+
+   ok = 1;
+   for (uu = u; uu && ok; uu = uu->next)
+     {
+        /* merged rectangles are tile aligned and may stick out */
+        CLIP(uu->x, uu->y, uu->w, uu->h, 0, 0, cap->w, cap->h);
+        ok = _CaptureFetch(cap, uu->x, uu->y, uu->w, uu->h);
+     }
+
+   XSync(cap->d, False);
+   ok = ok && !_x_err;
+   XSetErrorHandler(prev_erh);
+   if (grab)
+      XUngrabServer(cap->d);
+
+   if (!ok)
+     {
+        /* the drawable went away or off screen, start over next time */
+        __imlib_FreeUpdates(u);
+        cap->full = 1;
+        return NULL;
+     }
+
+   cap->full = 0;
+
+   return u;
+}
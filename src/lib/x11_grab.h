@@ -2,6 +2,10 @@
 #define X11_GRAB_H 1
 
 #include "common.h"
+#include "image.h"
+#include "updates.h"
+
+typedef struct _ImlibCapture ImlibCapture;
 
 int                 __imlib_GrabDrawableToRGBA(DATA32 * data, int x_dst,
                                                int y_dst, int w_dst, int h_dst,
@@ -29,4 +33,11 @@ void                __imlib_GrabXImageToRGBA(DATA32 * data, int x_dst,
                                              int depth, int x_src, int y_src,
                                              int w_src, int h_src, int grab);
 
+ImlibCapture       *__imlib_CaptureNew(Display * d, Drawable p, Visual * v,
+                                       Colormap cm, int x, int y, int w,
+                                       int h);
+void                __imlib_CaptureFree(ImlibCapture * cap);
+ImlibImage         *__imlib_CaptureImage(ImlibCapture * cap);
+ImlibUpdate        *__imlib_CaptureUpdate(ImlibCapture * cap, int grab);
+
 #endif /* X11_GRAB_H */
@@ -4,7 +4,239 @@
 
 #include "x11_pixmap.h"
 
-static ImlibImagePixmap *pixmaps = NULL;
+/*
+ * The pixmap cache.
+ *
+ * Entries are kept on a list in least recently used order (most recent
+ * first), and indexed by three hash tables: by cache key for lookups when
+ * rendering, by image for dirtying, and by pixmap ID for freeing.
+ * The size of the unreferenced (reusable) pixmaps is kept up to date as
+ * references come and go, so checking it against the cache size is cheap.
+ */
+
+#define PIXMAP_HASH_MIN 256     /* Initial number of buckets */
+
+static ImlibImagePixmap *pixmaps = NULL;        /* Most recently used first */
+static ImlibImagePixmap *pixmaps_last = NULL;
+static ImlibImagePixmap **hash_key = NULL;      /* Key, image and ID tables */
+static ImlibImagePixmap **hash_img = NULL;
+static ImlibImagePixmap **hash_pmap = NULL;
+static unsigned int hash_mask = 0;      /* Number of buckets - 1 */
+static int          pixmaps_count = 0;
+static int          pixmaps_size = 0;   /* Size of unreferenced pixmaps */
+static int          pixmaps_hits = 0;
+static int          pixmaps_misses = 0;
+
+static unsigned int
+_HashAdd(unsigned int h, unsigned long v)
+{
+   h ^= (unsigned int)(v ^ (v >> 16 >> 16)) + 0x9e3779b9 + (h << 6) + (h >> 2);
+   return h;
+}
+
+static unsigned int
+_HashBucket(unsigned int h)
+{
+   h ^= h >> 16;
+   h *= 0x7feb352d;
+   h ^= h >> 15;
+   return h & hash_mask;
+}
+
+/* hash of everything that must match for a cached pixmap to be reused */
+static unsigned int
+_HashKey(ImlibImage * im, int w, int h, Display * d, Visual * v, int depth,
+         int sx, int sy, int sw, int sh, Colormap cm, char aa, char hiq,
+         char dmask, DATABIG modification_count)
+{
+   unsigned int        hash = 0;
+   const char         *s;
+
+   /* images from files are identified by file name */
+   if (im->file)
+     {
+        for (s = im->file; *s; s++)
+           hash = (hash ^ (unsigned char)*s) * 16777619;
+     }
+   else
+     {
+        hash = _HashAdd(hash, (unsigned long)im);
+     }
+   hash = _HashAdd(hash, w);
+   hash = _HashAdd(hash, h);
+   hash = _HashAdd(hash, (unsigned long)d);
+   hash = _HashAdd(hash, (unsigned long)v);
+   hash = _HashAdd(hash, depth);
+   hash = _HashAdd(hash, sx);
+   hash = _HashAdd(hash, sy);
+   hash = _HashAdd(hash, sw);
+   hash = _HashAdd(hash, sh);
+   hash = _HashAdd(hash, cm);
+   hash = _HashAdd(hash, (aa << 16) | (hiq << 8) | dmask);
+   hash = _HashAdd(hash, im->border.left);
+   hash = _HashAdd(hash, im->border.right);
+   hash = _HashAdd(hash, im->border.top);
+   hash = _HashAdd(hash, im->border.bottom);
+   hash = _HashAdd(hash, modification_count);
+   hash = _HashAdd(hash, modification_count >> 16 >> 16);
+
+   return hash;
+}
+
+static unsigned int
+_HashImage(ImlibImage * im)
+{
+   return _HashBucket(_HashAdd(0, (unsigned long)im));
+}
+
+static unsigned int
+_HashPixmap(Display * d, Pixmap p)
+{
+   return _HashBucket(_HashAdd(_HashAdd(0, (unsigned long)d), p));
+}
+
+/* bytes of server memory held by the pixmap and mask */
+static int
+_PixmapSize(ImlibImagePixmap * ip)
+{
+   int                 size = 0;
+
+   if (ip->pixmap)
+     {
+        if (ip->depth < 8)
+           size += ip->w * ip->h * ip->depth / 8;
+        else if (ip->depth == 8)
+           size += ip->w * ip->h;
+        else if (ip->depth <= 16)
+           size += ip->w * ip->h * 2;
+        else if (ip->depth <= 32)
+           size += ip->w * ip->h * 4;
+     }
+   if (ip->mask)
+      size += ip->w * ip->h / 8;
+
+   return size;
+}
+
+static void
+_HashInsert(ImlibImagePixmap * ip)
+{
+   unsigned int        i;
+
+   i = _HashBucket(ip->hash);
+   ip->hnext = hash_key[i];
+   hash_key[i] = ip;
+
+   if (ip->image)
+     {
+        i = _HashImage(ip->image);
+        ip->inext = hash_img[i];
+        hash_img[i] = ip;
+     }
+
+   i = _HashPixmap(ip->display, ip->pixmap);
+   ip->pnext = hash_pmap[i];
+   hash_pmap[i] = ip;
+}
+
+/* take an entry off the image table (done when the image goes away) */
+static void
+_HashRemoveImage(ImlibImagePixmap * ip)
+{
+   ImlibImagePixmap  **pp;
+
+   if (!ip->image)
+      return;
+   for (pp = &hash_img[_HashImage(ip->image)]; *pp; pp = &(*pp)->inext)
+     {
+        if (*pp == ip)
+          {
+             *pp = ip->inext;
+             break;
+          }
+     }
+}
+
+static void
+_HashRemove(ImlibImagePixmap * ip)
+{
+   ImlibImagePixmap  **pp;
+
+   for (pp = &hash_key[_HashBucket(ip->hash)]; *pp; pp = &(*pp)->hnext)
+     {
+        if (*pp == ip)
+          {
+             *pp = ip->hnext;
+             break;
+          }
+     }
+
+   _HashRemoveImage(ip);
+
+   for (pp = &hash_pmap[_HashPixmap(ip->display, ip->pixmap)]; *pp;
+        pp = &(*pp)->pnext)
+     {
+        if (*pp == ip)
+          {
+             *pp = ip->pnext;
+             break;
+          }
+     }
+}
+
+/* (re)build the hash tables with room for at least num entries */
+static int
+_HashResize(int num)
+{
+   ImlibImagePixmap  **tab, *ip;
+   unsigned int        nb;
+
+   for (nb = PIXMAP_HASH_MIN; (int)nb < num; nb *= 2)
+      ;
+   if (hash_key && nb == hash_mask + 1)
+      return 0;
+
+   tab = calloc(3 * nb, sizeof(ImlibImagePixmap *));
+   if (!tab)
+      return hash_key ? 0 : -1; /* Keep going with the old tables */
+
+   free(hash_key);
+   hash_key = tab;
+   hash_img = tab + nb;
+   hash_pmap = tab + 2 * nb;
+   hash_mask = nb - 1;
+
+   for (ip = pixmaps; ip; ip = ip->next)
+      _HashInsert(ip);
+
+   return 0;
+}
+
+static void
+_ListUnlink(ImlibImagePixmap * ip)
+{
+   if (ip->prev)
+      ip->prev->next = ip->next;
+   else
+      pixmaps = ip->next;
+   if (ip->next)
+      ip->next->prev = ip->prev;
+   else
+      pixmaps_last = ip->prev;
+   ip->prev = ip->next = NULL;
+}
+
+static void
+_ListPush(ImlibImagePixmap * ip)
+{
+   ip->prev = NULL;
+   ip->next = pixmaps;
+   if (pixmaps)
+      pixmaps->prev = ip;
+   else
+      pixmaps_last = ip;
+   pixmaps = ip;
+}
 
 /* create a pixmap cache data struct */
 static ImlibImagePixmap *
@@ -25,6 +257,10 @@ __imlib_ConsumeImagePixmap(ImlibImagePixmap * ip)
    fprintf(stderr,
            "[Imlib2]  Deleting pixmap.  Reference count is %d, pixmap 0x%08lx, mask 0x%08lx\n",
            ip->references, ip->pixmap, ip->mask);
+#endif
+#ifdef HAVE_X11_XRENDER
+   if (ip->picture)
+      XRenderFreePicture(ip->display, ip->picture);
 #endif
    if (ip->pixmap)
       XFreePixmap(ip->display, ip->pixmap);
@@ -34,41 +270,87 @@ __imlib_ConsumeImagePixmap(ImlibImagePixmap * ip)
    free(ip);
 }
 
+/* remove a pixmap cache struct from the pixmap cache and free it */
+static void
+__imlib_RemoveImagePixmapFromCache(ImlibImagePixmap * ip)
+{
+   if (ip->references <= 0)
+      pixmaps_size -= ip->size;
+   pixmaps_count--;
+   _HashRemove(ip);
+   _ListUnlink(ip);
+   __imlib_ConsumeImagePixmap(ip);
+}
+
+/* mark a pixmap as no longer matching its image, drop it if unused */
+static void
+__imlib_DirtyImagePixmap(ImlibImagePixmap * ip)
+{
+   if (ip->references <= 0)
+      __imlib_RemoveImagePixmapFromCache(ip);
+   else
+      ip->dirty = 1;
+}
+
+/* find a matching pixmap in the cache, returned with a new reference */
 ImlibImagePixmap   *
 __imlib_FindCachedImagePixmap(ImlibImage * im, int w, int h, Display * d,
                               Visual * v, int depth, int sx, int sy, int sw,
                               int sh, Colormap cm, char aa, char hiq,
                               char dmask, DATABIG modification_count)
 {
-   ImlibImagePixmap   *ip, *ip_prev;
+   ImlibImagePixmap   *ip, *ip_next;
+   unsigned int        hash;
+
+   if (!hash_key)
+      goto miss;
 
-   for (ip = pixmaps, ip_prev = NULL; ip; ip_prev = ip, ip = ip->next)
+   hash = _HashKey(im, w, h, d, v, depth, sx, sy, sw, sh, cm, aa, hiq, dmask,
+                   modification_count);
+
+   for (ip = hash_key[_HashBucket(hash)]; ip; ip = ip_next)
      {
+        ip_next = ip->hnext;
+
         /* if all the pixmap attributes match */
-        if ((ip->w == w) && (ip->h == h) && (ip->depth == depth) && (!ip->dirty)
-            && (ip->visual == v) && (ip->display == d)
-            && (ip->source_x == sx) && (ip->source_x == sy)
-            && (ip->source_w == sw) && (ip->source_h == sh)
-            && (ip->colormap == cm) && (ip->antialias == aa)
-            && (ip->modification_count == modification_count)
-            && (ip->dither_mask == dmask)
-            && (ip->border.left == im->border.left)
-            && (ip->border.right == im->border.right)
-            && (ip->border.top == im->border.top)
-            && (ip->border.bottom == im->border.bottom) &&
-            (((im->file) && (ip->file) && !strcmp(im->file, ip->file)) ||
-             ((!im->file) && (!ip->file) && (im == ip->image))))
+        if ((ip->hash != hash) || (ip->dirty)
+            || (ip->w != w) || (ip->h != h) || (ip->depth != depth)
+            || (ip->visual != v) || (ip->display != d)
+            || (ip->source_x != sx) || (ip->source_y != sy)
+            || (ip->source_w != sw) || (ip->source_h != sh)
+            || (ip->colormap != cm) || (ip->antialias != aa)
+            || (ip->hi_quality != hiq) || (ip->dither_mask != dmask)
+            || (ip->modification_count != modification_count)
+            || (ip->border.left != im->border.left)
+            || (ip->border.right != im->border.right)
+            || (ip->border.top != im->border.top)
+            || (ip->border.bottom != im->border.bottom))
+           continue;
+        if (im->file ? !ip->file || strcmp(im->file, ip->file) :
+            ip->file || im != ip->image)
+           continue;
+
+        /* the image it was made from has been replaced on disk */
+        if (ip->image && !IMAGE_IS_VALID(ip->image))
           {
-             /* move the pixmap to the head of the pixmap list */
-             if (ip_prev)
-               {
-                  ip_prev->next = ip->next;
-                  ip->next = pixmaps;
-                  pixmaps = ip;
-               }
-             return ip;
+             __imlib_DirtyImagePixmap(ip);
+             continue;
           }
+
+        /* move the pixmap to the head of the pixmap list */
+        if (ip != pixmaps)
+          {
+             _ListUnlink(ip);
+             _ListPush(ip);
+          }
+        if (ip->references++ <= 0)
+           pixmaps_size -= ip->size;
+        pixmaps_hits++;
+        return ip;
      }
+
+ miss:
+   pixmaps_misses++;
    return NULL;
 }
 
@@ -83,7 +365,14 @@ __imlib_AddImagePixmapToCache(ImlibImage * im, Pixmap pmap, Pixmap mask,
 {
    ImlibImagePixmap   *ip;
 
+   /* keep about one entry per bucket */
+   if ((!hash_key || pixmaps_count > (int)hash_mask) &&
+       _HashResize(2 * pixmaps_count))
+      return NULL;
+
    ip = __imlib_ProduceImagePixmap();
+   if (!ip)
+      return NULL;
    ip->visual = v;
    ip->depth = depth;
    ip->image = im;
@@ -108,80 +397,84 @@ __imlib_AddImagePixmapToCache(ImlibImage * im, Pixmap pmap, Pixmap mask,
    ip->references = 1;
    ip->pixmap = pmap;
    ip->mask = mask;
+   ip->size = _PixmapSize(ip);
+   ip->hash = _HashKey(im, w, h, d, v, depth, sx, sy, sw, sh, cm, aa, hiq,
+                       dmask, modification_count);
 
-   ip->next = pixmaps;
-   pixmaps = ip;
+   _ListPush(ip);
+   _HashInsert(ip);
+   pixmaps_count++;
 
    return ip;
 }
 
+/* drop a reference, keeping the pixmap cached for reuse if still valid */
 void
-__imlib_PixmapUnrefImage(ImlibImage * im)
+__imlib_ReleaseImagePixmap(ImlibImagePixmap * ip)
 {
-   ImlibImagePixmap   *ip;
+   if (ip->references <= 0)
+      return;
 
-   for (ip = pixmaps; ip; ip = ip->next)
-     {
-        if (ip->image == im)
-          {
-             ip->image = NULL;
-             ip->dirty = 1;
-          }
-     }
+   /* dereference it by one */
+   ip->references--;
+#ifdef DEBUG_CACHE
+   fprintf(stderr,
+           "[Imlib2]  Reference count is now %d for pixmap 0x%08lx\n",
+           ip->references, ip->pixmap);
+#endif
+   if (ip->references > 0)
+      return;
+
+   /* if it became 0 reference count - clean the cache up */
+   pixmaps_size += ip->size;
+   if (ip->dirty)
+      __imlib_RemoveImagePixmapFromCache(ip);
+   else
+      __imlib_CleanupImagePixmapCache();
 }
 
-/* remove a pixmap cache struct from the pixmap cache */
-static void
-__imlib_RemoveImagePixmapFromCache(ImlibImagePixmap * ip_del)
+void
+__imlib_PixmapUnrefImage(ImlibImage * im)
 {
-   ImlibImagePixmap   *ip, *ip_prev;
+   ImlibImagePixmap   *ip, *ip_next;
+
+   if (!hash_img)
+      return;
 
-   for (ip = pixmaps, ip_prev = NULL; ip; ip_prev = ip, ip = ip->next)
+   for (ip = hash_img[_HashImage(im)]; ip; ip = ip_next)
      {
-        if (ip == ip_del)
+        ip_next = ip->inext;
+        if (ip->image == im)
           {
-             if (ip_prev)
-                ip_prev->next = ip->next;
-             else
-                pixmaps = ip->next;
-             return;
+             _HashRemoveImage(ip);
+             ip->image = NULL;
+             __imlib_DirtyImagePixmap(ip);
           }
      }
 }
 
-/* clean out 0 reference count & dirty pixmaps from the cache */
+/* clean out the least recently used unreferenced pixmaps while the cache */
+/* is overgrown */
 void
 __imlib_CleanupImagePixmapCache(void)
 {
-   ImlibImagePixmap   *ip, *ip_next, *ip_del;
-   int                 current_cache;
+   ImlibImagePixmap   *ip, *ip_prev;
+   int                 current_cache, cache_max;
 
-   current_cache = __imlib_CurrentCacheSize();
+   if (pixmaps_size <= 0)
+      return;
 
-   for (ip = pixmaps; ip; ip = ip_next)
-     {
-        ip_next = ip->next;
-        if ((ip->references <= 0) && (ip->dirty))
-          {
-             __imlib_RemoveImagePixmapFromCache(ip);
-             __imlib_ConsumeImagePixmap(ip);
-          }
-     }
+   current_cache = __imlib_CurrentCacheSize();
+   cache_max = __imlib_GetCacheSize();
 
-   while (current_cache > __imlib_GetCacheSize())
+   for (ip = pixmaps_last; ip && current_cache > cache_max; ip = ip_prev)
      {
-        for (ip = pixmaps, ip_del = NULL; ip; ip = ip->next)
-          {
-             if (ip->references <= 0)
-                ip_del = ip;
-          }
-        if (!ip_del)
-           break;
-
-        __imlib_RemoveImagePixmapFromCache(ip_del);
-        __imlib_ConsumeImagePixmap(ip_del);
+        ip_prev = ip->prev;
+        if (ip->references > 0)
+           continue;
 
-        current_cache = __imlib_CurrentCacheSize();
+        current_cache -= ip->size;
+        __imlib_RemoveImagePixmapFromCache(ip);
      }
 }
 
@@ -191,7 +484,10 @@ __imlib_FindImlibImagePixmapByID(Display * d, Pixmap p)
 {
    ImlibImagePixmap   *ip;
 
-   for (ip = pixmaps; ip; ip = ip->next)
+   if (!hash_pmap)
+      return NULL;
+
+   for (ip = hash_pmap[_HashPixmap(d, p)]; ip; ip = ip->pnext)
      {
         /* if all the pixmap ID & Display match */
         if ((ip->pixmap == p) && (ip->display == d))
@@ -217,20 +513,7 @@ __imlib_FreePixmap(Display * d, Pixmap p)
    ip = __imlib_FindImlibImagePixmapByID(d, p);
    if (ip)
      {
-        /* if tis positive reference count */
-        if (ip->references > 0)
-          {
-             /* dereference it by one */
-             ip->references--;
-#ifdef DEBUG_CACHE
-             fprintf(stderr,
-                     "[Imlib2]  Reference count is now %d for pixmap 0x%08lx\n",
-                     ip->references, ip->pixmap);
-#endif
-             /* if it becaume 0 reference count - clean the cache up */
-             if (ip->references == 0)
-                __imlib_CleanupImagePixmapCache();
-          }
+        __imlib_ReleaseImagePixmap(ip);
      }
    else
      {
@@ -247,56 +530,41 @@ __imlib_FreePixmap(Display * d, Pixmap p)
 void
 __imlib_DirtyPixmapsForImage(ImlibImage * im)
 {
-   ImlibImagePixmap   *ip;
+   ImlibImagePixmap   *ip, *ip_next;
 
-   for (ip = pixmaps; ip; ip = ip->next)
+   if (!hash_img)
+      return;
+
+   for (ip = hash_img[_HashImage(im)]; ip; ip = ip_next)
      {
+        ip_next = ip->inext;
         /* if image matches */
         if (ip->image == im)
-           ip->dirty = 1;
+           __imlib_DirtyImagePixmap(ip);
      }
-   __imlib_CleanupImagePixmapCache();
 }
 
+/* size of the cached pixmaps not in use */
 int
 __imlib_PixmapCacheSize(void)
 {
-   int                 current_cache = 0;
-   ImlibImagePixmap   *ip, *ip_next;
+   return pixmaps_size;
+}
 
-   for (ip = pixmaps; ip; ip = ip_next)
-     {
-        ip_next = ip->next;
+int
+__imlib_PixmapCacheCount(void)
+{
+   return pixmaps_count;
+}
 
-        /* if the pixmap has 0 references */
-        if (ip->references == 0)
-          {
-             /* if the image is invalid */
-             if ((ip->dirty) || ((ip->image) && (!(IMAGE_IS_VALID(ip->image)))))
-               {
-                  __imlib_RemoveImagePixmapFromCache(ip);
-                  __imlib_ConsumeImagePixmap(ip);
-               }
-             else
-               {
-                  /* add the pixmap data size to the cache size */
-                  if (ip->pixmap)
-                    {
-                       if (ip->depth < 8)
-                          current_cache += ip->w * ip->h * (ip->depth / 8);
-                       else if (ip->depth == 8)
-                          current_cache += ip->w * ip->h;
-                       else if (ip->depth <= 16)
-                          current_cache += ip->w * ip->h * 2;
-                       else if (ip->depth <= 32)
-                          current_cache += ip->w * ip->h * 4;
-                    }
-                  /* if theres a mask add it too */
-                  if (ip->mask)
-                     current_cache += ip->w * ip->h / 8;
-               }
-          }
-     }
+int
+__imlib_PixmapCacheHits(void)
+{
+   return pixmaps_hits;
+}
 
-   return current_cache;
+int
+__imlib_PixmapCacheMisses(void)
+{
+   return pixmaps_misses;
 }
@@ -2,12 +2,18 @@
 #define X11_PIXMAP_H 1
 
 #include <X11/Xlib.h>
+#ifdef HAVE_X11_XRENDER
+#include <X11/extensions/Xrender.h>
+#endif
 
 #include "image.h"
 
 typedef struct _ImlibImagePixmap {
    int                 w, h;
    Pixmap              pixmap, mask;
+#ifdef HAVE_X11_XRENDER
+   Picture             picture; /* ARGB32 picture of pixmap (no visual) */
+#endif
    Display            *display;
    Visual             *visual;
    int                 depth;
@@ -20,7 +26,12 @@ typedef struct _ImlibImagePixmap {
    char                dirty;
    int                 references;
    DATABIG             modification_count;
-   struct _ImlibImagePixmap *next;
+   unsigned int        hash;    /* Hash of the cache key */
+   int                 size;    /* Bytes counted in the cache when unused */
+   struct _ImlibImagePixmap *prev, *next;       /* LRU list */
+   struct _ImlibImagePixmap *hnext;     /* Key hash chain */
+   struct _ImlibImagePixmap *inext;     /* Image hash chain */
+   struct _ImlibImagePixmap *pnext;     /* Pixmap ID hash chain */
 } ImlibImagePixmap;
 
 ImlibImagePixmap   *__imlib_FindCachedImagePixmap(ImlibImage * im, int w, int h,
@@ -37,8 +48,12 @@ ImlibImagePixmap   *__imlib_AddImagePixmapToCache(ImlibImage * im,
                                                   int sw, int sh, Colormap cm,
                                                   char aa, char hiq, char dmask,
                                                   DATABIG modification_count);
+void                __imlib_ReleaseImagePixmap(ImlibImagePixmap * ip);
 void                __imlib_CleanupImagePixmapCache(void);
 int                 __imlib_PixmapCacheSize(void);
+int                 __imlib_PixmapCacheCount(void);
+int                 __imlib_PixmapCacheHits(void);
+int                 __imlib_PixmapCacheMisses(void);
 
 void                __imlib_FreePixmap(Display * d, Pixmap p);
 void                __imlib_DirtyPixmapsForImage(ImlibImage * im);
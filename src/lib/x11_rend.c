@@ -1,5 +1,6 @@
 #include "common.h"
 
+#include <limits.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/XShm.h>
@@ -9,16 +10,25 @@
 #include "image.h"
 #include "rotate.h"
 #include "scale.h"
+#include "threads.h"
 #include "x11_color.h"
 #include "x11_context.h"
 #include "x11_grab.h"
 #include "x11_rend.h"
 #include "x11_rgba.h"
 #include "x11_ximage.h"
+#include "x11_xrender.h"
 
 /* size of the lines per segment we scale / render at a time */
 #define LINESIZE 16
 
+/* minimum output size to render bands in parallel */
+#define REND_MT_PIXELS (512 * 512)
+
+/* overhead of one more update rect, in pixels (see __imlib_CoalesceUpdates) */
+#define UPD_COST_SHM (32 * 32)  /* A call to the converter */
+#define UPD_COST_PUT (96 * 96)  /* An XPutImage request */
+
 DATA32
 __imlib_RenderGetPixel(Display * d, Drawable w, Visual * v, Colormap cm,
                        int depth, DATA8 r, DATA8 g, DATA8 b)
@@ -244,6 +254,169 @@ __imlib_RenderDisconnect(Display * d)
    last_depth = 0;
 }
 
+static void
+__imlib_RenderGC(Display * d, Drawable w, int depth)
+{
+   XGCValues           gcv;
+
+   /* if we changed diplays or depth since last time... free old gc */
+   if ((gc) && ((last_depth != depth) || (disp != d)))
+     {
+        XFreeGC(disp, gc);
+        gc = 0;
+     }
+   /* if we didn't have a gc... create it */
+   if (!gc)
+     {
+        disp = d;
+        last_depth = depth;
+        gcv.graphics_exposures = False;
+        gc = XCreateGC(d, w, GCGraphicsExposures, &gcv);
+     }
+}
+
+typedef struct {
+   ImlibImage         *im;
+   ImlibScaleInfo     *scaleinfo;
+   XImage             *xim, *mxim;
+   Visual             *v;
+   Context            *ct;
+   DATA32             *back;
+   int                 sx, sy, sw, sh, dx, dy, dw, dh;
+   char                antialias, unpremul;
+   int                 mat;
+   ImlibColorModifier *cmod;
+   ImlibRGBAFunction   rgbaer;
+   ImlibMaskFunction   masker;
+   ImlibBlendFunction  blender;
+   int                 bufsize; /* Pixels in the band buffer, 0: none */
+   int                 nbands, nchunks;
+   int                 fail;
+} ImlibRenderRun;
+
+/* scale, color modify, blend and convert the rows [y .. y + hh) into the
+ * XImages, using buf for the scaled/modified pixels */
+static void
+__imlib_RenderBand(const ImlibRenderRun * run, ImlibScaleInfo * scaleinfo,
+                   DATA32 * buf, int y, int hh)
+{
+   ImlibImage         *im = run->im;
+   XImage             *xim = run->xim, *mxim = run->mxim;
+   int                 sx = run->sx, sy = run->sy, sw = run->sw, sh = run->sh;
+   int                 dw = run->dw, dh = run->dh;
+   DATA32             *pointer;
+   int                 jump;
+
+   /* if we're scaling it */
+   if (scaleinfo)
+     {
+        /* scale the imagedata for this LINESIZE lines chunk of image data */
+        if (run->antialias >= SCALE_BICUBIC)
+           __imlib_ScaleFilterRGBA(scaleinfo, buf, ((sx * dw) / sw),
+                                   ((sy * dh) / sh) + y,
+                                   0, 0, dw, hh, dw, im->w);
+        else if (run->antialias)
+          {
+             if (IMAGE_HAS_ALPHA(im))
+                __imlib_ScaleAARGBA(scaleinfo, buf, ((sx * dw) / sw),
+                                    ((sy * dh) / sh) + y,
+                                    0, 0, dw, hh, dw, im->w);
+             else
+                __imlib_ScaleAARGB(scaleinfo, buf, ((sx * dw) / sw),
+                                   ((sy * dh) / sh) + y,
+                                   0, 0, dw, hh, dw, im->w);
+          }
+        else
+           __imlib_ScaleSampleRGBA(scaleinfo, buf, ((sx * dw) / sw),
+                                   ((sy * dh) / sh) + y, 0, 0, dw, hh, dw);
+        jump = 0;
+        pointer = buf;
+        if (run->unpremul)
+           __imlib_UnpremulData(buf, dw * hh);
+        if (run->cmod)
+           __imlib_DataCmodApply(buf, dw, hh, 0, NULL, run->cmod);
+     }
+   else
+     {
+        if (run->cmod || run->unpremul)
+          {
+             memcpy(buf, im->data + ((y + sy) * im->w),
+                    im->w * hh * sizeof(DATA32));
+             if (run->unpremul)
+                __imlib_UnpremulData(buf, im->w * hh);
+             if (run->cmod)
+                __imlib_DataCmodApply(buf, im->w, hh, 0, NULL, run->cmod);
+             pointer = buf + sx;
+             jump = im->w - sw;
+          }
+        else
+          {
+             jump = im->w - sw;
+             pointer = im->data + ((y + sy) * im->w) + sx;
+          }
+     }
+   /* if we have a back buffer - we're blending to the bg */
+   if (run->back)
+     {
+        run->blender(pointer, jump + dw, run->back + (y * dw), dw, dw, hh,
+                     NULL);
+        pointer = run->back + (y * dw);
+        jump = 0;
+     }
+   /* once scaled... convert chunk to bit depth into XImage bufer */
+   if (run->rgbaer)
+      run->rgbaer(pointer, jump,
+                  ((DATA8 *) xim->data) + (y * (xim->bytes_per_line)),
+                  xim->bytes_per_line, dw, hh, run->dx, run->dy + y);
+   else
+      __imlib_generic_render(pointer, jump, dw, hh, 0, y, xim, run->v,
+                             run->ct);
+   if (mxim)
+      run->masker(pointer, jump,
+                  ((DATA8 *) mxim->data) + (y * (mxim->bytes_per_line)),
+                  mxim->bytes_per_line, dw, hh, run->dx, run->dy + y,
+                  run->mat);
+}
+
+/* render a run of bands with its own buffer (and filter tile) */
+static void
+__imlib_RenderChunk(void *arg, int chunk)
+{
+   ImlibRenderRun     *run = arg;
+   ImlibScaleInfo     *scaleinfo = run->scaleinfo;
+   DATA32             *buf = NULL;
+   int                 b, b1, y;
+
+   if (run->bufsize)
+     {
+        buf = malloc(run->bufsize * sizeof(DATA32));
+        if (!buf)
+           goto quit;
+     }
+   if (scaleinfo && run->nchunks > 1)
+     {
+        scaleinfo = __imlib_ShareScaleInfo(scaleinfo);
+        if (!scaleinfo)
+           goto quit;
+     }
+
+   b1 = (chunk + 1) * run->nbands / run->nchunks;
+   for (b = chunk * run->nbands / run->nchunks; b < b1; b++)
+     {
+        y = b * LINESIZE;
+        __imlib_RenderBand(run, scaleinfo, buf, y, MIN(LINESIZE, run->dh - y));
+     }
+
+   if (scaleinfo != run->scaleinfo)
+      __imlib_FreeSharedScaleInfo(scaleinfo);
+   free(buf);
+   return;
+
+ quit:
+   free(buf);
+   __atomic_store_n(&run->fail, 1, __ATOMIC_RELAXED);
+}
+
 void
 __imlib_RenderImage(Display * d, ImlibImage * im,
                     Drawable w, Drawable m,
@@ -255,18 +428,17 @@ __imlib_RenderImage(Display * d, ImlibImage * im,
 {
    XImage             *xim = NULL, *mxim = NULL;
    Context            *ct;
-   DATA32             *buf = NULL, *pointer = NULL, *back = NULL;
-   int                 y, h, hh, jump;
+   DATA32             *back = NULL;
    XGCValues           gcv;
+   ImlibRenderRun      run;
+   int                 nth;
    ImlibScaleInfo     *scaleinfo = NULL;
    int                 psx, psy, psw, psh;
    char                shm = 0;
    ImlibRGBAFunction   rgbaer;
    ImlibMaskFunction   masker = NULL;
    ImlibBlendFunction  blender = NULL;
-
-   blender = __imlib_GetBlendFunction(op, 1, 0,
-                                      (!(im->flags & F_HAS_ALPHA)), NULL);
+   char                unpremul;
 
    /* dont do anything if we have a 0 widht or height image to render */
    if ((dw == 0) || (dh == 0))
@@ -302,6 +474,25 @@ __imlib_RenderImage(Display * d, ImlibImage * im,
    /* if the output is too big (8k arbitrary limit here) dont bother */
    if ((abs(dw) > X_MAX_DIM) || (abs(dh) > X_MAX_DIM))
       return;
+#ifdef HAVE_X11_XRENDER
+   /* let the server composite alpha images instead of fetching the
+    * background, blending here and sending it back */
+   if ((blend) && (IMAGE_HAS_ALPHA(im)) && (!m) &&
+       __imlib_XRenderImage(d, im, w, v, sx, sy, sw, sh, dx, dy, dw, dh,
+                            antialias, cmod, op))
+      return;
+#endif
+   /* start heavy downscales from a smaller pyramid level */
+   if (antialias && (sw > abs(dw) || sh > abs(dh)))
+      im = __imlib_MipmapSelect(im, &sx, &sy, &sw, &sh, dw, dh);
+   /* premultiplied pixels can be blended onto the background as they are,
+    * otherwise they are converted back to straight alpha */
+   blender = NULL;
+   if (IMAGE_ALPHA_PREMUL(im) && !cmod)
+      blender = __imlib_GetPremulBlendFunction(op, 1, 0, NULL, PREMUL_SRC);
+   unpremul = IMAGE_ALPHA_PREMUL(im) && !(blend && blender);
+   if (!blender)
+      blender = __imlib_GetBlendFunction(op, 1, 0, !IMAGE_HAS_ALPHA(im), NULL);
    /* if we are scaling the image at all make a scaling buffer */
    if (!((sw == dw) && (sh == dh)))
      {
@@ -344,124 +535,72 @@ __imlib_RenderImage(Display * d, ImlibImage * im,
           }
         memset(mxim->data, 0, mxim->bytes_per_line * mxim->height);
      }
-   /* if we are scaling the image at all make a scaling buffer */
-   if (scaleinfo)
-     {
-        /* allocate a buffer to render scaled RGBA data into */
-        buf = malloc(dw * LINESIZE * sizeof(DATA32));
-        if (!buf)
-          {
-             __imlib_ConsumeXImage(d, xim);
-             if (m)
-                __imlib_ConsumeXImage(d, mxim);
-             __imlib_FreeScaleInfo(scaleinfo);
-             free(back);
-             return;
-          }
-     }
-   /* setup h */
-   h = dh;
-   /* scale in LINESIZE Y chunks and convert to depth */
    /* Get rgba and mask functions for XImage rendering */
    rgbaer = __imlib_GetRGBAFunction(xim->bits_per_pixel,
                                     v->red_mask, v->green_mask, v->blue_mask,
                                     hiq, ct->palette_type);
    if (m)
       masker = __imlib_GetMaskFunction(dither_mask);
-   for (y = 0; y < dh; y += LINESIZE)
+
+   run.im = im;
+   run.scaleinfo = scaleinfo;
+   run.xim = xim;
+   run.mxim = mxim;
+   run.v = v;
+   run.ct = ct;
+   run.back = back;
+   run.sx = sx;
+   run.sy = sy;
+   run.sw = sw;
+   run.sh = sh;
+   run.dx = dx;
+   run.dy = dy;
+   run.dw = dw;
+   run.dh = dh;
+   run.antialias = antialias;
+   run.unpremul = unpremul;
+   run.mat = mat;
+   run.cmod = cmod;
+   run.rgbaer = rgbaer;
+   run.masker = masker;
+   run.blender = blender;
+   /* scaled or modified bands go through a buffer */
+   if (scaleinfo)
+      run.bufsize = dw * LINESIZE;
+   else if (cmod || unpremul)
+      run.bufsize = im->w * LINESIZE;
+   else
+      run.bufsize = 0;
+   run.nbands = (dh + LINESIZE - 1) / LINESIZE;
+   run.nchunks = 1;
+   run.fail = 0;
+
+   /* scale in LINESIZE Y chunks and convert to depth, the bands write
+    * disjoint rows of the XImages so large ones are spread over threads */
+   nth = __imlib_GetThreadCount();
+   if ((dw * dh >= REND_MT_PIXELS) && (nth > 1))
      {
-        hh = LINESIZE;
-        if (h < LINESIZE)
-           hh = h;
-        /* if we're scaling it */
-        if (scaleinfo)
-          {
-             /* scale the imagedata for this LINESIZE lines chunk of image data */
-             if (antialias)
-               {
-                  if (IMAGE_HAS_ALPHA(im))
-                     __imlib_ScaleAARGBA(scaleinfo, buf, ((sx * dw) / sw),
-                                         ((sy * dh) / sh) + y,
-                                         0, 0, dw, hh, dw, im->w);
-                  else
-                     __imlib_ScaleAARGB(scaleinfo, buf, ((sx * dw) / sw),
-                                        ((sy * dh) / sh) + y,
-                                        0, 0, dw, hh, dw, im->w);
-               }
-             else
-                __imlib_ScaleSampleRGBA(scaleinfo, buf, ((sx * dw) / sw),
-                                        ((sy * dh) / sh) + y, 0, 0, dw, hh, dw);
-             jump = 0;
-             pointer = buf;
-             if (cmod)
-                __imlib_DataCmodApply(buf, dw, hh, 0, NULL, cmod);
-          }
-        else
-          {
-             if (cmod)
-               {
-                  if (!buf)
-                     buf = malloc(im->w * LINESIZE * sizeof(DATA32));
-                  if (!buf)
-                    {
-                       __imlib_ConsumeXImage(d, xim);
-                       if (m)
-                          __imlib_ConsumeXImage(d, mxim);
-                       __imlib_FreeScaleInfo(scaleinfo);
-                       free(back);
-                       return;
-                    }
-                  memcpy(buf, im->data + ((y + sy) * im->w),
-                         im->w * hh * sizeof(DATA32));
-                  __imlib_DataCmodApply(buf, im->w, hh, 0, NULL, cmod);
-                  pointer = buf + sx;
-                  jump = im->w - sw;
-               }
-             else
-               {
-                  jump = im->w - sw;
-                  pointer = im->data + ((y + sy) * im->w) + sx;
-               }
-          }
-        /* if we have a back buffer - we're blending to the bg */
-        if (back)
-          {
-             blender(pointer, jump + dw, back + (y * dw), dw, dw, hh, NULL);
-             pointer = back + (y * dw);
-             jump = 0;
-          }
-        /* once scaled... convert chunk to bit depth into XImage bufer */
-        if (rgbaer)
-           rgbaer(pointer, jump,
-                  ((DATA8 *) xim->data) + (y * (xim->bytes_per_line)),
-                  xim->bytes_per_line, dw, hh, dx, dy + y);
-        else
-           __imlib_generic_render(pointer, jump, dw, hh, 0, y, xim, v, ct);
-        if (m)
-           masker(pointer, jump,
-                  ((DATA8 *) mxim->data) + (y * (mxim->bytes_per_line)),
-                  mxim->bytes_per_line, dw, hh, dx, dy + y, mat);
-        h -= LINESIZE;
+        /* A few chunks per thread to even out the load */
+        run.nchunks = MIN(run.nbands, 4 * nth);
+        __imlib_RunJobs(run.nchunks, __imlib_RenderChunk, &run);
      }
+   else
+     {
+        __imlib_RenderChunk(&run, 0);
+     }
+
    /* free up our buffers and poit tables */
-   free(buf);
    if (scaleinfo)
       __imlib_FreeScaleInfo(scaleinfo);
    free(back);
-   /* if we changed diplays or depth since last time... free old gc */
-   if ((gc) && ((last_depth != depth) || (disp != d)))
+   if (run.fail)
      {
-        XFreeGC(disp, gc);
-        gc = 0;
-     }
-   /* if we didn't have a gc... create it */
-   if (!gc)
-     {
-        disp = d;
-        last_depth = depth;
-        gcv.graphics_exposures = False;
-        gc = XCreateGC(d, w, GCGraphicsExposures, &gcv);
+        __imlib_ConsumeXImage(d, xim);
+        if (m)
+           __imlib_ConsumeXImage(d, mxim);
+        return;
      }
+   __imlib_RenderGC(d, w, depth);
    if (m)
      {
         /* if we changed diplays since last time... free old gc */
@@ -478,7 +617,7 @@ __imlib_RenderImage(Display * d, ImlibImage * im,
         /* write the mask */
         if (shm)
            /* write shm XImage */
-           XShmPutImage(d, m, gcm, mxim, 0, 0, dx, dy, dw, dh, False);
+           __imlib_ShmPutXImage(d, m, gcm, mxim, 0, 0, dx, dy, dw, dh);
         /* write regular XImage */
         else
            XPutImage(d, m, gcm, mxim, 0, 0, dx, dy, dw, dh);
@@ -486,19 +625,164 @@ __imlib_RenderImage(Display * d, ImlibImage * im,
    /* write the image */
    if (shm)
       /* write shm XImage */
-      XShmPutImage(d, w, gc, xim, 0, 0, dx, dy, dw, dh, False);
+      __imlib_ShmPutXImage(d, w, gc, xim, 0, 0, dx, dy, dw, dh);
    /* write regular XImage */
    else
       XPutImage(d, w, gc, xim, 0, 0, dx, dy, dw, dh);
-   /* free the XImage and put onto our free list */
-   /* wait for the write to be done */
-   if (shm)
-      XSync(d, False);
+   /* put the XImage back onto our free list, shared ones are not handed
+    * out again before the server is done reading them */
    __imlib_ConsumeXImage(d, xim);
    if (m)
       __imlib_ConsumeXImage(d, mxim);
 }
 
+/*
+ * Render the updated rects of an image, each to the same place offset by
+ * x, y on the drawable.
+ * All rects are converted into one XImage covering their bounding box, that
+ * is put in a single request (clipped to the rects) when it is shared.
+ * Rects are merged first where converting the pixels between them costs
+ * less than the overhead of one more rect.
+ * If no such XImage can be had the rects are rendered one by one.
+ */
+void
+__imlib_RenderImageUpdates(Display * d, ImlibImage * im, Drawable w,
+                           Visual * v, Colormap cm, int depth,
+                           ImlibUpdate * updates, int x, int y, char hiq,
+                           ImlibColorModifier * cmod)
+{
+   ImlibUpdate        *u = NULL, *uu;
+   XImage             *xim, sub;
+   XRectangle         *rects = NULL;
+   Context            *ct;
+   ImlibRenderRun      run;
+   DATA32             *buf = NULL;
+   int                 ux, uy, uw, uh, bx0, by0, bx1, by1, n, yy;
+   char                shm = 0;
+
+   /* clip the rects to the image */
+   for (uu = updates; uu; uu = uu->next)
+     {
+        ux = uu->x;
+        uy = uu->y;
+        uw = uu->w;
+        uh = uu->h;
+        CLIP(ux, uy, uw, uh, 0, 0, im->w, im->h);
+        u = __imlib_AddUpdate(u, ux, uy, uw, uh);
+     }
+   if (!u)
+      return;
+
+   bx0 = by0 = INT_MAX;
+   bx1 = by1 = 0;
+   for (uu = u; uu; uu = uu->next)
+     {
+        bx0 = MIN(bx0, uu->x);
+        by0 = MIN(by0, uu->y);
+        bx1 = MAX(bx1, uu->x + uu->w);
+        by1 = MAX(by1, uu->y + uu->h);
+     }
+
+   /* no XImage as big as the bounding box (sparse rects far apart) -
+    * render one by one */
+   xim = __imlib_ProduceXImage(d, v, depth, bx1 - bx0, by1 - by0, &shm);
+   if (!xim)
+      goto one_by_one;
+
+   if (xim->bits_per_pixel < 8)
+     {
+        /* rects don't start on byte boundaries - render one by one */
+        __imlib_ConsumeXImage(d, xim);
+        goto one_by_one;
+     }
+
+   u = __imlib_CoalesceUpdates(u, shm ? UPD_COST_SHM : UPD_COST_PUT);
+
+   ct = __imlib_GetContext(d, v, cm, depth);
+   __imlib_RGBASetupContext(ct);
+
+   memset(&run, 0, sizeof(run));
+   run.im = im;
+   run.xim = &sub;
+   run.v = v;
+   run.ct = ct;
+   run.unpremul = IMAGE_ALPHA_PREMUL(im);
+   run.cmod = cmod;
+   run.rgbaer = __imlib_GetRGBAFunction(xim->bits_per_pixel,
+                                        v->red_mask, v->green_mask,
+                                        v->blue_mask, hiq, ct->palette_type);
+   if (cmod || run.unpremul)
+     {
+        buf = malloc(im->w * LINESIZE * sizeof(DATA32));
+        if (!buf)
+          {
+             __imlib_ConsumeXImage(d, xim);
+             goto one_by_one;
+          }
+     }
+
+   /* convert each rect into its place in the XImage */
+   for (uu = u, n = 0; uu; uu = uu->next, n++)
+     {
+        sub = *xim;
+        sub.data += (uu->y - by0) * xim->bytes_per_line +
+           (uu->x - bx0) * (xim->bits_per_pixel / 8);
+        run.sx = uu->x;
+        run.sy = uu->y;
+        run.sw = run.dw = uu->w;
+        run.sh = run.dh = uu->h;
+        run.dx = x + uu->x;
+        run.dy = y + uu->y;
+        for (yy = 0; yy < uu->h; yy += LINESIZE)
+           __imlib_RenderBand(&run, NULL, buf, yy, MIN(LINESIZE, uu->h - yy));
+     }
+
+   __imlib_RenderGC(d, w, depth);
+   if (shm)
+     {
+        rects = malloc(n * sizeof(XRectangle));
+        if (rects)
+          {
+             for (uu = u, n = 0; uu; uu = uu->next, n++)
+               {
+                  rects[n].x = uu->x - bx0;
+                  rects[n].y = uu->y - by0;
+                  rects[n].width = uu->w;
+                  rects[n].height = uu->h;
+               }
+             XSetClipRectangles(d, gc, x + bx0, y + by0, rects, n, Unsorted);
+             __imlib_ShmPutXImage(d, w, gc, xim, 0, 0, x + bx0, y + by0,
+                                  bx1 - bx0, by1 - by0);
+             XSetClipMask(d, gc, None);
+             free(rects);
+             goto done;
+          }
+     }
+   for (uu = u; uu; uu = uu->next)
+     {
+        if (shm)
+           __imlib_ShmPutXImage(d, w, gc, xim, uu->x - bx0, uu->y - by0,
+                                x + uu->x, y + uu->y, uu->w, uu->h);
+        else
+           XPutImage(d, w, gc, xim, uu->x - bx0, uu->y - by0,
+                     x + uu->x, y + uu->y, uu->w, uu->h);
+     }
+
+ done:
+   __imlib_ConsumeXImage(d, xim);
+   free(buf);
+   goto quit;
+
+ one_by_one:
+   for (uu = u; uu; uu = uu->next)
+      __imlib_RenderImage(d, im, w, 0, v, cm, depth,
+                          uu->x, uu->y, uu->w, uu->h,
+                          x + uu->x, y + uu->y, uu->w, uu->h,
+                          0, hiq, 0, 0, 0, cmod, OP_COPY);
+ quit:
+   __imlib_FreeUpdates(u);
+}
+
 void
 __imlib_RenderImageSkewed(Display * d, ImlibImage * im, Drawable w, Drawable m,
                           Visual * v, Colormap cm, int depth,
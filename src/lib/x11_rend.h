@@ -2,6 +2,7 @@
 #define X11_REND_H 1
 
 #include "common.h"
+#include "updates.h"
 
 DATA32              __imlib_RenderGetPixel(Display * d, Drawable w, Visual * v,
                                            Colormap cm, int depth, DATA8 r,
@@ -18,6 +19,13 @@ void                __imlib_RenderImage(Display * d, ImlibImage * im,
                                         char dither_mask, int mat,
                                         ImlibColorModifier * cmod, ImlibOp op);
 
+void                __imlib_RenderImageUpdates(Display * d, ImlibImage * im,
+                                               Drawable w, Visual * v,
+                                               Colormap cm, int depth,
+                                               ImlibUpdate * updates,
+                                               int x, int y, char hiq,
+                                               ImlibColorModifier * cmod);
+
 void                __imlib_RenderImageSkewed(Display * d, ImlibImage * im,
                                               Drawable w, Drawable m,
                                               Visual * v, Colormap cm,
@@ -1,6 +1,9 @@
 #include "common.h"
 
 #include <X11/Xlib.h>
+#ifdef DO_SIMD
+#include <immintrin.h>
+#endif
 
 #include "asm_c.h"
 #include "x11_context.h"
@@ -2985,7 +2988,7 @@ __imlib_RGBA_to_RGB565_dither(DATA32 * src, int src_jump,
         else
           {
              w--;
-             for (y = 0; y < h; y++)
+             for (y = dy; y < h; y++)
                {
                   x = dx - 1;
                   WRITE1_RGBA_RGB565_DITHER(src, dest);
@@ -3121,7 +3124,7 @@ __imlib_RGBA_to_BGR565_dither(DATA32 * src, int src_jump,
         else
           {
              w--;
-             for (y = 0; y < h; y++)
+             for (y = dy; y < h; y++)
                {
                   x = dx - 1;
                   WRITE1_RGBA_BGR565_DITHER(src, dest);
@@ -4804,11 +4807,195 @@ __imlib_RGBA_to_Nothing(DATA32 * src, int src_jump,
 }
 #endif
 
+#ifdef DO_SIMD
+/*
+ * SSE2 and AVX2 versions of the 16 and 24 bpp converters.
+ *
+ * The kernels are written once (x11_rgba_simd_ops.h) and instantiated for
+ * both instruction sets, the AVX2 ones are only selected when the CPU
+ * supports it. 32 bpp needs none, RGB8888_fast is a plain copy.
+ */
+
+enum {
+   RGBA_RGB565,
+   RGBA_BGR565,
+   RGBA_RGB555,
+   RGBA_BGR555,
+};
+
+/* SSE2 */
+
+#define TARGET              __attribute__((target("sse2")))
+#define FN                  static inline TARGET
+#define F(name)             __imlib_sse2_rgba_##name
+#define N                   4
+#define V                   __m128i
+
+#define V_LOAD(p)           _mm_loadu_si128((const __m128i *)(p))
+#define V_SET32(x)          _mm_set1_epi32(x)
+#define V_AND(a, b)         _mm_and_si128(a, b)
+#define V_OR(a, b)          _mm_or_si128(a, b)
+#define V_SLLI32(a, n)      _mm_slli_epi32(a, n)
+#define V_SRLI32(a, n)      _mm_srli_epi32(a, n)
+#define V_ADDS8(a, b)       _mm_adds_epu8(a, b)
+#define V_CMPGT8(a, b)      _mm_cmpgt_epi8(a, b)
+#define V_STORE16(p, v)     __imlib_sse2_rgba_store16(p, v)
+#define V_STORE24(p, v)     __imlib_sse2_rgba_store24(p, v)
+
+FN                  void
+__imlib_sse2_rgba_store16(DATA16 * p, __m128i v)
+{
+   v = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+   _mm_storel_epi64((__m128i *) p, _mm_packs_epi32(v, v));
+}
+
+FN                  void
+__imlib_sse2_rgba_store24(DATA8 * p, __m128i v)
+{
+   int                 last;
+
+   /* 6 bytes at the bottom of each 64 bit half, then join the halves */
+   v = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi64x(0xffffffLL)),
+                    _mm_and_si128(_mm_srli_epi64(v, 8),
+                                  _mm_set1_epi64x(0xffffff000000LL)));
+   v = _mm_or_si128(_mm_and_si128(v, _mm_set_epi32(0, 0, 0xffff, -1)),
+                    _mm_and_si128(_mm_srli_si128(v, 2),
+                                  _mm_set_epi32(0, -1, 0xffff0000, 0)));
+   _mm_storel_epi64((__m128i *) p, v);
+   last = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+   memcpy(p + 8, &last, 4);
+}
+
+#include "x11_rgba_simd_ops.h"
+
+#undef TARGET
+#undef FN
+#undef F
+#undef N
+#undef V
+#undef V_LOAD
+#undef V_SET32
+#undef V_AND
+#undef V_OR
+#undef V_SLLI32
+#undef V_SRLI32
+#undef V_ADDS8
+#undef V_CMPGT8
+#undef V_STORE16
+#undef V_STORE24
+
+/* AVX2 */
+
+#define TARGET              __attribute__((target("avx2")))
+#define FN                  static inline TARGET
+#define F(name)             __imlib_avx2_rgba_##name
+#define N                   8
+#define V                   __m256i
+
+#define V_LOAD(p)           _mm256_loadu_si256((const __m256i *)(p))
+#define V_SET32(x)          _mm256_set1_epi32(x)
+#define V_AND(a, b)         _mm256_and_si256(a, b)
+#define V_OR(a, b)          _mm256_or_si256(a, b)
+#define V_SLLI32(a, n)      _mm256_slli_epi32(a, n)
+#define V_SRLI32(a, n)      _mm256_srli_epi32(a, n)
+#define V_ADDS8(a, b)       _mm256_adds_epu8(a, b)
+#define V_CMPGT8(a, b)      _mm256_cmpgt_epi8(a, b)
+#define V_STORE16(p, v)     __imlib_avx2_rgba_store16(p, v)
+#define V_STORE24(p, v)     __imlib_avx2_rgba_store24(p, v)
+
+FN                  void
+__imlib_avx2_rgba_store16(DATA16 * p, __m256i v)
+{
+   v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+   v = _mm256_permute4x64_epi64(_mm256_packs_epi32(v, v), 0x08);
+   _mm_storeu_si128((__m128i *) p, _mm256_castsi256_si128(v));
+}
+
+FN                  void
+__imlib_avx2_rgba_store24(DATA8 * p, __m256i v)
+{
+   const __m256i       shuf = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9,
+                                               10, 12, 13, 14, -1, -1, -1,
+                                               -1, 0, 1, 2, 4, 5, 6, 8, 9,
+                                               10, 12, 13, 14, -1, -1, -1,
+                                               -1);
+
+   /* 12 bytes at the bottom of each lane, then join the lanes */
+   v = _mm256_shuffle_epi8(v, shuf);
+   v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6,
+                                                        3, 7));
+   _mm_storeu_si128((__m128i *) p, _mm256_castsi256_si128(v));
+   _mm_storel_epi64((__m128i *) (p + 16), _mm256_extracti128_si256(v, 1));
+}
+
+#include "x11_rgba_simd_ops.h"
+
+#undef TARGET
+#undef FN
+#undef F
+#undef N
+#undef V
+#undef V_LOAD
+#undef V_SET32
+#undef V_AND
+#undef V_OR
+#undef V_SLLI32
+#undef V_SRLI32
+#undef V_ADDS8
+#undef V_CMPGT8
+#undef V_STORE16
+#undef V_STORE24
+
+ImlibRGBAFunction
+__imlib_GetRGBAFunctionSimd(int simd, int depth, unsigned long rm,
+                            unsigned long gm, unsigned long bm, char hiq)
+{
+   int                 fmt;
+
+   if (simd == SIMD_NONE)
+      return NULL;
+
+   if (depth == 24)
+     {
+        if ((rm == 0xff0000) && (gm == 0xff00) && (bm == 0xff))
+           return simd == SIMD_AVX2 ? __imlib_avx2_rgba_rgb888_fast :
+              __imlib_sse2_rgba_rgb888_fast;
+        return NULL;
+     }
+
+   if (depth != 16)
+      return NULL;
+
+   if ((rm == 0xf800) && (gm == 0x7e0) && (bm == 0x1f))
+      fmt = RGBA_RGB565;
+   else if ((bm == 0xf800) && (gm == 0x7e0) && (rm == 0x1f))
+      fmt = RGBA_BGR565;
+   else if ((rm == 0x7c00) && (gm == 0x3e0) && (bm == 0x1f))
+      fmt = RGBA_RGB555;
+   else if ((bm == 0x7c00) && (gm == 0x3e0) && (rm == 0x1f))
+      fmt = RGBA_BGR555;
+   else
+      return NULL;
+
+   return simd == SIMD_AVX2 ? __imlib_avx2_rgba_to16_funcs[fmt][! !hiq] :
+      __imlib_sse2_rgba_to16_funcs[fmt][! !hiq];
+}
+#endif /* DO_SIMD */
+
 ImlibRGBAFunction
 __imlib_GetRGBAFunction(int depth,
                         unsigned long rm, unsigned long gm, unsigned long bm,
                         char hiq, DATA8 palette_type)
 {
+#ifdef DO_SIMD
+   ImlibRGBAFunction   func;
+
+   func = __imlib_GetRGBAFunctionSimd(__imlib_do_simd(), depth, rm, gm, bm,
+                                      hiq);
+   if (func)
+      return func;
+#endif
+
    if (depth == 16)
      {
         if (hiq)
@@ -21,6 +21,13 @@ ImlibRGBAFunction   __imlib_GetRGBAFunction(int depth, unsigned long rm,
                                             char hiq, DATA8 palette_type);
 ImlibMaskFunction   __imlib_GetMaskFunction(char hiq);
 
+#ifdef DO_SIMD
+ImlibRGBAFunction   __imlib_GetRGBAFunctionSimd(int simd, int depth,
+                                                unsigned long rm,
+                                                unsigned long gm,
+                                                unsigned long bm, char hiq);
+#endif
+
 #ifdef DO_MMX_ASM
 void                __imlib_mmx_rgb555_fast(DATA32 *, int, DATA8 *, int, int,
                                             int, int, int);
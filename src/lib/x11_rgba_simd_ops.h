@@ -0,0 +1,212 @@
+/*
+ * SIMD visual conversion kernels - included by x11_rgba.c once per
+ * instruction set.
+ *
+ * The includer defines:
+ *   F(name)   - Function name for the instruction set
+ *   FN        - Function attributes (static inline + target)
+ *   TARGET    - Target attribute of the converters
+ *   N         - Pixels per vector
+ *   V         - Vector type, and the V_* operations used below
+ *   V_STORE16 - Store the low 16 bits of each 32 bit element
+ *   V_STORE24 - Store the low 24 bits of each 32 bit element
+ *
+ * Every converter produces exactly what the C function it replaces does.
+ */
+
+/* the 16 bit layout of the low 24 bits of each element */
+FN                  V
+F(pack16) (V p, int fmt)
+{
+   switch (fmt)
+     {
+     default:
+     case RGBA_RGB565:
+        return V_OR(V_OR(V_AND(V_SRLI32(p, 8), V_SET32(0xf800)),
+                         V_AND(V_SRLI32(p, 5), V_SET32(0x7e0))),
+                    V_AND(V_SRLI32(p, 3), V_SET32(0x1f)));
+     case RGBA_BGR565:
+        return V_OR(V_OR(V_AND(V_SLLI32(p, 8), V_SET32(0xf800)),
+                         V_AND(V_SRLI32(p, 5), V_SET32(0x7e0))),
+                    V_AND(V_SRLI32(p, 19), V_SET32(0x1f)));
+     case RGBA_RGB555:
+        return V_OR(V_OR(V_AND(V_SRLI32(p, 9), V_SET32(0x7c00)),
+                         V_AND(V_SRLI32(p, 6), V_SET32(0x3e0))),
+                    V_AND(V_SRLI32(p, 3), V_SET32(0x1f)));
+     case RGBA_BGR555:
+        return V_OR(V_OR(V_AND(V_SLLI32(p, 7), V_SET32(0x7c00)),
+                         V_AND(V_SRLI32(p, 6), V_SET32(0x3e0))),
+                    V_AND(V_SRLI32(p, 19), V_SET32(0x1f)));
+     }
+}
+
+/* the thresholds of the 4x4 dither matrix for a vector of row y starting at
+ * x, per byte (the 565 green thresholds are halved, as it has 2 low bits) */
+FN                  V
+F(dither_thr) (int x, int y, int fmt)
+{
+   DATA32              thr[N];
+   int                 i, t, tg;
+
+   for (i = 0; i < N; i++)
+     {
+        t = _dither_44[(x + i) & 0x3][y & 0x3];
+        tg = (fmt == RGBA_RGB565 || fmt == RGBA_BGR565) ? t >> 1 : t;
+        thr[i] = 0x7f000000 | (t << 16) | (tg << 8) | t;
+     }
+
+   return V_LOAD(thr);
+}
+
+/* round each channel up where its dropped bits exceed the threshold, the
+ * same as the _dither_r16/g16/b16 tables set up by __imlib_RGBA_init() */
+FN                  V
+F(dither16) (V p, V thr, int fmt)
+{
+   V                   low, add;
+
+   if (fmt == RGBA_RGB565 || fmt == RGBA_BGR565)
+     {
+        low = V_SET32(0x070307);
+        add = V_SET32(0x080408);
+     }
+   else
+     {
+        low = V_SET32(0x070707);
+        add = V_SET32(0x080808);
+     }
+
+   return V_ADDS8(p, V_AND(V_CMPGT8(V_AND(p, low), thr), add));
+}
+
+FN                  void
+F(to16) (DATA32 * src, int src_jump, DATA8 * dst, int dow,
+         int width, int height, int dx, int dy, int fmt, int dither)
+{
+   DATA16             *dest = (DATA16 *) dst;
+   int                 dest_jump = (dow / sizeof(DATA16)) - width;
+   DATA32              tmp_src[N];
+   DATA16              tmp_dst[N];
+   int                 x, y, x0;
+   V                   p, thr = V_SET32(0);
+
+   /* the scalar functions start the dither pattern one pixel earlier when
+    * the destination is not 32 bit aligned, keep the output the same */
+   x0 = IS_ALIGNED_32((unsigned long)dest) ? dx : dx - 1;
+
+   for (y = 0; y < height; y++)
+     {
+        if (dither)
+           thr = F(dither_thr) (x0, dy + y, fmt);
+
+        for (x = 0; x + N <= width; x += N)
+          {
+             p = V_LOAD(src + x);
+             if (dither)
+                p = F(dither16) (p, thr, fmt);
+             V_STORE16(dest + x, F(pack16) (p, fmt));
+          }
+
+        if (x < width)
+          {
+             memcpy(tmp_src, src + x, (width - x) * sizeof(DATA32));
+             p = V_LOAD(tmp_src);
+             if (dither)
+                p = F(dither16) (p, thr, fmt);
+             V_STORE16(tmp_dst, F(pack16) (p, fmt));
+             memcpy(dest + x, tmp_dst, (width - x) * sizeof(DATA16));
+          }
+
+        src += width + src_jump;
+        dest += width + dest_jump;
+     }
+}
+
+static              TARGET void
+F(rgb565_fast) (DATA32 * src, int src_jump, DATA8 * dst, int dow,
+                int width, int height, int dx, int dy)
+{
+   F(to16) (src, src_jump, dst, dow, width, height, dx, dy, RGBA_RGB565, 0);
+}
+
+static              TARGET void
+F(bgr565_fast) (DATA32 * src, int src_jump, DATA8 * dst, int dow,
+                int width, int height, int dx, int dy)
+{
+   F(to16) (src, src_jump, dst, dow, width, height, dx, dy, RGBA_BGR565, 0);
+}
+
+static              TARGET void
+F(rgb555_fast) (DATA32 * src, int src_jump, DATA8 * dst, int dow,
+                int width, int height, int dx, int dy)
+{
+   F(to16) (src, src_jump, dst, dow, width, height, dx, dy, RGBA_RGB555, 0);
+}
+
+static              TARGET void
+F(bgr555_fast) (DATA32 * src, int src_jump, DATA8 * dst, int dow,
+                int width, int height, int dx, int dy)
+{
+   F(to16) (src, src_jump, dst, dow, width, height, dx, dy, RGBA_BGR555, 0);
+}
+
+static              TARGET void
+F(rgb565_dither) (DATA32 * src, int src_jump, DATA8 * dst, int dow,
+                  int width, int height, int dx, int dy)
+{
+   F(to16) (src, src_jump, dst, dow, width, height, dx, dy, RGBA_RGB565, 1);
+}
+
+static              TARGET void
+F(bgr565_dither) (DATA32 * src, int src_jump, DATA8 * dst, int dow,
+                  int width, int height, int dx, int dy)
+{
+   F(to16) (src, src_jump, dst, dow, width, height, dx, dy, RGBA_BGR565, 1);
+}
+
+static              TARGET void
+F(rgb555_dither) (DATA32 * src, int src_jump, DATA8 * dst, int dow,
+                  int width, int height, int dx, int dy)
+{
+   F(to16) (src, src_jump, dst, dow, width, height, dx, dy, RGBA_RGB555, 1);
+}
+
+static              TARGET void
+F(bgr555_dither) (DATA32 * src, int src_jump, DATA8 * dst, int dow,
+                  int width, int height, int dx, int dy)
+{
+   F(to16) (src, src_jump, dst, dow, width, height, dx, dy, RGBA_BGR555, 1);
+}
+
+static              TARGET void
+F(rgb888_fast) (DATA32 * src, int src_jump, DATA8 * dest, int dow,
+                int width, int height, int dx, int dy)
+{
+   DATA32              tmp_src[N];
+   DATA8               tmp_dst[3 * N];
+   int                 x, y;
+
+   for (y = 0; y < height; y++)
+     {
+        for (x = 0; x + N <= width; x += N)
+           V_STORE24(dest + 3 * x, V_LOAD(src + x));
+
+        if (x < width)
+          {
+             memcpy(tmp_src, src + x, (width - x) * sizeof(DATA32));
+             V_STORE24(tmp_dst, V_LOAD(tmp_src));
+             memcpy(dest + 3 * x, tmp_dst, 3 * (width - x));
+          }
+
+        src += width + src_jump;
+        dest += dow;
+     }
+}
+
+/* indexed by RGBA_RGB565.. and dither */
+static const ImlibRGBAFunction F(to16_funcs)[4][2] = {
+   {F(rgb565_fast), F(rgb565_dither)},
+   {F(bgr565_fast), F(bgr565_dither)},
+   {F(rgb555_fast), F(rgb555_dither)},
+   {F(bgr555_fast), F(bgr555_dither)},
+};
@@ -24,6 +24,7 @@ typedef struct {
    XShmSegmentInfo    *si;
    Display            *dpy;
    char                used;
+   unsigned long       serial;  /* Put still reading the segment, 0 if none */
 } xim_cache_rec_t;
 
 static xim_cache_rec_t *xim_cache = NULL;
@@ -33,6 +34,9 @@ static int          list_mem_use = 0;
 static int          list_max_mem = 1024 * 1024 * 1024;
 static int          list_max_count = 0;
 
+/* event type of ShmCompletion */
+static int          shm_completion = -1;
+
 /* temporary X error catcher we use later */
 static char         _x_err = 0;
 
@@ -58,6 +62,7 @@ ShmCheck(Display * d)
         Bool                pixmaps;
 #endif
         x_does_shm = 2;         /* 2: __imlib_ShmGetXImage tests first XShmAttach */
+        shm_completion = XShmGetEventBase(d) + ShmCompletion;
 #ifdef HAVE_X11_SHM_FD
         if (XShmQueryVersion(d, &major, &minor, &pixmaps))
           {
@@ -252,6 +257,84 @@ __imlib_ShmDestroyXImage(Display * d, XImage * xim, XShmSegmentInfo * si)
    XDestroyImage(xim);
 }
 
+/* ShmCompletion events for our segments, the application never sees them */
+/* (segment ids are per connection, only look at the ones attached on d) */
+static              Bool
+ShmCompletionMatch(Display * d, XEvent * ev, XPointer arg)
+{
+   int                 i;
+
+   if (ev->type != shm_completion)
+      return False;
+   for (i = 0; i < list_num; i++)
+      if (xim_cache[i].dpy == d && xim_cache[i].si &&
+          xim_cache[i].si->shmseg == ((XShmCompletionEvent *) ev)->shmseg)
+         return True;
+   return False;
+}
+
+/* mark the segments whose puts the server on d has finished as idle */
+static void
+ShmUpdateBusy(Display * d)
+{
+   XEvent              ev;
+   unsigned long       done;
+   int                 i;
+
+   for (i = 0; i < list_num; i++)
+      if (xim_cache[i].dpy == d && xim_cache[i].serial)
+         break;
+   if (i >= list_num)
+      return;
+
+   /* reading the events also advances the last processed request */
+   while (XCheckIfEvent(d, &ev, ShmCompletionMatch, NULL))
+      ;
+   done = LastKnownRequestProcessed(d);
+   for (i = 0; i < list_num; i++)
+      if (xim_cache[i].dpy == d && xim_cache[i].serial &&
+          (long)(done - xim_cache[i].serial) >= 0)
+         xim_cache[i].serial = 0;
+}
+
+/* wait for all our puts to be done */
+static void
+ShmWaitBusy(Display * d)
+{
+   XSync(d, False);
+   ShmUpdateBusy(d);
+}
+
+/*
+ * Put a shared XImage without waiting for the server to read it.
+ * The segment is handed out again by __imlib_ProduceXImage() only after
+ * the put has completed, so the next image can be converted while the
+ * server is still copying this one.
+ */
+void
+__imlib_ShmPutXImage(Display * d, Drawable draw, GC gc, XImage * xim,
+                     int sx, int sy, int dx, int dy, int w, int h)
+{
+   int                 i;
+
+   for (i = 0; i < list_num; i++)
+      if (xim_cache[i].xim == xim)
+         break;
+   if (i >= list_num)
+     {
+        /* not ours - put it synchronously */
+        XShmPutImage(d, draw, gc, xim, sx, sy, dx, dy, w, h, False);
+        XSync(d, False);
+        return;
+     }
+
+   xim_cache[i].serial = NextRequest(d);
+   if (xim_cache[i].serial == 0)
+      xim_cache[i].serial = 1;  /* serial wrapped, 0 means idle */
+   XShmPutImage(d, draw, gc, xim, sx, sy, dx, dy, w, h, True);
+   XFlush(d);
+}
+
 void
 __imlib_SetXImageCacheCountMax(Display * d, int num)
 {
@@ -297,6 +380,8 @@ __imlib_FlushXImage(Display * d)
    XImage             *xim;
    char                did_free = 1;
 
+   ShmUpdateBusy(d);
+
    while (((list_mem_use > list_max_mem) || (list_num > list_max_count)) &&
           (did_free))
      {
@@ -309,6 +394,12 @@ __imlib_FlushXImage(Display * d)
                   continue;
                }
 
+             if (xim_cache[i].serial)
+               {
+                  /* the server still reads it (and owes us an event) */
+                  ShmWaitBusy(xim_cache[i].dpy);
+               }
+
              xim = xim_cache[i].xim;
              list_mem_use -= xim->bytes_per_line * xim->height;
 
@@ -379,17 +470,20 @@ __imlib_ProduceXImage(Display * d, Visual * v, int depth, int w, int h,
    /* find a cached XImage (to avoid server to & fro) that is big enough */
    /* for our needs and the right depth */
    *shared = 0;
+   ShmUpdateBusy(d);
+ again:
    /* go thru the current image list */
    for (i = 0; i < list_num; i++)
      {
-        if (xim_cache[i].used)
+        if (xim_cache[i].used || xim_cache[i].serial)
            continue;
 
         xim = xim_cache[i].xim;
 
         /* if the image has the same depth, width and height - recycle it */
-        if ((xim->depth == depth) && (xim->width >= w) && (xim->height >= h))
-           /*  && (xim_cache[i].dpy == d) */
+        /* (shared segments are attached to one display only) */
+        if ((xim->depth == depth) && (xim->width >= w) && (xim->height >= h)
+            && (!xim_cache[i].si || xim_cache[i].dpy == d))
           {
              xim_cache[i].used = 1;
              /* if its shared set shared flag */
@@ -400,6 +494,23 @@ __imlib_ProduceXImage(Display * d, Visual * v, int depth, int w, int h,
           }
      }
 
+   /* if the cache is full rather wait for a fitting one in flight */
+   if (list_num >= list_max_count)
+     {
+        for (i = 0; i < list_num; i++)
+          {
+             xim = xim_cache[i].xim;
+             if (!xim_cache[i].used && xim_cache[i].serial &&
+                 xim_cache[i].dpy == d &&
+                 (xim->depth == depth) && (xim->width >= w) &&
+                 (xim->height >= h))
+               {
+                  ShmWaitBusy(d);
+                  goto again;
+               }
+          }
+     }
+
    /* can't find a usable XImage on the cache - create one */
    /* add the new XImage to the XImage cache */
    list_num++;
@@ -453,6 +564,7 @@ __imlib_ProduceXImage(Display * d, Visual * v, int depth, int w, int h,
    list_mem_use += xim->bytes_per_line * xim->height;
    /* mark image as used */
    xim_cache[list_num - 1].used = 1;
+   xim_cache[list_num - 1].serial = 0;
    /* remember what display that XImage was for */
    xim_cache[list_num - 1].dpy = d;
 
@@ -21,5 +21,8 @@ XImage             *__imlib_ShmGetXImage(Display * d, Visual * v, Drawable draw,
                                          XShmSegmentInfo * si);
 void                __imlib_ShmDestroyXImage(Display * d, XImage * xim,
                                              XShmSegmentInfo * si);
+void                __imlib_ShmPutXImage(Display * d, Drawable draw, GC gc,
+                                         XImage * xim, int sx, int sy,
+                                         int dx, int dy, int w, int h);
 
 #endif /* X11_XIMAGE_H */
@@ -0,0 +1,220 @@
+#include "common.h"
+
+#ifdef HAVE_X11_XRENDER
+
+#include <X11/Xlib.h>
+#include <X11/extensions/Xrender.h>
+
+#include "blend.h"
+#include "image.h"
+#include "scale.h"
+#include "x11_pixmap.h"
+#include "x11_xrender.h"
+
+/*
+ * Blending alpha images onto drawables with XRender.
+ *
+ * The image is uploaded once as premultiplied ARGB32 picture, kept in the
+ * pixmap cache, and composited onto the drawable by the server. This saves
+ * fetching the drawable contents, blending them on the CPU and sending them
+ * back for every draw.
+ *
+ * Scales the server does like we do (sampled, and bilinear upscales) use a
+ * picture of the source rectangle with a scaling transform, the others a
+ * picture prescaled by us to the destination size.
+ *
+ * The server samples at destination pixel centers, we step the source by
+ * (sw << 16) / dw from the left edge. The transform uses the same step and
+ * is offset so both pick the same source pixels (nearest) or interpolate
+ * between the same two (bilinear).
+ *
+ * Used whenever the server has XRender 0.10 or later, unless
+ * IMLIB2_XRENDER_OFF is set in the environment.
+ */
+
+static Display     *xr_display = NULL;
+static signed char  xr_ok = -1;
+
+static int
+XRenderCheck(Display * d)
+{
+   int                 event_base, error_base, major, minor;
+
+   if (d == xr_display && xr_ok >= 0)
+      return xr_ok;
+
+   xr_display = d;
+   xr_ok = 0;
+   if (getenv("IMLIB2_XRENDER_OFF"))
+      return xr_ok;
+   if (!XRenderQueryExtension(d, &event_base, &error_base))
+      return xr_ok;
+   if (!XRenderQueryVersion(d, &major, &minor))
+      return xr_ok;
+   /* transforms, filters and pad repeat */
+   xr_ok = major > 0 || minor >= 10;
+
+   return xr_ok;
+}
+
+/* the transform offset making destination pixel x + .5 land on source
+ * position x * inc - nearest: one unit past it, as the server rounds down
+ * from the position minus one unit, bilinear: on the center of that pixel */
+static              XFixed
+XRenderOffset(XFixed inc, int nearest)
+{
+   return (nearest ? 1 : XDoubleToFixed(.5)) - ((inc + 1) >> 1);
+}
+
+/* upload w x h premultiplied pixels as picture and cache it */
+static ImlibImagePixmap *
+XRenderUpload(Display * d, Drawable draw, ImlibImage * im, DATA32 * data,
+              int w, int h, int sx, int sy, int sw, int sh, char aa)
+{
+   XRenderPictFormat  *fmt;
+   XRenderPictureAttributes pa;
+   ImlibImagePixmap   *ip;
+   XImage             *xim;
+   Pixmap              pmap;
+   GC                  gc;
+
+   fmt = XRenderFindStandardFormat(d, PictStandardARGB32);
+   if (!fmt)
+      return NULL;
+
+   xim = XCreateImage(d, NULL, 32, ZPixmap, 0, (char *)data, w, h, 32,
+                      w * sizeof(DATA32));
+   if (!xim)
+      return NULL;
+#ifdef WORDS_BIGENDIAN
+   xim->byte_order = MSBFirst;
+#else
+   xim->byte_order = LSBFirst;
+#endif
+
+   pmap = XCreatePixmap(d, draw, w, h, 32);
+   gc = XCreateGC(d, pmap, 0, NULL);
+   XPutImage(d, pmap, gc, xim, 0, 0, 0, 0, w, h);
+   XFreeGC(d, gc);
+   xim->data = NULL;
+   XDestroyImage(xim);
+
+   ip = __imlib_AddImagePixmapToCache(im, pmap, None, w, h, d, NULL, 32,
+                                      sx, sy, sw, sh, 0, aa, 0, 0, 0);
+   if (!ip)
+     {
+        XFreePixmap(d, pmap);
+        return NULL;
+     }
+   pa.repeat = RepeatPad;
+   ip->picture = XRenderCreatePicture(d, pmap, fmt, CPRepeat, &pa);
+
+   return ip;
+}
+
+/*
+ * Blend the sw x sh rectangle at (sx, sy) of im onto the dw x dh rectangle
+ * at (dx, dy) of drawable w. Returns 0 if this can't be done with XRender
+ * (nothing drawn), the caller then renders on the CPU.
+ */
+int
+__imlib_XRenderImage(Display * d, ImlibImage * im, Drawable w, Visual * v,
+                     int sx, int sy, int sw, int sh, int dx, int dy,
+                     int dw, int dh, char antialias,
+                     ImlibColorModifier * cmod, ImlibOp op)
+{
+   XRenderPictFormat  *fmt;
+   XTransform          xf;
+   ImlibImagePixmap   *ip;
+   ImlibImage         *im_tmp;
+   Picture             pict;
+   DATA32             *data;
+   int                 y, pw, ph, xop;
+   char                aa, server_scale, filt;
+
+   if (cmod || dw <= 0 || dh <= 0)
+      return 0;
+   switch (op)
+     {
+     case OP_COPY:
+        xop = PictOpOver;
+        break;
+     case OP_ADD:
+        xop = PictOpAdd;
+        break;
+     default:
+        return 0;
+     }
+   if (!XRenderCheck(d))
+      return 0;
+   fmt = XRenderFindVisualFormat(d, v);
+   if (!fmt)
+      return 0;
+
+   server_scale = (dw == sw && dh == sh) || !antialias ||
+      (antialias < SCALE_BICUBIC && dw >= sw && dh >= sh);
+   pw = server_scale ? sw : dw;
+   ph = server_scale ? sh : dh;
+   aa = server_scale ? 0 : antialias;
+
+   ip = __imlib_FindCachedImagePixmap(im, pw, ph, d, NULL, 32, sx, sy, sw, sh,
+                                      0, aa, 0, 0, 0);
+   if (!ip)
+     {
+        data = malloc(pw * ph * sizeof(DATA32));
+        if (!data)
+           return 0;
+        if (server_scale)
+          {
+             for (y = 0; y < ph; y++)
+                memcpy(data + y * pw, im->data + (sy + y) * im->w + sx,
+                       pw * sizeof(DATA32));
+             if (!IMAGE_ALPHA_PREMUL(im))
+                __imlib_PremulData(data, pw * ph);
+          }
+        else
+          {
+             im_tmp = __imlib_CreateImage(pw, ph, data);
+             if (!im_tmp)
+               {
+                  free(data);
+                  return 0;
+               }
+             SET_FLAG(im_tmp->flags, F_HAS_ALPHA);
+             __imlib_BlendImageToImage(im, im_tmp, antialias, 0, 1,
+                                       sx, sy, sw, sh, 0, 0, pw, ph,
+                                       NULL, OP_COPY, 0, 0, 0, 0);
+             im_tmp->data = NULL;
+             __imlib_FreeImage(im_tmp);
+             __imlib_PremulData(data, pw * ph);
+          }
+        ip = XRenderUpload(d, w, im, data, pw, ph, sx, sy, sw, sh, aa);
+        free(data);
+        if (!ip)
+           return 0;
+     }
+
+   /* the picture is shared by all scales, set up this one */
+   filt = server_scale && !antialias;
+   memset(&xf, 0, sizeof(xf));
+   xf.matrix[0][0] = (pw << 16) / dw;
+   xf.matrix[1][1] = (ph << 16) / dh;
+   xf.matrix[0][2] = XRenderOffset(xf.matrix[0][0], filt);
+   xf.matrix[1][2] = XRenderOffset(xf.matrix[1][1], filt);
+   xf.matrix[2][2] = XDoubleToFixed(1);
+   XRenderSetPictureTransform(d, ip->picture, &xf);
+   XRenderSetPictureFilter(d, ip->picture,
+                           filt ? FilterNearest : FilterBilinear, NULL, 0);
+
+   pict = XRenderCreatePicture(d, w, fmt, 0, NULL);
+   XRenderComposite(d, xop, ip->picture, None, pict,
+                    0, 0, 0, 0, dx, dy, dw, dh);
+   XRenderFreePicture(d, pict);
+
+   /* keep it cached, but as any unused pixmap */
+   __imlib_ReleaseImagePixmap(ip);
+
+   return 1;
+}
+
+#endif /* HAVE_X11_XRENDER */
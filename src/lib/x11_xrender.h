@@ -0,0 +1,18 @@
+#ifndef X11_XRENDER_H
+#define X11_XRENDER_H 1
+
+#include <X11/Xlib.h>
+
+#include "common.h"
+#include "colormod.h"
+#include "image.h"
+
+int                 __imlib_XRenderImage(Display * d, ImlibImage * im,
+                                         Drawable w, Visual * v,
+                                         int sx, int sy, int sw, int sh,
+                                         int dx, int dy, int dw, int dh,
+                                         char antialias,
+                                         ImlibColorModifier * cmod,
+                                         ImlibOp op);
+
+#endif /* X11_XRENDER_H */
@@ -51,11 +51,12 @@ mod_tint(double t[256], double v)
       t[i] *= v;
 }
 
-static              Imlib_Image
-colormod(Imlib_Image im, IFunctionParam * par)
+static void
+colormod_tables(Imlib_Image im, IFunctionParam * par,
+                DATA8 * r_b, DATA8 * g_b, DATA8 * b_b, DATA8 * a_b,
+                int *px, int *py, int *pw, int *ph)
 {
    double              a_d[256], r_d[256], g_d[256], b_d[256];
-   DATA8               a_b[256], r_b[256], g_b[256], b_b[256];
    IFunctionParam     *ptr;
    int                 x = 0, y = 0, h, w, i;
    double              v = 0.0;
@@ -217,6 +218,19 @@ colormod(Imlib_Image im, IFunctionParam * par)
            b_d[i] = 1;
         b_b[i] = b_d[i] * 255;
      }
+   *px = x;
+   *py = y;
+   *pw = w;
+   *ph = h;
+}
+
+static              Imlib_Image
+colormod(Imlib_Image im, IFunctionParam * par)
+{
+   DATA8               a_b[256], r_b[256], g_b[256], b_b[256];
+   int                 x, y, w, h;
+
+   colormod_tables(im, par, r_b, g_b, b_b, a_b, &x, &y, &w, &h);
    imlib_context_set_color_modifier(imlib_create_color_modifier());
    imlib_set_color_modifier_tables(r_b, g_b, b_b, a_b);
    imlib_apply_color_modifier_to_rectangle(x, y, w, h);
@@ -253,3 +267,15 @@ exec(char *filter, void *im, IFunctionParam * par)
       return colormod((Imlib_Image) im, par);
    return im;
 }
+
+int
+cmod(char *filter, void *im, IFunctionParam * par,
+     DATA8 * r, DATA8 * g, DATA8 * b, DATA8 * a, int *x, int *y, int *w, int *h)
+{
+   if (!strcmp(filter, "colormod"))
+     {
+        colormod_tables((Imlib_Image) im, par, r, g, b, a, x, y, w, h);
+        return 1;
+     }
+   return 0;
+}
@@ -9,5 +9,8 @@
 __EXPORT__ void     init(ImlibFilterInfo * info);
 __EXPORT__ void     deinit(void);
 __EXPORT__ void    *exec(char *filter, void *im, IFunctionParam * params);
+__EXPORT__ int      cmod(char *filter, void *im, IFunctionParam * params,
+                         DATA8 * r, DATA8 * g, DATA8 * b, DATA8 * a,
+                         int *x, int *y, int *w, int *h);
 
 #endif /* __FILTER_COMMON_H */
@@ -49,7 +49,9 @@ load2(ImlibImage * im, int load_data)
 
    rc = LOAD_FAIL;
 
-   fdata = mmap(NULL, im->fsize, PROT_READ, MAP_SHARED, fileno(im->fp), 0);
+   /* Private writable mapping - may be handed out as image data */
+   fdata = mmap(NULL, im->fsize, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                fileno(im->fp), 0);
    if (fdata == MAP_FAILED)
       return LOAD_BADFILE;
 
@@ -82,6 +84,22 @@ load2(ImlibImage * im, int load_data)
 
    /* Load data */
 
+#ifndef WORDS_BIGENDIAN
+   /* If the pixels are aligned, fill the file exactly and no custom memory
+    * function is in use, the mapping is the image data (no copy) */
+   if (!im->data_memory_func && ((row - fptr) & 3) == 0 &&
+       im->fsize == (row - fptr) + 4 * im->w * im->h)
+     {
+        __imlib_SetMappedData(im, fdata, row - fptr);
+        fdata = NULL;
+
+        if (im->lc && __imlib_LoadProgressRows(im, 0, im->h))
+           QUIT_WITH_RC(LOAD_BREAK);
+
+        QUIT_WITH_RC(LOAD_SUCCESS);
+     }
+#endif
+
    ptr = __imlib_AllocateData(im);
    if (!ptr)
       QUIT_WITH_RC(LOAD_OOM);
@@ -108,7 +126,8 @@ load2(ImlibImage * im, int load_data)
  quit:
    if (rc <= 0)
       __imlib_FreeData(im);
-   munmap(fdata, im->fsize);
+   if (fdata)
+      munmap(fdata, im->fsize);
 
    return rc;
 }
@@ -119,7 +138,7 @@ save(ImlibImage * im, ImlibProgressFunction progress, char progress_granularity)
    int                 rc;
    FILE               *f;
    DATA32             *ptr;
-   int                 y, alpha = 0;
+   int                 y, alpha = 0, n;
 
 #ifdef WORDS_BIGENDIAN
    DATA32             *buf = (DATA32 *) malloc(im->w * 4);
@@ -132,7 +151,12 @@ save(ImlibImage * im, ImlibProgressFunction progress, char progress_granularity)
    if (im->flags & F_HAS_ALPHA)
       alpha = 1;
 
-   fprintf(f, "ARGB %i %i %i\n", im->w, im->h, alpha);
+   /* Pad the header so the pixel data is 32-bit aligned in the file,
+    * which allows loading it without copying */
+   n = fprintf(f, "ARGB %i %i %i", im->w, im->h, alpha);
+   for (n++; n & 3; n++)
+      fputc(' ', f);
+   fputc('\n', f);
 
    ptr = im->data;
    for (y = 0; y < im->h; y++)
@@ -135,7 +135,7 @@ ico_read_idir(ico_t * ico, int ino)
 }
 
 static void
-ico_read_icon(ico_t * ico, int ino)
+ico_read_icon(ico_t * ico, int ino, int load_data)
 {
    ie_t               *ie;
    unsigned int        size;
@@ -182,6 +182,13 @@ ico_read_icon(ico_t * ico, int ino)
    if (ie->bih.colors == 0 && ie->bih.bpp < 32)
       ie->bih.colors = 1U << ie->bih.bpp;
 
+   if (!IMAGE_DIMENSIONS_OK(ie->w, ie->h) || ie->bih.bpp == 0 ||
+       UINT_MAX / ie->bih.bpp < ie->w * ie->h)
+      goto bail;
+
+   if (!load_data)
+      return;
+
    switch (ie->bih.bpp)
      {
      case 1:
@@ -205,10 +212,6 @@ ico_read_icon(ico_t * ico, int ino)
         break;
      }
 
-   if (!IMAGE_DIMENSIONS_OK(ie->w, ie->h) || ie->bih.bpp == 0 ||
-       UINT_MAX / ie->bih.bpp < ie->w * ie->h)
-      goto bail;
-
    size = ((ie->bih.bpp * ie->w + 31) / 32 * 4) * ie->h;
    ie->pxls = malloc(size);
    if (ie->pxls == NULL)
@@ -231,6 +234,59 @@ ico_read_icon(ico_t * ico, int ino)
    ie->w = ie->h = 0;           /* Mark invalid */
 }
 
+/* Entries may hold a PNG image instead of a BMP one */
+static int
+ico_entry_is_png(ico_t * ico, int ino)
+{
+   static const DATA8  png_sig[8] =
+      { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+   DATA8               sig[8];
+
+   mm_seek(ico->ie[ino].ide.offs);
+   if (mm_read(sig, sizeof(sig)))
+      return 0;
+
+   return memcmp(sig, png_sig, sizeof(sig)) == 0;
+}
+
+/* Is entry a preferable to entry b (for requested size rw x rh)?
+ * Entries covering the requested size beat those that don't, of these the
+ * smallest is preferred, otherwise the largest. Then the deepest. */
+static int
+ico_entry_better(const ie_t * a, const ie_t * b, int rw, int rh)
+{
+   int                 fa, fb, sa, sb;
+
+   fa = (rw || rh) && a->w >= rw && a->h >= rh;
+   fb = (rw || rh) && b->w >= rw && b->h >= rh;
+   if (fa != fb)
+      return fa;
+
+   sa = a->w * a->h;
+   sb = b->w * b->h;
+   if (sa != sb)
+      return fa ? sa < sb : sa > sb;
+
+   return a->ide.bpp >= b->ide.bpp;
+}
+
+static int
+ico_select(ico_t * ico, int rw, int rh)
+{
+   int                 i, ic;
+
+   ic = -1;
+   for (i = 0; i < ico->idir.icons; i++)
+     {
+        if (ico->ie[i].w == 0)
+           continue;            /* Invalid */
+        if (ic < 0 || ico_entry_better(&ico->ie[i], &ico->ie[ic], rw, rh))
+           ic = i;
+     }
+
+   return ic;
+}
+
 static int
 ico_data_get_bit(DATA8 * data, int w, int x, int y)
 {
@@ -257,10 +313,44 @@ ico_data_get_nibble(DATA8 * data, int w, int x, int y)
    return res;
 }
 
+/* Let the PNG loader have the entry */
+static int
+ico_load_png(ico_t * ico, int ino, ImlibImage * im, int load_data)
+{
+   ie_t               *ie;
+   ImlibLoader        *l;
+   int                 rc, frame_num, frame_count;
+
+   ie = &ico->ie[ino];
+   if (ie->ide.offs > mdata.size || ie->ide.size > mdata.size - ie->ide.offs)
+      return 0;
+
+   l = __imlib_FindBestLoaderForFormat("png", 0);
+   if (!l)
+      return 0;
+
+   D("Loading icon %d: PNG, size = %d\n", ino, ie->ide.size);
+
+   /* The frame is the icon number, not a PNG animation frame */
+   frame_num = im->frame_num;
+   frame_count = im->frame_count;
+   im->frame_num = 0;
+
+   rc = __imlib_LoadEmbeddedMem(l, im, mdata.data + ie->ide.offs,
+                                ie->ide.size, load_data);
+
+   im->frame_num = frame_num;
+   im->frame_count = frame_count;
+   free(im->format);
+   im->format = NULL;
+
+   return rc > 0;
+}
+
 static int
 ico_load(ico_t * ico, ImlibImage * im, int load_data)
 {
-   int                 ic, x, y, w, h, d, frame;
+   int                 ic, x, y, w, h, frame;
    DATA32             *cmap;
    DATA8              *pxls, *mask, *psrc;
    ie_t               *ie;
@@ -277,24 +367,27 @@ ico_load(ico_t * ico, ImlibImage * im, int load_data)
            return 0;
      }
 
-   ic = frame - 1;
-   if (ic < 0)
+   /* Select the requested entry, or the best for the requested size.
+    * Only the selected entry is read, if it is bad try the next best. */
+   for (;;)
      {
-        /* Select default: Find icon with largest size and depth */
-        ic = y = d = 0;
-        for (x = 0; x < ico->idir.icons; x++)
+        ic = frame > 0 ? frame - 1 : ico_select(ico, im->load_w, im->load_h);
+        if (ic < 0)
+           return 0;
+
+        if (ico_entry_is_png(ico, ic))
           {
-             ie = &ico->ie[x];
-             w = ie->w;
-             h = ie->h;
-             if (w * h < y)
-                continue;
-             if (w * h == y && ie->bih.bpp < d)
-                continue;
-             ic = x;
-             y = w * h;
-             d = ie->bih.bpp;
+             if (ico_load_png(ico, ic, im, load_data))
+                return 1;
+             if (frame > 0)
+                return 0;
+             ico->ie[ic].w = ico->ie[ic].h = 0; /* Mark invalid */
+             continue;
           }
+
+        ico_read_icon(ico, ic, load_data);
+        if (ico->ie[ic].w != 0 || frame > 0)
+           break;
      }
 
    ie = &ico->ie[ic];
@@ -424,10 +517,7 @@ load2(ImlibImage * im, int load_data)
    D("Loading '%s' Nicons = %d\n", im->real_file, ico.idir.icons);
 
    for (i = 0; i < ico.idir.icons; i++)
-     {
-        ico_read_idir(&ico, i);
-        ico_read_icon(&ico, i);
-     }
+      ico_read_idir(&ico, i);
 
    rc = LOAD_BADIMAGE;          /* Format accepted */
 
@@ -2,6 +2,7 @@
 
 #include <errno.h>
 #include <limits.h>
+#include <sys/stat.h>
 #include <id3tag.h>
 
 #if ! defined (__STDC_VERSION__) || __STDC_VERSION__ < 199901L
@@ -12,21 +13,26 @@
 #endif
 #endif
 
-#ifdef __GNUC__
-#define UNLIKELY(exp) __builtin_expect ((exp), 0)
-#else
-#define UNLIKELY(exp) (exp)
-#endif
-
 typedef struct context {
    int                 id;
    char               *filename;
+   dev_t               dev;     /* Identity of the file the tag was read from */
+   ino_t               ino;
+   off_t               size;
+   time_t              mtime;
    struct id3_tag     *tag;
    int                 refcount;
    struct context     *next;
 } context;
 
 static context     *id3_ctxs = NULL;
+static int          id3_ctx_id = 0;
+
+/* The most recently parsed tag is kept around (holding a reference), so the
+ * header and data passes, and queries for other pictures in the same file,
+ * don't parse it again. It is dropped when another file is loaded and when
+ * the loader is unloaded. */
+static context     *id3_ctx_last = NULL;
 
 static inline struct id3_frame *
 id3_tag_get_frame(struct id3_tag *tag, size_t index)
@@ -47,11 +53,20 @@ id3_frame_id(struct id3_frame *frame)
 }
 
 static context     *
-context_create(const char *filename, FILE * f)
+context_find(int id)
+{
+   context            *ptr;
+
+   for (ptr = id3_ctxs; ptr; ptr = ptr->next)
+      if (ptr->id == id)
+         return ptr;
+   return NULL;
+}
+
+static context     *
+context_create(const char *filename, FILE * f, const struct stat *st)
 {
    context            *node = (context *) malloc(sizeof(context));
-   context            *ptr, *last;
-   int                 last_id = INT_MAX;
 
    node->refcount = 1;
    {
@@ -84,48 +99,24 @@ context_create(const char *filename, FILE * f)
    }
 
    node->filename = strdup(filename);
+   node->dev = st->st_dev;
+   node->ino = st->st_ino;
+   node->size = st->st_size;
+   node->mtime = st->st_mtime;
 
-   if (!id3_ctxs)
+   /* Handles only need to be unique among the live contexts */
+   do
      {
-        node->id = 1;
-        node->next = NULL;
-        id3_ctxs = node;
-        return node;
-     }
-   ptr = id3_ctxs;
-
-   last = NULL;
-   while (UNLIKELY(ptr && (ptr->id + 1) >= last_id))
-     {
-        last_id = ptr->id;
-        last = ptr;
-        ptr = ptr->next;
+        if (id3_ctx_id == INT_MAX)
+           id3_ctx_id = 0;
+        node->id = ++id3_ctx_id;
      }
+   while (context_find(node->id));
+   node->next = id3_ctxs;
+   id3_ctxs = node;
 
-   /* Paranoid! this can occur only if there are INT_MAX contexts :) */
-   if (UNLIKELY(!ptr))
-     {
-        fprintf(stderr, "Too many open ID3 contexts\n");
-        goto fail_close;
-     }
-
-   node->id = ptr->id + 1;
-
-   if (UNLIKELY(!!last))
-     {
-        node->next = last->next;
-        last->next = node;
-     }
-   else
-     {
-        node->next = id3_ctxs;
-        id3_ctxs = node;
-     }
    return node;
 
- fail_close:
-   free(node->filename);
-   id3_tag_delete(node->tag);
  fail_free:
    free(node);
    return NULL;
@@ -148,29 +139,27 @@ context_addref(context * ctx)
 static context     *
 context_get(int id)
 {
-   context            *ptr = id3_ctxs;
+   context            *ptr = context_find(id);
 
-   while (ptr)
+   if (!ptr)
      {
-        if (ptr->id == id)
-          {
-             context_addref(ptr);
-             return ptr;
-          }
-        ptr = ptr->next;
+        fprintf(stderr, "No context by handle %d found\n", id);
+        return NULL;
      }
-   fprintf(stderr, "No context by handle %d found\n", id);
-   return NULL;
+   context_addref(ptr);
+   return ptr;
 }
 
 static context     *
-context_get_by_name(const char *name)
+context_get_by_name(const char *name, const struct stat *st)
 {
    context            *ptr = id3_ctxs;
 
    while (ptr)
      {
-        if (!strcmp(name, ptr->filename))
+        if (!strcmp(name, ptr->filename) &&
+            ptr->dev == st->st_dev && ptr->ino == st->st_ino &&
+            ptr->size == st->st_size && ptr->mtime == st->st_mtime)
           {
              context_addref(ptr);
              return ptr;
@@ -188,6 +177,9 @@ context_delref(context * ctx)
      {
         context            *last = NULL, *ptr = id3_ctxs;
 
+        if (ctx == id3_ctx_last)
+           id3_ctx_last = NULL;
+
         while (ptr)
           {
              if (ptr == ctx)
@@ -205,6 +197,25 @@ context_delref(context * ctx)
      }
 }
 
+static void
+context_set_last(context * ctx)
+{
+   if (ctx == id3_ctx_last)
+      return;
+   if (id3_ctx_last)
+      context_delref(id3_ctx_last);
+   if (ctx)
+      context_addref(ctx);
+   id3_ctx_last = ctx;
+}
+
+__attribute__((destructor))
+static void
+id3_unload(void)
+{
+   context_set_last(NULL);
+}
+
 static int
 str2int(const char *str, int old)
 {
@@ -249,6 +260,7 @@ get_options(lopt * opt, const ImlibImage * im)
 {
    unsigned int        handle = 0, index = 0, traverse = 0;
    context            *ctx;
+   struct stat         st;
 
    if (im->key)
      {
@@ -291,10 +303,21 @@ get_options(lopt * opt, const ImlibImage * im)
            handle = htag->val;
      }
    if (handle)
-      ctx = context_get(handle);
-   else if (!(ctx = context_get_by_name(im->real_file)) &&
-            !(ctx = context_create(im->real_file, im->fp)))
+     {
+        if (!(ctx = context_get(handle)))
+           return 0;
+     }
+   else if (fstat(fileno(im->fp), &st) < 0)
       return 0;
+   else if (!(ctx = context_get_by_name(im->real_file, &st)))
+     {
+        /* Another file, don't hold on to the previous tag while parsing */
+        context_set_last(NULL);
+        if (!(ctx = context_create(im->real_file, im->fp, &st)))
+           return 0;
+     }
+
+   context_set_last(ctx);
 
    if (!index)
      {
@@ -321,38 +344,6 @@ get_options(lopt * opt, const ImlibImage * im)
    return 1;
 }
 
-static int
-extract_pic(struct id3_frame *frame, int dest)
-{
-   union id3_field    *field;
-   unsigned char const *data;
-   id3_length_t        length;
-   int                 done = 0;
-
-   field = id3_frame_field(frame, 4);
-   data = id3_field_getbinarydata(field, &length);
-   if (!data)
-     {
-        fprintf(stderr, "No image data found for frame\n");
-        return 0;
-     }
-   while (length > 0)
-     {
-        ssize_t             res;
-
-        if ((res = write(dest, data + done, length)) < 0)
-          {
-             if (errno == EINTR)
-                continue;
-             perror("Unable to write to file");
-             return 0;
-          }
-        length -= res;
-        done += res;
-     }
-   return 1;
-}
-
 #define EXT_LEN 14
 
 static char
@@ -513,27 +504,20 @@ load2(ImlibImage * im, int load_data)
 
    if (loader)
      {
-        char                tmp[] = "/tmp/imlib2_loader_id3-XXXXXX";
-        int                 dest, res;
-
-        if ((dest = mkstemp(tmp)) < 0)
-          {
-             fprintf(stderr, "Unable to create a temporary file\n");
-             goto quit;
-          }
-
-        res = extract_pic(id3_tag_get_frame(opt.ctx->tag, opt.index - 1), dest);
-        close(dest);
+        union id3_field    *field;
+        id3_length_t        length;
+        unsigned char const *data;
 
-        if (!res)
+        field = id3_frame_field
+           (id3_tag_get_frame(opt.ctx->tag, opt.index - 1), 4);
+        data = id3_field_getbinarydata(field, &length);
+        if (!data || !length)
           {
-             unlink(tmp);
+             fprintf(stderr, "No image data found for frame\n");
              goto quit;
           }
 
-        rc = __imlib_LoadEmbedded(loader, im, tmp, load_data);
-
-        unlink(tmp);
+        rc = __imlib_LoadEmbeddedMem(loader, im, data, length, load_data);
      }
    else
      {
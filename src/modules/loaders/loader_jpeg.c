@@ -6,10 +6,13 @@
 
 #define DBG_PFX "LDR-jpg"
 
+#define JPEG_BAND 16            /* Rows per band when rotating */
+
 typedef struct {
    struct jpeg_error_mgr jem;
    sigjmp_buf          setjmp_buffer;
    DATA8              *data;
+   DATA32             *band;
 } ImLib_JPEG_data;
 
 static void
@@ -57,6 +60,7 @@ _jdata_init(ImLib_JPEG_data * jd)
    jd->jem.output_message = _JPEGErrorHandler;
 
    jd->data = NULL;
+   jd->band = NULL;
 
    return jem;
 }
@@ -68,8 +72,8 @@ load2(ImlibImage * im, int load_data)
    struct jpeg_decompress_struct jds;
    ImLib_JPEG_data     jdata;
    DATA8              *ptr, *line[16];
-   DATA32             *ptr2;
-   int                 x, y, l, scans, inc;
+   DATA32             *ptr2, *tdst;
+   int                 x, y, l, scans, inc, tdxs, tdys;
    ExifInfo            ei = { 0 };
 
    /* set up error handling */
@@ -141,6 +145,42 @@ load2(ImlibImage * im, int load_data)
    for (y = 0; y < jds.rec_outbuf_height; y++)
       line[y] = jdata.data + (y * w * jds.output_components);
 
+   /* rotated images are decoded in bands of rows which are then transposed
+    * into place, rather than writing each pixel with a stride of h */
+   tdst = NULL;
+   tdxs = tdys = 0;
+   if (ei.swap_wh)
+     {
+        jdata.band = malloc(w * JPEG_BAND * sizeof(DATA32));
+        if (!jdata.band)
+           QUIT_WITH_RC(LOAD_OOM);
+
+        switch (ei.orientation)
+          {
+          default:
+          case ORIENT_LEFTTOP:
+             tdst = im->data;
+             tdxs = h;
+             tdys = 1;
+             break;
+          case ORIENT_RIGHTTOP:
+             tdst = im->data + h - 1;
+             tdxs = h;
+             tdys = -1;
+             break;
+          case ORIENT_RIGHTBOT:
+             tdst = im->data + (h - 1) + (w - 1) * h;
+             tdxs = -h;
+             tdys = -1;
+             break;
+          case ORIENT_LEFTBOT:
+             tdst = im->data + (w - 1) * h;
+             tdxs = -h;
+             tdys = 1;
+             break;
+          }
+     }
+
    for (l = 0; l < h; l += jds.rec_outbuf_height)
      {
         jpeg_read_scanlines(&jds, line, jds.rec_outbuf_height);
@@ -173,24 +213,13 @@ load2(ImlibImage * im, int load_data)
                   inc = 1;
                   break;
                case ORIENT_LEFTTOP:
-                  ptr2 = im->data + (l + y);
-                  inc = h;
-                  break;
                case ORIENT_RIGHTTOP:
-                  ptr2 = im->data + (h - 1 - (l + y));
-                  inc = h;
-                  break;
                case ORIENT_RIGHTBOT:
-                  ptr2 = im->data + (h - 1 - (l + y)) + (w - 1) * h;
-                  inc = -h;
-                  break;
                case ORIENT_LEFTBOT:
-                  ptr2 = im->data + (l + y) + (w - 1) * h;
-                  inc = -h;
+                  ptr2 = jdata.band + ((l + y) % JPEG_BAND) * w;
+                  inc = 1;
                   break;
                }
-             D("l,s,y=%d,%d, %d - x,y=%4ld,%4ld\n", l, y, l + y,
-               (ptr2 - im->data) % im->w, (ptr2 - im->data) / im->w);
 
              switch (jds.out_color_space)
                {
@@ -223,6 +252,15 @@ load2(ImlibImage * im, int load_data)
                     }
                   break;
                }
+
+             /* band full or last row - transpose it into place */
+             if (ei.swap_wh &&
+                 ((l + y + 1) % JPEG_BAND == 0 || l + y + 1 == h))
+               {
+                  x = (l + y) - (l + y) % JPEG_BAND;
+                  __imlib_TransposeData(tdst + x * tdys, tdxs, tdys,
+                                        jdata.band, w, w, l + y + 1 - x);
+               }
           }
 
         if (ei.orientation != ORIENT_TOPLEFT &&
@@ -245,6 +283,7 @@ load2(ImlibImage * im, int load_data)
  quit:
    jpeg_destroy_decompress(&jds);
    free(jdata.data);
+   free(jdata.band);
    if (rc <= 0)
       __imlib_FreeData(im);
 
@@ -32,6 +32,22 @@ u2pix(double x, int unit)
      }
 }
 
+/* scale the natural size to fit the requested one, keeping the aspect ratio
+ * (a requested width or height of 0 does not constrain) */
+static void
+fit_size(ImlibImage * im)
+{
+   double              sx, sy, sc;
+
+   sx = im->load_w > 0 ? (double)im->load_w / im->w : 0;
+   sy = im->load_h > 0 ? (double)im->load_h / im->h : 0;
+   sc = sx <= 0 ? sy : sy <= 0 ? sx : MIN(sx, sy);
+
+   im->w = MAX(lrint(im->w * sc), 1);
+   im->h = MAX(lrint(im->h * sc), 1);
+   D("Fit to %dx%d: %dx%d\n", im->load_w, im->load_h, im->w, im->h);
+}
+
 int
 load2(ImlibImage * im, int load_data)
 {
@@ -88,7 +104,7 @@ load2(ImlibImage * im, int load_data)
 #endif
         }
 
-      if (out_has_viewbox && (im->w <= 0 || im->w <= 0))
+      if (out_has_viewbox && (im->w <= 0 || im->h <= 0))
         {
            im->w = ceil(out_viewbox.width);
            im->h = ceil(out_viewbox.height);
@@ -106,7 +122,7 @@ load2(ImlibImage * im, int load_data)
 
       ok = rsvg_handle_get_intrinsic_size_in_pixels(rsvg, &dw, &dh);
       D("ok=%d WxH=%.1fx%.1f\n", ok, dw, dh);
-      if (ok && (im->w <= 0 || im->w <= 0))
+      if (ok && (im->w <= 0 || im->h <= 0))
         {
            im->w = ceil(dw);
            im->h = ceil(dh);
@@ -129,7 +145,7 @@ load2(ImlibImage * im, int load_data)
         out_ink_rect.x, out_ink_rect.y, out_ink_rect.width, out_ink_rect.height,
         out_logical_rect.x, out_logical_rect.y, out_logical_rect.width,
         out_logical_rect.height);
-      if (ok && (im->w <= 0 || im->w <= 0))
+      if (ok && (im->w <= 0 || im->h <= 0))
         {
            im->w = ceil(out_ink_rect.width);
            im->h = ceil(out_ink_rect.height);
@@ -143,6 +159,14 @@ load2(ImlibImage * im, int load_data)
 #if !IMLIB2_DEBUG
  got_size:
 #endif
+   if (im->w <= 0 || im->h <= 0)
+      goto quit;
+
+   /* Render straight at the requested size rather than have the caller
+    * scale a raster of the natural size */
+   if (im->load_w > 0 || im->load_h > 0)
+      fit_size(im);
+
    if (!IMAGE_DIMENSIONS_OK(im->w, im->h))
       goto quit;
 
@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+
+#include <Imlib2.h>
+
+#include "config.h"
+/**INDENT-OFF**/
+extern "C" {
+#include "common.h"
+#include "asm_c.h"
+#include "blend_simd.h"
+#include "colormod.h"
+}
+/**INDENT-ON**/
+
+int                 debug = 0;
+
+#define D(...)  if (debug) printf(__VA_ARGS__)
+
+#define SW	37              // Source width
+#define SH	5               // Source height
+#define DW	(SW + 8)        // Destination width
+
+static DATA32       src[SW * SH], dst[DW * SH], dout[DW * SH];
+static Imlib_Color_Modifier cmods[3];   /* None, a(255) partial, opaque */
+
+static DATA32
+rand_pixel(void)
+{
+   DATA32              pix;
+
+   pix = (DATA32) rand() ^ ((DATA32) rand() << 16);
+   // Plenty of the alpha values the C functions special case
+   switch (rand() % 4)
+     {
+     case 0:
+        return pix & 0x00ffffff;
+     case 1:
+        return pix | 0xff000000;
+     default:
+        return pix;
+     }
+}
+
+static void
+setup_cmods(void)
+{
+   DATA8               r[256], g[256], b[256], a[256];
+   int                 i, j;
+
+   cmods[0] = NULL;
+   for (i = 1; i < 3; i++)
+     {
+        cmods[i] = imlib_create_color_modifier();
+        imlib_context_set_color_modifier(cmods[i]);
+        for (j = 0; j < 256; j++)
+          {
+             r[j] = rand();
+             g[j] = rand();
+             b[j] = rand();
+             a[j] = rand();
+          }
+        // Opaque source pixels map to partial, or stay opaque
+        a[255] = i == 1 ? 0xc0 : 0xff;
+        a[0] = 0;
+        imlib_set_color_modifier_tables(r, g, b, a);
+     }
+   imlib_context_set_color_modifier(NULL);
+}
+
+// Each SIMD blend function must produce exactly what the C one (used by
+// the library, as IMLIB2_ASM_OFF is set) does, for any width and source
+// and destination alignment
+static void
+test_blend(int simd)
+{
+   static const Imlib_Operation ops[] = {
+      IMLIB_OP_COPY, IMLIB_OP_ADD, IMLIB_OP_SUBTRACT, IMLIB_OP_RESHADE,
+   };
+   Imlib_Image         im_src, im_dst;
+   ImlibColorModifier *cm;
+   ImlibBlendFunction  fout;
+   DATA32             *pdst;
+   const DATA32       *pref;
+   unsigned int        i;
+   int                 op, icm, merge_alpha, rgb_src, blend, blend_used;
+   int                 w, sx, dx;
+
+   for (i = 0; i < SW * SH; i++)
+      src[i] = rand_pixel();
+   for (i = 0; i < DW * SH; i++)
+      dst[i] = rand_pixel();
+
+   im_src = imlib_create_image_using_data(SW, SH, src);
+   im_dst = imlib_create_image(DW, SH);
+   ASSERT_TRUE(im_src);
+   ASSERT_TRUE(im_dst);
+   imlib_context_set_image(im_dst);
+   imlib_image_set_has_alpha(1);
+
+   for (op = 0; op < 4; op++)
+      for (icm = 0; icm < 3; icm++)
+         for (merge_alpha = 0; merge_alpha < 2; merge_alpha++)
+            for (rgb_src = 0; rgb_src < 2; rgb_src++)
+               for (blend = 0; blend < 2; blend++)
+                 {
+                    cm = (ImlibColorModifier *) cmods[icm];
+
+                    // What __imlib_BlendImageToImage() and
+                    // __imlib_GetBlendFunction() make of the arguments
+                    blend_used = blend || (rgb_src && merge_alpha);
+                    if (cm && rgb_src && A_CMOD(cm, 0xff) == 0xff)
+                       blend_used = 0;
+
+                    fout = __imlib_GetBlendFunctionSimd(simd, (ImlibOp) op,
+                                                        blend_used,
+                                                        merge_alpha, rgb_src,
+                                                        cm);
+                    ASSERT_TRUE(fout);
+
+                    imlib_context_set_image(im_src);
+                    imlib_image_set_has_alpha(!rgb_src);
+                    imlib_context_set_image(im_dst);
+                    imlib_context_set_operation(ops[op]);
+                    imlib_context_set_color_modifier(cmods[icm]);
+                    imlib_context_set_blend(blend);
+
+                    for (w = 1; w <= SW - 3; w++)
+                       for (sx = 0; sx < 4; sx++)
+                          for (dx = 0; dx < 4; dx++)
+                            {
+                               D("op=%d cm=%d ma=%d rgb=%d blend=%d w=%d "
+                                 "sx=%d dx=%d\n", op, icm, merge_alpha,
+                                 rgb_src, blend, w, sx, dx);
+
+                               pdst = imlib_image_get_data();
+                               memcpy(pdst, dst, sizeof(dst));
+                               imlib_image_put_back_data(pdst);
+                               imlib_blend_image_onto_image(im_src,
+                                                            merge_alpha, sx,
+                                                            0, w, SH, dx, 0,
+                                                            w, SH);
+                               pref = imlib_image_get_data_for_reading_only();
+
+                               memcpy(dout, dst, sizeof(dst));
+                               fout(src + sx, SW, dout + dx, DW, w, SH, cm);
+
+                               ASSERT_EQ(memcmp(pref, dout, sizeof(dout)), 0)
+                                  << "op=" << op << " cm=" << icm
+                                  << " merge_alpha=" << merge_alpha
+                                  << " rgb_src=" << rgb_src
+                                  << " blend=" << blend << " w=" << w
+                                  << " sx=" << sx << " dx=" << dx;
+                            }
+                 }
+
+   imlib_context_set_color_modifier(NULL);
+   imlib_context_set_operation(IMLIB_OP_COPY);
+   imlib_context_set_blend(1);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(im_src);
+   imlib_free_image_and_decache();
+}
+
+TEST(BLEND, blend_sse2)
+{
+   if (!__builtin_cpu_supports("sse2"))
+      GTEST_SKIP();
+   test_blend(SIMD_SSE2);
+}
+
+TEST(BLEND, blend_avx2)
+{
+   if (!__builtin_cpu_supports("avx2"))
+      GTEST_SKIP();
+   test_blend(SIMD_AVX2);
+}
+
+int
+main(int argc, char **argv)
+{
+   const char         *s;
+
+   ::testing::InitGoogleTest(&argc, argv);
+
+   for (argc--, argv++; argc > 0; argc--, argv++)
+     {
+        s = argv[0];
+        if (*s++ != '-')
+           break;
+        switch (*s)
+          {
+          case 'd':
+             debug++;
+             break;
+          }
+     }
+
+   // The library must use the C functions
+   setenv("IMLIB2_ASM_OFF", "1", 1);
+   __builtin_cpu_init();
+   srand(1);
+   setup_cmods();
+
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,261 @@
+#include <gtest/gtest.h>
+
+#include <Imlib2.h>
+
+#include "config.h"
+
+int                 debug = 0;
+
+#define D(...)  if (debug) printf(__VA_ARGS__)
+
+#define W	16
+#define H	8
+
+// An image with alpha and a distinct value in every pixel
+static              Imlib_Image
+mk_image(DATA32 base)
+{
+   Imlib_Image         im;
+   DATA32             *data;
+   int                 i;
+
+   im = imlib_create_image(W, H);
+   imlib_context_set_image(im);
+   imlib_image_set_has_alpha(1);
+   data = imlib_image_get_data();
+   for (i = 0; i < W * H; i++)
+      data[i] = base + 0x010203 * i;
+   imlib_image_put_back_data(data);
+
+   return im;
+}
+
+static void
+get_pixels(Imlib_Image im, DATA32 * buf)
+{
+   imlib_context_set_image(im);
+   memcpy(buf, imlib_image_get_data_for_reading_only(),
+          imlib_image_get_width() * imlib_image_get_height() * sizeof(DATA32));
+}
+
+// Copying alpha into a clone must leave the original alone (and vice versa)
+TEST(CLONE, copy_alpha_to_clone)
+{
+   Imlib_Image         imo, imc, ima;
+   DATA32              ref[W * H], buf[W * H];
+   int                 i;
+
+   imo = mk_image(0xc80a141e);
+   ima = mk_image(0x07000000);
+   get_pixels(imo, ref);
+
+   imlib_context_set_image(imo);
+   imc = imlib_clone_image();
+   ASSERT_TRUE(imc);
+
+   imlib_context_set_image(imc);
+   imlib_image_copy_alpha_to_image(ima, 0, 0);
+
+   get_pixels(imo, buf);
+   EXPECT_EQ(memcmp(ref, buf, sizeof(ref)), 0);
+
+   get_pixels(imc, buf);
+   for (i = 0; i < W * H; i++)
+     {
+        EXPECT_EQ(buf[i] & 0x00ffffff, ref[i] & 0x00ffffff);
+        EXPECT_EQ(buf[i] >> 24, 0x07U);
+     }
+
+   // And writing to the original leaves the clone alone
+   imlib_context_set_image(imo);
+   imlib_image_copy_alpha_rectangle_to_image(ima, 0, 0, W, H, 0, 0);
+   get_pixels(imc, ref);
+   EXPECT_EQ(memcmp(ref, buf, sizeof(ref)), 0);
+
+   imlib_context_set_image(imc);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(ima);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(imo);
+   imlib_free_image_and_decache();
+}
+
+// A band of rows shares its parent's data, writing to it must not leak back
+TEST(CLONE, copy_alpha_to_crop)
+{
+   Imlib_Image         imo, imc, ima;
+   DATA32              ref[W * H], buf[W * H];
+   int                 i;
+
+   imo = mk_image(0xc80a141e);
+   ima = mk_image(0x07000000);
+   get_pixels(imo, ref);
+
+   imlib_context_set_image(imo);
+   imc = imlib_create_cropped_image(0, 2, W, 3);
+   ASSERT_TRUE(imc);
+
+   imlib_context_set_image(imc);
+   imlib_image_copy_alpha_rectangle_to_image(ima, 0, 0, W, 3, 0, 0);
+
+   get_pixels(imo, buf);
+   EXPECT_EQ(memcmp(ref, buf, sizeof(ref)), 0);
+
+   get_pixels(imc, buf);
+   for (i = 0; i < W * 3; i++)
+     {
+        EXPECT_EQ(buf[i] & 0x00ffffff, ref[2 * W + i] & 0x00ffffff);
+        EXPECT_EQ(buf[i] >> 24, 0x07U);
+     }
+
+   imlib_context_set_image(imc);
+   imlib_image_copy_alpha_to_image(ima, 0, -2);
+
+   get_pixels(imo, buf);
+   EXPECT_EQ(memcmp(ref, buf, sizeof(ref)), 0);
+
+   imlib_context_set_image(imc);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(ima);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(imo);
+   imlib_free_image_and_decache();
+}
+
+// Other writers, on a crop that outlives its parent
+TEST(CLONE, write_crop_after_parent)
+{
+   Imlib_Image         imo, imc;
+   DATA32              ref[W * H], buf[W * H];
+
+   imo = mk_image(0xc80a141e);
+   get_pixels(imo, ref);
+
+   imlib_context_set_image(imo);
+   imc = imlib_create_cropped_image(0, 0, W, 4);
+   ASSERT_TRUE(imc);
+   imlib_free_image_and_decache();
+
+   imlib_context_set_image(imc);
+   get_pixels(imc, buf);
+   EXPECT_EQ(memcmp(ref, buf, W * 4 * sizeof(DATA32)), 0);
+
+   imlib_context_set_color(1, 2, 3, 255);
+   imlib_image_fill_rectangle(0, 0, W, 4);
+   get_pixels(imc, buf);
+   EXPECT_EQ(buf[0], 0xff010203U);
+   EXPECT_EQ(buf[W * 4 - 1], 0xff010203U);
+
+   imlib_free_image_and_decache();
+}
+
+// Rotating into a clone must leave the original alone
+TEST(CLONE, rotate_to_clone)
+{
+   Imlib_Image         imo, imc, ims;
+   DATA32              ref[W * W], buf[W * W];
+   DATA32             *data;
+   int                 i;
+
+   imo = imlib_create_image(W, W);
+   imlib_context_set_image(imo);
+   imlib_image_set_has_alpha(1);
+   data = imlib_image_get_data();
+   for (i = 0; i < W * W; i++)
+      data[i] = 0xff0000ff;
+   imlib_image_put_back_data(data);
+   get_pixels(imo, ref);
+
+   mk_image(0x07000000);
+   ims = imlib_create_cropped_image(0, 0, 4, 4);
+   imlib_free_image_and_decache();
+
+   imlib_context_set_image(imo);
+   imc = imlib_clone_image();
+   ASSERT_TRUE(imc);
+
+   imlib_context_set_image(imc);
+   imlib_context_set_anti_alias(1);
+   imlib_rotate_image_from_buffer(0.0, ims);
+   imlib_context_set_anti_alias(0);
+   imlib_rotate_image_from_buffer(0.0, ims);
+
+   get_pixels(imo, buf);
+   EXPECT_EQ(memcmp(ref, buf, sizeof(ref)), 0);
+
+   get_pixels(imc, buf);
+   EXPECT_NE(memcmp(ref, buf, sizeof(ref)), 0);
+
+   imlib_context_set_image(imc);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(ims);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(imo);
+   imlib_free_image_and_decache();
+}
+
+static long         mem_used;
+
+static void        *
+mem_func(void *data, size_t size)
+{
+   if (data)
+     {
+        mem_used -= size;
+        free(data);
+        return NULL;
+     }
+
+   mem_used += size;
+   return malloc(size);
+}
+
+// The parent's allocation must be released whole by a band of its top rows
+TEST(CLONE, free_crop_after_parent)
+{
+   Imlib_Image         imo, imc;
+   DATA32             *data;
+
+   mem_used = 0;
+   data = (DATA32 *) mem_func(NULL, W * H * sizeof(DATA32));
+   memset(data, 0x55, W * H * sizeof(DATA32));
+   imo = imlib_create_image_using_data_and_memory_function(W, H, data,
+                                                           mem_func);
+   ASSERT_TRUE(imo);
+
+   imlib_context_set_image(imo);
+   imlib_image_set_has_alpha(1);
+   imc = imlib_create_cropped_image(0, 0, W, 3);
+   ASSERT_TRUE(imc);
+   imlib_free_image_and_decache();
+
+   imlib_context_set_image(imc);
+   imlib_context_set_color(1, 2, 3, 255);
+   imlib_image_fill_rectangle(0, 0, W, 3);
+   imlib_free_image_and_decache();
+
+   EXPECT_EQ(mem_used, 0);
+}
+
+int
+main(int argc, char **argv)
+{
+   const char         *s;
+
+   ::testing::InitGoogleTest(&argc, argv);
+
+   for (argc--, argv++; argc > 0; argc--, argv++)
+     {
+        s = argv[0];
+        if (*s++ != '-')
+           break;
+        switch (*s)
+          {
+          case 'd':
+             debug++;
+             break;
+          }
+     }
+
+   return RUN_ALL_TESTS();
+}
@@ -0,0 +1,317 @@
+#include <gtest/gtest.h>
+
+#include <Imlib2.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "test_common.h"
+
+int                 debug = 0;
+
+#define D(...)  if (debug) printf(__VA_ARGS__)
+
+#define FILE_REF	"icon-64"       // RGB
+
+#define MARK	0x12345678      // Put into cached pixels to tell hits
+
+static char         dir[200];   // Per test scratch directory
+static char         cache[256]; // Disk cache directory in it
+static char         src[256];   // Copy of the source image in it
+
+static void
+_cp(const char *from, const char *to)
+{
+   char                buf[4096];
+   FILE               *fi, *fo;
+   size_t              n;
+
+   fi = fopen(from, "rb");
+   fo = fopen(to, "wb");
+   ASSERT_TRUE(fi);
+   ASSERT_TRUE(fo);
+   while ((n = fread(buf, 1, sizeof(buf), fi)) > 0)
+      fwrite(buf, 1, n, fo);
+   fclose(fi);
+   fclose(fo);
+}
+
+// Fresh scratch directory with a copy of the source, cache pointed into it
+static void
+_setup(const char *test)
+{
+   char                file[512];
+
+   mkdir(IMG_GEN, 0755);
+   snprintf(dir, sizeof(dir), "%s/dcache-%s", IMG_GEN, test);
+   snprintf(cache, sizeof(cache), "%s/cache", dir);
+   snprintf(src, sizeof(src), "%s/%s.png", dir, FILE_REF);
+
+   snprintf(file, sizeof(file), "rm -rf %s", dir);
+   ASSERT_EQ(system(file), 0);
+   mkdir(dir, 0755);
+   mkdir(cache, 0700);
+
+   snprintf(file, sizeof(file), "%s/%s.png", IMG_SRC, FILE_REF);
+   _cp(file, src);
+
+   imlib_set_disk_cache_path(cache);
+}
+
+// The one entry in the cache, "" if none
+static void
+_entry(char *buf, size_t len)
+{
+   DIR                *d;
+   struct dirent      *de;
+   int                 n;
+
+   buf[0] = '\0';
+   d = opendir(cache);
+   ASSERT_TRUE(d);
+   for (n = 0; (de = readdir(d));)
+     {
+        if (!strstr(de->d_name, ".imc"))
+           continue;
+        snprintf(buf, len, "%s/%s", cache, de->d_name);
+        n++;
+     }
+   closedir(d);
+   EXPECT_LE(n, 1);
+}
+
+// Load the source and return its first pixel
+static              DATA32
+_load(void)
+{
+   Imlib_Image         im;
+   DATA32              pix;
+
+   im = imlib_load_image_immediately(src);
+   EXPECT_TRUE(im);
+   if (!im)
+      return 0;
+   imlib_context_set_image(im);
+   EXPECT_EQ(imlib_image_get_width(), 64);
+   EXPECT_EQ(imlib_image_get_height(), 64);
+   pix = imlib_image_get_data_for_reading_only()[0];
+   imlib_free_image_and_decache();
+
+   return pix;
+}
+
+// Store an entry and mark its first pixel, so hits can be told from misses
+static void
+_store_and_mark(char *entry, size_t len)
+{
+   DATA32              pix = MARK;
+   struct stat         st;
+   int                 fd;
+
+   _load();
+   _entry(entry, len);
+   ASSERT_TRUE(entry[0]);
+
+   ASSERT_EQ(stat(entry, &st), 0);
+   fd = open(entry, O_WRONLY);
+   ASSERT_GE(fd, 0);
+   ASSERT_EQ(pwrite(fd, &pix, sizeof(pix), st.st_size - 64 * 64 * 4),
+             (ssize_t) sizeof(pix));
+   close(fd);
+}
+
+TEST(DCACHE, store_and_hit)
+{
+   char                entry[512];
+   DATA32              pix;
+
+   _setup("hit");
+
+   imlib_set_disk_cache_path(NULL);
+   pix = _load();
+   EXPECT_NE(pix, (DATA32) MARK);
+
+   imlib_set_disk_cache_path(cache);
+   _store_and_mark(entry, sizeof(entry));
+   EXPECT_EQ(_load(), (DATA32) MARK);
+   EXPECT_EQ(_load(), (DATA32) MARK);
+
+   // Without the cache it is decoded again
+   imlib_set_disk_cache_path(NULL);
+   EXPECT_EQ(_load(), pix);
+   imlib_set_disk_cache_path(cache);
+}
+
+TEST(DCACHE, miss_source_mtime)
+{
+   char                entry[512];
+   struct timespec     ts[2];
+   DATA32              pix;
+
+   _setup("mtime");
+   _store_and_mark(entry, sizeof(entry));
+   ASSERT_EQ(_load(), (DATA32) MARK);
+
+   // Later than the change time, which counts too
+   ts[0].tv_sec = ts[1].tv_sec = time(NULL) + 100;
+   ts[0].tv_nsec = ts[1].tv_nsec = 0;
+   ASSERT_EQ(utimensat(AT_FDCWD, src, ts, 0), 0);
+   pix = _load();
+   EXPECT_NE(pix, (DATA32) MARK);
+
+   // And the entry was overwritten with the new source
+   _entry(entry, sizeof(entry));
+   EXPECT_TRUE(entry[0]);
+   EXPECT_EQ(_load(), pix);
+}
+
+TEST(DCACHE, miss_source_size)
+{
+   char                entry[512];
+   struct stat         st;
+   struct timespec     ts[2];
+   FILE               *f;
+
+   _setup("size");
+   _store_and_mark(entry, sizeof(entry));
+   ASSERT_EQ(_load(), (DATA32) MARK);
+
+   // Grow the file keeping its mtime, trailing junk is ignored by the loader
+   ASSERT_EQ(stat(src, &st), 0);
+   f = fopen(src, "ab");
+   ASSERT_TRUE(f);
+   fputc(0, f);
+   fclose(f);
+   ts[0] = st.st_atim;
+   ts[1] = st.st_mtim;
+   ASSERT_EQ(utimensat(AT_FDCWD, src, ts, 0), 0);
+
+   EXPECT_NE(_load(), (DATA32) MARK);
+}
+
+TEST(DCACHE, reject_truncated)
+{
+   char                entry[512];
+   struct stat         st;
+
+   _setup("trunc");
+
+   _store_and_mark(entry, sizeof(entry));
+   ASSERT_EQ(stat(entry, &st), 0);
+   ASSERT_EQ(truncate(entry, st.st_size - 4), 0);
+   EXPECT_NE(_load(), (DATA32) MARK);
+
+   _store_and_mark(entry, sizeof(entry));
+   ASSERT_EQ(truncate(entry, 20), 0);
+   EXPECT_NE(_load(), (DATA32) MARK);
+
+   _store_and_mark(entry, sizeof(entry));
+   ASSERT_EQ(truncate(entry, 0), 0);
+   EXPECT_NE(_load(), (DATA32) MARK);
+}
+
+TEST(DCACHE, reject_corrupt)
+{
+   static const char   junk[8] = "junkjun";
+   char                entry[512];
+   unsigned int        off;
+   DATA32              big = 0x7fffffff;
+   int                 fd;
+
+   _setup("corrupt");
+
+   // Magic, width
+   for (off = 0; off <= 12; off += 12)
+     {
+        _store_and_mark(entry, sizeof(entry));
+        ASSERT_EQ(_load(), (DATA32) MARK);
+        fd = open(entry, O_WRONLY);
+        ASSERT_GE(fd, 0);
+        if (off == 0)
+           ASSERT_EQ(pwrite(fd, junk, 8, off), 8);
+        else
+           ASSERT_EQ(pwrite(fd, &big, 4, off), 4);
+        close(fd);
+        EXPECT_NE(_load(), (DATA32) MARK) << "off=" << off;
+     }
+}
+
+// An entry from a loader we don't have is not used
+TEST(DCACHE, reject_loader)
+{
+   char                entry[512], buf[1024], *p;
+   ssize_t             n;
+   int                 fd;
+
+   _setup("loader");
+   _store_and_mark(entry, sizeof(entry));
+   ASSERT_EQ(_load(), (DATA32) MARK);
+
+   // Format and loader follow the identity
+   fd = open(entry, O_RDWR);
+   ASSERT_GE(fd, 0);
+   n = pread(fd, buf, sizeof(buf), 0);
+   ASSERT_GT(n, 0);
+   p = (char *)memmem(buf, n, "png\0png\0", 8);
+   ASSERT_TRUE(p);
+   ASSERT_EQ(pwrite(fd, "xyz", 3, p + 4 - buf), 3);
+   close(fd);
+
+   EXPECT_NE(_load(), (DATA32) MARK);
+}
+
+TEST(DCACHE, trim_tmp)
+{
+   char                file_old[512], file_new[512];
+   struct timespec     ts[2];
+   FILE               *f;
+
+   _setup("tmp");
+
+   snprintf(file_old, sizeof(file_old), "%s/.tmp-old", cache);
+   snprintf(file_new, sizeof(file_new), "%s/.tmp-new", cache);
+   f = fopen(file_old, "wb");
+   ASSERT_TRUE(f);
+   fclose(f);
+   f = fopen(file_new, "wb");
+   ASSERT_TRUE(f);
+   fclose(f);
+   ts[0].tv_sec = ts[1].tv_sec = time(NULL) - 2 * 3600;
+   ts[0].tv_nsec = ts[1].tv_nsec = 0;
+   ASSERT_EQ(utimensat(AT_FDCWD, file_old, ts, 0), 0);
+
+   // The first store after setting the path trims
+   _load();
+
+   EXPECT_NE(access(file_old, F_OK), 0);
+   EXPECT_EQ(access(file_new, F_OK), 0);
+}
+
+int
+main(int argc, char **argv)
+{
+   const char         *s;
+   int                 rc;
+
+   ::testing::InitGoogleTest(&argc, argv);
+
+   for (argc--, argv++; argc > 0; argc--, argv++)
+     {
+        s = argv[0];
+        if (*s++ != '-')
+           break;
+        switch (*s)
+          {
+          case 'd':
+             debug++;
+             break;
+          }
+     }
+
+   rc = RUN_ALL_TESTS();
+
+   imlib_set_disk_cache_path(NULL);
+
+   return rc;
+}
@@ -0,0 +1,345 @@
+#include <gtest/gtest.h>
+
+#include <Imlib2.h>
+#include <zlib.h>
+
+#include "config.h"
+
+int                 debug = 0;
+
+#define D(...)  if (debug) printf(__VA_ARGS__)
+
+#define W	64
+#define H	48
+
+#define COLOR	0xff2060a0
+
+typedef struct {
+   const char         *name;
+   int                 npts;
+   int                 pts[10][2];
+   unsigned int        crcs[2];        /* Aliased, anti-aliased */
+} tdp_t;
+
+/**INDENT-OFF**/
+static const tdp_t  tdp[] = {
+   { "rect",     4, {{ 2, 2}, {12, 2}, {12, 8}, { 2, 8}},
+                    { 1258371656, 1258371656 }},
+   { "triangle", 3, {{ 5, 3}, {58, 17}, {20, 44}},
+                    {  146582606, 2281989092 }},
+   { "concave",  6, {{ 4, 4}, {60, 4}, {60, 44}, {40, 44}, {40, 20}, { 4, 30}},
+                    { 4027729998, 2071276037 }},
+   { "bowtie",   4, {{ 3, 3}, {60, 44}, {60, 3}, { 3, 44}},
+                    { 1770076680, 2234897108 }},
+   { "star",     5, {{32, 2}, {45, 45}, { 3, 17}, {61, 17}, {19, 45}},
+                    { 2847403962,  435632458 }},
+};
+/**INDENT-ON**/
+
+static              Imlib_Image
+mk_image(void)
+{
+   Imlib_Image         im;
+
+   im = imlib_create_image(W, H);
+   imlib_context_set_image(im);
+   imlib_image_set_has_alpha(1);
+   imlib_image_clear();
+
+   return im;
+}
+
+static              ImlibPolygon
+mk_poly(const tdp_t * ptd)
+{
+   ImlibPolygon        poly;
+   int                 i;
+
+   poly = imlib_polygon_new();
+   for (i = 0; i < ptd->npts; i++)
+      imlib_polygon_add_point(poly, ptd->pts[i][0], ptd->pts[i][1]);
+
+   return poly;
+}
+
+static unsigned int
+image_crc(void)
+{
+   const DATA32       *data;
+
+   data = imlib_image_get_data_for_reading_only();
+
+   return crc32(0, (const unsigned char *)data, W * H * sizeof(DATA32));
+}
+
+static void
+test_fill_crc(int aa)
+{
+   const tdp_t        *ptd;
+   ImlibPolygon        poly;
+   unsigned int        i, crc;
+
+   imlib_context_set_anti_alias(aa);
+   imlib_context_set_blend(1);
+   imlib_context_set_color(0x20, 0x60, 0xa0, 0xff);
+
+   for (i = 0; i < sizeof(tdp) / sizeof(tdp[0]); i++)
+     {
+        ptd = &tdp[i];
+        mk_image();
+        poly = mk_poly(ptd);
+        imlib_image_fill_polygon(poly);
+        crc = image_crc();
+        D("%s aa=%d: %u\n", ptd->name, aa, crc);
+        EXPECT_EQ(crc, ptd->crcs[aa]) << ptd->name << " aa=" << aa;
+        imlib_polygon_free(poly);
+        imlib_free_image_and_decache();
+     }
+}
+
+TEST(DRAW, fill_polygon_crc)
+{
+   test_fill_crc(0);
+}
+
+TEST(DRAW, fill_polygon_aa_crc)
+{
+   test_fill_crc(1);
+}
+
+// Integer rectangles cover their outline pixels, anti-aliased or not
+static void
+test_fill_rect(int aa)
+{
+   ImlibPolygon        poly;
+   const DATA32       *data;
+   int                 x, y;
+   DATA32              exp;
+
+   imlib_context_set_anti_alias(aa);
+   imlib_context_set_blend(1);
+   imlib_context_set_color(0x20, 0x60, 0xa0, 0xff);
+
+   mk_image();
+   poly = mk_poly(&tdp[0]);
+   imlib_image_fill_polygon(poly);
+   data = imlib_image_get_data_for_reading_only();
+
+   for (y = 0; y < H; y++)
+      for (x = 0; x < W; x++)
+        {
+           exp = x >= 2 && x <= 12 && y >= 2 && y <= 8 ? COLOR : 0;
+           EXPECT_EQ(data[y * W + x], exp) << "aa=" << aa << " at "
+              << x << "," << y;
+        }
+
+   imlib_polygon_free(poly);
+   imlib_free_image_and_decache();
+}
+
+TEST(DRAW, fill_polygon_rect)
+{
+   test_fill_rect(0);
+   test_fill_rect(1);
+}
+
+// Points well inside/outside are the same with and without anti-aliasing
+TEST(DRAW, fill_polygon_probe)
+{
+   /**INDENT-OFF**/
+   static const struct {
+      int                 poly, x, y;
+      DATA32              color;
+   } probes[] = {
+      { 1, 25, 20, COLOR }, { 1,  2, 40, 0 }, { 1, 60, 40, 0 },
+      { 2, 10, 10, COLOR }, { 2, 50, 30, COLOR }, { 2, 20, 40, 0 },
+      { 2, 32, 38, 0 },
+      { 3, 10, 23, COLOR }, { 3, 53, 23, COLOR }, { 3, 31, 10, 0 },
+      { 3, 31, 37, 0 },
+      { 4, 32, 10, COLOR }, { 4, 10, 18, COLOR }, { 4, 32, 28, 0 },
+      { 4, 32, 44, 0 },
+   };
+   /**INDENT-ON**/
+   ImlibPolygon        poly;
+   const DATA32       *data;
+   unsigned int        i;
+   int                 aa;
+
+   imlib_context_set_blend(1);
+   imlib_context_set_color(0x20, 0x60, 0xa0, 0xff);
+
+   for (aa = 0; aa < 2; aa++)
+     {
+        imlib_context_set_anti_alias(aa);
+        for (i = 0; i < sizeof(probes) / sizeof(probes[0]); i++)
+          {
+             mk_image();
+             poly = mk_poly(&tdp[probes[i].poly]);
+             imlib_image_fill_polygon(poly);
+             data = imlib_image_get_data_for_reading_only();
+             EXPECT_EQ(data[probes[i].y * W + probes[i].x], probes[i].color)
+                << tdp[probes[i].poly].name << " aa=" << aa << " at "
+                << probes[i].x << "," << probes[i].y;
+             imlib_polygon_free(poly);
+             imlib_free_image_and_decache();
+          }
+     }
+}
+
+// Draw lists
+
+#define DLW	4096            // Wide, so the list is drawn in many bands
+#define DLH	160
+#define DLN	5000            // Enough for the threaded path
+
+static              Imlib_Image
+mk_image_dl(void)
+{
+   Imlib_Image         im;
+
+   im = imlib_create_image(DLW, DLH);
+   imlib_context_set_image(im);
+   imlib_image_set_has_alpha(1);
+   imlib_image_clear();
+
+   return im;
+}
+
+// Random items around the band edges, drawn one by one (dl == NULL) or
+// added to dl
+static void
+dl_items(Imlib_Draw_List dl)
+{
+   int                 i, type, x, y, a, b;
+
+   srand(7);
+   for (i = 0; i < DLN; i++)
+     {
+        type = rand() % 6;
+        x = rand() % 300 - 10;
+        y = rand() % (DLH + 20) - 10;
+        a = rand() % 40 - (type == 1 ? 20 : 0);
+        b = rand() % 30 - (type == 1 ? 15 : 0);
+        switch (type)
+          {
+          case 0:
+             if (dl)
+                imlib_draw_list_add_pixel(dl, x, y);
+             else
+                imlib_image_draw_pixel(x, y, 0);
+             break;
+          case 1:
+             if (dl)
+                imlib_draw_list_add_line(dl, x, y, x + a, y + b);
+             else
+                imlib_image_draw_line(x, y, x + a, y + b, 0);
+             break;
+          case 2:
+             if (dl)
+                imlib_draw_list_add_rectangle(dl, x, y, a, b);
+             else
+                imlib_image_draw_rectangle(x, y, a, b);
+             break;
+          case 3:
+             if (dl)
+                imlib_draw_list_add_filled_rectangle(dl, x, y, a, b);
+             else
+                imlib_image_fill_rectangle(x, y, a, b);
+             break;
+          case 4:
+             if (dl)
+                imlib_draw_list_add_ellipse(dl, x, y, a, b);
+             else
+                imlib_image_draw_ellipse(x, y, a, b);
+             break;
+          case 5:
+             if (dl)
+                imlib_draw_list_add_filled_ellipse(dl, x, y, a, b);
+             else
+                imlib_image_fill_ellipse(x, y, a, b);
+             break;
+          }
+     }
+}
+
+// A draw list gives exactly what drawing the items one by one does
+static void
+test_draw_list(int aa, int blend, int clip)
+{
+   Imlib_Image         im_dl, im_ref;
+   Imlib_Draw_List     dl;
+   const DATA32       *pdl, *pref;
+   int                 i, nbad;
+
+   imlib_context_set_anti_alias(aa);
+   imlib_context_set_blend(blend);
+   imlib_context_set_color(0x20, 0x60, 0xa0, blend ? 0x90 : 0xff);
+   if (clip)
+      imlib_context_set_cliprect(5, 3, DLW - 20, DLH - 11);
+
+   im_ref = mk_image_dl();
+   dl_items(NULL);
+
+   im_dl = mk_image_dl();
+   dl = imlib_draw_list_new();
+   dl_items(dl);
+   imlib_image_draw_list(dl);
+   imlib_draw_list_free(dl);
+
+   imlib_context_set_cliprect(0, 0, 0, 0);
+
+   imlib_context_set_image(im_ref);
+   pref = imlib_image_get_data_for_reading_only();
+   imlib_context_set_image(im_dl);
+   pdl = imlib_image_get_data_for_reading_only();
+
+   nbad = 0;
+   for (i = 0; i < DLW * DLH; i++)
+     {
+        if (pdl[i] == pref[i])
+           continue;
+        if (nbad++ < 8)
+           ADD_FAILURE() << "aa=" << aa << " blend=" << blend << " clip="
+              << clip << " at " << i % DLW << "," << i / DLW << ": "
+              << std::hex << pdl[i] << " != " << pref[i];
+     }
+   D("aa=%d blend=%d clip=%d: %d bad\n", aa, blend, clip, nbad);
+   EXPECT_EQ(nbad, 0);
+
+   imlib_free_image_and_decache();
+   imlib_context_set_image(im_ref);
+   imlib_free_image_and_decache();
+}
+
+TEST(DRAW, draw_list)
+{
+   int                 aa, blend, clip;
+
+   for (aa = 0; aa < 2; aa++)
+      for (blend = 0; blend < 2; blend++)
+         for (clip = 0; clip < 2; clip++)
+            test_draw_list(aa, blend, clip);
+}
+
+int
+main(int argc, char **argv)
+{
+   const char         *s;
+
+   ::testing::InitGoogleTest(&argc, argv);
+
+   for (argc--, argv++; argc > 0; argc--, argv++)
+     {
+        s = argv[0];
+        if (*s++ != '-')
+           break;
+        switch (*s)
+          {
+          case 'd':
+             debug++;
+             break;
+          }
+     }
+
+   return RUN_ALL_TESTS();
+}
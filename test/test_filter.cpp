@@ -0,0 +1,198 @@
+#include <gtest/gtest.h>
+
+#include <Imlib2.h>
+#include <zlib.h>
+
+#include "config.h"
+
+int                 debug = 0;
+
+#define D(...)  if (debug) printf(__VA_ARGS__)
+
+#define W	64
+#define H	48
+
+/**INDENT-OFF**/
+static const char  *const scripts[] = {
+   "colormod(brightness=0.1);",
+   "colormod(contrast=1.5,gamma_g=0.7);",
+   "colormod(tint_r=0.8,x=5,y=3,w=40,h=30);",
+   "colormod(brightness=-0.1);colormod(contrast=1.3);colormod(gamma=0.8);",
+   "colormod(brightness=0.2);tint(red=20,green=200,blue=90,alpha=100,"
+      "x=10,y=10,w=30,h=20);colormod(contrast=0.7);",
+   "colormod(gamma_a=1.4,x=2,y=2,w=50,h=40);colormod(tint=0.9);",
+   "bump_map_point(x=20,y=10,z=30,depth=2);colormod(brightness=0.1);",
+};
+/**INDENT-ON**/
+
+// An image with alpha and random pixels
+static              Imlib_Image
+mk_image(void)
+{
+   Imlib_Image         im;
+   DATA32             *data;
+   int                 i;
+
+   srand(1);
+   im = imlib_create_image(W, H);
+   imlib_context_set_image(im);
+   imlib_image_set_has_alpha(1);
+   data = imlib_image_get_data();
+   for (i = 0; i < W * H; i++)
+      data[i] = (DATA32) rand() ^ ((DATA32) rand() << 16);
+   imlib_image_put_back_data(data);
+
+   return im;
+}
+
+static unsigned int
+image_crc(void)
+{
+   const DATA32       *data;
+
+   data = imlib_image_get_data_for_reading_only();
+
+   return crc32(0, (const unsigned char *)data, W * H * sizeof(DATA32));
+}
+
+// A compiled script does what imlib_apply_filter() does with the string,
+// and can be applied more than once
+TEST(FILTER, compiled_vs_apply)
+{
+   Imlib_Filter_Script script;
+   unsigned int        i, crc_org, crc_ref, crc;
+   int                 n;
+
+   mk_image();
+   crc_org = image_crc();
+   imlib_free_image_and_decache();
+
+   for (i = 0; i < sizeof(scripts) / sizeof(scripts[0]); i++)
+     {
+        mk_image();
+        imlib_apply_filter(scripts[i]);
+        crc_ref = image_crc();
+        imlib_free_image_and_decache();
+        // The filters must have been found
+        EXPECT_NE(crc_ref, crc_org) << scripts[i];
+
+        script = imlib_compile_filter_script(scripts[i]);
+        ASSERT_TRUE(script) << scripts[i];
+
+        for (n = 0; n < 2; n++)
+          {
+             mk_image();
+             imlib_apply_filter_script(script);
+             crc = image_crc();
+             D("%u: %u %u\n", i, crc_ref, crc);
+             EXPECT_EQ(crc, crc_ref) << scripts[i] << " run " << n;
+             imlib_free_image_and_decache();
+          }
+
+        imlib_free_filter_script(script);
+     }
+}
+
+// Pointer variables are read each time the script is applied
+TEST(FILTER, compiled_ptr)
+{
+   Imlib_Filter_Script script;
+   char                str[64];
+   unsigned int        crc_ref, crc;
+   double              v;
+
+   script = imlib_compile_filter_script("colormod(brightness=[]);", &v);
+   ASSERT_TRUE(script);
+
+   for (v = -0.2; v < 0.3; v += 0.1)
+     {
+        snprintf(str, sizeof(str), "colormod(brightness=%.17g);", v);
+        mk_image();
+        imlib_apply_filter(str);
+        crc_ref = image_crc();
+        imlib_free_image_and_decache();
+
+        mk_image();
+        imlib_apply_filter_script(script);
+        crc = image_crc();
+        imlib_free_image_and_decache();
+
+        EXPECT_EQ(crc, crc_ref) << "v=" << v;
+     }
+
+   imlib_free_filter_script(script);
+}
+
+// Consecutive colormod steps are fused into one pass, this must give what
+// applying them one at a time does
+TEST(FILTER, cmod_fusion)
+{
+   /**INDENT-OFF**/
+   static const char  *const steps[] = {
+      "colormod(brightness=0.15,gamma_a=0.8);",
+      "colormod(contrast=1.7);",
+      "colormod(gamma=1.3,tint_b=0.6);",
+      "colormod(brightness_r=-0.2,x=3,y=5,w=33,h=21);",
+      "colormod(contrast_a=1.2,x=3,y=5,w=33,h=21);",
+      "colormod(tint=1.1);",
+   };
+   /**INDENT-ON**/
+   Imlib_Filter_Script script;
+   char                str[1024];
+   const DATA32       *pref, *pout;
+   Imlib_Image         im_ref, im_out;
+   unsigned int        i;
+
+   str[0] = '\0';
+   im_ref = mk_image();
+   for (i = 0; i < sizeof(steps) / sizeof(steps[0]); i++)
+     {
+        imlib_apply_filter(steps[i]);
+        strcat(str, steps[i]);
+     }
+   pref = imlib_image_get_data_for_reading_only();
+
+   script = imlib_compile_filter_script(str);
+   ASSERT_TRUE(script);
+   im_out = mk_image();
+   imlib_apply_filter_script(script);
+   pout = imlib_image_get_data_for_reading_only();
+   imlib_free_filter_script(script);
+
+   EXPECT_EQ(memcmp(pout, pref, W * H * sizeof(DATA32)), 0);
+   for (i = 0; i < W * H; i++)
+      if (pout[i] != pref[i])
+        {
+           ADD_FAILURE() << "at " << i % W << "," << i / W << ": "
+              << std::hex << pout[i] << " != " << pref[i];
+           break;
+        }
+
+   imlib_context_set_image(im_ref);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(im_out);
+   imlib_free_image_and_decache();
+}
+
+int
+main(int argc, char **argv)
+{
+   const char         *s;
+
+   ::testing::InitGoogleTest(&argc, argv);
+
+   for (argc--, argv++; argc > 0; argc--, argv++)
+     {
+        s = argv[0];
+        if (*s++ != '-')
+           break;
+        switch (*s)
+          {
+          case 'd':
+             debug++;
+             break;
+          }
+     }
+
+   return RUN_ALL_TESTS();
+}
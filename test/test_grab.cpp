@@ -324,6 +324,208 @@ TEST(GRAB, grab_offs_32_sd2)
    _test_grab("grab_offs_32_sd2", 32, -2, 1);
 }
 
+// Capture sessions
+
+#define CW	64              // Window size
+#define CH	48
+#define CX	4               // Session area in window
+#define CY	6
+#define CSW	40
+#define CSH	30
+
+#define COL_BG	0x204060
+#define COL_FG	0xc08040
+
+static              Window
+_win_mk(int w, int h, unsigned int bg)
+{
+   XSetWindowAttributes attr;
+   Window              win;
+
+   attr.override_redirect = True;
+   attr.background_pixel = bg;
+   win = XCreateWindow(xd.dpy, xd.root, 10, 10, w, h, 0, CopyFromParent,
+                       InputOutput, CopyFromParent,
+                       CWOverrideRedirect | CWBackPixel, &attr);
+   XMapWindow(xd.dpy, win);
+   XSync(xd.dpy, False);
+
+   return win;
+}
+
+static void
+_win_fill(Window win, int x, int y, int w, int h, unsigned int color)
+{
+   XGCValues           gcv;
+   GC                  gc;
+
+   gcv.foreground = color;
+   gcv.graphics_exposures = False;
+   gc = XCreateGC(xd.dpy, win, GCForeground | GCGraphicsExposures, &gcv);
+   XFillRectangle(xd.dpy, win, gc, x, y, w, h);
+   XFreeGC(xd.dpy, gc);
+   XSync(xd.dpy, False);
+}
+
+static int
+_cap_has_damage(void)
+{
+#ifdef HAVE_X11_XDAMAGE
+   int                 op, ev, er;
+
+   return !getenv("IMLIB2_XDAMAGE_OFF") &&
+      XQueryExtension(xd.dpy, "DAMAGE", &op, &ev, &er);
+#else
+   return 0;
+#endif
+}
+
+// Check that the updates lie in the session area and cover the (session
+// coordinates) rectangle x,y,w,h, and free them
+static void
+_cap_check_updates(Imlib_Updates u, int x, int y, int w, int h)
+{
+   Imlib_Updates       uu;
+   int                 ux, uy, uw, uh;
+   int                 i, j, ncov, covered;
+
+   for (uu = u; uu; uu = imlib_updates_get_next(uu))
+     {
+        imlib_updates_get_coordinates(uu, &ux, &uy, &uw, &uh);
+        D("%s: %d,%d %dx%d\n", __func__, ux, uy, uw, uh);
+        EXPECT_TRUE(ux >= 0 && uy >= 0 && uw > 0 && uh > 0 &&
+                    ux + uw <= CSW && uy + uh <= CSH)
+           << ux << "," << uy << " " << uw << "x" << uh;
+     }
+
+   ncov = 0;
+   for (j = y; j < y + h; j++)
+      for (i = x; i < x + w; i++)
+        {
+           covered = 0;
+           for (uu = u; uu && !covered; uu = imlib_updates_get_next(uu))
+             {
+                imlib_updates_get_coordinates(uu, &ux, &uy, &uw, &uh);
+                covered = i >= ux && i < ux + uw && j >= uy && j < uy + uh;
+             }
+           ncov += covered;
+        }
+   EXPECT_EQ(ncov, w * h) << "updates don't cover " << x << "," << y
+      << " " << w << "x" << h;
+
+   imlib_updates_free(u);
+}
+
+// Check the session image against the window contents, which are COL_BG
+// except for x,y,w,h (window coordinates) in COL_FG
+static void
+_cap_check_image(Imlib_Capture cap, int x, int y, int w, int h)
+{
+   const DATA32       *data;
+   DATA32              exp;
+   int                 i, j, nbad;
+
+   imlib_context_set_image(imlib_capture_get_image(cap));
+   ASSERT_EQ(imlib_image_get_width(), CSW);
+   ASSERT_EQ(imlib_image_get_height(), CSH);
+   data = imlib_image_get_data_for_reading_only();
+
+   nbad = 0;
+   for (j = 0; j < CSH; j++)
+      for (i = 0; i < CSW; i++)
+        {
+           exp = i + CX >= x && i + CX < x + w && j + CY >= y && j + CY < y + h ?
+              COL_FG : COL_BG;
+           if ((data[j * CSW + i] & 0xffffff) != exp && nbad++ < 8)
+              ADD_FAILURE() << "at " << i << "," << j << ": " << std::hex
+                 << data[j * CSW + i] << " != " << exp;
+        }
+   EXPECT_EQ(nbad, 0);
+}
+
+TEST(GRAB, capture_update)
+{
+   Imlib_Capture       cap;
+   Imlib_Updates       u;
+   Window              win;
+   int                 damage;
+
+   _x11_init(24);
+   damage = _cap_has_damage();
+   D("%s: damage=%d\n", __func__, damage);
+
+   win = _win_mk(CW, CH, COL_BG);
+   imlib_context_set_drawable(win);
+
+   cap = imlib_capture_new(CX, CY, CSW, CSH);
+   ASSERT_TRUE(cap);
+
+   // The first update fetches everything
+   u = imlib_capture_update(cap, 0);
+   ASSERT_TRUE(u);
+   _cap_check_updates(u, 0, 0, CSW, CSH);
+   _cap_check_image(cap, 0, 0, 0, 0);
+
+   // Nothing changed
+   u = imlib_capture_update(cap, 0);
+   if (damage)
+      EXPECT_FALSE(u);
+   else
+      _cap_check_updates(u, 0, 0, CSW, CSH);
+
+   // A change inside the area, reported in session coordinates
+   _win_fill(win, 10, 12, 5, 3, COL_FG);
+   u = imlib_capture_update(cap, 0);
+   ASSERT_TRUE(u);
+   _cap_check_updates(u, 10 - CX, 12 - CY, 5, 3);
+   _cap_check_image(cap, 10, 12, 5, 3);
+
+   // A change outside the area is not
+   _win_fill(win, CX + CSW + 2, CY + CSH + 2, 4, 4, COL_BG);
+   u = imlib_capture_update(cap, 0);
+   if (damage)
+      EXPECT_FALSE(u);
+   else
+      imlib_updates_free(u);
+   _cap_check_image(cap, 10, 12, 5, 3);
+
+   // Unmapped with damage pending, the grab fails
+   _win_fill(win, 10, 12, 5, 3, COL_BG);
+   XUnmapWindow(xd.dpy, win);
+   XSync(xd.dpy, False);
+   u = imlib_capture_update(cap, 0);
+   EXPECT_FALSE(u);
+
+   // and the next one fetches everything again (the window was repainted)
+   XMapWindow(xd.dpy, win);
+   XSync(xd.dpy, False);
+   u = imlib_capture_update(cap, 0);
+   ASSERT_TRUE(u);
+   _cap_check_updates(u, 0, 0, CSW, CSH);
+   _cap_check_image(cap, 0, 0, 0, 0);
+
+   // Shrunk below the area with damage pending, the grab fails
+   _win_fill(win, 10, 12, 5, 3, COL_FG);
+   XResizeWindow(xd.dpy, win, CX + 2, CY + 2);
+   XSync(xd.dpy, False);
+   u = imlib_capture_update(cap, 0);
+   EXPECT_FALSE(u);
+
+   // and after growing back everything is fetched again
+   XResizeWindow(xd.dpy, win, CW, CH);
+   XSync(xd.dpy, False);
+   _win_fill(win, 0, 0, CW, CH, COL_BG);
+   u = imlib_capture_update(cap, 0);
+   ASSERT_TRUE(u);
+   _cap_check_updates(u, 0, 0, CSW, CSH);
+   _cap_check_image(cap, 0, 0, 0, 0);
+
+   imlib_capture_free(cap);
+   XDestroyWindow(xd.dpy, win);
+
+   _x11_fini();
+}
+
 int
 main(int argc, char **argv)
 {
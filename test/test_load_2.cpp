@@ -2,6 +2,7 @@
 
 #include <Imlib2.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <zlib.h>
 
 #include "config.h"
@@ -87,6 +88,163 @@ TEST(LOAD2, load_1)
      }
 }
 
+/**INDENT-OFF**/
+static const struct {
+   int                 rw, rh;  // Requested size
+   int                 w, h;    // Size of the expected entry
+} tis[] = {
+   {  0,  0, 48, 48 },          // Largest, the PNG entry
+   { 16, 16, 16, 16 },          // Exact
+   { 20, 20, 24, 24 },          // Smallest covering
+   { 16, 30, 32, 32 },
+   { 40,  0, 48, 48 },
+   { 64, 64, 48, 48 },          // None covers, largest
+};
+/**INDENT-ON**/
+#define NT_SIZES (sizeof(tis) / sizeof(tis[0]))
+
+// Entries are 32, 48 (PNG), 16 and 24 pixels, in that order
+#define FILE_ICO	"icon-multi.ico"
+
+TEST(LOAD2, load_at_size_ico)
+{
+   char                buf[256];
+   Imlib_Image         im[NT_SIZES], im2;
+   unsigned int        i, j;
+
+   snprintf(buf, sizeof(buf), "%s/%s", IMG_SRC, FILE_ICO);
+
+   // Keep them all, requests for different sizes must not hit each other
+   for (i = 0; i < NT_SIZES; i++)
+     {
+        D("Load '%s' at %dx%d\n", buf, tis[i].rw, tis[i].rh);
+        im[i] = imlib_load_image_at_size(buf, tis[i].rw, tis[i].rh);
+        ASSERT_TRUE(im[i]);
+        imlib_context_set_image(im[i]);
+        EXPECT_EQ(imlib_image_get_width(), tis[i].w) << "i=" << i;
+        EXPECT_EQ(imlib_image_get_height(), tis[i].h) << "i=" << i;
+        EXPECT_TRUE(imlib_image_has_alpha());
+        for (j = 0; j < i; j++)
+           EXPECT_NE(im[i], im[j]) << "i=" << i << " j=" << j;
+     }
+
+   // Same size again is a cache hit
+   im2 = imlib_load_image_at_size(buf, tis[2].rw, tis[2].rh);
+   EXPECT_EQ(im2, im[2]);
+   imlib_context_set_image(im2);
+   imlib_free_image();
+
+   for (i = 0; i < NT_SIZES; i++)
+     {
+        imlib_context_set_image(im[i]);
+        imlib_free_image_and_decache();
+     }
+
+   EXPECT_FALSE(imlib_load_image_at_size(buf, -1, 16));
+}
+
+// A bad PNG entry is passed over for the next best, like bad BMP ones
+TEST(LOAD2, load_at_size_ico_bad_png)
+{
+   char                fsrc[256], fdst[256], *p;
+   FILE               *f;
+   char                data[16384];
+   size_t              len;
+   Imlib_Image         im;
+
+   snprintf(fsrc, sizeof(fsrc), "%s/%s", IMG_SRC, FILE_ICO);
+   snprintf(fdst, sizeof(fdst), "%s/%s", IMG_GEN, "icon-multi-bad-png.ico");
+
+   f = fopen(fsrc, "rb");
+   ASSERT_TRUE(f);
+   len = fread(data, 1, sizeof(data), f);
+   fclose(f);
+   ASSERT_LT(len, sizeof(data));
+
+   // Zero the PNG width
+   p = (char *)memmem(data, len, "IHDR", 4);
+   ASSERT_TRUE(p);
+   memset(p + 4, 0, 4);
+
+   mkdir(IMG_GEN, 0755);
+   f = fopen(fdst, "wb");
+   ASSERT_TRUE(f);
+   fwrite(data, 1, len, f);
+   fclose(f);
+
+   im = imlib_load_image_at_size(fdst, 0, 0);
+   ASSERT_TRUE(im);
+   imlib_context_set_image(im);
+   EXPECT_EQ(imlib_image_get_width(), 32);
+   EXPECT_EQ(imlib_image_get_height(), 32);
+   imlib_free_image_and_decache();
+
+   im = imlib_load_image_at_size(fdst, 20, 20);
+   ASSERT_TRUE(im);
+   imlib_context_set_image(im);
+   EXPECT_EQ(imlib_image_get_width(), 24);
+   imlib_free_image_and_decache();
+}
+
+#ifdef BUILD_SVG_LOADER
+/**INDENT-OFF**/
+static const struct {
+   int                 rw, rh;  // Requested size
+   int                 w, h;    // Fitted size
+} tsv[] = {
+   {   0,   0,  80,  40 },      // Natural size
+   {  40,  40,  40,  20 },      // Width limits
+   { 200,  60, 120,  60 },      // Height limits
+   { 160,   0, 160,  80 },      // Height unconstrained
+   {   0,  20,  40,  20 },      // Width unconstrained
+   {   1,   1,   1,   1 },      // Never less than a pixel
+};
+/**INDENT-ON**/
+
+// SVGs are rendered at the largest size fitting the requested one
+TEST(LOAD2, load_at_size_svg)
+{
+   static const char   svg[] =
+      "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"80px\" "
+      "height=\"40px\" viewBox=\"0 0 80 40\">"
+      "<rect x=\"0\" y=\"0\" width=\"80\" height=\"40\" fill=\"red\"/>"
+      "</svg>\n";
+   char                buf[256];
+   Imlib_Image         im;
+   unsigned int        i;
+   FILE               *f;
+
+   mkdir(IMG_GEN, 0755);
+   snprintf(buf, sizeof(buf), "%s/%s", IMG_GEN, "rect-80x40.svg");
+   f = fopen(buf, "wb");
+   ASSERT_TRUE(f);
+   fputs(svg, f);
+   fclose(f);
+
+   for (i = 0; i < sizeof(tsv) / sizeof(tsv[0]); i++)
+     {
+        D("Load '%s' at %dx%d\n", buf, tsv[i].rw, tsv[i].rh);
+        im = imlib_load_image_at_size(buf, tsv[i].rw, tsv[i].rh);
+        ASSERT_TRUE(im) << "i=" << i;
+        imlib_context_set_image(im);
+        EXPECT_EQ(imlib_image_get_width(), tsv[i].w) << "i=" << i;
+        EXPECT_EQ(imlib_image_get_height(), tsv[i].h) << "i=" << i;
+        // The rect covers the whole canvas
+        EXPECT_EQ(imlib_image_get_data_for_reading_only()
+                  [tsv[i].w * tsv[i].h - 1], 0xffff0000U) << "i=" << i;
+        imlib_free_image_and_decache();
+     }
+
+   snprintf(buf, sizeof(buf), "%s/%s", IMG_SRC, "icon-64.svg");
+   im = imlib_load_image_at_size(buf, 16, 0);
+   ASSERT_TRUE(im);
+   imlib_context_set_image(im);
+   EXPECT_EQ(imlib_image_get_width(), 16);
+   EXPECT_EQ(imlib_image_get_height(), 16);
+   imlib_free_image_and_decache();
+}
+#endif
+
 int
 main(int argc, char **argv)
 {
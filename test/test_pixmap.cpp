@@ -0,0 +1,281 @@
+#include <gtest/gtest.h>
+
+#include <X11/Xlib.h>
+#include <Imlib2.h>
+
+#include "config.h"
+
+// The pixmap cache: lookups, dropping dirty entries and LRU eviction.
+// Needs an X server (e.g. Xvfb).
+
+int                 debug = 0;
+
+#define D(...)  if (debug) printf(__VA_ARGS__)
+
+#define W	32
+#define H	24
+
+#define CACHE_BIG	(64 * 1024 * 1024)
+
+static Display     *dpy;
+
+// Counters at the start of a test
+static int          hits0, misses0;
+
+static void
+_x11_init(void)
+{
+   dpy = XOpenDisplay(NULL);
+   if (!dpy)
+     {
+        fprintf(stderr, "Can't open display\n");
+        exit(1);
+     }
+
+   imlib_context_set_display(dpy);
+   imlib_context_set_visual(DefaultVisual(dpy, DefaultScreen(dpy)));
+   imlib_context_set_colormap(DefaultColormap(dpy, DefaultScreen(dpy)));
+   imlib_context_set_drawable(DefaultRootWindow(dpy));
+}
+
+static void
+_x11_fini(void)
+{
+   XCloseDisplay(dpy);
+}
+
+static void
+_start(void)
+{
+   imlib_set_cache_size(CACHE_BIG);
+   ASSERT_EQ(imlib_get_pixmap_cache_count_used(), 0);
+   ASSERT_EQ(imlib_get_pixmap_cache_size_used(), 0);
+   hits0 = imlib_get_pixmap_cache_hits();
+   misses0 = imlib_get_pixmap_cache_misses();
+}
+
+#define HITS()   (imlib_get_pixmap_cache_hits() - hits0)
+#define MISSES() (imlib_get_pixmap_cache_misses() - misses0)
+
+// An opaque image (no mask)
+static              Imlib_Image
+_mk_image(DATA32 color)
+{
+   Imlib_Image         im;
+   DATA32             *data;
+   int                 i;
+
+   im = imlib_create_image(W, H);
+   imlib_context_set_image(im);
+   imlib_image_set_has_alpha(0);
+   data = imlib_image_get_data();
+   for (i = 0; i < W * H; i++)
+      data[i] = color;
+   imlib_image_put_back_data(data);
+
+   return im;
+}
+
+static              Pixmap
+_render(Imlib_Image im)
+{
+   Pixmap              pmap, mask;
+
+   imlib_context_set_image(im);
+   pmap = mask = 0;
+   imlib_render_pixmaps_for_whole_image(&pmap, &mask);
+   EXPECT_TRUE(pmap);
+   EXPECT_FALSE(mask);
+
+   return pmap;
+}
+
+static void
+_free_image(Imlib_Image im)
+{
+   imlib_context_set_image(im);
+   imlib_free_image_and_decache();
+}
+
+TEST(PIXMAP, hit_miss)
+{
+   Imlib_Image         im;
+   Pixmap              p1, p2;
+   int                 size;
+
+   _start();
+   im = _mk_image(0xff204060);
+
+   p1 = _render(im);
+   EXPECT_EQ(MISSES(), 1);
+   EXPECT_EQ(HITS(), 0);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 1);
+   EXPECT_EQ(imlib_get_pixmap_cache_size_used(), 0);   // In use
+
+   imlib_free_pixmap_and_mask(p1);
+   size = imlib_get_pixmap_cache_size_used();
+   D("Pixmap size %d\n", size);
+   EXPECT_GE(size, W * H);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 1);
+
+   // Same image, same context - the same pixmap
+   p2 = _render(im);
+   EXPECT_EQ(p2, p1);
+   EXPECT_EQ(MISSES(), 1);
+   EXPECT_EQ(HITS(), 1);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 1);
+   EXPECT_EQ(imlib_get_pixmap_cache_size_used(), 0);
+
+   // Another size is another entry
+   imlib_context_set_image(im);
+   imlib_render_pixmaps_for_whole_image_at_size(&p1, NULL, W / 2, H / 2);
+   EXPECT_NE(p1, p2);
+   EXPECT_EQ(MISSES(), 2);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 2);
+
+   imlib_free_pixmap_and_mask(p1);
+   imlib_free_pixmap_and_mask(p2);
+   EXPECT_GT(imlib_get_pixmap_cache_size_used(), size);
+
+   _free_image(im);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 0);
+   EXPECT_EQ(imlib_get_pixmap_cache_size_used(), 0);
+}
+
+TEST(PIXMAP, dirty)
+{
+   Imlib_Image         im;
+   Pixmap              p1, p2;
+
+   _start();
+   im = _mk_image(0xff204060);
+
+   // Not in use - dropped when the image is changed
+   p1 = _render(im);
+   imlib_free_pixmap_and_mask(p1);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 1);
+   EXPECT_GT(imlib_get_pixmap_cache_size_used(), 0);
+
+   imlib_context_set_image(im);
+   imlib_context_set_color(255, 0, 0, 255);
+   imlib_image_fill_rectangle(0, 0, 4, 4);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 0);
+   EXPECT_EQ(imlib_get_pixmap_cache_size_used(), 0);
+
+   _render(im);
+   EXPECT_EQ(MISSES(), 2);
+   EXPECT_EQ(HITS(), 0);
+
+   // In use - kept until freed, but not found again
+   p1 = _render(im);
+   EXPECT_EQ(HITS(), 1);
+   imlib_context_set_image(im);
+   imlib_image_fill_rectangle(4, 4, 4, 4);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 1);
+
+   p2 = _render(im);
+   EXPECT_NE(p2, p1);
+   EXPECT_EQ(MISSES(), 3);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 2);
+
+   imlib_free_pixmap_and_mask(p1);      // Both references
+   imlib_free_pixmap_and_mask(p1);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 1);
+
+   imlib_free_pixmap_and_mask(p2);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 1);
+
+   _free_image(im);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 0);
+   EXPECT_EQ(imlib_get_pixmap_cache_size_used(), 0);
+}
+
+TEST(PIXMAP, evict_lru)
+{
+   Imlib_Image         ima, imb, imc;
+   Pixmap              pa, pb, pc;
+   int                 size;
+
+   _start();
+   ima = _mk_image(0xff0000ff);
+   imb = _mk_image(0xff00ff00);
+   imc = _mk_image(0xffff0000);
+
+   pa = _render(ima);
+   pb = _render(imb);
+   pc = _render(imc);
+   imlib_free_pixmap_and_mask(pa);
+   size = imlib_get_pixmap_cache_size_used();
+   imlib_free_pixmap_and_mask(pb);
+   imlib_free_pixmap_and_mask(pc);
+   EXPECT_EQ(imlib_get_pixmap_cache_size_used(), 3 * size);
+
+   // Use a again, b is now the least recently used
+   imlib_free_pixmap_and_mask(_render(ima));
+   EXPECT_EQ(HITS(), 1);
+
+   // The images are all in use, so only pixmaps count against the cache
+   imlib_set_cache_size(2 * size);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 2);
+   EXPECT_EQ(imlib_get_pixmap_cache_size_used(), 2 * size);
+
+   imlib_free_pixmap_and_mask(_render(imc));
+   EXPECT_EQ(HITS(), 2);
+   imlib_free_pixmap_and_mask(_render(ima));
+   EXPECT_EQ(HITS(), 3);
+   EXPECT_EQ(MISSES(), 3);
+
+   // b is rendered again, which pushes out c
+   pb = _render(imb);
+   EXPECT_EQ(MISSES(), 4);
+   imlib_free_pixmap_and_mask(pb);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 2);
+   imlib_free_pixmap_and_mask(_render(ima));
+   imlib_free_pixmap_and_mask(_render(imb));
+   EXPECT_EQ(HITS(), 5);
+   imlib_free_pixmap_and_mask(_render(imc));
+   EXPECT_EQ(MISSES(), 5);
+
+   // Pixmaps in use stay
+   pa = _render(ima);
+   imlib_set_cache_size(0);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 1);
+   EXPECT_EQ(imlib_get_pixmap_cache_size_used(), 0);
+   imlib_free_pixmap_and_mask(pa);
+   EXPECT_EQ(imlib_get_pixmap_cache_count_used(), 0);
+
+   imlib_set_cache_size(CACHE_BIG);
+   _free_image(ima);
+   _free_image(imb);
+   _free_image(imc);
+}
+
+int
+main(int argc, char **argv)
+{
+   const char         *s;
+   int                 rc;
+
+   ::testing::InitGoogleTest(&argc, argv);
+
+   for (argc--, argv++; argc > 0; argc--, argv++)
+     {
+        s = argv[0];
+        if (*s++ != '-')
+           break;
+        switch (*s)
+          {
+          case 'd':
+             debug++;
+             break;
+          }
+     }
+
+   _x11_init();
+
+   rc = RUN_ALL_TESTS();
+
+   _x11_fini();
+
+   return rc;
+}
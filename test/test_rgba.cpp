@@ -0,0 +1,146 @@
+#include <gtest/gtest.h>
+
+#include <X11/Xlib.h>
+
+#include "config.h"
+/**INDENT-OFF**/
+extern "C" {
+#include "common.h"
+#include "asm_c.h"
+#include "x11_context.h"
+#include "x11_rgba.h"
+}
+/**INDENT-ON**/
+
+int                 debug = 0;
+
+#define D(...)  if (debug) printf(__VA_ARGS__)
+
+#define SW	37              // Source width
+#define SH	7               // Source height
+#define DOW	(4 * SW + 8)    // Destination line size
+
+typedef struct {
+   const char         *name;
+   int                 bpp, depth;
+   unsigned long       rm, gm, bm;
+} fmt_t;
+
+/**INDENT-OFF**/
+static const fmt_t  fmts[] = {
+   { "rgb565", 16, 16, 0xf800, 0x7e0, 0x1f },
+   { "bgr565", 16, 16, 0x1f, 0x7e0, 0xf800 },
+   { "rgb555", 16, 15, 0x7c00, 0x3e0, 0x1f },
+   { "bgr555", 16, 15, 0x1f, 0x3e0, 0x7c00 },
+   { "rgb888", 24, 24, 0xff0000, 0xff00, 0xff },
+};
+/**INDENT-ON**/
+
+static DATA32       src[SW * SH];
+static DATA8        dref[DOW * SH + 8], dout[DOW * SH + 8];
+
+static void
+setup_dither(const fmt_t * pf, Context * ct)
+{
+   static DATA16       rd[2][4 * 4 * 256], gd[2][4 * 4 * 256],
+      bd[2][4 * 4 * 256];
+   int                 i = pf->depth == 15;
+
+   memset(ct, 0, sizeof(*ct));
+   ct->depth = pf->depth;
+   ct->r_dither = rd[i];
+   ct->g_dither = gd[i];
+   ct->b_dither = bd[i];
+   __imlib_RGBA_init(rd[i], gd[i], bd[i], pf->depth, 0);
+   __imlib_RGBASetupContext(ct);
+}
+
+// Each SIMD converter must produce exactly what the C one does, for any
+// width, offset into the dither matrix and destination alignment
+static void
+test_rgba(int simd)
+{
+   const fmt_t        *pf;
+   Context             ct;
+   ImlibRGBAFunction   fref, fout;
+   unsigned int        i;
+   int                 hiq, w, h, dx, dy, off;
+
+   for (i = 0; i < sizeof(src) / sizeof(src[0]); i++)
+      src[i] = (DATA32) rand() ^ ((DATA32) rand() << 16);
+
+   for (pf = fmts; pf < fmts + sizeof(fmts) / sizeof(fmts[0]); pf++)
+     {
+        setup_dither(pf, &ct);
+
+        for (hiq = 0; hiq < 2; hiq++)
+          {
+             fref = __imlib_GetRGBAFunction(pf->bpp, pf->rm, pf->gm, pf->bm,
+                                            hiq, 0);
+             fout = __imlib_GetRGBAFunctionSimd(simd, pf->bpp, pf->rm,
+                                                pf->gm, pf->bm, hiq);
+             ASSERT_TRUE(fref);
+             ASSERT_TRUE(fout);
+             ASSERT_NE(fref, fout);
+
+             for (w = 1; w <= SW; w++)
+                for (off = 0; off < 4; off += 2)
+                   for (dx = 0, dy = 0; dx < 4; dx++, dy += 3)
+                     {
+                        h = SH - (w & 3);
+                        D("%s hiq=%d w=%d h=%d off=%d dx=%d dy=%d\n",
+                          pf->name, hiq, w, h, off, dx, dy);
+
+                        memset(dref, 0x55, sizeof(dref));
+                        memset(dout, 0x55, sizeof(dout));
+                        fref(src + 1, SW - w, dref + off, DOW, w, h, dx, dy);
+                        fout(src + 1, SW - w, dout + off, DOW, w, h, dx, dy);
+                        ASSERT_EQ(memcmp(dref, dout, sizeof(dref)), 0)
+                           << pf->name << " hiq=" << hiq << " w=" << w
+                           << " off=" << off << " dx=" << dx;
+                     }
+          }
+     }
+}
+
+TEST(RGBA, rgba_sse2)
+{
+   if (!__builtin_cpu_supports("sse2"))
+      GTEST_SKIP();
+   test_rgba(SIMD_SSE2);
+}
+
+TEST(RGBA, rgba_avx2)
+{
+   if (!__builtin_cpu_supports("avx2"))
+      GTEST_SKIP();
+   test_rgba(SIMD_AVX2);
+}
+
+int
+main(int argc, char **argv)
+{
+   const char         *s;
+
+   ::testing::InitGoogleTest(&argc, argv);
+
+   for (argc--, argv++; argc > 0; argc--, argv++)
+     {
+        s = argv[0];
+        if (*s++ != '-')
+           break;
+        switch (*s)
+          {
+          case 'd':
+             debug++;
+             break;
+          }
+     }
+
+   // __imlib_GetRGBAFunction() must return the C functions
+   setenv("IMLIB2_ASM_OFF", "1", 1);
+   __builtin_cpu_init();
+   srand(1);
+
+   return RUN_ALL_TESTS();
+}
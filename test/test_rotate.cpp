@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <Imlib2.h>
+#include <math.h>
 #include <zlib.h>
 
 #include "config.h"
@@ -112,6 +113,58 @@ test_rotate(int no, int aa)
    imlib_free_image_and_decache();
 }
 
+// Right angles are copied exactly when sampling. When anti-aliasing the
+// origin is not on a whole pixel, so it is interpolated.
+static void
+test_rotate_right_angle(int no, unsigned int crc_exp)
+{
+   const td_t         *ptd;
+   char                filei[256];
+   int                 aa, wo, ho;
+   unsigned int        crc[2];
+   Imlib_Image         imi, imo;
+   unsigned char      *data;
+
+   ptd = &td[no];
+
+   snprintf(filei, sizeof(filei), "%s/%s.png", IMG_SRC, ptd->file);
+   D("Load '%s'\n", filei);
+   imi = imlib_load_image(filei);
+   ASSERT_TRUE(imi);
+
+   for (aa = 0; aa < 2; aa++)
+     {
+        imlib_context_set_anti_alias(aa);
+        imlib_context_set_image(imi);
+        imo = imlib_create_rotated_image(M_PI_2);
+        ASSERT_TRUE(imo);
+
+        imlib_context_set_image(imo);
+        wo = imlib_image_get_width();
+        ho = imlib_image_get_height();
+        data = (unsigned char *)imlib_image_get_data_for_reading_only();
+        crc[aa] = crc32(0, data, wo * ho * sizeof(DATA32));
+        D("aa=%d: %u\n", aa, crc[aa]);
+        imlib_free_image_and_decache();
+     }
+
+   EXPECT_EQ(crc[0], crc_exp);
+   EXPECT_NE(crc[1], crc[0]);
+
+   imlib_context_set_image(imi);
+   imlib_free_image_and_decache();
+}
+
+TEST(ROTAT, rotate_1_right_angle)
+{
+   test_rotate_right_angle(0, 1138147971);
+}
+
+TEST(ROTAT, rotate_2_right_angle)
+{
+   test_rotate_right_angle(1, 2302660287);
+}
+
 TEST(ROTAT, rotate_1_aa)
 {
    test_rotate(0, 1);
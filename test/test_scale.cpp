@@ -4,9 +4,16 @@
 #include <zlib.h>
 
 #include "config.h"
+/**INDENT-OFF**/
+extern "C" {
+#include "common.h"
+#include "image.h"
+}
+/**INDENT-ON**/
 #include "test_common.h"
 
 int                 debug = 0;
+static const char  *prog;
 
 #define D(...)  if (debug) printf(__VA_ARGS__)
 
@@ -103,6 +110,410 @@ TEST(SCALE, scale_1_argb)
    test_scale(1);
 }
 
+// Bicubic and Lanczos kernels are 1 at the center and 0 at the other
+// sample points, so scaling to the same size must reproduce the source
+static void
+test_scale_filter_same(const char *file)
+{
+   char                filei[256];
+   int                 w, h;
+   Imlib_Scale_Filter  filter;
+   Imlib_Image         imi, imo;
+   const DATA32       *di, *dout;
+
+   snprintf(filei, sizeof(filei), "%s/%s.png", IMG_SRC, file);
+   imi = imlib_load_image(filei);
+   ASSERT_TRUE(imi);
+
+   imlib_context_set_image(imi);
+   w = imlib_image_get_width();
+   h = imlib_image_get_height();
+   di = imlib_image_get_data_for_reading_only();
+
+   for (filter = IMLIB_SCALE_BICUBIC; filter <= IMLIB_SCALE_LANCZOS;
+        filter = (Imlib_Scale_Filter) (filter + 1))
+     {
+        imlib_context_set_scale_filter(filter);
+        EXPECT_EQ(imlib_context_get_scale_filter(), filter);
+        EXPECT_TRUE(imlib_context_get_anti_alias());
+
+        imlib_context_set_image(imi);
+        imo = imlib_create_cropped_scaled_image(0, 0, w, h, w, h);
+        ASSERT_TRUE(imo);
+        imlib_context_set_image(imo);
+        dout = imlib_image_get_data_for_reading_only();
+        EXPECT_EQ(memcmp(di, dout, w * h * sizeof(DATA32)), 0);
+        imlib_free_image_and_decache();
+     }
+
+   imlib_context_set_anti_alias(1);
+   EXPECT_EQ(imlib_context_get_scale_filter(), IMLIB_SCALE_AREA);
+
+   imlib_context_set_image(imi);
+   imlib_free_image_and_decache();
+}
+
+TEST(SCALE, scale_filter_same_rgb)
+{
+   test_scale_filter_same(FILE_REF1);
+}
+
+TEST(SCALE, scale_filter_same_argb)
+{
+   test_scale_filter_same(FILE_REF2);
+}
+
+// Bicubic and Lanczos weights are normalised, so scaling a constant image
+// in either direction must give the same constant
+static void
+test_scale_filter_const(Imlib_Scale_Filter filter, DATA32 color)
+{
+   static const int    sizes[][2] = { {37, 23}, {80, 61}, {9, 5}, {37, 2} };
+   Imlib_Image         imi, imo;
+   DATA32             *data;
+   const DATA32       *dout;
+   unsigned int        i;
+   int                 j, w, h;
+
+   imi = imlib_create_image(37, 23);
+   ASSERT_TRUE(imi);
+   imlib_context_set_image(imi);
+   imlib_image_set_has_alpha(1);
+   data = imlib_image_get_data();
+   for (j = 0; j < 37 * 23; j++)
+      data[j] = color;
+   imlib_image_put_back_data(data);
+
+   imlib_context_set_scale_filter(filter);
+
+   for (i = 1; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+     {
+        w = sizes[i][0];
+        h = sizes[i][1];
+        imlib_context_set_image(imi);
+        imo = imlib_create_cropped_scaled_image(0, 0, 37, 23, w, h);
+        ASSERT_TRUE(imo);
+        imlib_context_set_image(imo);
+        dout = imlib_image_get_data_for_reading_only();
+        for (j = 0; j < w * h; j++)
+          {
+             EXPECT_EQ(dout[j], color) << "filter=" << filter << " "
+                << w << "x" << h << " pixel " << j;
+             if (dout[j] != color)
+                break;
+          }
+        imlib_free_image_and_decache();
+     }
+
+   imlib_context_set_anti_alias(1);
+   imlib_context_set_image(imi);
+   imlib_free_image_and_decache();
+}
+
+TEST(SCALE, scale_filter_const)
+{
+   test_scale_filter_const(IMLIB_SCALE_BICUBIC, 0x80c04020);
+   test_scale_filter_const(IMLIB_SCALE_BICUBIC, 0xffffffff);
+   test_scale_filter_const(IMLIB_SCALE_LANCZOS, 0x80c04020);
+   test_scale_filter_const(IMLIB_SCALE_LANCZOS, 0x00000000);
+}
+
+typedef struct {
+   const char         *file;
+   Imlib_Scale_Filter  filter;
+   unsigned int        crcs[4];
+} tdf_t;
+
+// Up, down, and up in one direction / down in the other
+static const int    fsizes[4][2] = {
+   {3, 2}, {-3, -2}, {2, -3}, {-2, 3},
+};
+
+/**INDENT-OFF**/
+static const tdf_t  tdf[] = {
+   { FILE_REF1, IMLIB_SCALE_BICUBIC, { 2362971445, 1976137410, 1286576167,  847920881 }},
+   { FILE_REF2, IMLIB_SCALE_BICUBIC, {  902519498, 3460486814, 4021867689, 3501750593 }},
+   { FILE_REF1, IMLIB_SCALE_LANCZOS, { 3952475047,  894356503, 1760846235,  547527981 }},
+   { FILE_REF2, IMLIB_SCALE_LANCZOS, {  383664611, 2143933497, 1669196577, 1980769068 }},
+};
+/**INDENT-ON**/
+
+// Really up- and downscale with the filters, the C and SIMD passes must
+// both give these results
+static void
+test_scale_filter_crc(const tdf_t * ptd)
+{
+   char                filei[256];
+   int                 w, h, wo, ho;
+   unsigned int        i, crc;
+   Imlib_Image         imi, imo;
+   const DATA32       *dout;
+
+   snprintf(filei, sizeof(filei), "%s/%s.png", IMG_SRC, ptd->file);
+   imi = imlib_load_image(filei);
+   ASSERT_TRUE(imi);
+
+   imlib_context_set_image(imi);
+   w = imlib_image_get_width();
+   h = imlib_image_get_height();
+
+   imlib_context_set_scale_filter(ptd->filter);
+
+   for (i = 0; i < 4; i++)
+     {
+        wo = fsizes[i][0] > 0 ? w * fsizes[i][0] + 1 : w / -fsizes[i][0] + 1;
+        ho = fsizes[i][1] > 0 ? h * fsizes[i][1] + 1 : h / -fsizes[i][1] + 1;
+
+        imlib_context_set_image(imi);
+        imo = imlib_create_cropped_scaled_image(0, 0, w, h, wo, ho);
+        ASSERT_TRUE(imo);
+        imlib_context_set_image(imo);
+        dout = imlib_image_get_data_for_reading_only();
+        crc = crc32(0, (unsigned char *)dout, wo * ho * sizeof(DATA32));
+        D("%s filter=%d %dx%d: %u\n", ptd->file, ptd->filter, wo, ho, crc);
+        EXPECT_EQ(crc, ptd->crcs[i]) << ptd->file << " filter="
+           << ptd->filter << " " << wo << "x" << ho;
+        imlib_free_image_and_decache();
+     }
+
+   imlib_context_set_anti_alias(1);
+   imlib_context_set_image(imi);
+   imlib_free_image_and_decache();
+}
+
+TEST(SCALE, scale_filter_crc)
+{
+   unsigned int        i;
+
+   for (i = 0; i < sizeof(tdf) / sizeof(tdf[0]); i++)
+      test_scale_filter_crc(&tdf[i]);
+}
+
+// Run the above again with the C passes, unless this is that run
+TEST(SCALE, scale_filter_crc_c)
+{
+   char                cmd[1024];
+
+   if (getenv("IMLIB2_ASM_OFF"))
+      GTEST_SKIP();
+
+   snprintf(cmd, sizeof(cmd), "IMLIB2_ASM_OFF=1 %s "
+            "--gtest_filter=SCALE.scale_filter_crc > /dev/null", prog);
+   EXPECT_EQ(system(cmd), 0);
+}
+
+// A pipeline streams its steps band by band, the result must be the same
+// as running them one after another on whole images
+static void
+test_scale_pipeline(const char *file)
+{
+   char                filei[256];
+   int                 w, h, ws, hs;
+   Imlib_Pipeline      pl;
+   Imlib_Image         imi, imo, imr;
+   const DATA32       *dout, *dref;
+
+   snprintf(filei, sizeof(filei), "%s/%s.png", IMG_SRC, file);
+   imi = imlib_load_image(filei);
+   ASSERT_TRUE(imi);
+
+   imlib_context_set_image(imi);
+   w = imlib_image_get_width();
+   h = imlib_image_get_height();
+   ws = 2 * w + 5;
+   hs = 3 * h / 2 + 3;
+
+   pl = imlib_pipeline_new();
+   ASSERT_TRUE(pl);
+   imlib_pipeline_add_scale(pl, ws, hs);
+   imlib_pipeline_add_sharpen(pl, 2);
+   imlib_pipeline_add_blur(pl, 3);
+
+   imo = imlib_create_image_from_pipeline(pl, 1, 2, w - 3, h - 2);
+   ASSERT_TRUE(imo);
+
+   imr = imlib_create_cropped_scaled_image(1, 2, w - 3, h - 2, ws, hs);
+   ASSERT_TRUE(imr);
+   imlib_context_set_image(imr);
+   imlib_image_sharpen(2);
+   imlib_image_blur(3);
+   dref = imlib_image_get_data_for_reading_only();
+
+   imlib_context_set_image(imo);
+   EXPECT_EQ(imlib_image_get_width(), ws);
+   EXPECT_EQ(imlib_image_get_height(), hs);
+   dout = imlib_image_get_data_for_reading_only();
+   EXPECT_EQ(memcmp(dref, dout, ws * hs * sizeof(DATA32)), 0);
+
+   imlib_free_image_and_decache();
+   imlib_context_set_image(imr);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(imi);
+   imlib_free_image_and_decache();
+   imlib_pipeline_free(pl);
+}
+
+TEST(SCALE, scale_pipeline_rgb)
+{
+   test_scale_pipeline(FILE_REF1);
+}
+
+TEST(SCALE, scale_pipeline_argb)
+{
+   test_scale_pipeline(FILE_REF2);
+}
+
+// Mipmaps
+
+#define MW	1024            // Source size
+#define MH	768
+#define MTOL	32              // Documented max difference per channel
+#define MTOL_MEAN	2.      // Documented mean difference per channel
+
+// A large image with detail, upscaled from a real one
+static              Imlib_Image
+mk_image_mipmap(const char *file)
+{
+   char                filei[256];
+   Imlib_Image         imi, im;
+
+   snprintf(filei, sizeof(filei), "%s/%s.png", IMG_SRC, file);
+   imi = imlib_load_image(filei);
+   if (!imi)
+      return NULL;
+   imlib_context_set_image(imi);
+   im = imlib_create_cropped_scaled_image(0, 0, imlib_image_get_width(),
+                                          imlib_image_get_height(), MW, MH);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(im);
+
+   return im;
+}
+
+// Number of pyramid levels built for im
+static int
+mipmap_levels(Imlib_Image im, int *w, int *h)
+{
+   ImlibImage         *lv;
+   int                 n;
+
+   *w = *h = 0;
+   for (n = 0, lv = ((ImlibImage *) im)->mipmap; lv; lv = lv->mipmap, n++)
+     {
+        *w = lv->w;
+        *h = lv->h;
+     }
+
+   return n;
+}
+
+// Largest and mean per channel difference between two images
+static int
+image_diff(Imlib_Image im1, Imlib_Image im2, int w, int h, double *mean)
+{
+   const DATA32       *p1, *p2;
+   int                 i, j, d, dmax;
+   long                sum;
+
+   imlib_context_set_image(im1);
+   p1 = imlib_image_get_data_for_reading_only();
+   imlib_context_set_image(im2);
+   p2 = imlib_image_get_data_for_reading_only();
+
+   for (i = dmax = sum = 0; i < w * h; i++)
+      for (j = 0; j < 32; j += 8)
+        {
+           d = abs((int)((p1[i] >> j) & 0xff) - (int)((p2[i] >> j) & 0xff));
+           sum += d;
+           if (d > dmax)
+              dmax = d;
+        }
+   *mean = (double)sum / (4 * w * h);
+
+   return dmax;
+}
+
+// Downscale with and without mipmaps, check the levels built
+static void
+test_scale_mipmap_once(Imlib_Image im, int dw, int dh, int nlev,
+                       int lw, int lh)
+{
+   Imlib_Image         imo, imr;
+   int                 n, w, h, d;
+   double              mean;
+
+   imlib_context_set_image(im);
+   imlib_image_set_use_mipmaps(0);
+   imr = imlib_create_cropped_scaled_image(0, 0, MW, MH, dw, dh);
+   ASSERT_TRUE(imr);
+
+   imlib_context_set_image(im);
+   imlib_image_set_use_mipmaps(1);
+   EXPECT_EQ(imlib_image_get_use_mipmaps(), 1);
+   imo = imlib_create_cropped_scaled_image(0, 0, MW, MH, dw, dh);
+   ASSERT_TRUE(imo);
+
+   n = mipmap_levels(im, &w, &h);
+   D("%dx%d: %d levels, last %dx%d\n", dw, dh, n, w, h);
+   EXPECT_EQ(n, nlev) << dw << "x" << dh;
+   EXPECT_EQ(w, lw) << dw << "x" << dh;
+   EXPECT_EQ(h, lh) << dw << "x" << dh;
+
+   d = image_diff(imo, imr, dw, dh, &mean);
+   D("%dx%d: max diff %d mean %.3f\n", dw, dh, d, mean);
+   EXPECT_LE(d, MTOL) << dw << "x" << dh;
+   EXPECT_LE(mean, MTOL_MEAN) << dw << "x" << dh;
+
+   imlib_context_set_image(imo);
+   imlib_free_image_and_decache();
+   imlib_context_set_image(imr);
+   imlib_free_image_and_decache();
+}
+
+static void
+test_scale_mipmap(const char *file)
+{
+   Imlib_Image         im;
+   int                 w, h;
+
+   im = mk_image_mipmap(file);
+   ASSERT_TRUE(im);
+
+   imlib_context_set_anti_alias(1);
+
+   // Smallest level still at least as large as the output
+   test_scale_mipmap_once(im, 200, 150, 2, 256, 192);
+   test_scale_mipmap_once(im, 100, 300, 1, 512, 384);
+   test_scale_mipmap_once(im, 37, 29, 4, 64, 48);
+   // No level for a mild downscale
+   test_scale_mipmap_once(im, 700, 600, 0, 0, 0);
+
+   // Drawing drops the levels, the next downscale rebuilds them from
+   // the modified image
+   imlib_context_set_image(im);
+   imlib_context_set_color(255, 0, 0, 255);
+   imlib_image_fill_rectangle(100, 200, 400, 300);
+   EXPECT_EQ(mipmap_levels(im, &w, &h), 0);
+   test_scale_mipmap_once(im, 200, 150, 2, 256, 192);
+
+   // And so does disabling them
+   imlib_context_set_image(im);
+   imlib_image_set_use_mipmaps(0);
+   EXPECT_EQ(mipmap_levels(im, &w, &h), 0);
+
+   imlib_free_image_and_decache();
+}
+
+TEST(SCALE, scale_mipmap_rgb)
+{
+   test_scale_mipmap(FILE_REF1);
+}
+
+TEST(SCALE, scale_mipmap_argb)
+{
+   test_scale_mipmap(FILE_REF2);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -110,6 +521,8 @@ main(int argc, char **argv)
 
    ::testing::InitGoogleTest(&argc, argv);
 
+   prog = argv[0];
+
    for (argc--, argv++; argc > 0; argc--, argv++)
      {
         s = argv[0];
@@ -0,0 +1,205 @@
+#include <gtest/gtest.h>
+
+#include <Imlib2.h>
+
+#include "config.h"
+
+int                 debug = 0;
+
+#define D(...)  if (debug) printf(__VA_ARGS__)
+
+#define W	640
+#define H	480
+
+#define NR	8               // Max rects per case
+
+typedef struct {
+   int                 x, y, w, h;
+} rect_t;
+
+typedef struct {
+   const char         *name;
+   rect_t              in[NR];
+   rect_t              out[NR];        /* Sorted by y, x */
+} tdu_t;
+
+/**INDENT-OFF**/
+static const tdu_t  tdu[] = {
+   { "disjoint",
+     {{   0,   0,  10,  10 }, { 200, 200,  10,  10 }},
+     {{   0,   0,  10,  10 }, { 200, 200,  10,  10 }}},
+   { "overlapping",
+     {{  10,  10,  50,  50 }, {  30,  30,  50,  50 }},
+     {{  10,  10,  70,  70 }}},
+   { "contained",
+     {{  10,  10, 100, 100 }, {  30,  30,  10,  10 }},
+     {{  10,  10, 100, 100 }}},
+   { "cross",          // Overlapping, but the corners cost too much
+     {{   0,  45, 100,  10 }, {  45,   0,  10, 100 }},
+     {{  45,   0,  10, 100 }, {   0,  45, 100,  10 }}},
+   { "adjacent",
+     {{ 100, 100,  40,  40 }, { 140, 100,  40,  40 }},
+     {{ 100, 100,  80,  40 }}},
+   { "nearly-adjacent",
+     {{ 100, 100,  40,  40 }, { 141, 100,  40,  40 }},
+     {{ 100, 100,  81,  40 }}},
+   { "nearly-adjacent-y",
+     {{ 300, 100,  40,  40 }, { 300, 143,  40,  40 }},
+     {{ 300, 100,  40,  83 }}},
+   { "gap-too-wide",
+     {{   0,   0,  10, 100 }, {  60,   0,  10, 100 }},
+     {{   0,   0,  10, 100 }, {  60,   0,  10, 100 }}},
+   { "chain",          // Each merge makes the next one cheap
+     {{   0,   0,   4,   4 }, {   6,   0,   4,   4 }, {  12,   0,   4,   4 },
+      {  18,   0,   4,   4 }, {  24,   0,   4,   4 }, {  30,   0,   4,   4 }},
+     {{   0,   0,  34,   4 }}},
+   { "clipped",
+     {{ -10, -10,  30,  30 }, { 700,  10,  10,  10 }, { 630, 470,  20,  20 }},
+     {{   0,   0,  20,  20 }, { 630, 470,  10,  10 }}},
+};
+/**INDENT-ON**/
+
+static int
+rect_cmp(const void *a, const void *b)
+{
+   const rect_t       *ra = (const rect_t *)a, *rb = (const rect_t *)b;
+
+   if (ra->y != rb->y)
+      return ra->y - rb->y;
+   return ra->x - rb->x;
+}
+
+// Get the rects of an updates list, sorted
+static int
+get_rects(Imlib_Updates up, rect_t * r, int nmax)
+{
+   int                 n;
+
+   for (n = 0; up && n < nmax; up = imlib_updates_get_next(up), n++)
+      imlib_updates_get_coordinates(up, &r[n].x, &r[n].y, &r[n].w, &r[n].h);
+   EXPECT_FALSE(up);
+   qsort(r, n, sizeof(rect_t), rect_cmp);
+
+   return n;
+}
+
+TEST(UPDATES, merge_for_rendering)
+{
+   const tdu_t        *ptd;
+   Imlib_Updates       up;
+   rect_t              r[NR];
+   unsigned int        i;
+   int                 j, n, nexp;
+
+   for (i = 0; i < sizeof(tdu) / sizeof(tdu[0]); i++)
+     {
+        ptd = &tdu[i];
+
+        up = imlib_updates_init();
+        for (j = 0; j < NR && ptd->in[j].w; j++)
+           up = imlib_update_append_rect(up, ptd->in[j].x, ptd->in[j].y,
+                                         ptd->in[j].w, ptd->in[j].h);
+        up = imlib_updates_merge_for_rendering(up, W, H);
+
+        n = get_rects(up, r, NR);
+        for (nexp = 0; nexp < NR && ptd->out[nexp].w; nexp++)
+           ;
+        EXPECT_EQ(n, nexp) << ptd->name;
+        for (j = 0; j < n && j < nexp; j++)
+          {
+             D("%s: %d,%d %dx%d\n", ptd->name, r[j].x, r[j].y, r[j].w,
+               r[j].h);
+             EXPECT_TRUE(r[j].x == ptd->out[j].x && r[j].y == ptd->out[j].y &&
+                         r[j].w == ptd->out[j].w && r[j].h == ptd->out[j].h)
+                << ptd->name << " rect " << j << ": " << r[j].x << ","
+                << r[j].y << " " << r[j].w << "x" << r[j].h;
+          }
+
+        imlib_updates_free(up);
+     }
+}
+
+static void
+fill(unsigned char map[H][W], int x, int y, int w, int h)
+{
+   int                 xx, yy;
+
+   for (yy = y; yy < y + h; yy++)
+      for (xx = x; xx < x + w; xx++)
+         if (xx >= 0 && xx < W && yy >= 0 && yy < H)
+            map[yy][xx] = 1;
+}
+
+// Random rects - the merged ones must stay inside, cover every pixel the
+// input did, and not be more
+TEST(UPDATES, merge_for_rendering_cover)
+{
+   static unsigned char in[H][W], out[H][W];
+   Imlib_Updates       up, uu;
+   int                 i, k, n, x, y, w, h;
+
+   srand(1);
+   for (k = 0; k < 50; k++)
+     {
+        memset(in, 0, sizeof(in));
+        memset(out, 0, sizeof(out));
+
+        up = imlib_updates_init();
+        n = 1 + rand() % 40;
+        for (i = 0; i < n; i++)
+          {
+             x = rand() % (W + 40) - 20;
+             y = rand() % (H + 40) - 20;
+             w = 1 + rand() % (k < 25 ? 20 : 120);
+             h = 1 + rand() % (k < 25 ? 20 : 120);
+             up = imlib_update_append_rect(up, x, y, w, h);
+             fill(in, x, y, w, h);
+          }
+        up = imlib_updates_merge_for_rendering(up, W, H);
+
+        for (i = 0, uu = up; uu; uu = imlib_updates_get_next(uu), i++)
+          {
+             imlib_updates_get_coordinates(uu, &x, &y, &w, &h);
+             EXPECT_TRUE(x >= 0 && y >= 0 && w > 0 && h > 0 &&
+                         x + w <= W && y + h <= H) << x << "," << y << " "
+                << w << "x" << h;
+             fill(out, x, y, w, h);
+          }
+        EXPECT_LE(i, n);
+
+        for (y = 0; y < H; y++)
+           for (x = 0; x < W; x++)
+              if (in[y][x] && !out[y][x])
+                {
+                   ADD_FAILURE() << "case " << k << ": " << x << "," << y
+                      << " not covered";
+                   x = W;
+                   y = H;
+                }
+
+        imlib_updates_free(up);
+     }
+}
+
+int
+main(int argc, char **argv)
+{
+   const char         *s;
+
+   ::testing::InitGoogleTest(&argc, argv);
+
+   for (argc--, argv++; argc > 0; argc--, argv++)
+     {
+        s = argv[0];
+        if (*s++ != '-')
+           break;
+        switch (*s)
+          {
+          case 'd':
+             debug++;
+             break;
+          }
+     }
+
+   return RUN_ALL_TESTS();
+}
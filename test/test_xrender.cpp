@@ -0,0 +1,250 @@
+#include <gtest/gtest.h>
+
+#include <X11/Xlib.h>
+#include <Imlib2.h>
+
+#include "config.h"
+
+// Blending alpha images onto drawables with XRender must give what the CPU
+// path does. Needs an X server with RENDER (e.g. Xvfb).
+//
+// The XRender path is turned off by IMLIB2_XRENDER_OFF, and is decided per
+// display, so each case renders with it on one connection and without it
+// on another.
+
+int                 debug = 0;
+
+#define D(...)  if (debug) printf(__VA_ARGS__)
+
+#define SW	24              // Source size
+#define SH	18
+#define PW	80              // Drawable size
+#define PH	64
+#define DX	3               // Destination offset
+#define DY	5
+
+typedef struct {
+   Display            *dpy;
+   Visual             *vis;
+   Colormap            cmap;
+   Window              root;
+   int                 depth;
+} xd_t;
+
+static xd_t         xd_xr, xd_cpu;
+static Imlib_Image  im_src, im_bg;
+
+typedef struct {
+   const char         *name;
+   int                 dw, dh;
+   Imlib_Scale_Filter  filter;
+   int                 tol;     /* Max difference per channel */
+} tdx_t;
+
+/**INDENT-OFF**/
+static const tdx_t  tdx[] = {
+   { "same",          SW,     SH,     IMLIB_SCALE_SAMPLE,  2 },
+   { "same-aa",       SW,     SH,     IMLIB_SCALE_AREA,    2 },
+   { "sample-up",     61,     47,     IMLIB_SCALE_SAMPLE,  2 },
+   { "sample-up-x",   50,     SH,     IMLIB_SCALE_SAMPLE,  2 },
+   { "sample-down",   13,      7,     IMLIB_SCALE_SAMPLE,  2 },
+   { "bilinear-up",   61,     47,     IMLIB_SCALE_AREA,    6 },
+   { "bilinear-up-y", SW,     41,     IMLIB_SCALE_AREA,    6 },
+   { "area-down",     13,      7,     IMLIB_SCALE_AREA,    2 },
+   { "bicubic-down",  13,      7,     IMLIB_SCALE_BICUBIC, 2 },
+   { "lanczos-up",    61,     47,     IMLIB_SCALE_LANCZOS, 2 },
+};
+/**INDENT-ON**/
+
+static void
+_x11_init(xd_t * xd)
+{
+   int                 op, ev, er;
+
+   xd->dpy = XOpenDisplay(NULL);
+   if (!xd->dpy)
+     {
+        fprintf(stderr, "Can't open display\n");
+        exit(1);
+     }
+   xd->root = DefaultRootWindow(xd->dpy);
+   xd->vis = DefaultVisual(xd->dpy, DefaultScreen(xd->dpy));
+   xd->cmap = DefaultColormap(xd->dpy, DefaultScreen(xd->dpy));
+   xd->depth = DefaultDepth(xd->dpy, DefaultScreen(xd->dpy));
+
+   if (!XQueryExtension(xd->dpy, "RENDER", &op, &ev, &er))
+      fprintf(stderr, "No RENDER extension, testing the CPU path only\n");
+}
+
+static void
+_img_init(void)
+{
+   DATA32             *data;
+   int                 i;
+
+   srand(1);
+
+   // Every pixel different, so misaligned sampling shows
+   im_src = imlib_create_image(SW, SH);
+   imlib_context_set_image(im_src);
+   imlib_image_set_has_alpha(1);
+   data = imlib_image_get_data();
+   for (i = 0; i < SW * SH; i++)
+      data[i] = (DATA32) rand() ^ ((DATA32) rand() << 16);
+   data[0] |= 0xff000000;
+   data[SW * SH - 1] &= 0x00ffffff;
+   imlib_image_put_back_data(data);
+
+   im_bg = imlib_create_image(PW, PH);
+   imlib_context_set_image(im_bg);
+   data = imlib_image_get_data();
+   for (i = 0; i < PW * PH; i++)
+      data[i] = 0xff000000 | ((i % PW) * 3) << 16 | ((i / PW) * 4) << 8 |
+         ((i * 7) & 0xff);
+   imlib_image_put_back_data(data);
+}
+
+// Render im_src onto the background at dw x dh and read back the result
+static              Imlib_Image
+_render(xd_t * xd, int xrender, const tdx_t * ptd, Imlib_Operation op)
+{
+   Imlib_Image         im;
+   Pixmap              pmap;
+
+   if (xrender)
+      unsetenv("IMLIB2_XRENDER_OFF");
+   else
+      setenv("IMLIB2_XRENDER_OFF", "1", 1);
+
+   imlib_context_set_display(xd->dpy);
+   imlib_context_set_visual(xd->vis);
+   imlib_context_set_colormap(xd->cmap);
+
+   pmap = XCreatePixmap(xd->dpy, xd->root, PW, PH, xd->depth);
+   imlib_context_set_drawable(pmap);
+   imlib_context_set_operation(IMLIB_OP_COPY);
+   imlib_context_set_anti_alias(0);
+
+   imlib_context_set_image(im_bg);
+   imlib_context_set_blend(0);
+   imlib_render_image_on_drawable(0, 0);
+
+   imlib_context_set_image(im_src);
+   imlib_context_set_blend(1);
+   imlib_context_set_operation(op);
+   imlib_context_set_scale_filter(ptd->filter);
+   imlib_render_image_on_drawable_at_size(DX, DY, ptd->dw, ptd->dh);
+
+   imlib_context_set_operation(IMLIB_OP_COPY);
+   imlib_context_set_anti_alias(1);
+   im = imlib_create_image_from_drawable(0, 0, 0, PW, PH, 1);
+   XFreePixmap(xd->dpy, pmap);
+
+   return im;
+}
+
+static int
+_diff(DATA32 a, DATA32 b)
+{
+   int                 i, d, dmax;
+
+   for (i = dmax = 0; i < 24; i += 8)
+     {
+        d = abs((int)((a >> i) & 0xff) - (int)((b >> i) & 0xff));
+        if (d > dmax)
+           dmax = d;
+     }
+
+   return dmax;
+}
+
+static void
+_test_xrender(Imlib_Operation op)
+{
+   const tdx_t        *ptd;
+   Imlib_Image         im_xr, im_cpu;
+   const DATA32       *pxr, *pcpu;
+   unsigned int        i;
+   int                 x, y, d, nbad;
+
+   for (i = 0; i < sizeof(tdx) / sizeof(tdx[0]); i++)
+     {
+        ptd = &tdx[i];
+
+        im_xr = _render(&xd_xr, 1, ptd, op);
+        im_cpu = _render(&xd_cpu, 0, ptd, op);
+        ASSERT_TRUE(im_xr);
+        ASSERT_TRUE(im_cpu);
+
+        imlib_context_set_image(im_xr);
+        pxr = imlib_image_get_data_for_reading_only();
+        imlib_context_set_image(im_cpu);
+        pcpu = imlib_image_get_data_for_reading_only();
+
+        // The whole drawable, so the first and last rows and columns of
+        // the destination (edge alignment) and the untouched area around
+        // it are checked too
+        nbad = 0;
+        for (y = 0; y < PH; y++)
+           for (x = 0; x < PW; x++)
+             {
+                d = _diff(pxr[y * PW + x], pcpu[y * PW + x]);
+                if (d <= ptd->tol)
+                   continue;
+                if (nbad++ < 8)
+                   ADD_FAILURE() << ptd->name << " op=" << op << " at "
+                      << x - DX << "," << y - DY << ": " << std::hex
+                      << pxr[y * PW + x] << " vs " << pcpu[y * PW + x];
+             }
+        D("%s op=%d: %d bad\n", ptd->name, op, nbad);
+        EXPECT_EQ(nbad, 0) << ptd->name << " op=" << op;
+
+        imlib_context_set_image(im_xr);
+        imlib_free_image_and_decache();
+        imlib_context_set_image(im_cpu);
+        imlib_free_image_and_decache();
+     }
+}
+
+TEST(XRENDER, xrender_copy)
+{
+   _test_xrender(IMLIB_OP_COPY);
+}
+
+TEST(XRENDER, xrender_add)
+{
+   _test_xrender(IMLIB_OP_ADD);
+}
+
+int
+main(int argc, char **argv)
+{
+   const char         *s;
+   int                 rc;
+
+   ::testing::InitGoogleTest(&argc, argv);
+
+   for (argc--, argv++; argc > 0; argc--, argv++)
+     {
+        s = argv[0];
+        if (*s++ != '-')
+           break;
+        switch (*s)
+          {
+          case 'd':
+             debug++;
+             break;
+          }
+     }
+
+   _x11_init(&xd_xr);
+   _x11_init(&xd_cpu);
+   _img_init();
+
+   rc = RUN_ALL_TESTS();
+
+   XCloseDisplay(xd_xr.dpy);
+   XCloseDisplay(xd_cpu.dpy);
+
+   return rc;
+}